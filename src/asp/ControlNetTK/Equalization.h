@@ -23,40 +23,57 @@
 
 #include <vw/InterestPoint/InterestData.h>
 #include <vector>
+#include <limits>
+#include <algorithm>
+#include <cmath>
 
 namespace asp {
 namespace cnettk {
 
-  // Algorithm for removing interest points
-  inline void remove_max( std::vector<std::vector<vw::ip::InterestPoint> > &b_ip1,
-                          std::vector<std::vector<vw::ip::InterestPoint> > &b_ip2 ) {
-    using namespace vw;
-
-    size_t max_index = 0;
-    size_t max_count = 0;
-    for ( size_t i = 0; i < b_ip1.size(); i++ )
-      if (b_ip1[i].size() > max_count ) {
-        max_count = b_ip1[i].size();
-        max_index = i;
-      }
-
-    size_t point_idx = 0;
-    float point_interest = std::numeric_limits<float>::min();
-    for ( size_t i = 0; i < b_ip1[max_index].size(); i++ ) {
-      if ( b_ip1[max_index][i].interest > point_interest ) {
-        point_interest = b_ip1[max_index][i].interest;
-        point_idx = i;
-      }
+  // The order in which the points of a bin are removed, as a heap
+  // comparison: the point of highest interest first, then the
+  // earliest. Points of no positive interest go after all others, the
+  // earliest first. Points are entries of the bins, numbered in their
+  // input order.
+  class EqualizationRemovalOrder {
+    std::vector<vw::ip::InterestPoint> const& m_ip;
+    std::vector<size_t> const& m_entry_point;
+  public:
+    EqualizationRemovalOrder( std::vector<vw::ip::InterestPoint> const& ip,
+                              std::vector<size_t> const& entry_point ) :
+      m_ip(ip), m_entry_point(entry_point) {}
+
+    // Whether entry 'a' is removed after entry 'b'
+    bool operator()( size_t a, size_t b ) const {
+      float interest_a = m_ip[m_entry_point[a]].interest;
+      float interest_b = m_ip[m_entry_point[b]].interest;
+      bool positive_a = interest_a > std::numeric_limits<float>::min();
+      bool positive_b = interest_b > std::numeric_limits<float>::min();
+      if ( positive_a != positive_b )
+        return positive_b;
+      if ( positive_a && interest_a != interest_b )
+        return interest_a < interest_b;
+      return a > b;
     }
-
-    // Okay dokey making my remove
-    b_ip1[max_index].erase( b_ip1[max_index].begin() + point_idx );
-    b_ip2[max_index].erase( b_ip2[max_index].begin() + point_idx );
-  }
+  };
+
+  // The order in which bins lose points: the fullest first, then the
+  // first one.
+  class EqualizationBinOrder {
+    std::vector<size_t> const& m_count;
+  public:
+    EqualizationBinOrder( std::vector<size_t> const& count ) : m_count(count) {}
+
+    bool operator()( size_t a, size_t b ) const {
+      if ( m_count[a] != m_count[b] )
+        return m_count[a] < m_count[b];
+      return a > b;
+    }
+  };
 
   // divide block
-  std::vector<vw::BBox2f> divide_block( vw::BBox2f const& orginal,
-                                    ssize_t div_x, ssize_t div_y ) {
+  inline std::vector<vw::BBox2f> divide_block( vw::BBox2f const& orginal,
+                                               ssize_t div_x, ssize_t div_y ) {
     using namespace vw;
 
     std::vector<BBox2f> bboxes;
@@ -84,9 +101,15 @@ namespace cnettk {
     return bboxes;
   }
 
-  void equalization( std::vector<vw::ip::InterestPoint>& l_ip,
-                     std::vector<vw::ip::InterestPoint>& r_ip,
-                     size_t max_points ) {
+  // Reduces the matches to 'max_points', spread over a grid on the
+  // left image. Points are removed one at a time from the fullest grid
+  // cell, the one of highest interest first. The cells are kept in a
+  // heap on their number of points, and the points of each cell in a
+  // heap on the order they are removed in, so that removing R points
+  // takes O(R log N).
+  inline void equalization( std::vector<vw::ip::InterestPoint>& l_ip,
+                            std::vector<vw::ip::InterestPoint>& r_ip,
+                            size_t max_points ) {
     using namespace vw;
 
     // Checking for early exit condition
@@ -101,45 +124,79 @@ namespace cnettk {
     for ( size_t i = 0; i < l_ip.size(); ++i )
       total_bbox.grow( Vector2f( l_ip[i].x, l_ip[i].y ) );
     vw_out(DebugMessage,"equalization") << "Total bbox: " << total_bbox << "\n";
-    std::vector<BBox2f> bboxes;
+    ssize_t divisions;
     if ( max_points < 10 )
-      bboxes = divide_block( total_bbox, 2, 2 );
+      divisions = 2;
     else if ( max_points < 30 )
-      bboxes = divide_block( total_bbox, 3, 3 );
+      divisions = 3;
     else if ( max_points < 110 )
-      bboxes = divide_block( total_bbox, 5, 5 );
+      divisions = 5;
     else
-      bboxes = divide_block( total_bbox, 10, 10 );
-    std::vector<std::vector<ip::InterestPoint> > b_ip1;
-    std::vector<std::vector<ip::InterestPoint> > b_ip2;
-    b_ip1.resize( bboxes.size() );
-    b_ip2.resize( bboxes.size() );
-    for ( size_t b = 0; b < bboxes.size(); ++b )
-      for ( size_t i = 0; i < l_ip.size(); ++i )
-        if ( bboxes[b].contains( Vector2f( l_ip[i].x, l_ip[i].y ) ) ) {
-          b_ip1[b].push_back( l_ip[i] );
-          b_ip2[b].push_back( r_ip[i] );
-        }
-
-    // Finding how many points there are
-    size_t count = 0;
-    for ( size_t b = 0; b < b_ip1.size(); ++b )
-      count += b_ip1[b].size();
+      divisions = 10;
+    std::vector<BBox2f> bboxes = divide_block( total_bbox, divisions, divisions );
+
+    // The cells holding each point. Only the cells next to the one it
+    // falls in are tested, as the cell bounds may round either way.
+    // Cells are numbered i*divisions+j, column i and row j.
+    std::vector<std::vector<size_t> > bin_points( bboxes.size() );
+    Vector2f cell_size( total_bbox.width() / float(divisions),
+                        total_bbox.height() / float(divisions) );
+    for ( size_t p = 0; p < l_ip.size(); ++p ) {
+      Vector2f point( l_ip[p].x, l_ip[p].y );
+      ssize_t ci = cell_size.x() > 0 ? ssize_t( std::floor( (point.x() - total_bbox.min().x()) / cell_size.x() ) ) : 0;
+      ssize_t cj = cell_size.y() > 0 ? ssize_t( std::floor( (point.y() - total_bbox.min().y()) / cell_size.y() ) ) : 0;
+      for ( ssize_t i = std::max( ci - 1, ssize_t(0) ); i <= std::min( ci + 1, divisions - 1 ); i++ )
+        for ( ssize_t j = std::max( cj - 1, ssize_t(0) ); j <= std::min( cj + 1, divisions - 1 ); j++ )
+          if ( bboxes[i*divisions + j].contains( point ) )
+            bin_points[i*divisions + j].push_back( p );
+    }
+
+    // The entries of all bins, one bin after the other, and a heap of
+    // them per bin
+    std::vector<size_t> bin_start( bboxes.size() + 1, 0 ), entry_point, heap;
+    for ( size_t b = 0; b < bboxes.size(); ++b ) {
+      entry_point.insert( entry_point.end(), bin_points[b].begin(), bin_points[b].end() );
+      bin_start[b+1] = entry_point.size();
+      std::vector<size_t>().swap( bin_points[b] );
+    }
+    EqualizationRemovalOrder removal_order( l_ip, entry_point );
+    std::vector<size_t> count( bboxes.size() ), bins( bboxes.size() );
+    heap.resize( entry_point.size() );
+    for ( size_t b = 0; b < bboxes.size(); ++b ) {
+      for ( size_t e = bin_start[b]; e < bin_start[b+1]; ++e )
+        heap[e] = e;
+      std::make_heap( heap.begin() + bin_start[b], heap.begin() + bin_start[b+1], removal_order );
+      count[b] = bin_start[b+1] - bin_start[b];
+      bins[b] = b;
+    }
+    EqualizationBinOrder bin_order( count );
+    std::make_heap( bins.begin(), bins.end(), bin_order );
 
     // Remove until less that max
-    while ( count > max_points ) {
-      remove_max( b_ip1, b_ip2 );
-      count--;
+    std::vector<bool> removed( entry_point.size(), false );
+    size_t total = entry_point.size();
+    while ( total > max_points ) {
+      std::pop_heap( bins.begin(), bins.end(), bin_order );
+      size_t b = bins.back();
+      std::vector<size_t>::iterator begin = heap.begin() + bin_start[b];
+      std::pop_heap( begin, begin + count[b], removal_order );
+      removed[ *(begin + count[b] - 1) ] = true;
+      count[b]--;
+      std::push_heap( bins.begin(), bins.end(), bin_order );
+      total--;
     }
 
     // Reorganize back into correct form
-    l_ip.clear();
-    r_ip.clear();
-    for ( size_t b = 0; b < b_ip1.size(); ++b )
-      for ( size_t i = 0; i < b_ip1[b].size(); ++i ) {
-        l_ip.push_back( b_ip1[b][i] );
-        r_ip.push_back( b_ip2[b][i] );
+    std::vector<ip::InterestPoint> l_result, r_result;
+    l_result.reserve( total );
+    r_result.reserve( total );
+    for ( size_t e = 0; e < entry_point.size(); ++e )
+      if ( !removed[e] ) {
+        l_result.push_back( l_ip[entry_point[e]] );
+        r_result.push_back( r_ip[entry_point[e]] );
       }
+    l_ip.swap( l_result );
+    r_ip.swap( r_result );
   }
 
 }} // end asp::cnettk
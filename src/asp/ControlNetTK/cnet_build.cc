@@ -24,13 +24,17 @@ namespace fs = boost::filesystem;
 
 // Vision Workbench
 #include <vw/Math.h>
+#include <vw/Core/Thread.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/InterestPoint/InterestData.h>
+#include <vw/InterestPoint/Matcher.h>
 #include <vw/BundleAdjustment/ControlNetworkLoader.h>
 using namespace vw;
 using namespace vw::ba;
 
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/MeasureMerge.h>
 #include <asp/IsisIO/IsisCameraModel.h>
 #include <asp/IsisIO/IsisAdjustCameraModel.h>
 using namespace vw::camera;
@@ -91,6 +95,193 @@ struct Options : public asp::BaseOptions {
   std::string cnet_output_type;
 };
 
+boost::shared_ptr<CameraModel> load_camera( std::string const& name, bool isis_adjust ) {
+  std::string adjust_file =
+    fs::path( name ).replace_extension("isis_adjust").string();
+  if ( isis_adjust && fs::exists( adjust_file ) ) {
+    std::ifstream input( adjust_file.c_str() );
+    boost::shared_ptr<asp::BaseEquation> position_eq = asp::read_equation(input);
+    boost::shared_ptr<asp::BaseEquation> pose_eq = asp::read_equation(input);
+    input.close();
+    return boost::shared_ptr<CameraModel>( new IsisAdjustCameraModel( name, position_eq, pose_eq ) );
+  }
+  return boost::shared_ptr<CameraModel>( new IsisCameraModel(name) );
+}
+
+std::string serial_number( boost::shared_ptr<CameraModel> const& camera ) {
+  boost::shared_ptr<IsisAdjustCameraModel> adjust =
+    boost::dynamic_pointer_cast<IsisAdjustCameraModel>( camera );
+  if ( adjust )
+    return adjust->serial_number();
+  return boost::dynamic_pointer_cast<IsisCameraModel>( camera )->serial_number();
+}
+
+namespace asp {
+
+  // The matches between two images
+  struct PairMatches {
+    size_t image1, image2;
+    std::string filename;
+    std::vector<ip::InterestPoint> ip1, ip2;
+  };
+
+  // Reads one match file. Pairs with too few matches are left empty.
+  class MatchLoadTask : public Task, private boost::noncopyable {
+    PairMatches& m_pair;
+    int m_min_matches;
+    Mutex& m_progress_mutex;
+    const ProgressCallback& m_progress;
+    float m_inc_amt;
+  public:
+    MatchLoadTask( PairMatches& pair, int min_matches, Mutex& progress_mutex,
+                   const ProgressCallback& progress, float inc_amt ) :
+      m_pair(pair), m_min_matches(min_matches), m_progress_mutex(progress_mutex),
+      m_progress(progress), m_inc_amt(inc_amt) {}
+
+    void operator()() {
+      ip::read_binary_match_file( m_pair.filename, m_pair.ip1, m_pair.ip2 );
+      if ( int(m_pair.ip1.size()) < m_min_matches ) {
+        m_pair.ip1.clear();
+        m_pair.ip2.clear();
+      }
+      Mutex::Lock lock( m_progress_mutex );
+      m_progress.report_incremental_progress( m_inc_amt );
+    }
+  };
+
+  // Triangulates a range of control points. ISIS camera models can't
+  // be shared between threads, so each task loads the cameras it
+  // needs for itself.
+  class TriangulateTask : public Task, private boost::noncopyable {
+    ControlNetwork& m_cnet;
+    size_t m_begin, m_end;
+    Options const& m_opt;
+    std::vector<boost::shared_ptr<CameraModel> > m_cameras;
+    Mutex& m_progress_mutex;
+    const ProgressCallback& m_progress;
+    float m_inc_amt;
+  public:
+    TriangulateTask( ControlNetwork& cnet, size_t begin, size_t end, Options const& opt,
+                     std::vector<boost::shared_ptr<CameraModel> > const& cameras,
+                     Mutex& progress_mutex, const ProgressCallback& progress, float inc_amt ) :
+      m_cnet(cnet), m_begin(begin), m_end(end), m_opt(opt), m_cameras(cameras),
+      m_progress_mutex(progress_mutex), m_progress(progress), m_inc_amt(inc_amt) {}
+
+    void operator()() {
+      for ( size_t i = m_begin; i < m_end; i++ ) {
+        ControlPoint& cp = m_cnet[i];
+        BOOST_FOREACH( ControlMeasure const& cm, cp ) {
+          if ( !m_cameras[cm.image_id()] )
+            m_cameras[cm.image_id()] = load_camera( m_opt.input_names[cm.image_id()], m_opt.isis_adjust );
+        }
+        triangulate_control_point( cp, m_cameras, 8.726646E-2 ); // require 5 degrees
+        Mutex::Lock lock( m_progress_mutex );
+        m_progress.report_incremental_progress( m_inc_amt );
+      }
+    }
+  };
+
+}
+
+// Builds the control network from the match files of every pair of
+// images. Matches that share an interest point are joined in one
+// control point.
+void build_tracks( ControlNetwork& cnet, Options const& opt ) {
+  size_t num_threads = vw_settings().default_num_threads();
+
+  // Looking for the match files of each pair
+  std::vector<asp::PairMatches> pairs;
+  for ( size_t i = 0; i < opt.input_names.size(); ++i ) {
+    std::string prefix = fs::path( opt.input_names[i] ).replace_extension().string();
+    for ( size_t j = i+1; j < opt.input_names.size(); ++j ) {
+      std::string match_filename =
+        prefix + "__" + fs::path( opt.input_names[j] ).stem().string() + ".match";
+      for ( size_t d = 0; d < opt.directory_names.size(); d++ ) {
+        std::string filename = opt.directory_names[d] + "/" + match_filename;
+        if ( fs::exists( filename ) ) {
+          asp::PairMatches pair;
+          pair.image1 = i;
+          pair.image2 = j;
+          pair.filename = filename;
+          pairs.push_back( pair );
+          break;
+        }
+      }
+    }
+  }
+  if ( pairs.empty() )
+    vw_throw( IOErr() << "Unable to find any match files." );
+
+  {
+    TerminalProgressCallback progress("cnet","Loading Matches:");
+    Mutex progress_mutex;
+    float inc_amt = 1.0 / float(pairs.size());
+    FifoWorkQueue queue( num_threads );
+    for ( size_t k = 0; k < pairs.size(); k++ ) {
+      boost::shared_ptr<asp::MatchLoadTask>
+        task( new asp::MatchLoadTask( pairs[k], opt.min_matches, progress_mutex,
+                                                progress, inc_amt ) );
+      queue.add_task( task );
+    }
+    queue.join_all();
+    progress.report_finished();
+  }
+
+  // Every match is a point of two measures, merged with the others
+  // on the same interest points.
+  std::vector<asp::MergeMeasure> measures;
+  std::vector<float> scales;
+  std::vector<size_t> point_start( 1, 0 );
+  size_t num_pairs = 0;
+  for ( size_t k = 0; k < pairs.size(); k++ ) {
+    asp::PairMatches& pair = pairs[k];
+    if ( !pair.ip1.empty() )
+      num_pairs++;
+    for ( size_t n = 0; n < pair.ip1.size(); n++ ) {
+      measures.push_back( asp::MergeMeasure( pair.image1, pair.ip1[n].x, pair.ip1[n].y ) );
+      scales.push_back( pair.ip1[n].scale );
+      measures.push_back( asp::MergeMeasure( pair.image2, pair.ip2[n].x, pair.ip2[n].y ) );
+      scales.push_back( pair.ip2[n].scale );
+      point_start.push_back( measures.size() );
+    }
+    std::vector<ip::InterestPoint>().swap( pair.ip1 );
+    std::vector<ip::InterestPoint>().swap( pair.ip2 );
+  }
+  vw_out() << "Joining " << point_start.size() - 1 << " matches from "
+           << num_pairs << " image pairs.\n";
+
+  asp::MeasureMergeResult tracks =
+    asp::merge_measures( measures, point_start, -1, num_threads );
+  std::vector<size_t> track_start, order;
+  asp::group_unique_measures( tracks, point_start, track_start, order );
+
+  // Tracks that hold two interest points of the same image are
+  // inconsistent, and dropped.
+  std::vector<size_t> seen( opt.input_names.size(), tracks.num_groups );
+  size_t dropped = 0;
+  for ( size_t t = 0; t < tracks.num_groups; t++ ) {
+    bool consistent = true;
+    for ( size_t k = track_start[t]; k < track_start[t+1]; k++ ) {
+      size_t image = measures[order[k]].image;
+      if ( seen[image] == t )
+        consistent = false;
+      seen[image] = t;
+    }
+    if ( !consistent || track_start[t+1] - track_start[t] < 2 ) {
+      dropped++;
+      continue;
+    }
+    ControlPoint cp;
+    for ( size_t k = track_start[t]; k < track_start[t+1]; k++ ) {
+      asp::MergeMeasure const& m = measures[order[k]];
+      cp.add_measure( ControlMeasure( m.x, m.y, scales[order[k]], scales[order[k]], m.image ) );
+    }
+    cnet.add_control_point( cp );
+  }
+  if ( dropped )
+    vw_out() << "Dropped " << dropped << " tracks that see an image twice.\n";
+}
+
 void handle_arguments( int argc, char *argv[], Options& opt ) {
   po::options_description general_options("");
   general_options.add_options()
@@ -138,30 +329,40 @@ int main( int argc, char* argv[] ) {
     TerminalProgressCallback tpc("cnet","");
     double inc_amt = 1.0/double(opt.input_names.size());
     BOOST_FOREACH( std::string const& name, opt.input_names ) {
-      std::string adjust_file =
-        fs::path( name ).replace_extension("isis_adjust").string();
-      if ( opt.isis_adjust && fs::exists( adjust_file ) ) {
-        std::ifstream input( adjust_file.c_str() );
-        boost::shared_ptr<asp::BaseEquation> position_eq = asp::read_equation(input);
-        boost::shared_ptr<asp::BaseEquation> pose_eq = asp::read_equation(input);
-        input.close();
-
-        camera_models.push_back( boost::shared_ptr<CameraModel>( new IsisAdjustCameraModel( name, position_eq, pose_eq ) ) );
-        opt.serial_names.push_back( boost::dynamic_pointer_cast<IsisAdjustCameraModel>(camera_models.back())->serial_number() );
-      } else {
-        camera_models.push_back( boost::shared_ptr<CameraModel>( new IsisCameraModel(name) ));
-        opt.serial_names.push_back( boost::dynamic_pointer_cast<IsisCameraModel>(camera_models.back())->serial_number() );
-      }
-
+      camera_models.push_back( load_camera( name, opt.isis_adjust ) );
+      opt.serial_names.push_back( serial_number( camera_models.back() ) );
       tpc.report_incremental_progress(inc_amt);
     }
     tpc.report_finished();
 
     vw_out() << "Building Control Network\n";
     ControlNetwork cnet( "ControlNetworkTK" );
-    build_control_network( cnet, camera_models,
-                           opt.input_names, opt.min_matches,
-                           opt.directory_names);
+    build_tracks( cnet, opt );
+
+    {
+      // The first task reuses the cameras loaded above
+      TerminalProgressCallback progress("cnet","Triangulating:");
+      Mutex progress_mutex;
+      size_t num_tasks = std::min( size_t(vw_settings().default_num_threads()),
+                                   std::max( cnet.size(), size_t(1) ) );
+      size_t chunk = ( cnet.size() + num_tasks - 1 ) / num_tasks;
+      float point_inc = 1.0 / float( std::max( cnet.size(), size_t(1) ) );
+      FifoWorkQueue queue( num_tasks );
+      for ( size_t t = 0; t < num_tasks; t++ ) {
+        std::vector<boost::shared_ptr<CameraModel> > cameras( camera_models.size() );
+        if ( t == 0 )
+          cameras = camera_models;
+        boost::shared_ptr<asp::TriangulateTask>
+          task( new asp::TriangulateTask( cnet, std::min( t * chunk, cnet.size() ),
+                                          std::min( (t+1) * chunk, cnet.size() ),
+                                          opt, cameras, progress_mutex, progress,
+                                          point_inc ) );
+        queue.add_task( task );
+      }
+      queue.join_all();
+      progress.report_finished();
+    }
+
     add_ground_control_points( cnet, opt.input_names,
                                opt.gcp_names.begin(), opt.gcp_names.end() );
     add_ground_control_cnets( cnet, opt.input_names,
@@ -17,74 +17,26 @@
 
 
 #include <vw/BundleAdjustment/ControlNetwork.h>
-#include <vw/BundleAdjustment/CameraRelation.h>
-#include <vw/Cartography.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ProgressCallback.h>
 using namespace vw;
 using namespace vw::ba;
-using namespace vw::camera;
 
 #include <boost/algorithm/string.hpp>
 #include <boost/program_options.hpp>
 #include <boost/foreach.hpp>
-#include <boost/filesystem/path.hpp>
+#include <boost/unordered_map.hpp>
 namespace po = boost::program_options;
-namespace fs = boost::filesystem;
 
-#include <asp/IsisIO/IsisCameraModel.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/MeasureMerge.h>
 
-size_t find_destination_index( int const& source_idx,
-                               std::map<int,std::string> const& src_map,
-                               std::map<std::string,int> & dst_map,
-                               size_t & dst_max_idx ) {
-  std::map<std::string,int>::iterator search =
-    dst_map.find( src_map.find(source_idx)->second );
-  size_t dst_index;
-  if ( search == dst_map.end() ) {
-    dst_max_idx++;
-    dst_index = dst_max_idx;
-    std::string serial = src_map.find(source_idx)->second;
-    vw_out() << "  Adding camera w/ serial: " << serial << "\n";
-    dst_map[ serial ] = dst_index;
-  } else {
-    dst_index = search->second;
-  }
-  return dst_index;
+void print_cnet_statistics( size_t num_points, size_t num_measures ) {
+  vw_out() << "  CP : " << num_points << "   CM : " << num_measures << "\n";
 }
 
-void print_cnet_statistics( ControlNetwork const& cnet ) {
-  int cmeasure_size = 0;
-  BOOST_FOREACH( ControlPoint const& cp, cnet ) {
-    cmeasure_size+=cp.size();
-  }
-  vw_out() << "  CP : " << cnet.size() << "   CM : " << cmeasure_size << "\n";
-}
-
-struct ContainsEqualMeasure {
-  Vector2 m_position;
-  ContainsEqualMeasure( Vector2 const& pos ) : m_position(pos) {}
-
-  bool operator()( boost::shared_ptr<IPFeature> in ) {
-    if ( m_position[0] == in->m_ip.x &&
-         m_position[1] == in->m_ip.y )
-      return true;
-    return false;
-  }
-};
-
-struct ContainsCloseMeasure {
-  Vector2 m_position;
-  double m_close;
-  ContainsCloseMeasure( Vector2 const& pos, double const& close ) : m_position(pos), m_close(close) {}
-
-  bool operator()( boost::shared_ptr<IPFeature> in ) {
-    if ( norm_2( Vector2(in->m_ip.x, in->m_ip.y) - m_position ) <= m_close )
-      return true;
-    return false;
-  }
-};
-
 struct Options : public asp::BaseOptions {
   // Input
   std::string destination_cnet;
@@ -96,6 +48,63 @@ struct Options : public asp::BaseOptions {
   std::string output_prefix;
 };
 
+namespace asp {
+
+  // An input network, reduced to what the merge needs. Serials are
+  // numbered in the order they are met in the network.
+  struct NetworkTable {
+    std::vector<std::string> serials;
+    std::vector<vw::uint32> serial_image_id;    // The image id of each serial in the file
+    std::vector<size_t> point_start;
+    std::vector<Vector3> positions;
+    std::vector<ControlMeasure> measures;
+    std::vector<vw::uint32> measure_serial;
+    std::vector<ControlPoint> ground_cp;        // These are appended, not merged
+    size_t num_points, num_measures;
+    NetworkTable() : num_points(0), num_measures(0) {}
+  };
+
+  // Reads a network into its table, and releases the network
+  class LoadNetworkTask : public Task, private boost::noncopyable {
+    std::string m_filename;
+    NetworkTable& m_table;
+  public:
+    LoadNetworkTask( std::string const& filename, NetworkTable& table ) :
+      m_filename(filename), m_table(table) {}
+
+    void operator()() {
+      ControlNetwork cnet("source");
+      cnet.read_binary( m_filename );
+
+      boost::unordered_map<std::string, vw::uint32> serial_index;
+      m_table.point_start.assign( 1, 0 );
+      m_table.num_points = cnet.size();
+      m_table.num_measures = 0;
+      BOOST_FOREACH( ControlPoint const& cp, cnet ) {
+        m_table.num_measures += cp.size();
+        BOOST_FOREACH( ControlMeasure const& cm, cp ) {
+          if ( serial_index.insert( std::make_pair( cm.serial(), vw::uint32( m_table.serials.size() ) ) ).second ) {
+            m_table.serials.push_back( cm.serial() );
+            m_table.serial_image_id.push_back( cm.image_id() );
+          }
+        }
+        // Measures of ground control points are kept with the points
+        if ( cp.type() == ControlPoint::GroundControlPoint ) {
+          m_table.ground_cp.push_back( cp );
+          continue;
+        }
+        BOOST_FOREACH( ControlMeasure const& cm, cp ) {
+          m_table.measures.push_back( cm );
+          m_table.measure_serial.push_back( serial_index[cm.serial()] );
+        }
+        m_table.point_start.push_back( m_table.measures.size() );
+        m_table.positions.push_back( cp.position() );
+      }
+    }
+  };
+
+}
+
 void handle_arguments( int argc, char *argv[], Options& opt ) {
   po::options_description general_options("");
   general_options.add_options()
@@ -130,184 +139,128 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 int main( int argc, char** argv ) {
 
   Options opt;
-  std::vector<ControlPoint> ground_cp; // These guys are just appended.
-
   try {
     handle_arguments( argc, argv, opt );
 
-    ControlNetwork dst_cnet("destination");
-    dst_cnet.read_binary( opt.destination_cnet );
-
-    vw_out() << "Input " << opt.destination_cnet << ":\n";
-    print_cnet_statistics( dst_cnet );
-
-    // Filling in dst_serial and dst_max_cam_idx
-    std::map<std::string,int> dst_serial_to_cam_idx;
-    size_t dst_max_cam_idx = 0;
+    // The destination comes first, as it specifies the camera
+    // indexing we should use.
+    std::vector<std::string> filenames( 1, opt.destination_cnet );
+    filenames.insert( filenames.end(), opt.source_cnets.begin(), opt.source_cnets.end() );
+    std::vector<asp::NetworkTable> tables( filenames.size() );
     {
-      float inc_amt = 1.0/float(dst_cnet.size());
-      TerminalProgressCallback tpc("","Destination Idx:");
-      BOOST_FOREACH( ControlPoint const& cp, dst_cnet ) {
-        tpc.report_incremental_progress( inc_amt );
-        BOOST_FOREACH( ControlMeasure const& cm, cp ) {
-          if ( dst_serial_to_cam_idx.find( cm.serial() ) ==
-               dst_serial_to_cam_idx.end() ) {
-            dst_serial_to_cam_idx[cm.serial()] = cm.image_id();
-            if ( cm.image_id() > dst_max_cam_idx )
-              dst_max_cam_idx = cm.image_id();
-          }
-        }
-      }
-      tpc.report_finished();
-
-      // Filter out ground control points as CRNs don't store the measurement.
-      for ( size_t i = 0; i < dst_cnet.size(); i++ ) {
-        if ( dst_cnet[i].type() == ControlPoint::GroundControlPoint ) {
-          ground_cp.push_back( dst_cnet[i] );
-          dst_cnet.delete_control_point(i);
-          i--;
-        }
+      vw_out() << "Loading " << filenames.size() << " control networks.\n";
+      FifoWorkQueue queue( vw_settings().default_num_threads() );
+      for ( size_t t = 0; t < filenames.size(); t++ ) {
+        boost::shared_ptr<asp::LoadNetworkTask> task( new asp::LoadNetworkTask( filenames[t], tables[t] ) );
+        queue.add_task( task );
       }
+      queue.join_all();
     }
 
-    CameraRelationNetwork<IPFeature> dst_crn;
-    dst_crn.read_controlnetwork( dst_cnet );
-
-    BOOST_FOREACH( std::string const& source_cnet, opt.source_cnets ) {
-      ControlNetwork src_cnet("source");
-      src_cnet.read_binary( source_cnet );
-
-      // The reason we have a destination input, is that it specifies
-      // the camera indexing we should use.
-      vw_out() << "Inserting \"" << source_cnet << "\":\n";
-      print_cnet_statistics( src_cnet );
-
-      typedef std::map<int,std::string> src_map_type;
-      src_map_type src_cam_idx_to_serial;
-      float inc_amt = 1.0/float(src_cnet.size());
-      {
-        TerminalProgressCallback tpc("cnet","Indexing:");
-        BOOST_FOREACH( ControlPoint const& cp, src_cnet ) {
-          tpc.report_incremental_progress( inc_amt );
-          BOOST_FOREACH( ControlMeasure const& cm, cp ) {
-            if ( src_cam_idx_to_serial.find( cm.image_id() ) ==
-                 src_cam_idx_to_serial.end() )
-              src_cam_idx_to_serial[cm.image_id()] = cm.serial();
-          }
+    // Image ids of the serials, hashed. New serials follow those of
+    // the destination.
+    boost::unordered_map<std::string, vw::uint32> serial_to_cam_idx;
+    std::vector<std::string> cam_idx_to_serial;
+    std::vector<std::vector<vw::uint32> > table_image_id( tables.size() );
+    for ( size_t s = 0; s < tables[0].serials.size(); s++ ) {
+      vw::uint32 image_id = tables[0].serial_image_id[s];
+      serial_to_cam_idx[tables[0].serials[s]] = image_id;
+      if ( image_id >= cam_idx_to_serial.size() )
+        cam_idx_to_serial.resize( image_id + 1 );
+      cam_idx_to_serial[image_id] = tables[0].serials[s];
+    }
+    for ( size_t t = 0; t < tables.size(); t++ ) {
+      vw_out() << "Input " << filenames[t] << ":\n";
+      print_cnet_statistics( tables[t].num_points, tables[t].num_measures );
+      BOOST_FOREACH( std::string const& serial, tables[t].serials ) {
+        if ( serial_to_cam_idx.insert( std::make_pair( serial, vw::uint32( cam_idx_to_serial.size() ) ) ).second ) {
+          vw_out() << "  Adding camera w/ serial: " << serial << "\n";
+          cam_idx_to_serial.push_back( serial );
         }
-        tpc.report_finished();
+        table_image_id[t].push_back( serial_to_cam_idx[serial] );
       }
+    }
 
-      {
-        TerminalProgressCallback tpc("cnet","Merging: ");
-        BOOST_FOREACH( ControlPoint const& cp, src_cnet ) {
-          tpc.report_incremental_progress(inc_amt );
-
-          // Escape condition for GCPs
-          if ( cp.type() == ControlPoint::GroundControlPoint ) {
-            ground_cp.push_back( cp );
-            BOOST_FOREACH( ControlMeasure & cm, ground_cp.back() ) {
-
-              size_t new_index =
-                find_destination_index( cm.image_id(),
-                                        src_cam_idx_to_serial,
-                                        dst_serial_to_cam_idx,
-                                        dst_max_cam_idx );
-              if ( new_index == dst_crn.size() )
-                dst_crn.add_node( CameraNode<IPFeature>(new_index,"") );
-              cm.set_image_id( new_index );
-            }
-            continue;
-          }
-
-          typedef boost::shared_ptr<IPFeature> f_ptr;
-          typedef std::list<f_ptr>::iterator f_itr;
-
-          ControlPoint::const_iterator cm1, cm2;
-          cm1 = cm2 = cp.begin();
-          cm2++;
-          size_t dst_index1 =
-            find_destination_index( cm1->image_id(),
-                                    src_cam_idx_to_serial,
-                                    dst_serial_to_cam_idx,
-                                    dst_max_cam_idx );
-
-          if ( dst_index1 == dst_crn.size() )
-            dst_crn.add_node( CameraNode<IPFeature>(dst_index1,"") );
-
-          f_itr dst_feature1;
-          if ( opt.close < 0 ) {
-            dst_feature1 = std::find_if( dst_crn[dst_index1].begin(),
-                                         dst_crn[dst_index1].end(),
-                                         ContainsEqualMeasure(cm1->position()));
-          } else {
-            dst_feature1 = std::find_if( dst_crn[dst_index1].begin(),
-                                         dst_crn[dst_index1].end(),
-                                         ContainsCloseMeasure(cm1->position(),opt.close));
-          }
-          if ( dst_feature1 == dst_crn[dst_index1].end() ) {
-            dst_crn[dst_index1].relations.push_front( f_ptr( new IPFeature(*cm1,0, dst_index1) ));
-            dst_feature1 = dst_crn[dst_index1].begin();
-          }
-          while ( cm2 != cp.end() ) {
-            size_t dst_index2 =
-              find_destination_index( cm2->image_id(),
-                                      src_cam_idx_to_serial,
-                                      dst_serial_to_cam_idx,
-                                      dst_max_cam_idx );
-
-            if ( dst_index2 == dst_crn.size() )
-              dst_crn.add_node( CameraNode<IPFeature>(dst_index2,"") );
-
-            f_itr dst_feature2;
-            if ( opt.close < 0 ) {
-              dst_feature2 = std::find_if( dst_crn[dst_index2].begin(),
-                                           dst_crn[dst_index2].end(),
-                                           ContainsEqualMeasure(cm2->position()));
-            } else {
-              dst_feature2 = std::find_if( dst_crn[dst_index2].begin(),
-                                           dst_crn[dst_index2].end(),
-                                           ContainsCloseMeasure(cm2->position(),opt.close));
-            }
-            if ( dst_feature2 == dst_crn[dst_index2].end() ) {
-              dst_crn[dst_index2].relations.push_front( f_ptr( new IPFeature( *cm2, 0, dst_index2 )));
-              dst_feature2 = dst_crn[dst_index2].begin();
-            }
-
-            // Doubly linking
-            (*dst_feature1)->connection( *dst_feature2, true );
-            (*dst_feature2)->connection( *dst_feature1, true );
-
-            dst_index1 = dst_index2;
-            dst_feature1 = dst_feature2;
-            cm1++; cm2++;
-          }
-        }
-        tpc.report_finished();
+    // All tie point measures, one network after the other
+    std::vector<asp::MergeMeasure> measures;
+    std::vector<size_t> point_start( 1, 0 ), table_point_start( 1, 0 );
+    for ( size_t t = 0; t < tables.size(); t++ ) {
+      asp::NetworkTable const& table = tables[t];
+      for ( size_t m = 0; m < table.measures.size(); m++ ) {
+        Vector2 position = table.measures[m].position();
+        measures.push_back( asp::MergeMeasure( table_image_id[t][table.measure_serial[m]],
+                                               position[0], position[1] ) );
       }
+      for ( size_t p = 1; p < table.point_start.size(); p++ )
+        point_start.push_back( point_start.back() + table.point_start[p] - table.point_start[p-1] );
+      table_point_start.push_back( point_start.size() - 1 );
     }
 
-    try {
-      dst_crn.write_controlnetwork( dst_cnet );
-    } catch ( ArgumentErr const& e ) {
-      dst_cnet.clear();
+    vw_out() << "Merging " << measures.size() << " measures.\n";
+    asp::MeasureMergeResult merge =
+      asp::merge_measures( measures, point_start, opt.close, vw_settings().default_num_threads() );
+
+    // The unique measures, ordered by merged point
+    std::vector<size_t> group_start, order;
+    asp::group_unique_measures( merge, point_start, group_start, order );
+    std::vector<size_t> group_first_point( merge.num_groups, point_start.size() );
+    for ( size_t p = 0; p + 1 < point_start.size(); p++ )
+      group_first_point[merge.point_group[p]] = std::min( group_first_point[merge.point_group[p]], p );
+    measures.clear();
+
+    // Where each merged measure came from
+    std::vector<size_t> measure_table( point_start.back() );
+    for ( size_t t = 0; t < tables.size(); t++ )
+      for ( size_t p = table_point_start[t]; p < table_point_start[t+1]; p++ )
+        for ( size_t m = point_start[p]; m < point_start[p+1]; m++ )
+          measure_table[m] = t;
+    std::vector<size_t> table_measure_start( tables.size() + 1, 0 );
+    for ( size_t t = 0; t < tables.size(); t++ )
+      table_measure_start[t+1] = table_measure_start[t] + tables[t].measures.size();
+
+    // Points whose measures all fell onto one are dropped
+    ControlNetwork dst_cnet("destination");
+    size_t num_measures = 0, dropped = 0;
+    for ( size_t g = 0; g < merge.num_groups; g++ ) {
+      if ( group_start[g+1] - group_start[g] < 2 ) {
+        dropped++;
+        continue;
+      }
+      size_t first = group_first_point[g];
+      size_t first_table = measure_table[point_start[first]];
+      ControlPoint cp;
+      cp.set_position( tables[first_table].positions[first - table_point_start[first_table]] );
+      for ( size_t k = group_start[g]; k < group_start[g+1]; k++ ) {
+        size_t m = order[k], t = measure_table[m];
+        size_t local = m - table_measure_start[t];
+        ControlMeasure cm = tables[t].measures[local];
+        vw::uint32 image_id = table_image_id[t][tables[t].measure_serial[local]];
+        cm.set_image_id( image_id );
+        cm.set_serial( cam_idx_to_serial[image_id] );
+        cp.add_measure( cm );
+      }
+      num_measures += cp.size();
+      dst_cnet.add_control_point( cp );
     }
-    dst_cnet.add_control_points( ground_cp );
-    vw_out() << "Output Control Network:\n";
-    print_cnet_statistics( dst_cnet );
 
-    // Re apply serial
-    std::map<int,std::string> reverse_dst;
-    for ( std::map<std::string,int>::iterator it = dst_serial_to_cam_idx.begin();
-          it != dst_serial_to_cam_idx.end(); it++ ) {
-      reverse_dst[it->second] = it->first;
-    }
-    BOOST_FOREACH( ControlPoint & cp, dst_cnet ) {
-      BOOST_FOREACH( ControlMeasure & cm, cp ) {
-        cm.set_serial( reverse_dst[cm.image_id()] );
+    // Ground control points move to the merged camera indexing
+    for ( size_t t = 0; t < tables.size(); t++ ) {
+      BOOST_FOREACH( ControlPoint & cp, tables[t].ground_cp ) {
+        BOOST_FOREACH( ControlMeasure & cm, cp ) {
+          vw::uint32 image_id = serial_to_cam_idx[cm.serial()];
+          cm.set_image_id( image_id );
+        }
+        num_measures += cp.size();
+        dst_cnet.add_control_point( cp );
       }
+      tables[t] = asp::NetworkTable();
     }
 
+    vw_out() << "Output Control Network:\n";
+    print_cnet_statistics( dst_cnet.size(), num_measures );
+    if ( dropped )
+      vw_out() << "  Dropped " << dropped << " points left with a single measure.\n";
+
     dst_cnet.write_binary(opt.output_prefix);
 
   } ASP_STANDARD_CATCHES;
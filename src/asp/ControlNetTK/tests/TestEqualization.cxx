@@ -0,0 +1,142 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/ControlNetTK/Equalization.h>
+
+#include <cstdlib>
+
+using namespace vw;
+using namespace asp::cnettk;
+
+namespace {
+
+  // The equalization as it was first written: scanning for the
+  // fullest bin and its strongest point on every removal.
+  void reference_equalization( std::vector<ip::InterestPoint>& l_ip,
+                               std::vector<ip::InterestPoint>& r_ip,
+                               size_t max_points ) {
+    if ( l_ip.size() <= max_points )
+      return;
+    BBox2f total_bbox;
+    for ( size_t i = 0; i < l_ip.size(); ++i )
+      total_bbox.grow( Vector2f( l_ip[i].x, l_ip[i].y ) );
+    ssize_t divisions = max_points < 10 ? 2 : max_points < 30 ? 3 : max_points < 110 ? 5 : 10;
+    std::vector<BBox2f> bboxes = divide_block( total_bbox, divisions, divisions );
+    std::vector<std::vector<ip::InterestPoint> > b_ip1( bboxes.size() ), b_ip2( bboxes.size() );
+    size_t count = 0;
+    for ( size_t b = 0; b < bboxes.size(); ++b )
+      for ( size_t i = 0; i < l_ip.size(); ++i )
+        if ( bboxes[b].contains( Vector2f( l_ip[i].x, l_ip[i].y ) ) ) {
+          b_ip1[b].push_back( l_ip[i] );
+          b_ip2[b].push_back( r_ip[i] );
+          count++;
+        }
+
+    while ( count > max_points ) {
+      size_t max_index = 0, max_count = 0;
+      for ( size_t i = 0; i < b_ip1.size(); i++ )
+        if ( b_ip1[i].size() > max_count ) {
+          max_count = b_ip1[i].size();
+          max_index = i;
+        }
+      size_t point_idx = 0;
+      float point_interest = std::numeric_limits<float>::min();
+      for ( size_t i = 0; i < b_ip1[max_index].size(); i++ )
+        if ( b_ip1[max_index][i].interest > point_interest ) {
+          point_interest = b_ip1[max_index][i].interest;
+          point_idx = i;
+        }
+      b_ip1[max_index].erase( b_ip1[max_index].begin() + point_idx );
+      b_ip2[max_index].erase( b_ip2[max_index].begin() + point_idx );
+      count--;
+    }
+
+    l_ip.clear();
+    r_ip.clear();
+    for ( size_t b = 0; b < b_ip1.size(); ++b )
+      for ( size_t i = 0; i < b_ip1[b].size(); ++i ) {
+        l_ip.push_back( b_ip1[b][i] );
+        r_ip.push_back( b_ip2[b][i] );
+      }
+  }
+
+  // Matches with their index in r_ip.x, clustered, with tied and
+  // non-positive interests, and some on the cell bounds.
+  void synthetic_matches( size_t count, std::vector<ip::InterestPoint>& l_ip,
+                          std::vector<ip::InterestPoint>& r_ip ) {
+    l_ip.resize( count );
+    r_ip.resize( count );
+    for ( size_t i = 0; i < count; i++ ) {
+      if ( i % 3 == 0 ) {
+        l_ip[i].x = 100 + rand() % 50;
+        l_ip[i].y = 200 + rand() % 50;
+      } else {
+        l_ip[i].x = rand() % 1000;
+        l_ip[i].y = rand() % 1000;
+      }
+      l_ip[i].interest = float( rand() % 20 ) - 2;
+      r_ip[i].x = i;
+    }
+  }
+
+}
+
+TEST( Equalization, MatchesReference ) {
+  srand( 11 );
+  size_t sizes[] = { 5, 20, 100, 500 };
+  for ( size_t s = 0; s < 4; s++ ) {
+    std::vector<ip::InterestPoint> l_ip, r_ip;
+    synthetic_matches( 3000, l_ip, r_ip );
+    std::vector<ip::InterestPoint> l_ref = l_ip, r_ref = r_ip;
+
+    equalization( l_ip, r_ip, sizes[s] );
+    reference_equalization( l_ref, r_ref, sizes[s] );
+
+    ASSERT_EQ( r_ref.size(), r_ip.size() );
+    EXPECT_EQ( sizes[s], r_ip.size() );
+    for ( size_t i = 0; i < r_ip.size(); i++ )
+      EXPECT_EQ( r_ref[i].x, r_ip[i].x );
+  }
+}
+
+TEST( Equalization, FewPoints ) {
+  std::vector<ip::InterestPoint> l_ip, r_ip;
+  synthetic_matches( 10, l_ip, r_ip );
+  equalization( l_ip, r_ip, 10 );
+  EXPECT_EQ( 10u, l_ip.size() );
+}
+
+// Many more matches than the reference could handle in a test. Each
+// kept match must be one of the input matches, kept once.
+TEST( Equalization, ManyPoints ) {
+  srand( 5 );
+  std::vector<ip::InterestPoint> l_ip, r_ip;
+  synthetic_matches( 200000, l_ip, r_ip );
+
+  equalization( l_ip, r_ip, 1000 );
+  ASSERT_EQ( 1000u, l_ip.size() );
+  ASSERT_EQ( 1000u, r_ip.size() );
+  std::vector<bool> kept( 200000, false );
+  for ( size_t i = 0; i < r_ip.size(); i++ ) {
+    size_t index = size_t( r_ip[i].x );
+    ASSERT_LT( index, kept.size() );
+    EXPECT_FALSE( kept[index] );
+    kept[index] = true;
+  }
+}
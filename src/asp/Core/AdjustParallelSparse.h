@@ -0,0 +1,585 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file AdjustParallelSparse.h
+///
+/// Sparse Levenberg-Marquardt bundle adjustment that forms the reduced
+/// camera system on all threads and solves it with BlockSparseSolver.
+/// It is a drop-in replacement for vw::ba::AdjustSparse, with the same
+/// robust cost functions and constraints.
+
+#ifndef __ASP_CORE_ADJUST_PARALLEL_SPARSE_H__
+#define __ASP_CORE_ADJUST_PARALLEL_SPARSE_H__
+
+#include <vw/BundleAdjustment/AdjustBase.h>
+#include <vw/BundleAdjustment/ControlNetwork.h>
+#include <vw/Core/Debugging.h>
+#include <vw/Math/LinearAlgebra.h>
+#include <asp/Core/BlockSparseSolver.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+
+namespace asp {
+
+  struct LinearSolverOptions {
+    enum Solver { Cholesky, PCG };
+    Solver solver;
+    PCGOptions pcg;
+    // Whether the model may be evaluated from several threads at once.
+    // Models around ISIS cameras may not.
+    bool threaded_model;
+    size_t num_threads;
+    LinearSolverOptions() : solver(Cholesky), threaded_model(false),
+                            num_threads(vw::vw_settings().default_num_threads()) {}
+  };
+
+  // Options from their command line names, case insensitive:
+  // [Cholesky, PCG] and [BlockJacobi, Jacobi].
+  inline LinearSolverOptions
+  linear_solver_options( std::string solver, std::string preconditioner ) {
+    LinearSolverOptions opt;
+    boost::to_lower( solver );
+    boost::to_lower( preconditioner );
+    if ( solver == "cholesky" )
+      opt.solver = LinearSolverOptions::Cholesky;
+    else if ( solver == "pcg" )
+      opt.solver = LinearSolverOptions::PCG;
+    else
+      vw::vw_throw( vw::ArgumentErr() << "Unknown linear solver: " << solver
+                    << ". Options are : [Cholesky, PCG]\n" );
+    if ( preconditioner == "blockjacobi" )
+      opt.pcg.preconditioner = PCGOptions::BlockJacobi;
+    else if ( preconditioner == "jacobi" )
+      opt.pcg.preconditioner = PCGOptions::Jacobi;
+    else
+      vw::vw_throw( vw::ArgumentErr() << "Unknown preconditioner: " << preconditioner
+                    << ". Options are : [BlockJacobi, Jacobi]\n" );
+    return opt;
+  }
+
+  // The predicted improvement dS of a Levenberg-Marquardt step, its
+  // squared norm, and the range of the gradient g
+  struct StepStatistics {
+    double dS, norm_2_sqr, g_max, g_min;
+    StepStatistics() : dS(0), norm_2_sqr(0), g_max(-std::numeric_limits<double>::max()),
+                       g_min(std::numeric_limits<double>::max()) {}
+    void add( double lambda, double d, double g ) {
+      dS += .5 * d * ( lambda * d + g );
+      norm_2_sqr += d * d;
+      g_max = std::max( g_max, g );
+      g_min = std::min( g_min, g );
+    }
+  };
+
+  // The work of sparse Levenberg-Marquardt that is done point by
+  // point, shared by AdjustParallelSparse and the MPI adjuster. The
+  // points that this process linearizes are added with add_point(),
+  // and are numbered p here; m_points[p] is their index in the model,
+  // and their measures are [m_point_start[p], m_point_start[p+1]).
+  // The cameras are indexed as in the model.
+  template <class BundleAdjustModelT, class RobustCostT>
+  class SparseAdjustBase : public vw::ba::AdjustBase<BundleAdjustModelT, RobustCostT> {
+  protected:
+    static const size_t CN = BundleAdjustModelT::camera_params_n;
+    static const size_t PN = BundleAdjustModelT::point_params_n;
+
+    typedef vw::Matrix<double, 2, CN>  matrix_2_camera;
+    typedef vw::Matrix<double, 2, PN>  matrix_2_point;
+    typedef vw::Matrix<double, CN, CN> matrix_camera_camera;
+    typedef vw::Matrix<double, PN, PN> matrix_point_point;
+    typedef vw::Matrix<double, CN, PN> matrix_camera_point;
+    typedef vw::Vector<double, CN>     vector_camera;
+    typedef vw::Vector<double, PN>     vector_point;
+
+    std::vector<size_t> m_points, m_point_start, m_measure_camera;
+    std::vector<vw::Vector2> m_measure_pixel, m_measure_icov;
+    std::vector<bool> m_point_gcp;
+
+    // The linearization at the current parameters. The camera blocks
+    // are indexed by camera, the point blocks by p.
+    std::vector<matrix_2_camera> m_A;
+    std::vector<matrix_2_point> m_B;
+    std::vector<vw::Vector2> m_epsilon;
+    std::vector<matrix_camera_camera> m_U;
+    std::vector<matrix_point_point> m_V, m_V_inverse;
+    std::vector<vector_camera> m_epsilon_a;
+    std::vector<vector_point> m_epsilon_b;
+
+    // The step
+    std::vector<double> m_delta_a;
+    std::vector<vector_point> m_delta_b;
+
+    SparseAdjustBase( BundleAdjustModelT & model,
+                      RobustCostT const& robust_cost_func,
+                      bool use_camera_constraint, bool use_gcp_constraint ) :
+      vw::ba::AdjustBase<BundleAdjustModelT,RobustCostT>( model, robust_cost_func,
+                                                          use_camera_constraint,
+                                                          use_gcp_constraint ) {
+      m_point_start.push_back( 0 );
+    }
+
+    // Adds point i of the control network to the points linearized here
+    void add_point( size_t i ) {
+      vw::ba::ControlPoint const& point = (*this->m_control_net)[i];
+      m_points.push_back( i );
+      m_point_gcp.push_back( point.type() == vw::ba::ControlPoint::GroundControlPoint );
+      for ( vw::ba::ControlPoint::const_iterator measure = point.begin();
+            measure != point.end(); ++measure ) {
+        VW_ASSERT( measure->image_id() < this->m_model.num_cameras(),
+                   vw::ArgumentErr() << "SparseAdjustBase: image index out of bounds." );
+        m_measure_camera.push_back( measure->image_id() );
+        m_measure_pixel.push_back( measure->dominant() );
+        vw::Vector2 sigma = measure->sigma();
+        m_measure_icov.push_back( vw::Vector2( 1/(sigma[0]*sigma[0]), 1/(sigma[1]*sigma[1]) ) );
+      }
+      m_point_start.push_back( m_measure_camera.size() );
+    }
+
+    // Sizes the linearization, once the points are added
+    void allocate() {
+      size_t num_cameras = this->m_model.num_cameras(), num_measures = m_measure_camera.size();
+      m_A.resize( num_measures );
+      m_B.resize( num_measures );
+      m_epsilon.resize( num_measures );
+      m_U.resize( num_cameras );
+      m_epsilon_a.resize( num_cameras );
+      m_V.resize( m_points.size() );
+      m_V_inverse.resize( m_points.size() );
+      m_epsilon_b.resize( m_points.size() );
+      m_delta_a.resize( num_cameras * CN );
+      m_delta_b.resize( m_points.size() );
+    }
+
+    matrix_2_camera camera_jacobian_weighted( size_t m ) const {
+      matrix_2_camera result = m_A[m];
+      for ( size_t c = 0; c < CN; c++ ) {
+        result(0,c) *= m_measure_icov[m][0];
+        result(1,c) *= m_measure_icov[m][1];
+      }
+      return result;
+    }
+
+    matrix_2_point point_jacobian_weighted( size_t m ) const {
+      matrix_2_point result = m_B[m];
+      for ( size_t c = 0; c < PN; c++ ) {
+        result(0,c) *= m_measure_icov[m][0];
+        result(1,c) *= m_measure_icov[m][1];
+      }
+      return result;
+    }
+
+    vector_camera delta_a( size_t j ) const {
+      vector_camera result;
+      for ( size_t c = 0; c < CN; c++ )
+        result[c] = m_delta_a[j*CN + c];
+      return result;
+    }
+
+    // Robust weighted reprojection error of measure m of model point i
+    vw::Vector2 measure_error( size_t m, size_t i, vector_camera const& a_j, vector_point const& b_i ) {
+      vw::Vector2 unweighted_error = m_measure_pixel[m] -
+        this->m_model( i, m_measure_camera[m], a_j, b_i );
+      double mag = norm_2(unweighted_error);
+      if ( mag == 0 )
+        return unweighted_error;
+      return unweighted_error * ( std::sqrt( this->m_robust_cost_func(mag) ) / mag );
+    }
+
+    double measure_cost( size_t m, vw::Vector2 const& epsilon ) const {
+      return .5 * ( epsilon[0] * epsilon[0] * m_measure_icov[m][0] +
+                    epsilon[1] * epsilon[1] * m_measure_icov[m][1] );
+    }
+
+    // Jacobians and errors of the measures of point p, and its blocks
+    // V and epsilon_b. Returns the error of the point.
+    double linearize_point( size_t p ) {
+      size_t i = m_points[p];
+      vector_point b_i = this->m_model.B_parameters(i);
+      matrix_point_point V;
+      vector_point epsilon_b;
+      double error = 0;
+      for ( size_t m = m_point_start[p]; m < m_point_start[p+1]; m++ ) {
+        size_t j = m_measure_camera[m];
+        vector_camera a_j = this->m_model.A_parameters(j);
+        m_A[m] = this->m_model.A_jacobian( i, j, a_j, b_i );
+        m_B[m] = this->m_model.B_jacobian( i, j, a_j, b_i );
+        m_epsilon[m] = measure_error( m, i, a_j, b_i );
+        error += measure_cost( m, m_epsilon[m] );
+
+        matrix_2_point weighted_B = point_jacobian_weighted(m);
+        V += transpose(m_B[m]) * weighted_B;
+        epsilon_b += transpose(weighted_B) * m_epsilon[m];
+      }
+
+      // Only ground control points are constrained to their position
+      if ( this->m_use_gcp_constraint && m_point_gcp[p] ) {
+        matrix_point_point inverse_cov = this->m_model.B_inverse_covariance(i);
+        vector_point eps_b = this->m_model.B_target(i) - b_i;
+        V += inverse_cov;
+        epsilon_b += inverse_cov * eps_b;
+        error += .5 * transpose(eps_b) * inverse_cov * eps_b;
+      }
+      m_V[p] = V;
+      m_epsilon_b[p] = epsilon_b;
+      return error;
+    }
+
+    void invert_point( size_t p ) {
+      matrix_point_point V = m_V[p];
+      for ( size_t c = 0; c < PN; c++ )
+        V(c,c) += this->m_lambda;
+      m_V_inverse[p] = vw::math::inverse(V);
+    }
+
+    // delta_b = V^-1 (epsilon_b - sum W^T delta_a), where W = A^T Sigma^-1 B
+    void back_substitute_point( size_t p ) {
+      vector_point rhs = m_epsilon_b[p];
+      for ( size_t m = m_point_start[p]; m < m_point_start[p+1]; m++ )
+        rhs -= transpose( m_B[m] ) * ( camera_jacobian_weighted(m) * delta_a( m_measure_camera[m] ) );
+      m_delta_b[p] = m_V_inverse[p] * rhs;
+    }
+
+    // The error of point p, at the parameters moved by the step
+    double evaluate_point( size_t p ) {
+      size_t i = m_points[p];
+      vector_point new_b = this->m_model.B_parameters(i) + m_delta_b[p];
+      double error = 0;
+      for ( size_t m = m_point_start[p]; m < m_point_start[p+1]; m++ ) {
+        size_t j = m_measure_camera[m];
+        vector_camera new_a = this->m_model.A_parameters(j) + delta_a(j);
+        error += measure_cost( m, measure_error( m, i, new_a, new_b ) );
+      }
+      if ( this->m_use_gcp_constraint && m_point_gcp[p] ) {
+        vector_point eps_b = this->m_model.B_target(i) - new_b;
+        error += .5 * transpose(eps_b) * this->m_model.B_inverse_covariance(i) * eps_b;
+      }
+      return error;
+    }
+
+    // The camera constraint error of camera j, moved by the step or not
+    double camera_error( size_t j, bool moved ) const {
+      if ( !this->m_use_camera_constraint )
+        return 0;
+      vector_camera a_j = this->m_model.A_parameters(j);
+      if ( moved )
+        a_j += delta_a(j);
+      vector_camera eps_a = this->m_model.A_target(j) - a_j;
+      return .5 * transpose(eps_a) * this->m_model.A_inverse_covariance(j) * eps_a;
+    }
+
+    void add_camera_step( size_t j, StepStatistics& step ) const {
+      for ( size_t c = 0; c < CN; c++ )
+        step.add( this->m_lambda, m_delta_a[j*CN + c], m_epsilon_a[j][c] );
+    }
+
+    void add_point_steps( StepStatistics& step ) const {
+      for ( size_t p = 0; p < m_points.size(); p++ )
+        for ( size_t c = 0; c < PN; c++ )
+          step.add( this->m_lambda, m_delta_b[p][c], m_epsilon_b[p][c] );
+    }
+
+    // Applies the step if R, the actual over the predicted improvement,
+    // is positive, and updates lambda by Fletcher's rule. Moves every
+    // camera, but only the points linearized here. Returns whether the
+    // step was applied.
+    bool fletcher_update( double R ) {
+      if ( R > 0 ) {
+        for ( size_t j = 0; j < m_U.size(); j++ )
+          this->m_model.set_A_parameters( j, this->m_model.A_parameters(j) + delta_a(j) );
+        for ( size_t p = 0; p < m_points.size(); p++ )
+          this->m_model.set_B_parameters( m_points[p], this->m_model.B_parameters(m_points[p]) + m_delta_b[p] );
+
+        if ( this->m_control == 0 ) {
+          double temp = 1 - std::pow( (2*R - 1), 3 );
+          if ( temp < 1.0/3.0 )
+            temp = 1.0/3.0;
+          this->m_lambda *= temp;
+          this->m_nu = 2;
+        } else if ( this->m_control == 1 ) {
+          this->m_lambda /= 10;
+        }
+        return true;
+      }
+
+      // here we didn't make progress
+      if ( this->m_control == 0 ) {
+        this->m_lambda *= this->m_nu;
+        this->m_nu *= 2;
+      } else if ( this->m_control == 1 ) {
+        this->m_lambda *= 10;
+      }
+      return false;
+    }
+  };
+
+  template <class BundleAdjustModelT, class RobustCostT>
+  class AdjustParallelSparse : public SparseAdjustBase<BundleAdjustModelT, RobustCostT> {
+    typedef AdjustParallelSparse<BundleAdjustModelT, RobustCostT> Self;
+    typedef SparseAdjustBase<BundleAdjustModelT, RobustCostT> Base;
+    using Base::CN;
+    using Base::PN;
+    typedef typename Base::matrix_camera_camera matrix_camera_camera;
+    typedef typename Base::matrix_camera_point  matrix_camera_point;
+    typedef typename Base::vector_camera        vector_camera;
+
+    using Base::m_point_start;
+    using Base::m_measure_camera;
+    using Base::m_B;
+    using Base::m_epsilon;
+    using Base::m_A;
+    using Base::m_U;
+    using Base::m_V;
+    using Base::m_V_inverse;
+    using Base::m_epsilon_a;
+    using Base::m_epsilon_b;
+    using Base::m_delta_a;
+
+    LinearSolverOptions m_opt;
+
+    // Every point is linearized here, so p is the index of the point
+    // in the model. These are the point of each measure, and the
+    // measures of each camera.
+    std::vector<size_t> m_measure_point;
+    std::vector<std::vector<size_t> > m_camera_measures;
+    std::vector<double> m_point_error, m_camera_error;
+
+    // The reduced camera system S delta_a = e
+    BlockSparseMatrix m_S;
+    BlockCholesky m_cholesky;
+    std::vector<double> m_e;
+
+    void linearize_points( size_t begin, size_t end ) {
+      for ( size_t i = begin; i < end; i++ )
+        m_point_error[i] = this->linearize_point(i);
+    }
+
+    // The camera blocks U and epsilon_a
+    void accumulate_cameras( size_t begin, size_t end ) {
+      for ( size_t j = begin; j < end; j++ ) {
+        matrix_camera_camera U;
+        vector_camera epsilon_a;
+        for ( size_t n = 0; n < m_camera_measures[j].size(); n++ ) {
+          size_t m = m_camera_measures[j][n];
+          typename Base::matrix_2_camera weighted_A = this->camera_jacobian_weighted(m);
+          U += transpose(m_A[m]) * weighted_A;
+          epsilon_a += transpose(weighted_A) * m_epsilon[m];
+        }
+        if ( this->m_use_camera_constraint ) {
+          matrix_camera_camera inverse_cov = this->m_model.A_inverse_covariance(j);
+          vector_camera eps_a = this->m_model.A_target(j) - this->m_model.A_parameters(j);
+          U += inverse_cov;
+          epsilon_a += inverse_cov * eps_a;
+        }
+        m_camera_error[j] = this->camera_error( j, false );
+        m_U[j] = U;
+        m_epsilon_a[j] = epsilon_a;
+      }
+    }
+
+    void invert_points( size_t begin, size_t end ) {
+      for ( size_t i = begin; i < end; i++ )
+        this->invert_point(i);
+    }
+
+    // Block rows of S = U - sum W V^-1 W^T and of e = epsilon_a -
+    // sum W V^-1 epsilon_b, where W = A^T Sigma^-1 B. Each row only
+    // reads the points of its own camera, so rows need no locking.
+    void reduce_cameras( size_t begin, size_t end ) {
+      for ( size_t j = begin; j < end; j++ ) {
+        for ( size_t n = m_S.row_begin(j); n < m_S.row_end(j); n++ )
+          std::fill( m_S.values(n), m_S.values(n) + CN*CN, 0.0 );
+
+        double* S_jj = m_S.block( j, j );
+        for ( size_t r = 0; r < CN; r++ ) {
+          for ( size_t c = 0; c < CN; c++ )
+            S_jj[r*CN + c] = m_U[j](r,c);
+          S_jj[r*CN + r] += this->m_lambda;
+          m_e[j*CN + r] = m_epsilon_a[j][r];
+        }
+
+        for ( size_t n = 0; n < m_camera_measures[j].size(); n++ ) {
+          size_t m = m_camera_measures[j][n], i = m_measure_point[m];
+          matrix_camera_point Y = transpose( this->camera_jacobian_weighted(m) ) * m_B[m] * m_V_inverse[i];
+          vector_camera Y_eps = Y * m_epsilon_b[i];
+          for ( size_t r = 0; r < CN; r++ )
+            m_e[j*CN + r] -= Y_eps[r];
+
+          for ( size_t o = m_point_start[i]; o < m_point_start[i+1]; o++ ) {
+            matrix_camera_camera YW = Y * transpose( transpose( this->camera_jacobian_weighted(o) ) * m_B[o] );
+            double* S_jk = m_S.block( j, m_measure_camera[o] );
+            for ( size_t r = 0; r < CN; r++ )
+              for ( size_t c = 0; c < CN; c++ )
+                S_jk[r*CN + c] -= YW(r,c);
+          }
+        }
+      }
+    }
+
+    void back_substitute( size_t begin, size_t end ) {
+      for ( size_t i = begin; i < end; i++ )
+        this->back_substitute_point(i);
+    }
+
+    void evaluate_points( size_t begin, size_t end ) {
+      for ( size_t i = begin; i < end; i++ )
+        m_point_error[i] = this->evaluate_point(i);
+    }
+
+    size_t model_threads() const {
+      return m_opt.threaded_model ? m_opt.num_threads : 1;
+    }
+
+  public:
+
+    AdjustParallelSparse( BundleAdjustModelT & model,
+                          RobustCostT const& robust_cost_func,
+                          bool use_camera_constraint=true,
+                          bool use_gcp_constraint=true ) :
+      Base( model, robust_cost_func, use_camera_constraint, use_gcp_constraint ) {
+      vw::ba::ControlNetwork const& cnet = *this->m_control_net;
+      size_t num_cameras = this->m_model.num_cameras();
+      VW_ASSERT( cnet.size() == this->m_model.num_points(),
+                 vw::LogicErr() << "AdjustParallelSparse: Number of bundles does not match the number of points in the bundle adjustment model." );
+
+      m_camera_measures.resize( num_cameras );
+      for ( size_t i = 0; i < cnet.size(); i++ ) {
+        this->add_point( i );
+        for ( size_t m = m_point_start[i]; m < m_point_start[i+1]; m++ ) {
+          m_camera_measures[m_measure_camera[m]].push_back( m );
+          m_measure_point.push_back( i );
+        }
+      }
+      this->allocate();
+
+      // Cameras are coupled in S when they see a common point
+      std::vector<std::vector<size_t> > pattern( num_cameras );
+      for ( size_t i = 0; i < cnet.size(); i++ )
+        for ( size_t m = m_point_start[i]; m < m_point_start[i+1]; m++ )
+          for ( size_t o = m_point_start[i]; o < m_point_start[i+1]; o++ )
+            pattern[m_measure_camera[m]].push_back( m_measure_camera[o] );
+      for ( size_t j = 0; j < num_cameras; j++ ) {
+        std::sort( pattern[j].begin(), pattern[j].end() );
+        pattern[j].erase( std::unique( pattern[j].begin(), pattern[j].end() ), pattern[j].end() );
+      }
+      m_S = BlockSparseMatrix( CN, pattern );
+
+      m_camera_error.resize( num_cameras );
+      m_point_error.resize( cnet.size() );
+      m_e.resize( num_cameras * CN );
+    }
+
+    void set_linear_solver_options( LinearSolverOptions const& opt ) { m_opt = opt; }
+    LinearSolverOptions const& linear_solver_options() const { return m_opt; }
+
+    BlockSparseMatrix const& S() const { return m_S; }
+
+    // UPDATE IMPLEMENTATION
+    //-------------------------------------------------------------
+    // This is the sparse levenberg marquardt update step. Returns
+    // the squared norm of the step, or 0 if it was rejected.
+    double update( double &abs_tol, double &rel_tol ) {
+      ++this->m_iterations;
+      vw::Timer* time;
+      size_t num_cameras = m_U.size(), num_points = m_V.size();
+
+      time = new vw::Timer("Solve for Image Error, Jacobian, U, V:", vw::DebugMessage, "bundle_adjust");
+      parallel_range( num_points, boost::bind( &Self::linearize_points, this, _1, _2 ),
+                      model_threads() );
+      parallel_range( num_cameras, boost::bind( &Self::accumulate_cameras, this, _1, _2 ),
+                      m_opt.num_threads );
+      double error_total = 0;
+      for ( size_t i = 0; i < num_points; i++ )
+        error_total += m_point_error[i];
+      for ( size_t j = 0; j < num_cameras; j++ )
+        error_total += m_camera_error[j];
+      delete time;
+
+      // set initial lambda, and ignore if the user has touched it
+      if ( this->m_iterations == 1 && this->m_lambda == 1e-3 ) {
+        double max = 0.0;
+        for ( size_t j = 0; j < num_cameras; j++ )
+          for ( size_t c = 0; c < CN; c++ )
+            max = std::max( max, std::fabs( m_U[j](c,c) ) );
+        for ( size_t i = 0; i < num_points; i++ )
+          for ( size_t c = 0; c < PN; c++ )
+            max = std::max( max, std::fabs( m_V[i](c,c) ) );
+        this->m_lambda = max * 1e-10;
+      }
+
+      time = new vw::Timer("Build Sparse", vw::DebugMessage, "bundle_adjust");
+      parallel_range( num_points, boost::bind( &Self::invert_points, this, _1, _2 ),
+                      m_opt.num_threads );
+      parallel_range( num_cameras, boost::bind( &Self::reduce_cameras, this, _1, _2 ),
+                      m_opt.num_threads );
+      delete time;
+
+      time = new vw::Timer("Solve Delta A", vw::DebugMessage, "bundle_adjust");
+      if ( m_opt.solver == LinearSolverOptions::PCG ) {
+        int iterations = pcg_solve( m_S, m_e, m_delta_a, m_opt.pcg, m_opt.num_threads );
+        vw::vw_out(vw::DebugMessage, "bundle_adjust") << "PCG iterations: " << iterations << "\n";
+      } else {
+        if ( !m_cholesky.analyzed() ) {
+          m_cholesky.analyze( m_S );
+          vw::vw_out(vw::DebugMessage, "bundle_adjust") << "Cholesky factor blocks: "
+                                                        << m_cholesky.num_blocks() << "\n";
+        }
+        if ( !m_cholesky.factor( m_S, m_opt.num_threads ) )
+          vw::vw_throw( vw::LogicErr() << "AdjustParallelSparse: the reduced camera system is not positive definite." );
+        m_cholesky.solve( m_e, m_delta_a );
+      }
+      delete time;
+
+      time = new vw::Timer("Solve Delta B", vw::DebugMessage, "bundle_adjust");
+      parallel_range( num_points, boost::bind( &Self::back_substitute, this, _1, _2 ),
+                      m_opt.num_threads );
+      delete time;
+
+      // The gradient g = (epsilon_a, epsilon_b), the predicted
+      // improvement dS, and the step size
+      StepStatistics step;
+      for ( size_t j = 0; j < num_cameras; j++ )
+        this->add_camera_step( j, step );
+      this->add_point_steps( step );
+      rel_tol = step.norm_2_sqr;
+      abs_tol = step.g_max - step.g_min;
+
+      time = new vw::Timer("Solve for Updated Error", vw::DebugMessage, "bundle_adjust");
+      parallel_range( num_points, boost::bind( &Self::evaluate_points, this, _1, _2 ),
+                      model_threads() );
+      double new_error_total = 0;
+      for ( size_t i = 0; i < num_points; i++ )
+        new_error_total += m_point_error[i];
+      for ( size_t j = 0; j < num_cameras; j++ )
+        new_error_total += this->camera_error( j, true );
+      delete time;
+
+      //Fletcher modification
+      double R = ( error_total - new_error_total ) / step.dS;
+      return this->fletcher_update( R ) ? rel_tol : 0;
+    }
+  };
+
+}
+
+#endif//__ASP_CORE_ADJUST_PARALLEL_SPARSE_H__
@@ -0,0 +1,416 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file BlockSparseSolver.cc
+///
+
+#include <vw/Core/Exception.h>
+#include <asp/Core/BlockSparseSolver.h>
+
+#include <cmath>
+#include <set>
+#include <utility>
+
+using namespace vw;
+
+namespace {
+
+  // X = X L^-T, that is each row of X solved against L
+  void right_solve_transpose( double const* L, double* X, size_t b ) {
+    for ( size_t r = 0; r < b; r++ )
+      asp::forward_solve( L, X + r*b, b );
+  }
+
+  // C -= A B^T
+  void subtract_product_transpose( double const* A, double const* B, double* C, size_t b ) {
+    for ( size_t i = 0; i < b; i++ )
+      for ( size_t j = 0; j < b; j++ ) {
+        double sum = 0;
+        for ( size_t k = 0; k < b; k++ )
+          sum += A[i*b+k] * B[j*b+k];
+        C[i*b+j] -= sum;
+      }
+  }
+
+  double dot( std::vector<double> const& a, std::vector<double> const& b ) {
+    double sum = 0;
+    for ( size_t i = 0; i < a.size(); i++ )
+      sum += a[i] * b[i];
+    return sum;
+  }
+
+  struct MultiplyRows {
+    asp::BlockSparseMatrix const& S;
+    std::vector<double> const& x;
+    std::vector<double>& y;
+    MultiplyRows( asp::BlockSparseMatrix const& S, std::vector<double> const& x,
+                  std::vector<double>& y ) : S(S), x(x), y(y) {}
+    void operator()( size_t begin, size_t end ) const {
+      size_t b = S.block_size();
+      for ( size_t i = begin; i < end; i++ ) {
+        double* yi = &y[i*b];
+        std::fill( yi, yi + b, 0.0 );
+        for ( size_t n = S.row_begin(i); n < S.row_end(i); n++ ) {
+          double const* block = S.values(n);
+          double const* xj = &x[S.col(n)*b];
+          for ( size_t r = 0; r < b; r++ )
+            for ( size_t c = 0; c < b; c++ )
+              yi[r] += block[r*b+c] * xj[c];
+        }
+      }
+    }
+  };
+
+  struct UpdateColumns {
+    asp::BlockCholesky* chol;
+    size_t k;
+    void (asp::BlockCholesky::*func)( size_t, size_t, size_t );
+    void operator()( size_t begin, size_t end ) const { (chol->*func)( k, begin, end ); }
+  };
+
+}
+
+namespace asp {
+
+  // Dense blocks
+  // ------------------------------------------------------------------
+
+  bool cholesky_in_place( double* A, size_t b ) {
+    for ( size_t i = 0; i < b; i++ ) {
+      for ( size_t j = 0; j <= i; j++ ) {
+        double sum = A[i*b+j];
+        for ( size_t k = 0; k < j; k++ )
+          sum -= A[i*b+k] * A[j*b+k];
+        if ( i == j ) {
+          if ( !(sum > 0) )
+            return false;
+          A[i*b+i] = std::sqrt(sum);
+        } else {
+          A[i*b+j] = sum / A[j*b+j];
+        }
+      }
+      for ( size_t j = i + 1; j < b; j++ )
+        A[i*b+j] = 0;
+    }
+    return true;
+  }
+
+  void forward_solve( double const* L, double* x, size_t b ) {
+    for ( size_t i = 0; i < b; i++ ) {
+      for ( size_t k = 0; k < i; k++ )
+        x[i] -= L[i*b+k] * x[k];
+      x[i] /= L[i*b+i];
+    }
+  }
+  void backward_solve( double const* L, double* x, size_t b ) {
+    for ( size_t i = b; i-- > 0; ) {
+      for ( size_t k = i + 1; k < b; k++ )
+        x[i] -= L[k*b+i] * x[k];
+      x[i] /= L[i*b+i];
+    }
+  }
+
+  bool factor_preconditioner( PCGOptions::Preconditioner preconditioner,
+                              double const* D, double* P, size_t b ) {
+    if ( preconditioner == PCGOptions::BlockJacobi ) {
+      std::copy( D, D + b*b, P );
+      return cholesky_in_place( P, b );
+    }
+    for ( size_t r = 0; r < b; r++ ) {
+      if ( !(D[r*b+r] > 0) )
+        return false;
+      P[r] = 1.0 / D[r*b+r];
+    }
+    return true;
+  }
+
+  void apply_preconditioner( PCGOptions::Preconditioner preconditioner,
+                             double const* P, double* z, size_t b ) {
+    if ( preconditioner == PCGOptions::BlockJacobi ) {
+      forward_solve( P, z, b );
+      backward_solve( P, z, b );
+    } else {
+      for ( size_t c = 0; c < b; c++ )
+        z[c] *= P[c];
+    }
+  }
+
+  // BlockSparseMatrix
+  // ------------------------------------------------------------------
+
+  BlockSparseMatrix::BlockSparseMatrix( size_t block_size,
+                                        std::vector<std::vector<size_t> > const& pattern ) :
+    m_block_size(block_size) {
+    VW_ASSERT( block_size > 0, ArgumentErr() << "BlockSparseMatrix: the block size must be positive." );
+    m_row_start.push_back( 0 );
+    for ( size_t i = 0; i < pattern.size(); i++ ) {
+      std::vector<size_t> cols = pattern[i];
+      cols.push_back( i );
+      std::sort( cols.begin(), cols.end() );
+      cols.erase( std::unique( cols.begin(), cols.end() ), cols.end() );
+      VW_ASSERT( cols.back() < pattern.size(),
+                 ArgumentErr() << "BlockSparseMatrix: block column out of range." );
+      m_cols.insert( m_cols.end(), cols.begin(), cols.end() );
+      m_row_start.push_back( m_cols.size() );
+    }
+    m_values.resize( m_cols.size() * block_size * block_size, 0.0 );
+  }
+
+  double* BlockSparseMatrix::block( size_t i, size_t j ) {
+    return const_cast<double*>( static_cast<BlockSparseMatrix const*>(this)->block( i, j ) );
+  }
+
+  double const* BlockSparseMatrix::block( size_t i, size_t j ) const {
+    std::vector<size_t>::const_iterator begin = m_cols.begin() + m_row_start[i],
+      end = m_cols.begin() + m_row_start[i+1];
+    std::vector<size_t>::const_iterator it = std::lower_bound( begin, end, j );
+    if ( it == end || *it != j )
+      return 0;
+    return values( it - m_cols.begin() );
+  }
+
+  void BlockSparseMatrix::set_zero() {
+    std::fill( m_values.begin(), m_values.end(), 0.0 );
+  }
+
+  void BlockSparseMatrix::multiply( std::vector<double> const& x, std::vector<double>& y,
+                                    size_t num_threads ) const {
+    VW_ASSERT( x.size() == rows(), ArgumentErr() << "BlockSparseMatrix: vector size mismatch." );
+    y.resize( rows() );
+    parallel_range( num_block_rows(), MultiplyRows( *this, x, y ), num_threads );
+  }
+
+  // BlockCholesky
+  // ------------------------------------------------------------------
+
+  void BlockCholesky::analyze( BlockSparseMatrix const& S ) {
+    size_t n = S.num_block_rows();
+    m_block_size = S.block_size();
+    m_order.clear();
+    m_position.assign( n, 0 );
+    m_rows.assign( n, std::vector<size_t>() );
+
+    // Minimum degree: eliminate the block row with the fewest
+    // neighbors, and join those neighbors into a clique, the fill.
+    std::vector<std::set<size_t> > graph( n );
+    for ( size_t i = 0; i < n; i++ )
+      for ( size_t m = S.row_begin(i); m < S.row_end(i); m++ )
+        if ( S.col(m) != i )
+          graph[i].insert( S.col(m) );
+    typedef std::set<std::pair<size_t, size_t> > DegreeQueue;
+    DegreeQueue queue;
+    for ( size_t i = 0; i < n; i++ )
+      queue.insert( std::make_pair( graph[i].size(), i ) );
+
+    std::vector<std::vector<size_t> > columns( n );
+    while ( !queue.empty() ) {
+      size_t k = queue.begin()->second;
+      queue.erase( queue.begin() );
+      m_position[k] = m_order.size();
+      m_order.push_back( k );
+      columns[k].assign( graph[k].begin(), graph[k].end() );
+
+      for ( size_t a = 0; a < columns[k].size(); a++ ) {
+        size_t i = columns[k][a];
+        queue.erase( std::make_pair( graph[i].size(), i ) );
+        graph[i].erase( k );
+        for ( size_t c = 0; c < columns[k].size(); c++ )
+          if ( columns[k][c] != i )
+            graph[i].insert( columns[k][c] );
+        queue.insert( std::make_pair( graph[i].size(), i ) );
+      }
+      std::set<size_t>().swap( graph[k] );
+    }
+
+    // Every neighbor was eliminated after k, so its step is larger
+    for ( size_t k = 0; k < n; k++ ) {
+      std::vector<size_t>& rows = m_rows[m_position[k]];
+      for ( size_t a = 0; a < columns[k].size(); a++ )
+        rows.push_back( m_position[columns[k][a]] );
+      std::sort( rows.begin(), rows.end() );
+    }
+    m_blocks.assign( n, std::vector<double>() );
+    m_diag.assign( n, std::vector<double>() );
+  }
+
+  bool BlockCholesky::factor( BlockSparseMatrix const& S, size_t num_threads ) {
+    if ( !analyzed() )
+      analyze( S );
+    size_t n = m_order.size(), bb = m_block_size * m_block_size;
+    VW_ASSERT( S.num_block_rows() == n && S.block_size() == m_block_size,
+               ArgumentErr() << "BlockCholesky: the matrix does not match the analyzed one." );
+
+    // Scatter the lower triangle, in elimination order, into L
+    for ( size_t k = 0; k < n; k++ ) {
+      m_diag[k].assign( bb, 0.0 );
+      m_blocks[k].assign( m_rows[k].size() * bb, 0.0 );
+    }
+    for ( size_t i = 0; i < n; i++ ) {
+      for ( size_t m = S.row_begin(i); m < S.row_end(i); m++ ) {
+        size_t r = m_position[i], c = m_position[S.col(m)];
+        double* dest;
+        if ( r == c ) {
+          dest = &m_diag[c][0];
+        } else if ( r > c ) {
+          size_t a = std::lower_bound( m_rows[c].begin(), m_rows[c].end(), r ) - m_rows[c].begin();
+          dest = &m_blocks[c][a * bb];
+        } else {
+          continue;
+        }
+        std::copy( S.values(m), S.values(m) + bb, dest );
+      }
+    }
+
+    for ( size_t k = 0; k < n; k++ ) {
+      if ( !cholesky_in_place( &m_diag[k][0], m_block_size ) )
+        return false;
+      for ( size_t a = 0; a < m_rows[k].size(); a++ )
+        right_solve_transpose( &m_diag[k][0], &m_blocks[k][a * bb], m_block_size );
+
+      // The trailing update touches one column per row of column k.
+      // Large ones are spread over the threads, a column each.
+      UpdateColumns update = { this, k, &BlockCholesky::update_column };
+      if ( m_rows[k].size() > 32 )
+        parallel_range( m_rows[k].size(), update, num_threads );
+      else
+        update( 0, m_rows[k].size() );
+    }
+    return true;
+  }
+
+  // Subtracts L_ik L_jk^T from column j, for the rows j of column k
+  // in [begin, end), and every row i of column k at or below j.
+  void BlockCholesky::update_column( size_t k, size_t begin, size_t end ) {
+    size_t bb = m_block_size * m_block_size;
+    std::vector<size_t> const& rows = m_rows[k];
+    for ( size_t b = begin; b < end; b++ ) {
+      size_t j = rows[b];
+      double const* Ljk = &m_blocks[k][b * bb];
+      subtract_product_transpose( Ljk, Ljk, &m_diag[j][0], m_block_size );
+      std::vector<size_t> const& rows_j = m_rows[j];
+      std::vector<size_t>::const_iterator it = rows_j.begin();
+      for ( size_t a = b + 1; a < rows.size(); a++ ) {
+        it = std::lower_bound( it, rows_j.end(), rows[a] );
+        subtract_product_transpose( &m_blocks[k][a * bb], Ljk,
+                                    &m_blocks[j][(it - rows_j.begin()) * bb], m_block_size );
+      }
+    }
+  }
+
+  void BlockCholesky::solve( std::vector<double> const& rhs, std::vector<double>& x ) const {
+    size_t n = m_order.size(), b = m_block_size, bb = b * b;
+    VW_ASSERT( rhs.size() == n * b, ArgumentErr() << "BlockCholesky: vector size mismatch." );
+
+    std::vector<double> y( n * b );
+    for ( size_t k = 0; k < n; k++ )
+      std::copy( &rhs[m_order[k]*b], &rhs[m_order[k]*b] + b, &y[k*b] );
+
+    // L y' = y, column by column
+    for ( size_t k = 0; k < n; k++ ) {
+      forward_solve( &m_diag[k][0], &y[k*b], b );
+      for ( size_t a = 0; a < m_rows[k].size(); a++ ) {
+        double const* L = &m_blocks[k][a * bb];
+        double* yi = &y[m_rows[k][a]*b];
+        for ( size_t r = 0; r < b; r++ )
+          for ( size_t c = 0; c < b; c++ )
+            yi[r] -= L[r*b+c] * y[k*b+c];
+      }
+    }
+
+    // L^T x = y', row by row of L^T
+    for ( size_t k = n; k-- > 0; ) {
+      for ( size_t a = 0; a < m_rows[k].size(); a++ ) {
+        double const* L = &m_blocks[k][a * bb];
+        double const* xi = &y[m_rows[k][a]*b];
+        for ( size_t r = 0; r < b; r++ )
+          for ( size_t c = 0; c < b; c++ )
+            y[k*b+c] -= L[r*b+c] * xi[r];
+      }
+      backward_solve( &m_diag[k][0], &y[k*b], b );
+    }
+
+    x.resize( n * b );
+    for ( size_t k = 0; k < n; k++ )
+      std::copy( &y[k*b], &y[k*b] + b, &x[m_order[k]*b] );
+  }
+
+  size_t BlockCholesky::num_blocks() const {
+    size_t count = m_diag.size();
+    for ( size_t k = 0; k < m_rows.size(); k++ )
+      count += m_rows[k].size();
+    return count;
+  }
+
+  // PCG
+  // ------------------------------------------------------------------
+
+  int pcg_solve( BlockSparseMatrix const& S, std::vector<double> const& rhs,
+                 std::vector<double>& x, PCGOptions const& opt, size_t num_threads ) {
+    size_t n = S.num_block_rows(), b = S.block_size();
+    size_t stride = preconditioner_size( opt.preconditioner, b );
+    VW_ASSERT( rhs.size() == S.rows(), ArgumentErr() << "pcg_solve: vector size mismatch." );
+
+    std::vector<double> precond( n * stride );
+    for ( size_t i = 0; i < n; i++ )
+      if ( !factor_preconditioner( opt.preconditioner, S.block( i, i ), &precond[i*stride], b ) )
+        vw_throw( ArgumentErr() << "pcg_solve: the matrix is not positive definite." );
+
+    if ( x.size() != rhs.size() )
+      x.assign( rhs.size(), 0.0 );
+    std::vector<double> r( rhs.size() ), z( rhs.size() ), p, q;
+    S.multiply( x, q, num_threads );
+    for ( size_t i = 0; i < r.size(); i++ )
+      r[i] = rhs[i] - q[i];
+
+    double rhs_norm = std::sqrt( dot( rhs, rhs ) );
+    if ( rhs_norm == 0 ) {
+      std::fill( x.begin(), x.end(), 0.0 );
+      return 0;
+    }
+
+    double rz = 0;
+    int iteration = 0;
+    for ( ; iteration < opt.max_iterations; iteration++ ) {
+      if ( std::sqrt( dot( r, r ) ) <= opt.tolerance * rhs_norm )
+        break;
+
+      z = r;
+      for ( size_t i = 0; i < n; i++ )
+        apply_preconditioner( opt.preconditioner, &precond[i*stride], &z[i*b], b );
+
+      double rz_new = dot( r, z );
+      if ( iteration == 0 ) {
+        p = z;
+      } else {
+        double beta = rz_new / rz;
+        for ( size_t i = 0; i < p.size(); i++ )
+          p[i] = z[i] + beta * p[i];
+      }
+      rz = rz_new;
+
+      S.multiply( p, q, num_threads );
+      double alpha = rz / dot( p, q );
+      for ( size_t i = 0; i < x.size(); i++ ) {
+        x[i] += alpha * p[i];
+        r[i] -= alpha * q[i];
+      }
+    }
+    return iteration;
+  }
+
+}
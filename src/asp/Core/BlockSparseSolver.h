@@ -0,0 +1,180 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file BlockSparseSolver.h
+///
+/// Symmetric positive definite systems made of small dense blocks, as
+/// the reduced camera system of bundle adjustment, and their solution
+/// by sparse block Cholesky or by preconditioned conjugate gradients.
+
+#ifndef __ASP_CORE_BLOCK_SPARSE_SOLVER_H__
+#define __ASP_CORE_BLOCK_SPARSE_SOLVER_H__
+
+#include <vector>
+#include <algorithm>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
+namespace asp {
+
+  // Calls func(begin, end) on one chunk of [0, size)
+  template <class FuncT>
+  class RangeTask : public vw::Task, private boost::noncopyable {
+    FuncT m_func;
+    size_t m_begin, m_end;
+  public:
+    RangeTask( FuncT const& func, size_t begin, size_t end ) :
+      m_func(func), m_begin(begin), m_end(end) {}
+    void operator()() { m_func( m_begin, m_end ); }
+  };
+
+  // Splits [0, size) in a few chunks per thread and runs func(begin,
+  // end) on each of them on the thread pool. Chunks must not write to
+  // the same memory.
+  template <class FuncT>
+  void parallel_range( size_t size, FuncT const& func,
+                       size_t num_threads = vw::vw_settings().default_num_threads() ) {
+    if ( size == 0 )
+      return;
+    if ( num_threads <= 1 || size == 1 ) {
+      func( 0, size );
+      return;
+    }
+    size_t chunk = std::max( size_t(1), (size + 4*num_threads - 1) / (4*num_threads) );
+    vw::FifoWorkQueue queue( num_threads );
+    for ( size_t begin = 0; begin < size; begin += chunk ) {
+      boost::shared_ptr<RangeTask<FuncT> >
+        task( new RangeTask<FuncT>( func, begin, std::min( begin + chunk, size ) ) );
+      queue.add_task( task );
+    }
+    queue.join_all();
+  }
+
+  // Replaces the b x b symmetric matrix A, row major, by its lower
+  // Cholesky factor. Returns false if A is not positive definite.
+  bool cholesky_in_place( double* A, size_t b );
+
+  // x = L^-1 x and x = L^-T x, for a lower triangular b x b L
+  void forward_solve( double const* L, double* x, size_t b );
+  void backward_solve( double const* L, double* x, size_t b );
+
+  // A symmetric matrix of square blocks, stored by block rows. Both
+  // triangles are stored, so each block row can be filled and
+  // multiplied independently of the others. Blocks are row major.
+  class BlockSparseMatrix {
+    size_t m_block_size;
+    std::vector<size_t> m_row_start, m_cols;
+    std::vector<double> m_values;
+  public:
+    BlockSparseMatrix() : m_block_size(0) {}
+
+    // 'pattern[i]' lists the nonzero blocks of block row i, and must
+    // be symmetric. The diagonal blocks are always stored.
+    BlockSparseMatrix( size_t block_size, std::vector<std::vector<size_t> > const& pattern );
+
+    size_t block_size() const { return m_block_size; }
+    size_t num_block_rows() const { return m_row_start.empty() ? 0 : m_row_start.size() - 1; }
+    size_t rows() const { return num_block_rows() * m_block_size; }
+    size_t num_blocks() const { return m_cols.size(); }
+
+    // The blocks of row i are [row_begin(i), row_end(i)), in column order
+    size_t row_begin( size_t i ) const { return m_row_start[i]; }
+    size_t row_end( size_t i ) const { return m_row_start[i+1]; }
+    size_t col( size_t n ) const { return m_cols[n]; }
+    double* values( size_t n ) { return &m_values[n * m_block_size * m_block_size]; }
+    double const* values( size_t n ) const { return &m_values[n * m_block_size * m_block_size]; }
+
+    // Block (i,j), or 0 if it is not stored
+    double* block( size_t i, size_t j );
+    double const* block( size_t i, size_t j ) const;
+
+    void set_zero();
+
+    // y = S x
+    void multiply( std::vector<double> const& x, std::vector<double>& y,
+                   size_t num_threads = vw::vw_settings().default_num_threads() ) const;
+  };
+
+  // Cholesky factorization of a BlockSparseMatrix, block column by
+  // block column, so that each block is a small dense supernode. The
+  // elimination order is chosen by minimum degree on the block graph.
+  // analyze() depends only on the sparsity, and its result is reused
+  // by every factor() of matrices with the same pattern.
+  class BlockCholesky {
+    size_t m_block_size;
+    std::vector<size_t> m_order;     // Block row eliminated at each step
+    std::vector<size_t> m_position;  // Step at which each block row is eliminated
+    std::vector<std::vector<size_t> > m_rows;    // Rows of each column of L below the diagonal, as steps
+    std::vector<std::vector<double> > m_blocks;  // Their blocks
+    std::vector<std::vector<double> > m_diag;    // Diagonal blocks of L
+
+    void update_column( size_t k, size_t begin, size_t end );
+  public:
+    BlockCholesky() : m_block_size(0) {}
+
+    void analyze( BlockSparseMatrix const& S );
+    bool analyzed() const { return m_block_size != 0; }
+
+    // Returns false if S is not positive definite
+    bool factor( BlockSparseMatrix const& S,
+                 size_t num_threads = vw::vw_settings().default_num_threads() );
+
+    // x = S^-1 rhs, with the last factored S
+    void solve( std::vector<double> const& rhs, std::vector<double>& x ) const;
+
+    // The number of blocks in L, including the fill
+    size_t num_blocks() const;
+  };
+
+  struct PCGOptions {
+    enum Preconditioner { Jacobi, BlockJacobi };
+    Preconditioner preconditioner;
+    double tolerance;     // On the residual norm, relative to that of the right hand side
+    int    max_iterations;
+    PCGOptions() : preconditioner(BlockJacobi), tolerance(1e-10), max_iterations(500) {}
+  };
+
+  // The values the preconditioner keeps for each diagonal block: the
+  // whole Cholesky factor for BlockJacobi, or the inverse diagonal.
+  inline size_t preconditioner_size( PCGOptions::Preconditioner preconditioner, size_t b ) {
+    return preconditioner == PCGOptions::BlockJacobi ? b * b : b;
+  }
+
+  // Sets P, of preconditioner_size() values, to the preconditioner of
+  // the b x b diagonal block D. Returns false if D is not positive
+  // definite.
+  bool factor_preconditioner( PCGOptions::Preconditioner preconditioner,
+                              double const* D, double* P, size_t b );
+
+  // z = M^-1 z, where M is the diagonal block that P was factored from
+  void apply_preconditioner( PCGOptions::Preconditioner preconditioner,
+                             double const* P, double* z, size_t b );
+
+  // Solves S x = rhs by preconditioned conjugate gradients, starting
+  // from x if it has the right size and from zero otherwise. Returns
+  // the number of iterations.
+  int pcg_solve( BlockSparseMatrix const& S, std::vector<double> const& rhs,
+                 std::vector<double>& x, PCGOptions const& opt = PCGOptions(),
+                 size_t num_threads = vw::vw_settings().default_num_threads() );
+
+}
+
+#endif//__ASP_CORE_BLOCK_SPARSE_SOLVER_H__
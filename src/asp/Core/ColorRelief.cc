@@ -0,0 +1,217 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file ColorRelief.cc
+///
+
+#include <vw/Core/Exception.h>
+#include <asp/Core/ColorRelief.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <boost/math/constants/constants.hpp>
+
+using namespace vw;
+
+namespace {
+
+  // Round to the nearest value of the channel type. Unsigned channels
+  // are never negative here, so they skip the sign test.
+  template <class ChannelT> inline ChannelT round_channel( float x ) {
+    return ChannelT( x + 0.5f );
+  }
+  template <> inline int16 round_channel<int16>( float x ) {
+    return int16( x >= 0 ? x + 0.5f : x - 0.5f );
+  }
+  template <> inline float round_channel<float>( float x ) {
+    return x;
+  }
+
+  inline float max3( float a, float b, float c ) {
+    float m = a > b ? a : b;
+    return m > c ? m : c;
+  }
+
+  inline bool is_nodata( float value, float nodata ) {
+    return value == nodata || value != value;
+  }
+
+  // A neighbor, or the center pixel if the neighbor is missing
+  inline float neighbor( float value, float center, float nodata ) {
+    return is_nodata( value, nodata ) ? center : value;
+  }
+
+}
+
+namespace asp {
+
+  // The loop has no data dependent branches, so the compiler can
+  // vectorize it.
+  template <class ChannelT>
+  void hsv_replace_value( ChannelT const* rgb, ChannelT const* value,
+                          ChannelT* out, size_t count ) {
+    for ( size_t i = 0; i < count; i++ ) {
+      float r = rgb[3*i], g = rgb[3*i+1], b = rgb[3*i+2];
+      float v = value[i];
+      float m = max3( r, g, b );
+      float scale = m > 0 ? v / m : 0.0f;
+      float gray  = m > 0 ? 0.0f : v;
+      out[3*i]   = round_channel<ChannelT>( r * scale + gray );
+      out[3*i+1] = round_channel<ChannelT>( g * scale + gray );
+      out[3*i+2] = round_channel<ChannelT>( b * scale + gray );
+    }
+  }
+
+  template void hsv_replace_value<uint8>( uint8 const*, uint8 const*, uint8*, size_t );
+  template void hsv_replace_value<int16>( int16 const*, int16 const*, int16*, size_t );
+  template void hsv_replace_value<uint16>( uint16 const*, uint16 const*, uint16*, size_t );
+  template void hsv_replace_value<float>( float const*, float const*, float*, size_t );
+
+  ColorMap::ColorMap() {
+    m_nodata[0] = m_nodata[1] = m_nodata[2] = 0;
+  }
+
+  void ColorMap::add( double value, double r, double g, double b ) {
+    size_t i = std::upper_bound( m_values.begin(), m_values.end(), value ) - m_values.begin();
+    m_values.insert( m_values.begin() + i, value );
+    float color[3] = { float(r), float(g), float(b) };
+    m_colors.insert( m_colors.begin() + 3*i, color, color + 3 );
+  }
+
+  void ColorMap::set_nodata_color( uint8 r, uint8 g, uint8 b ) {
+    m_nodata[0] = r;
+    m_nodata[1] = g;
+    m_nodata[2] = b;
+  }
+
+  ColorMap ColorMap::jet( double min, double max ) {
+    static const double ramp[6][4] = { {0.0,   0,   0, 128}, {0.125, 0,   0, 255},
+                                       {0.375, 0, 255, 255}, {0.625, 255, 255, 0},
+                                       {0.875, 255, 0,   0}, {1.0, 128,   0,   0} };
+    ColorMap colormap;
+    for ( int i = 0; i < 6; i++ )
+      colormap.add( min + ramp[i][0] * (max - min), ramp[i][1], ramp[i][2], ramp[i][3] );
+    return colormap;
+  }
+
+  ColorMap ColorMap::read( std::string const& filename ) {
+    std::ifstream file( filename.c_str() );
+    if ( !file.is_open() )
+      vw_throw( IOErr() << "ColorMap: Could not open \"" << filename << "\"." );
+
+    ColorMap colormap;
+    std::string line;
+    while ( std::getline( file, line ) ) {
+      std::replace( line.begin(), line.end(), ',', ' ' );
+      std::istringstream fields( line );
+      std::string value;
+      double r, g, b;
+      if ( !(fields >> value) || value[0] == '#' )
+        continue;
+      if ( !(fields >> r >> g >> b) )
+        vw_throw( IOErr() << "ColorMap: Could not parse \"" << line << "\" in " << filename << "." );
+      if ( value == "nv" ) {
+        colormap.set_nodata_color( uint8(r), uint8(g), uint8(b) );
+        continue;
+      }
+      if ( value[value.size()-1] == '%' )
+        vw_throw( ArgumentErr() << "ColorMap: Percentages are not supported in " << filename
+                  << ". Use elevations instead." );
+      std::istringstream number( value );
+      double elevation;
+      if ( !(number >> elevation) )
+        vw_throw( IOErr() << "ColorMap: Could not parse \"" << line << "\" in " << filename << "." );
+      colormap.add( elevation, r, g, b );
+    }
+    VW_ASSERT( colormap.size() > 0,
+               IOErr() << "ColorMap: No colors in " << filename << "." );
+    return colormap;
+  }
+
+  void ColorMap::apply( float const* elevation, size_t count, float nodata, uint8* rgb ) const {
+    VW_ASSERT( !m_values.empty(), LogicErr() << "ColorMap: The map is empty." );
+    size_t last = m_values.size() - 1;
+    for ( size_t i = 0; i < count; i++ ) {
+      float e = elevation[i];
+      uint8* out = rgb + 3*i;
+      if ( is_nodata( e, nodata ) ) {
+        out[0] = m_nodata[0];
+        out[1] = m_nodata[1];
+        out[2] = m_nodata[2];
+        continue;
+      }
+      size_t k = std::upper_bound( m_values.begin(), m_values.end(), double(e) ) - m_values.begin();
+      float const* c0 = &m_colors[3 * (k == 0 ? 0 : k - 1)];
+      float const* c1 = &m_colors[3 * std::min( k, last )];
+      float t = 0;
+      if ( k > 0 && k <= last )
+        t = float( (e - m_values[k-1]) / (m_values[k] - m_values[k-1]) );
+      for ( int j = 0; j < 3; j++ )
+        out[j] = uint8( c0[j] + t * (c1[j] - c0[j]) + 0.5f );
+    }
+  }
+
+  // Horn's method for the slope and aspect, with the illumination
+  // formula and output range of gdaldem hillshade, so that the result
+  // matches merging gdaldem color-relief and hillshade outputs.
+  void color_relief( float const* dem, ptrdiff_t dem_stride, int32 cols, int32 rows,
+                     float nodata, double pixel_width, double pixel_height,
+                     HillshadeOptions const& options, ColorMap const& colormap,
+                     uint8* rgb ) {
+    const double pi = boost::math::constants::pi<double>();
+    const double zenith  = (90.0 - options.elevation) * pi / 180.0;
+    const double azimuth = (360.0 - options.azimuth + 90.0) * pi / 180.0;
+    const double cos_zenith = cos(zenith), sin_zenith = sin(zenith);
+    const double x_scale = 1.0 / (8.0 * fabs(pixel_width)  * options.scale);
+    const double y_scale = 1.0 / (8.0 * fabs(pixel_height) * options.scale);
+
+    std::vector<uint8> shade( cols ), color( 3 * size_t(cols) );
+    for ( int32 row = 0; row < rows; row++ ) {
+      float const* up   = dem + (row - 1) * dem_stride;
+      float const* mid  = dem + row * dem_stride;
+      float const* down = dem + (row + 1) * dem_stride;
+      for ( int32 col = 0; col < cols; col++ ) {
+        float e = mid[col];
+        if ( is_nodata( e, nodata ) ) {
+          shade[col] = 0;
+          continue;
+        }
+        double a = neighbor( up[col-1],   e, nodata ), b = neighbor( up[col],   e, nodata );
+        double c = neighbor( up[col+1],   e, nodata ), d = neighbor( mid[col-1], e, nodata );
+        double f = neighbor( mid[col+1],  e, nodata ), g = neighbor( down[col-1], e, nodata );
+        double h = neighbor( down[col],   e, nodata ), i = neighbor( down[col+1], e, nodata );
+        double dzdx = ((c + 2*f + i) - (a + 2*d + g)) * x_scale;
+        double dzdy = ((g + 2*h + i) - (a + 2*b + c)) * y_scale;
+        double slope  = atan( sqrt( dzdx*dzdx + dzdy*dzdy ) );
+        double aspect = atan2( dzdy, -dzdx );
+        double light  = cos_zenith * cos(slope) + sin_zenith * sin(slope) * cos(azimuth - aspect);
+        shade[col] = uint8( 1.0 + 254.0 * std::max( light, 0.0 ) + 0.5 );
+      }
+
+      uint8* out = rgb + 3 * size_t(row) * cols;
+      colormap.apply( mid, cols, nodata, &color[0] );
+      hsv_replace_value( &color[0], &shade[0], out, cols );
+      for ( int32 col = 0; col < cols; col++ )
+        if ( shade[col] == 0 )
+          std::copy( &color[3*col], &color[3*col] + 3, out + 3*col );
+    }
+  }
+
+}
@@ -0,0 +1,181 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file ColorRelief.h
+///
+/// Merging of shaded relief with color, as done by hsv_merge. Replacing
+/// the HSV value of a color and converting back to RGB only scales the
+/// color, since hue and saturation depend on the ratios of the
+/// channels alone. The kernels here do that on whole rows without the
+/// branchy per-pixel color space conversions.
+
+#ifndef __ASP_CORE_COLOR_RELIEF_H__
+#define __ASP_CORE_COLOR_RELIEF_H__
+
+#include <string>
+#include <vector>
+
+#include <vw/Core/FundamentalTypes.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/ImageView.h>
+#include <vw/Image/PixelTypes.h>
+#include <vw/Image/EdgeExtension.h>
+#include <vw/Image/Manipulation.h>
+
+namespace asp {
+
+  // Set the HSV value of 'count' interleaved RGB pixels to 'value',
+  // writing the result to 'out'. Black pixels become gray. Integer
+  // channels are rounded to nearest. Instantiated for uint8, int16,
+  // uint16 and float.
+  template <class ChannelT>
+  void hsv_replace_value( ChannelT const* rgb, ChannelT const* value,
+                          ChannelT* out, size_t count );
+
+  struct HillshadeOptions {
+    double azimuth;    // Light source direction, degrees clockwise from north
+    double elevation;  // Light source angle above the horizon, in degrees
+    double scale;      // Horizontal units per vertical unit, as in gdaldem
+    HillshadeOptions() : azimuth(315), elevation(45), scale(1) {}
+  };
+
+  // A piecewise linear map from elevation to color, clamped at the
+  // ends, with a separate color for missing elevations.
+  class ColorMap {
+    std::vector<double> m_values;
+    std::vector<float> m_colors;    // Three per value
+    vw::uint8 m_nodata[3];
+  public:
+    ColorMap();
+
+    // Entries may be added in any order.
+    void add( double value, double r, double g, double b );
+    void set_nodata_color( vw::uint8 r, vw::uint8 g, vw::uint8 b );
+
+    // A blue to red ramp over [min, max]
+    static ColorMap jet( double min, double max );
+    // Read a gdaldem color-relief file: "elevation r g b" per line,
+    // with "nv" as the elevation of the nodata color.
+    static ColorMap read( std::string const& filename );
+
+    size_t size() const { return m_values.size(); }
+
+    // Colorize 'count' elevations into interleaved RGB.
+    void apply( float const* elevation, size_t count, float nodata, vw::uint8* rgb ) const;
+  };
+
+  // Shade and colorize a block of a DEM into interleaved RGB. 'dem'
+  // points at the first output pixel and must have one valid pixel
+  // around the block; rows are 'dem_stride' floats apart. Missing
+  // neighbors take the value of the center pixel and missing pixels
+  // get the nodata color of the map.
+  void color_relief( float const* dem, ptrdiff_t dem_stride, vw::int32 cols, vw::int32 rows,
+                     float nodata, double pixel_width, double pixel_height,
+                     HillshadeOptions const& options, ColorMap const& colormap,
+                     vw::uint8* rgb );
+
+  // The colored shaded relief of a DEM, computed tile by tile.
+  class ColorReliefView : public vw::ImageViewBase<ColorReliefView> {
+    vw::ImageViewRef<float> m_dem;
+    float m_nodata;
+    double m_pixel_width, m_pixel_height;
+    HillshadeOptions m_options;
+    ColorMap m_colormap;
+  public:
+    typedef vw::PixelRGB<vw::uint8> pixel_type;
+    typedef pixel_type result_type;
+    typedef vw::ProceduralPixelAccessor<ColorReliefView> pixel_accessor;
+
+    ColorReliefView( vw::ImageViewRef<float> const& dem, float nodata,
+                     double pixel_width, double pixel_height,
+                     HillshadeOptions const& options, ColorMap const& colormap ) :
+      m_dem(dem), m_nodata(nodata), m_pixel_width(pixel_width),
+      m_pixel_height(pixel_height), m_options(options), m_colormap(colormap) {}
+
+    inline vw::int32 cols() const { return m_dem.cols(); }
+    inline vw::int32 rows() const { return m_dem.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this,0,0); }
+
+    inline result_type operator()( vw::int32 i, vw::int32 j, vw::int32 p=0 ) const {
+      return prerasterize( vw::BBox2i(i,j,1,1) )(i,j,p);
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize( vw::BBox2i const& bbox ) const {
+      vw::BBox2i expanded = bbox;
+      expanded.expand(1);
+      vw::ImageView<float> dem =
+        vw::crop( vw::edge_extend( m_dem, vw::ConstantEdgeExtension() ), expanded );
+      vw::ImageView<pixel_type> tile( bbox.width(), bbox.height() );
+      color_relief( &dem(1,1), dem.cols(), bbox.width(), bbox.height(), m_nodata,
+                    m_pixel_width, m_pixel_height, m_options, m_colormap,
+                    reinterpret_cast<vw::uint8*>( tile.data() ) );
+      return prerasterize_type( tile, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
+    }
+    template <class DestT>
+    inline void rasterize( DestT const& dest, vw::BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+  };
+
+  // An RGB image with its HSV value replaced by a gray image, computed
+  // tile by tile.
+  template <class ChannelT>
+  class HsvMergeView : public vw::ImageViewBase<HsvMergeView<ChannelT> > {
+    vw::ImageViewRef<vw::PixelRGB<ChannelT> > m_rgb;
+    vw::ImageViewRef<vw::PixelGray<ChannelT> > m_gray;
+  public:
+    typedef vw::PixelRGB<ChannelT> pixel_type;
+    typedef pixel_type result_type;
+    typedef vw::ProceduralPixelAccessor<HsvMergeView<ChannelT> > pixel_accessor;
+
+    HsvMergeView( vw::ImageViewRef<vw::PixelRGB<ChannelT> > const& rgb,
+                  vw::ImageViewRef<vw::PixelGray<ChannelT> > const& gray ) :
+      m_rgb(rgb), m_gray(gray) {}
+
+    inline vw::int32 cols() const { return m_rgb.cols(); }
+    inline vw::int32 rows() const { return m_rgb.rows(); }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this,0,0); }
+
+    inline result_type operator()( vw::int32 i, vw::int32 j, vw::int32 p=0 ) const {
+      return prerasterize( vw::BBox2i(i,j,1,1) )(i,j,p);
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize( vw::BBox2i const& bbox ) const {
+      vw::ImageView<pixel_type> tile = vw::crop( m_rgb, bbox );
+      vw::ImageView<vw::PixelGray<ChannelT> > gray = vw::crop( m_gray, bbox );
+      ChannelT* data = reinterpret_cast<ChannelT*>( tile.data() );
+      hsv_replace_value( data, reinterpret_cast<ChannelT const*>( gray.data() ), data,
+                         size_t(bbox.width()) * bbox.height() );
+      return prerasterize_type( tile, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
+    }
+    template <class DestT>
+    inline void rasterize( DestT const& dest, vw::BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+  };
+
+}
+
+#endif//__ASP_CORE_COLOR_RELIEF_H__
@@ -43,7 +43,7 @@ std::string asp::current_posix_time_string() {
   return boost::posix_time::to_simple_string(boost::posix_time::second_clock::local_time());
 }
 
-asp::BaseOptions::BaseOptions() {
+asp::BaseOptions::BaseOptions() : memory_budget(0) {
 #if defined(VW_HAS_BIGTIFF) && VW_HAS_BIGTIFF == 1
   gdal_options["COMPRESS"] = "LZW";
 #else
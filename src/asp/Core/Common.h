@@ -29,6 +29,7 @@
 #include <vw/FileIO/DiskImageResourceGDAL.h>
 #include <vw/Math/Vector.h>
 #include <vw/Cartography/GeoReference.h>
+#include <asp/Core/Telemetry.h>
 
 namespace asp {
 
@@ -43,6 +44,7 @@ namespace asp {
     vw::DiskImageResourceGDAL::Options gdal_options;
     vw::Vector2i raster_tile_size;
     vw::uint32 num_threads;
+    double memory_budget;            // In MiB. If positive, tiles are planned to fit it.
     std::string cache_dir;
     std::string tif_compress;
 
@@ -82,7 +84,7 @@ namespace asp {
                                BaseOptions const& opt,
                                vw::ProgressCallback const& progress_callback = vw::ProgressCallback::dummy_instance() ) {
     boost::scoped_ptr<vw::DiskImageResourceGDAL> rsrc( build_gdal_rsrc( filename, image, opt ) );
-    vw::block_write_image( *rsrc, image.impl(), progress_callback );
+    vw::block_write_image( *rsrc, telemetry_write_view( image, filename ), progress_callback );
   }
 
   // Block write image with georef.
@@ -94,7 +96,7 @@ namespace asp {
                                vw::ProgressCallback const& progress_callback = vw::ProgressCallback::dummy_instance() ) {
     boost::scoped_ptr<vw::DiskImageResourceGDAL> rsrc( build_gdal_rsrc( filename, image, opt ) );
     vw::cartography::write_georeference(*rsrc, georef);
-    vw::block_write_image( *rsrc, image.impl(), progress_callback );
+    vw::block_write_image( *rsrc, telemetry_write_view( image, filename ), progress_callback );
   }
 
   // Block write image with nodata.
@@ -106,7 +108,7 @@ namespace asp {
                                vw::ProgressCallback const& progress_callback = vw::ProgressCallback::dummy_instance() ) {
     boost::scoped_ptr<vw::DiskImageResourceGDAL> rsrc( build_gdal_rsrc( filename, image, opt ) );
     rsrc->set_nodata_write(nodata);
-    vw::block_write_image( *rsrc, image.impl(), progress_callback );
+    vw::block_write_image( *rsrc, telemetry_write_view( image, filename ), progress_callback );
   }
 
   // Block write image with nodata and georef.
@@ -120,9 +122,51 @@ namespace asp {
     boost::scoped_ptr<vw::DiskImageResourceGDAL> rsrc( build_gdal_rsrc( filename, image, opt ) );
     rsrc->set_nodata_write(nodata);
     vw::cartography::write_georeference(*rsrc, georef);
-    vw::block_write_image( *rsrc, image.impl(), progress_callback );
+    vw::block_write_image( *rsrc, telemetry_write_view( image, filename ), progress_callback );
   }
 
+  // A file written one tile at a time, in any order and from several
+  // threads, for tools that rasterize a tile once and write it to more
+  // than one file. Its tiles are recorded like those written by
+  // block_write_gdal_image.
+  template <class PixelT>
+  class TileWriter : private boost::noncopyable {
+    boost::scoped_ptr<vw::DiskImageResourceGDAL> m_rsrc;
+    std::string m_label;
+    vw::Mutex& m_write_mutex;
+  public:
+    // GDAL does not allow concurrent writes, so all the files written
+    // together share 'write_mutex'.
+    TileWriter( const std::string &filename, vw::Vector2i const& size,
+                BaseOptions const& opt, vw::Mutex& write_mutex ) :
+      m_label( write_label( filename ) ), m_write_mutex( write_mutex ) {
+      vw::ImageFormat format;
+      format.cols = size.x();
+      format.rows = size.y();
+      format.planes = 1;
+      format.pixel_format = vw::PixelFormatID<PixelT>::value;
+      format.channel_type = vw::ChannelTypeID<typename vw::CompoundChannelType<PixelT>::type>::value;
+      m_rsrc.reset( new vw::DiskImageResourceGDAL( filename, format, opt.raster_tile_size,
+                                                   opt.gdal_options ) );
+    }
+
+    vw::DiskImageResourceGDAL& resource() { return *m_rsrc; }
+
+    template <class ImageT>
+    void write_tile( vw::ImageViewBase<ImageT> const& tile, vw::BBox2i const& bbox ) {
+      boost::scoped_ptr<TileTimer> timer;
+      if ( telemetry().enabled() )
+        timer.reset( new TileTimer() );
+      vw::ImageView<PixelT> output = tile.impl();
+      {
+        vw::Mutex::Lock lock( m_write_mutex );
+        m_rsrc->write( output.buffer(), bbox );
+      }
+      if ( timer )
+        timer->finish( m_label, bbox, vw::uint64(bbox.width()) * bbox.height() * sizeof(PixelT) );
+    }
+  };
+
   template <class ImageT>
   void write_gdal_image( const std::string &filename,
                          vw::ImageViewBase<ImageT> const& image,
@@ -20,6 +20,10 @@
 ///
 
 #include <vw/Cartography/CameraBBox.h>
+#include <map>
+#include <list>
+#include <algorithm>
+#include <vw/Core/Thread.h>
 #include <vw/Image/ImageView.h>
 #include <vw/Image/Transform.h>
 #include <vw/FileIO/DiskImageView.h>
@@ -34,19 +38,189 @@ using namespace vw::cartography;
 
 namespace asp {
 
+  // In-memory cache of DEM blocks shared by all threads computing the
+  // DEM disparity. Neighboring low-res tiles intersect the DEM in
+  // overlapping regions, so without a cache the same DEM pixels get
+  // read from disk over and over. The cache holds at most max_bytes
+  // of blocks, evicting the least recently used ones first; a block
+  // still being copied from survives eviction through its shared
+  // pointer. Two threads asking for the same missing block at once
+  // may both read it, and only one copy is kept.
+  class DemTileCache {
+    typedef ImageView<PixelMask<float> > BlockT;
+    typedef std::pair<int, int> KeyT;
+    typedef std::list<KeyT> LruT;
+    typedef std::pair<boost::shared_ptr<BlockT>, LruT::iterator> EntryT;
+    ImageViewRef<PixelMask<float> > m_dem;
+    int m_block_size;
+    size_t m_max_bytes, m_bytes;
+    std::map<KeyT, EntryT> m_blocks;
+    LruT m_lru; // Most recently used first
+    Mutex m_mutex;
+
+    static size_t block_bytes(BlockT const& block) {
+      return size_t(block.cols())*block.rows()*sizeof(PixelMask<float>);
+    }
+
+    boost::shared_ptr<BlockT> get_block(int bx, int by) {
+      KeyT key(bx, by);
+      {
+        Mutex::Lock lock(m_mutex);
+        std::map<KeyT, EntryT>::iterator it = m_blocks.find(key);
+        if (it != m_blocks.end()){
+          m_lru.splice(m_lru.begin(), m_lru, it->second.second);
+          return it->second.first;
+        }
+      }
+
+      // Read outside the lock so that threads wanting different
+      // blocks don't serialize on disk access.
+      BBox2i block_box(bx*m_block_size, by*m_block_size, m_block_size, m_block_size);
+      block_box.crop(bounding_box(m_dem));
+      boost::shared_ptr<BlockT> block( new BlockT( crop(m_dem, block_box) ) );
+
+      Mutex::Lock lock(m_mutex);
+      std::map<KeyT, EntryT>::iterator it = m_blocks.find(key);
+      if (it != m_blocks.end()){
+        // Another thread got here first
+        m_lru.splice(m_lru.begin(), m_lru, it->second.second);
+        return it->second.first;
+      }
+      m_lru.push_front(key);
+      m_blocks.insert(std::make_pair(key, EntryT(block, m_lru.begin())));
+      m_bytes += block_bytes(*block);
+
+      // Keep the block just read even if it alone is over the limit
+      while (m_bytes > m_max_bytes && m_lru.size() > 1){
+        std::map<KeyT, EntryT>::iterator oldest = m_blocks.find(m_lru.back());
+        m_bytes -= block_bytes(*oldest->second.first);
+        m_blocks.erase(oldest);
+        m_lru.pop_back();
+      }
+      return block;
+    }
+
+  public:
+    DemTileCache(ImageViewRef<PixelMask<float> > const& dem, int block_size = 256,
+                 size_t max_bytes = 256*1024*1024):
+      m_dem(dem), m_block_size(block_size), m_max_bytes(max_bytes), m_bytes(0){}
+
+    // Return the given region of the DEM, assembled from cached blocks.
+    ImageView<PixelMask<float> > crop_dem(BBox2i const& dem_box) {
+      ImageView<PixelMask<float> > out(dem_box.width(), dem_box.height());
+      if (dem_box.empty()) return out;
+
+      int bx0 = dem_box.min().x()/m_block_size, bx1 = (dem_box.max().x() - 1)/m_block_size;
+      int by0 = dem_box.min().y()/m_block_size, by1 = (dem_box.max().y() - 1)/m_block_size;
+      for (int by = by0; by <= by1; by++){
+        for (int bx = bx0; bx <= bx1; bx++){
+          boost::shared_ptr<BlockT> block = get_block(bx, by);
+          Vector2i block_min(bx*m_block_size, by*m_block_size);
+          BBox2i overlap(block_min, block_min + Vector2i(block->cols(), block->rows()));
+          overlap.crop(dem_box);
+          for (int row = overlap.min().y(); row < overlap.max().y(); row++){
+            for (int col = overlap.min().x(); col < overlap.max().x(); col++){
+              out(col - dem_box.min().x(), row - dem_box.min().y())
+                = (*block)(col - block_min.x(), row - block_min.y());
+            }
+          }
+        }
+      }
+      return out;
+    }
+  };
+
+  // The disparity spread is a by-product of computing the low-res
+  // disparity. Each tile records its spread in its own buffer, and
+  // the buffers are merged in a fixed order once all tiles are done,
+  // so no two threads ever write to the same image.
+  class DemDisparitySpread {
+    typedef std::pair<BBox2i, boost::shared_ptr<ImageView<PixelMask<Vector2i> > > > TileT;
+    std::vector<TileT> m_tiles;
+    Mutex m_mutex;
+
+    static bool tile_less(TileT const& a, TileT const& b) {
+      if (a.first.min().y() != b.first.min().y())
+        return a.first.min().y() < b.first.min().y();
+      return a.first.min().x() < b.first.min().x();
+    }
+
+  public:
+    void add_tile(BBox2i const& bbox,
+                  boost::shared_ptr<ImageView<PixelMask<Vector2i> > > spread) {
+      Mutex::Lock lock(m_mutex);
+      m_tiles.push_back(TileT(bbox, spread));
+    }
+
+    void merge(ImageView<PixelMask<Vector2i> > & disparity_spread) {
+      Mutex::Lock lock(m_mutex);
+      std::sort(m_tiles.begin(), m_tiles.end(), tile_less);
+      for (unsigned k = 0; k < m_tiles.size(); k++){
+        BBox2i const& bbox = m_tiles[k].first;
+        ImageView<PixelMask<Vector2i> > const& tile = *m_tiles[k].second;
+        for (int row = bbox.min().y(); row < bbox.max().y(); row++){
+          for (int col = bbox.min().x(); col < bbox.max().x(); col++){
+            disparity_spread(col, row) = tile(col - bbox.min().x(), row - bbox.min().y());
+          }
+        }
+      }
+      m_tiles.clear();
+    }
+  };
+
   template <class ImageT, class DEMImageT>
   class DemDisparity : public ImageViewBase<DemDisparity<ImageT, DEMImageT> > {
     ImageT m_left_image;
     double m_dem_accuracy;
     GeoReference m_dem_georef;
     const DEMImageT & m_dem;
+    boost::shared_ptr<DemTileCache> m_dem_cache;
     Vector2f m_downsample_scale;
     boost::shared_ptr<camera::CameraModel> m_left_camera_model;
     boost::shared_ptr<camera::CameraModel> m_right_camera_model;
     bool m_homography_align;
     Matrix<double>  m_align_matrix;
     int m_pixel_sample;
-    ImageView<PixelMask<Vector2i> > & m_disparity_spread;
+    boost::shared_ptr<DemDisparitySpread> m_disparity_spread;
+
+    // Since our DEM is only known approximately, the true
+    // intersection point of the ray coming from the left camera with
+    // the DEM could be anywhere within m_dem_accuracy from xyz. Use
+    // that to get an estimate of the disparity accuracy. The two
+    // endpoints of the range are projected first, and the middle
+    // point only if one of them fails.
+    bool disparity_range(Vector3 const& xyz, Vector3 const& left_camera_vec,
+                         Vector2 const& left_lowres_pix,
+                         BBox2f & search_range) const {
+
+      Vector3 points[] = { xyz - m_dem_accuracy*left_camera_vec,
+                           xyz + m_dem_accuracy*left_camera_vec,
+                           xyz };
+      search_range = BBox2f();
+      int num_success = 0;
+      for (int k = 0; k < 3; k++){
+
+        // If the disparities at the endpoints of the range were
+        // successful, don't bother with the middle estimate.
+        if (k == 2 && num_success == 2) break;
+
+        Vector2 right_fullres_pix;
+        try {
+          right_fullres_pix = m_right_camera_model->point_to_pixel(points[k]);
+        } catch ( camera::PointToPixelErr const& e ) {
+          continue;
+        }
+        if (m_homography_align){
+          right_fullres_pix = HomographyTransform(m_align_matrix).forward(right_fullres_pix);
+        }
+
+        Vector2 right_lowres_pix = elem_prod(right_fullres_pix, m_downsample_scale);
+        search_range.grow(right_lowres_pix - left_lowres_pix);
+        num_success++;
+      }
+
+      return num_success > 0 && search_range != BBox2f(0,0,0,0);
+    }
 
   public:
     DemDisparity( ImageViewBase<ImageT> const& left_image,
@@ -56,11 +230,13 @@ namespace asp {
                   boost::shared_ptr<camera::CameraModel> left_camera_model,
                   boost::shared_ptr<camera::CameraModel> right_camera_model,
                   bool homography_align, Matrix<double> const& align_matrix,
-                  int pixel_sample, ImageView<PixelMask<Vector2i> > & disparity_spread)
+                  int pixel_sample,
+                  boost::shared_ptr<DemDisparitySpread> disparity_spread)
       :m_left_image(left_image.impl()),
        m_dem_accuracy(dem_accuracy),
        m_dem_georef(dem_georef),
        m_dem(dem),
+       m_dem_cache(new DemTileCache(dem)),
        m_downsample_scale(downsample_scale),
        m_left_camera_model(left_camera_model),
        m_right_camera_model(right_camera_model),
@@ -93,10 +269,15 @@ namespace asp {
                                                              -bbox.min().x(), -bbox.min().y(),
                                                              cols(), rows() );
 
-      for (int row = bbox.min().y(); row < bbox.max().y(); row++){
-        for (int col = bbox.min().x(); col < bbox.max().x(); col++){
-          lowres_disparity(col, row).invalidate();
-          m_disparity_spread(col, row).invalidate();
+      // The spread for this tile. It is only visible to this thread
+      // until handed over to m_disparity_spread at the end.
+      boost::shared_ptr<ImageView<pixel_type> >
+        spread( new ImageView<pixel_type>(bbox.width(), bbox.height()) );
+
+      for (int row = 0; row < bbox.height(); row++){
+        for (int col = 0; col < bbox.width(); col++){
+          lowres_disparity(bbox.min().x() + col, bbox.min().y() + row).invalidate();
+          (*spread)(col, row).invalidate();
         }
       }
 
@@ -155,21 +336,31 @@ namespace asp {
       dem_box.expand(expand);
       dem_box.crop(bounding_box(m_dem));
 
-      // Crop the georef, read the DEM region in memory
+      // Crop the georef, fetch the DEM region from the cache
       GeoReference georef_crop = crop(m_dem_georef, dem_box);
-      ImageView <PixelMask<float> > dem_crop = crop(m_dem, dem_box);
+      ImageView <PixelMask<float> > dem_crop = m_dem_cache->crop_dem(dem_box);
+
+      // Compute the DEM disparity. Use one in every 'm_pixel_sample'
+      // pixels. The intersection found for a pixel is used as the
+      // initial guess for the next pixel in the row, and the one
+      // found in the previous sampled row as the guess for the first
+      // pixel of a row, so the ray marching converges in a few
+      // iterations instead of starting from scratch.
 
-      // Compute the DEM disparity. Use one in every 'm_pixel_sample' pixels.
+      std::vector<Vector3> prev_row_xyz(bbox.width());
 
       for (int row = bbox.min().y(); row < bbox.max().y(); row++){
         if (row%m_pixel_sample != 0) continue;
 
-        // Must wipe the previous guess since we are now too far from it
         prev_xyz = Vector3();
 
         for (int col = bbox.min().x(); col < bbox.max().x(); col++){
           if (col%m_pixel_sample != 0) continue;
 
+          Vector3 & above_xyz = prev_row_xyz[col - bbox.min().x()];
+          if (prev_xyz == Vector3())
+            prev_xyz = above_xyz;
+
           Vector2 left_lowres_pix = Vector2(col, row);
           Vector2 left_fullres_pix = elem_quot(left_lowres_pix, m_downsample_scale);
           bool has_intersection;
@@ -189,49 +380,22 @@ namespace asp {
                                                 prev_xyz
                                                 );
           if ( !has_intersection || xyz == Vector3() ) continue;
-          prev_xyz = xyz;
-
-          // Since our DEM is only known approximately, the true
-          // intersection point of the ray coming from the left camera
-          // with the DEM could be anywhere within m_dem_accuracy from
-          // xyz. Use that to get an estimate of the disparity
-          // accuracy.
-
-          ImageView< PixelMask<Vector2> > curr_pixel_disp_range(3, 1);
-          double bias[] = {-1.0, 1.0, 0.0};
-          int success[] = {0, 0, 0};
-
-          for (int k = 0; k < curr_pixel_disp_range.cols(); k++){
-
-            Vector2 right_fullres_pix;
-            try {
-              right_fullres_pix = m_right_camera_model->point_to_pixel(xyz + bias[k]*m_dem_accuracy*left_camera_vec);
-            } catch ( camera::PointToPixelErr const& e ) {
-              curr_pixel_disp_range(k, 0).invalidate();
-              continue;
-            }
-            if (m_homography_align){
-              right_fullres_pix = HomographyTransform(m_align_matrix).forward(right_fullres_pix);
-            }
+          prev_xyz  = xyz;
+          above_xyz = xyz;
 
-            Vector2 right_lowres_pix = elem_prod(right_fullres_pix, m_downsample_scale);
-            curr_pixel_disp_range(k, 0) = right_lowres_pix - left_lowres_pix;
-            success[k] = 1;
-
-            // If the disparities at the endpoints of the range were successful,
-            // don't bother with the middle estimate.
-            if (k == 1 && success[0] && success[1]) break;
-          }
-
-          BBox2f search_range = stereo::get_disparity_range(curr_pixel_disp_range);
-          if (search_range ==  BBox2f(0,0,0,0)) continue;
+          BBox2f search_range;
+          if (!disparity_range(xyz, left_camera_vec, left_lowres_pix, search_range))
+            continue;
 
           lowres_disparity(col, row) = round( (search_range.min() + search_range.max())/2.0 );
-          m_disparity_spread(col, row) = ceil( (search_range.max() - search_range.min())/2.0 );
+          (*spread)(col - bbox.min().x(), row - bbox.min().y())
+            = ceil( (search_range.max() - search_range.min())/2.0 );
 
         }
       }
 
+      m_disparity_spread->add_tile(bbox, spread);
+
       return lowres_disparity;
     }
 
@@ -251,7 +415,7 @@ namespace asp {
                  boost::shared_ptr<camera::CameraModel> right_camera_model,
                  bool homography_align, Matrix<double> const& align_matrix,
                  int pixel_sample,
-                 ImageView<PixelMask<Vector2i> > & disparity_spread
+                 boost::shared_ptr<DemDisparitySpread> disparity_spread
                  ) {
     typedef DemDisparity<ImageT, DEMImageT> return_type;
     return return_type( left.impl(),
@@ -321,7 +485,9 @@ namespace asp {
     Vector2 orig_tile_size = opt.raster_tile_size;
     opt.raster_tile_size = Vector2i(64, 64);
 
-    // This image is small enough that we can keep it in memory
+    // Per-tile spreads, merged into this image after all tiles are
+    // done. It is small enough that we can keep it in memory.
+    boost::shared_ptr<DemDisparitySpread> spread_tiles( new DemDisparitySpread() );
     ImageView<PixelMask<Vector2i> > disparity_spread(left_image_sub.cols(), left_image_sub.rows());
 
     ImageViewRef<PixelMask<Vector2i> > lowres_disparity
@@ -330,7 +496,7 @@ namespace asp {
                       dem, downsample_scale,
                       left_camera_model, right_camera_model,
                       homography_align, align_matrix, pixel_sample,
-                      disparity_spread
+                      spread_tiles
                       );
     std::string disparity_file = opt.out_prefix + "-D_sub.tif";
     vw_out() << "Writing low-resolution disparity: " << disparity_file << "\n";
@@ -347,6 +513,8 @@ namespace asp {
                                    TerminalProgressCallback("asp", "\t--> Low-resolution disparity:") );
     }
 
+    spread_tiles->merge(disparity_spread);
+
     std::string disp_spread_file = opt.out_prefix + "-D_sub_spread.tif";
     vw_out() << "Writing low-resolution disparity spread: " << disp_spread_file << "\n";
     asp::block_write_gdal_image( disp_spread_file,
@@ -0,0 +1,282 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file DiskImageResourceMmap.cc
+///
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include <vw/Core/Exception.h>
+#include <vw/Image/PixelTypeInfo.h>
+#include <asp/Core/DiskImageResourceMmap.h>
+
+using namespace vw;
+
+namespace {
+
+  // Tiles start one page into the file so that they stay page
+  // aligned for any tile size that is a multiple of the page size.
+  const size_t HEADER_BYTES = 4096;
+  const char MMAP_MAGIC[8] = {'A','S','P','M','M','A','P','\0'};
+  const int32 MMAP_VERSION = 1;
+
+  struct MmapHeader {
+    char  magic[8];
+    int32 version;
+    int32 cols, rows, planes;
+    int32 pixel_format, channel_type;
+    int32 block_cols, block_rows;
+  };
+
+  struct ReadTileFunc {
+    void operator()(ImageBuffer const& file_buf, ImageBuffer const& user_buf) const {
+      convert(user_buf, file_buf);
+    }
+  };
+
+  struct WriteTileFunc {
+    void operator()(ImageBuffer const& file_buf, ImageBuffer const& user_buf) const {
+      convert(file_buf, user_buf);
+    }
+  };
+
+}
+
+namespace asp {
+
+  DiskImageResourceMmap::DiskImageResourceMmap(std::string const& filename)
+    : DiskImageResource(filename), m_fd(-1), m_data(0), m_size(0), m_writable(false) {
+    open(filename);
+  }
+
+  DiskImageResourceMmap::DiskImageResourceMmap(std::string const& filename,
+                                               ImageFormat const& format,
+                                               Vector2i const& block_size)
+    : DiskImageResource(filename), m_fd(-1), m_data(0), m_size(0), m_writable(false) {
+    create(filename, format, block_size);
+  }
+
+  DiskImageResourceMmap::~DiskImageResourceMmap() {
+    flush();
+    unmap_file();
+    if ( m_fd >= 0 )
+      ::close(m_fd);
+  }
+
+  // Compute the tile layout for the current format.
+  void DiskImageResourceMmap::set_layout(Vector2i const& block_size) {
+    VW_ASSERT( block_size.x() > 0 && block_size.y() > 0,
+               ArgumentErr() << "DiskImageResourceMmap: Invalid block size " << block_size << "." );
+    m_block_size    = block_size;
+    m_pixel_bytes   = num_channels(m_format.pixel_format) * channel_size(m_format.channel_type);
+    m_tile_bytes    = size_t(block_size.x()) * block_size.y() * m_pixel_bytes * m_format.planes;
+    m_tiles_per_row = (m_format.cols + block_size.x() - 1) / block_size.x();
+  }
+
+  void DiskImageResourceMmap::map_file(size_t size, bool writable) {
+    void* ptr = ::mmap(0, size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                       MAP_SHARED, m_fd, 0);
+    if ( ptr == MAP_FAILED )
+      vw_throw( IOErr() << "DiskImageResourceMmap: Could not map \"" << m_filename
+                << "\": " << std::strerror(errno) );
+    m_data = static_cast<uint8*>(ptr);
+    m_size = size;
+  }
+
+  void DiskImageResourceMmap::unmap_file() {
+    if ( m_data )
+      ::munmap(m_data, m_size);
+    m_data = 0;
+    m_size = 0;
+  }
+
+  void DiskImageResourceMmap::write_header() {
+    MmapHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MMAP_MAGIC, sizeof(header.magic));
+    header.version      = MMAP_VERSION;
+    header.cols         = m_format.cols;
+    header.rows         = m_format.rows;
+    header.planes       = m_format.planes;
+    header.pixel_format = m_format.pixel_format;
+    header.channel_type = m_format.channel_type;
+    header.block_cols   = m_block_size.x();
+    header.block_rows   = m_block_size.y();
+    std::memcpy(m_data, &header, sizeof(header));
+  }
+
+  // Size of a file holding the given format in tiles of the given size.
+  static size_t mmap_file_size(ImageFormat const& format, Vector2i const& block_size,
+                               size_t tile_bytes) {
+    size_t tiles_x = (format.cols + block_size.x() - 1) / block_size.x();
+    size_t tiles_y = (format.rows + block_size.y() - 1) / block_size.y();
+    return HEADER_BYTES + tiles_x * tiles_y * tile_bytes;
+  }
+
+  /// Bind the resource to a file for reading.
+  void DiskImageResourceMmap::open(std::string const& filename) {
+    m_filename = filename;
+    m_writable = false;
+    m_fd = ::open(filename.c_str(), O_RDONLY);
+    if ( m_fd < 0 )
+      vw_throw( IOErr() << "DiskImageResourceMmap: Could not open \"" << filename
+                << "\": " << std::strerror(errno) );
+
+    MmapHeader header;
+    if ( ::pread(m_fd, &header, sizeof(header), 0) != ssize_t(sizeof(header)) ||
+         std::memcmp(header.magic, MMAP_MAGIC, sizeof(header.magic)) != 0 )
+      vw_throw( IOErr() << "DiskImageResourceMmap: \"" << filename
+                << "\" is not a memory-mapped tile file." );
+    if ( header.version != MMAP_VERSION )
+      vw_throw( IOErr() << "DiskImageResourceMmap: \"" << filename
+                << "\" has unsupported version " << header.version << "." );
+
+    m_format.cols         = header.cols;
+    m_format.rows         = header.rows;
+    m_format.planes       = header.planes;
+    m_format.pixel_format = PixelFormatEnum(header.pixel_format);
+    m_format.channel_type = ChannelTypeEnum(header.channel_type);
+    set_layout(Vector2i(header.block_cols, header.block_rows));
+
+    size_t size = mmap_file_size(m_format, m_block_size, m_tile_bytes);
+    struct stat st;
+    if ( ::fstat(m_fd, &st) != 0 || size_t(st.st_size) < size )
+      vw_throw( IOErr() << "DiskImageResourceMmap: \"" << filename << "\" is truncated." );
+
+    map_file(size, false);
+  }
+
+  /// Bind the resource to a file for writing. The file is sized up
+  /// front, so untouched tiles stay sparse on disk.
+  void DiskImageResourceMmap::create(std::string const& filename,
+                                     ImageFormat const& format,
+                                     Vector2i const& block_size) {
+    m_filename = filename;
+    m_format   = format;
+    m_writable = true;
+    m_fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if ( m_fd < 0 )
+      vw_throw( IOErr() << "DiskImageResourceMmap: Could not create \"" << filename
+                << "\": " << std::strerror(errno) );
+
+    set_layout(block_size);
+    size_t size = mmap_file_size(m_format, m_block_size, m_tile_bytes);
+    if ( ::ftruncate(m_fd, off_t(size)) != 0 )
+      vw_throw( IOErr() << "DiskImageResourceMmap: Could not size \"" << filename
+                << "\": " << std::strerror(errno) );
+    map_file(size, true);
+    write_header();
+  }
+
+  void DiskImageResourceMmap::set_block_write_size(Vector2i const& block_size) {
+    VW_ASSERT( m_writable,
+               LogicErr() << "DiskImageResourceMmap: Cannot change the block size of a file opened for reading." );
+    if ( block_size == m_block_size )
+      return;
+
+    unmap_file();
+    set_layout(block_size);
+    size_t size = mmap_file_size(m_format, m_block_size, m_tile_bytes);
+    if ( ::ftruncate(m_fd, 0) != 0 || ::ftruncate(m_fd, off_t(size)) != 0 )
+      vw_throw( IOErr() << "DiskImageResourceMmap: Could not size \"" << m_filename
+                << "\": " << std::strerror(errno) );
+    map_file(size, true);
+    write_header();
+  }
+
+  template <class FuncT>
+  void DiskImageResourceMmap::for_each_tile(ImageBuffer const& buf, BBox2i const& bbox,
+                                            FuncT func) const {
+    VW_ASSERT( bbox.min().x() >= 0 && bbox.min().y() >= 0 &&
+               bbox.max().x() <= m_format.cols && bbox.max().y() <= m_format.rows,
+               ArgumentErr() << "DiskImageResourceMmap: requested bbox " << bbox
+               << " exceeds image dimensions [" << m_format.cols << " "
+               << m_format.rows << "]" );
+    if ( bbox.empty() )
+      return;
+
+    int bx = m_block_size.x(), by = m_block_size.y();
+    for ( int ty = bbox.min().y() / by; ty <= (bbox.max().y() - 1) / by; ty++ ) {
+      for ( int tx = bbox.min().x() / bx; tx <= (bbox.max().x() - 1) / bx; tx++ ) {
+        BBox2i piece(tx*bx, ty*by, bx, by);
+        piece.crop(bbox);
+
+        uint8* tile = m_data + HEADER_BYTES
+          + (size_t(ty) * m_tiles_per_row + tx) * m_tile_bytes;
+
+        ImageBuffer file_buf;
+        file_buf.format      = m_format;
+        file_buf.format.cols = piece.width();
+        file_buf.format.rows = piece.height();
+        file_buf.cstride     = m_pixel_bytes;
+        file_buf.rstride     = m_pixel_bytes * bx;
+        file_buf.pstride     = m_pixel_bytes * bx * by;
+        file_buf.data        = tile + (piece.min().y() - ty*by) * file_buf.rstride
+                                    + (piece.min().x() - tx*bx) * file_buf.cstride;
+
+        ImageBuffer user_buf = buf;
+        user_buf.format.cols = piece.width();
+        user_buf.format.rows = piece.height();
+        user_buf.data        = static_cast<uint8*>(buf.data)
+          + (piece.min().y() - bbox.min().y()) * buf.rstride
+          + (piece.min().x() - bbox.min().x()) * buf.cstride;
+
+        func(file_buf, user_buf);
+      }
+    }
+  }
+
+  // Reading is a conversion straight out of the mapped pages. The
+  // map is read-only and shared, so concurrent reads need no lock.
+  void DiskImageResourceMmap::read(ImageBuffer const& dest, BBox2i const& bbox) const {
+    for_each_tile(dest, bbox, ReadTileFunc());
+  }
+
+  // Writes to distinct tiles touch distinct pages and may run
+  // concurrently.
+  void DiskImageResourceMmap::write(ImageBuffer const& src, BBox2i const& bbox) {
+    VW_ASSERT( m_writable,
+               LogicErr() << "DiskImageResourceMmap: \"" << m_filename << "\" is open for reading only." );
+    for_each_tile(src, bbox, WriteTileFunc());
+  }
+
+  void DiskImageResourceMmap::flush() {
+    if ( m_writable && m_data )
+      ::msync(m_data, m_size, MS_ASYNC);
+  }
+
+  // A FileIO hook to open a file for reading
+  DiskImageResource*
+  DiskImageResourceMmap::construct_open(std::string const& filename) {
+    return new DiskImageResourceMmap(filename);
+  }
+
+  // A FileIO hook to open a file for writing
+  DiskImageResource*
+  DiskImageResourceMmap::construct_create(std::string const& filename,
+                                          ImageFormat const& format) {
+    return new DiskImageResourceMmap(filename, format);
+  }
+
+} // namespace asp
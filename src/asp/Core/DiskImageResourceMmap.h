@@ -0,0 +1,112 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file DiskImageResourceMmap.h
+///
+/// A native tiled container for the disparity intermediates of the
+/// stereo pipeline (-D, -RD and -F). Tiles are stored uncompressed at
+/// fixed offsets behind a one-page header and the file is accessed
+/// through a memory map, so reading a block costs a pixel copy rather
+/// than a TIFF decode.
+///
+#ifndef __ASP_CORE_DISK_IMAGE_RESOURCE_MMAP_H__
+#define __ASP_CORE_DISK_IMAGE_RESOURCE_MMAP_H__
+
+#include <vw/Image/ImageIO.h>
+#include <vw/FileIO/DiskImageResource.h>
+#include <asp/Core/Common.h>
+
+namespace asp {
+
+  class DiskImageResourceMmap : public vw::DiskImageResource {
+  public:
+
+    DiskImageResourceMmap(std::string const& filename);
+
+    DiskImageResourceMmap(std::string const& filename,
+                          vw::ImageFormat const& format,
+                          vw::Vector2i const& block_size = vw::Vector2i(256,256));
+
+    virtual ~DiskImageResourceMmap();
+
+    /// Returns the type of disk image resource.
+    static std::string type_static() { return "MMAP"; }
+    virtual std::string type() { return type_static(); }
+
+    /// The file extension this resource is registered under.
+    static std::string extension() { return ".mmap"; }
+
+    virtual bool has_block_write()  const {return true; }
+    virtual bool has_nodata_write() const {return false;}
+    virtual bool has_block_read()   const {return true; }
+    virtual bool has_nodata_read()  const {return false;}
+
+    virtual vw::Vector2i block_read_size()  const { return m_block_size; }
+    virtual vw::Vector2i block_write_size() const { return m_block_size; }
+
+    /// Change the tile layout. Only allowed before any data is written.
+    virtual void set_block_write_size(vw::Vector2i const& block_size);
+
+    virtual void read(vw::ImageBuffer const& dest, vw::BBox2i const& bbox) const;
+    virtual void write(vw::ImageBuffer const& src, vw::BBox2i const& bbox);
+    virtual void flush();
+
+    void open(std::string const& filename);
+    void create(std::string const& filename, vw::ImageFormat const& format,
+                vw::Vector2i const& block_size);
+    static vw::DiskImageResource* construct_open(std::string const& filename);
+    static vw::DiskImageResource* construct_create(std::string const& filename,
+                                                   vw::ImageFormat const& format);
+
+  private:
+    void set_layout(vw::Vector2i const& block_size);
+    void map_file(size_t size, bool writable);
+    void unmap_file();
+    void write_header();
+
+    // Apply func(file_buffer, user_buffer) to every piece of the
+    // user buffer, one piece per tile intersecting bbox.
+    template <class FuncT>
+    void for_each_tile(vw::ImageBuffer const& buf, vw::BBox2i const& bbox,
+                       FuncT func) const;
+
+    std::string  m_filename;
+    int          m_fd;
+    vw::uint8*   m_data;
+    size_t       m_size;
+    bool         m_writable;
+    vw::Vector2i m_block_size;
+    size_t       m_pixel_bytes;  // Bytes of one pixel in one plane
+    size_t       m_tile_bytes;   // Bytes of one tile, all planes
+    int          m_tiles_per_row;
+  };
+
+  /// Block write an image in the native memory-mapped format, using
+  /// the raster tile size from the options as the file's tile size.
+  template <class ImageT>
+  void block_write_mmap_image( const std::string &filename,
+                               vw::ImageViewBase<ImageT> const& image,
+                               BaseOptions const& opt,
+                               vw::ProgressCallback const& progress_callback = vw::ProgressCallback::dummy_instance() ) {
+    DiskImageResourceMmap rsrc( filename, image.impl().format(), opt.raster_tile_size );
+    vw::block_write_image( rsrc, telemetry_write_view( image, filename ), progress_callback );
+  }
+
+} // namespace asp
+
+#endif // __ASP_CORE_DISK_IMAGE_RESOURCE_MMAP_H__
@@ -0,0 +1,137 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file GraphPartition.cc
+///
+
+#include <vw/Core/Exception.h>
+#include <asp/Core/GraphPartition.h>
+
+#include <algorithm>
+#include <deque>
+
+using namespace vw;
+
+namespace {
+
+  class Dissection {
+    std::vector<std::vector<size_t> > const& m_graph;
+    std::vector<int>& m_part;
+    std::vector<int> m_mark;   // Set to the current pass on the vertices being split
+    std::vector<int> m_level;
+    int m_pass;
+
+    // Levels of a breadth first search over the marked vertices from
+    // 'root'. Disconnected pieces follow, at the next levels. Returns
+    // the vertices in visit order.
+    std::vector<size_t> levels( std::vector<size_t> const& vertices, size_t root ) {
+      std::vector<size_t> visited;
+      visited.reserve( vertices.size() );
+      m_pass++;
+      for ( size_t n = 0; n < vertices.size(); n++ )
+        m_mark[vertices[n]] = m_pass;
+
+      int level = 0;
+      size_t next_root = 0;
+      while ( visited.size() < vertices.size() ) {
+        if ( m_mark[root] != m_pass ) {
+          while ( m_mark[vertices[next_root]] != m_pass )
+            next_root++;
+          root = vertices[next_root];
+          level++;
+        }
+        std::deque<size_t> queue( 1, root );
+        m_mark[root] = -1;
+        m_level[root] = level;
+        while ( !queue.empty() ) {
+          size_t v = queue.front();
+          queue.pop_front();
+          visited.push_back( v );
+          for ( size_t n = 0; n < m_graph[v].size(); n++ ) {
+            size_t w = m_graph[v][n];
+            if ( m_mark[w] != m_pass ) continue;
+            m_mark[w] = -1;
+            m_level[w] = m_level[v] + 1;
+            queue.push_back( w );
+          }
+        }
+        level = m_level[visited.back()];
+      }
+      return visited;
+    }
+
+  public:
+    Dissection( std::vector<std::vector<size_t> > const& graph, std::vector<int>& part ) :
+      m_graph(graph), m_part(part), m_mark(graph.size(), 0), m_level(graph.size(), 0), m_pass(0) {}
+
+    void operator()( std::vector<size_t> const& vertices, int first_part, int num_parts ) {
+      if ( num_parts == 1 || vertices.size() <= 1 ) {
+        for ( size_t n = 0; n < vertices.size(); n++ )
+          m_part[vertices[n]] = first_part;
+        return;
+      }
+
+      // A pseudo-peripheral root: the last vertex reached from the
+      // last vertex reached from any vertex.
+      std::vector<size_t> order = levels( vertices, vertices.front() );
+      order = levels( vertices, order.back() );
+
+      // Cut after the level holding the left share of the vertices
+      int left_parts = num_parts / 2;
+      size_t left_size = vertices.size() * left_parts / num_parts;
+      int cut_level = m_level[order[std::max( left_size, size_t(1) ) - 1]];
+
+      std::vector<size_t> left, right;
+      for ( size_t n = 0; n < order.size(); n++ ) {
+        if ( m_level[order[n]] <= cut_level )
+          left.push_back( order[n] );
+        else
+          right.push_back( order[n] );
+      }
+      // A single level holds everything: split it by count instead
+      if ( right.empty() ) {
+        right.assign( left.begin() + left_size, left.end() );
+        left.resize( left_size );
+      }
+
+      (*this)( left, first_part, left_parts );
+      (*this)( right, first_part + left_parts, num_parts - left_parts );
+    }
+  };
+
+}
+
+namespace asp {
+
+  std::vector<int> partition_graph( std::vector<std::vector<size_t> > const& graph,
+                                    int num_parts ) {
+    VW_ASSERT( num_parts > 0, ArgumentErr() << "partition_graph: the number of parts must be positive." );
+    std::vector<int> part( graph.size(), 0 );
+    std::vector<size_t> vertices( graph.size() );
+    for ( size_t v = 0; v < graph.size(); v++ ) {
+      vertices[v] = v;
+      for ( size_t n = 0; n < graph[v].size(); n++ )
+        VW_ASSERT( graph[v][n] < graph.size(),
+                   ArgumentErr() << "partition_graph: vertex index out of range." );
+    }
+    Dissection dissect( graph, part );
+    dissect( vertices, 0, num_parts );
+    return part;
+  }
+
+}
@@ -0,0 +1,44 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file GraphPartition.h
+///
+/// Splitting a graph into parts with few edges between them, to
+/// distribute the cameras of a bundle adjustment over processes.
+
+#ifndef __ASP_CORE_GRAPH_PARTITION_H__
+#define __ASP_CORE_GRAPH_PARTITION_H__
+
+#include <vector>
+#include <cstddef>
+
+namespace asp {
+
+  // The part, in [0, num_parts), of each vertex of an undirected graph
+  // given by its adjacency lists, by nested dissection: the graph is
+  // cut in two after a level of a breadth first search from a
+  // peripheral vertex, in proportion to the number of parts on each
+  // side, and each side is cut again. Only the vertices of the levels
+  // next to a cut have edges to another part. Parts differ in size by
+  // about the size of a level.
+  std::vector<int> partition_graph( std::vector<std::vector<size_t> > const& graph,
+                                    int num_parts );
+
+}
+
+#endif//__ASP_CORE_GRAPH_PARTITION_H__
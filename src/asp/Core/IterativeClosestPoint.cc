@@ -0,0 +1,231 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file IterativeClosestPoint.cc
+///
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+#include <asp/Core/IterativeClosestPoint.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace vw;
+
+namespace {
+
+  // Pair each source point in a range with its nearest reference point
+  class ICPMatchTask : public Task, private boost::noncopyable {
+    std::vector<Vector3> const& m_source;
+    asp::PointKdTree const& m_reference;
+    Matrix4x4 m_transform;
+    double m_max_distance;
+    size_t m_begin, m_end;
+    std::vector<long>& m_matches;
+    std::vector<double>& m_dist2;
+  public:
+    ICPMatchTask( std::vector<Vector3> const& source, asp::PointKdTree const& reference,
+                  Matrix4x4 const& transform, double max_distance, size_t begin, size_t end,
+                  std::vector<long>& matches, std::vector<double>& dist2 ) :
+      m_source(source), m_reference(reference), m_transform(transform),
+      m_max_distance(max_distance), m_begin(begin), m_end(end),
+      m_matches(matches), m_dist2(dist2) {}
+
+    void operator()() {
+      for ( size_t i = m_begin; i < m_end; i++ )
+        m_matches[i] = m_reference.nearest( asp::apply_transform( m_transform, m_source[i] ),
+                                            m_dist2[i], m_max_distance );
+    }
+  };
+
+  // Solve the symmetric positive definite system A x = b by Cholesky.
+  // Returns false if A is not positive definite.
+  bool solve_6x6( double A[6][6], double b[6], double x[6] ) {
+    double L[6][6] = {{0}};
+    for ( int i = 0; i < 6; i++ ) {
+      for ( int j = 0; j <= i; j++ ) {
+        double sum = A[i][j];
+        for ( int k = 0; k < j; k++ )
+          sum -= L[i][k] * L[j][k];
+        if ( i == j ) {
+          if ( !(sum > 0) )
+            return false;
+          L[i][i] = std::sqrt(sum);
+        } else {
+          L[i][j] = sum / L[j][j];
+        }
+      }
+    }
+    double y[6];
+    for ( int i = 0; i < 6; i++ ) {
+      double sum = b[i];
+      for ( int k = 0; k < i; k++ )
+        sum -= L[i][k] * y[k];
+      y[i] = sum / L[i][i];
+    }
+    for ( int i = 5; i >= 0; i-- ) {
+      double sum = y[i];
+      for ( int k = i + 1; k < 6; k++ )
+        sum -= L[k][i] * x[k];
+      x[i] = sum / L[i][i];
+    }
+    return true;
+  }
+
+  // The rotation by angle |w| around w
+  Matrix3x3 rodrigues( Vector3 const& w ) {
+    Matrix3x3 K;
+    K(0,1) = -w[2]; K(0,2) =  w[1];
+    K(1,0) =  w[2]; K(1,2) = -w[0];
+    K(2,0) = -w[1]; K(2,1) =  w[0];
+    double theta = norm_2(w);
+    Matrix3x3 R = math::identity_matrix<3>();
+    if ( theta < 1e-12 )
+      return R + K;
+    K /= theta;
+    return R + std::sin(theta) * K + (1 - std::cos(theta)) * K * K;
+  }
+
+}
+
+namespace asp {
+
+  Vector3 apply_transform( Matrix4x4 const& transform, Vector3 const& point ) {
+    Vector3 result;
+    for ( int i = 0; i < 3; i++ )
+      result[i] = transform(i,0) * point[0] + transform(i,1) * point[1] +
+                  transform(i,2) * point[2] + transform(i,3);
+    return result;
+  }
+
+  PointToPlaneICP::PointToPlaneICP( std::vector<Vector3> const& points,
+                                    std::vector<Vector3> const& normals ) :
+    m_points(points), m_normals(normals), m_tree(points) {
+    VW_ASSERT( normals.size() == points.size(),
+               ArgumentErr() << "PointToPlaneICP: expecting one normal per reference point." );
+  }
+
+  ICPResult PointToPlaneICP::align( std::vector<Vector3> const& source,
+                                    Matrix4x4 const& initial, ICPOptions const& opt ) const {
+    ICPResult result;
+    result.transform = initial;
+    if ( source.empty() || m_points.empty() )
+      return result;
+
+    std::vector<long> matches( source.size() );
+    std::vector<double> dist2( source.size() );
+    std::vector<double> distances;
+    size_t num_threads = std::max( 1u, vw_settings().default_num_threads() );
+    size_t chunk = (source.size() + 4*num_threads - 1) / (4*num_threads);
+
+    while ( result.iterations < opt.max_iterations ) {
+      result.iterations++;
+
+      {
+        FifoWorkQueue queue( num_threads );
+        for ( size_t begin = 0; begin < source.size(); begin += chunk ) {
+          boost::shared_ptr<ICPMatchTask>
+            task( new ICPMatchTask( source, m_tree, result.transform, opt.max_distance,
+                                    begin, std::min( begin + chunk, source.size() ),
+                                    matches, dist2 ) );
+          queue.add_task( task );
+        }
+        queue.join_all();
+      }
+
+      // Pairs much farther apart than the median are outliers
+      distances.clear();
+      for ( size_t i = 0; i < source.size(); i++ )
+        if ( matches[i] >= 0 )
+          distances.push_back( dist2[i] );
+      if ( distances.size() < 6 )
+        vw_throw( LogicErr() << "PointToPlaneICP: too few point pairs ("
+                  << distances.size() << "). Try a larger maximum distance." );
+      std::nth_element( distances.begin(), distances.begin() + distances.size()/2,
+                        distances.end() );
+      double max_dist2 = opt.outlier_factor * opt.outlier_factor * distances[distances.size()/2];
+
+      // The problem is centered on the inliers for conditioning
+      Vector3 center;
+      size_t num_inliers = 0;
+      for ( size_t i = 0; i < source.size(); i++ ) {
+        if ( matches[i] < 0 || dist2[i] > max_dist2 ) continue;
+        center += apply_transform( result.transform, source[i] );
+        num_inliers++;
+      }
+      center /= double(num_inliers);
+
+      // Normal equations of the residuals n.(R(p - c) + c + t - q),
+      // linearized in the rotation vector w: n.(p - q) + (p - c)xn.w + n.t
+      double A[6][6] = {{0}}, b[6] = {0}, sum_sq = 0, max_radius = 0;
+      for ( size_t i = 0; i < source.size(); i++ ) {
+        if ( matches[i] < 0 || dist2[i] > max_dist2 ) continue;
+        Vector3 p = apply_transform( result.transform, source[i] );
+        Vector3 const& q = m_points[matches[i]];
+        Vector3 const& n = m_normals[matches[i]];
+        Vector3 pc = p - center;
+        Vector3 pxn = cross_prod( pc, n );
+        double a[6] = { pxn[0], pxn[1], pxn[2], n[0], n[1], n[2] };
+        double r = dot_prod( n, p - q );
+        for ( int j = 0; j < 6; j++ ) {
+          for ( int k = 0; k <= j; k++ )
+            A[j][k] += a[j] * a[k];
+          b[j] -= a[j] * r;
+        }
+        sum_sq += r * r;
+        max_radius = std::max( max_radius, norm_2(pc) );
+      }
+      for ( int j = 0; j < 6; j++ )
+        for ( int k = j + 1; k < 6; k++ )
+          A[j][k] = A[k][j];
+      double previous_rms = result.rms;
+      result.num_inliers = num_inliers;
+      result.rms = std::sqrt( sum_sq / double(num_inliers) );
+
+      double x[6];
+      if ( !solve_6x6( A, b, x ) )
+        vw_throw( LogicErr() << "PointToPlaneICP: the reference surface does not constrain "
+                  << "the alignment, it may be flat." );
+
+      // p -> R(p - c) + c + t, applied after the current transform
+      Vector3 w( x[0], x[1], x[2] ), t( x[3], x[4], x[5] );
+      Matrix3x3 R = rodrigues( w );
+      Vector3 shift = center + t - R * center;
+      Matrix4x4 update = math::identity_matrix<4>();
+      for ( int j = 0; j < 3; j++ ) {
+        for ( int k = 0; k < 3; k++ )
+          update(j,k) = R(j,k);
+        update(j,3) = shift[j];
+      }
+      result.transform = update * result.transform;
+
+      // The sampling of the reference limits how well the pairs can
+      // fit, and past that point the updates only jitter.
+      if ( norm_2(w) * max_radius + norm_2(t) < opt.tolerance ||
+           ( result.iterations > 1 && std::abs( previous_rms - result.rms ) < opt.tolerance ) )
+        break;
+    }
+    return result;
+  }
+
+}
@@ -0,0 +1,77 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file IterativeClosestPoint.h
+///
+/// Rigid alignment of a point set to a surface sampled with normals,
+/// by point-to-plane ICP.
+
+#ifndef __ASP_CORE_ITERATIVE_CLOSEST_POINT_H__
+#define __ASP_CORE_ITERATIVE_CLOSEST_POINT_H__
+
+#include <vector>
+#include <limits>
+#include <vw/Math/Vector.h>
+#include <vw/Math/Matrix.h>
+#include <asp/Core/PointKdTree.h>
+
+namespace asp {
+
+  struct ICPOptions {
+    int    max_iterations;
+    double max_distance;    // Pairs farther apart than this are ignored
+    double outlier_factor;  // And so are those farther than this times the median distance
+    double tolerance;       // Stop once an update moves no point, or changes the RMS, more than this
+    ICPOptions() : max_iterations(20), max_distance(std::numeric_limits<double>::infinity()),
+                   outlier_factor(3.0), tolerance(1e-4) {}
+  };
+
+  struct ICPResult {
+    vw::Matrix4x4 transform;
+    int    iterations;
+    size_t num_inliers;  // Pairs used by the last iteration
+    double rms;          // Point-to-plane RMS of those pairs, before the last update
+    ICPResult() : iterations(0), num_inliers(0), rms(0) {}
+  };
+
+  vw::Vector3 apply_transform( vw::Matrix4x4 const& transform, vw::Vector3 const& point );
+
+  // Aligns point sets to a reference surface, sampled as points with
+  // their normals. The points and normals are not copied and must
+  // outlive this object.
+  class PointToPlaneICP {
+    std::vector<vw::Vector3> const& m_points;
+    std::vector<vw::Vector3> const& m_normals;
+    PointKdTree m_tree;
+  public:
+    PointToPlaneICP( std::vector<vw::Vector3> const& points,
+                     std::vector<vw::Vector3> const& normals );
+
+    // The rigid transform, starting from 'initial', that moves the
+    // 'source' points onto the reference surface. Each iteration pairs
+    // every source point with its nearest reference point in parallel,
+    // drops the outlying pairs, and solves the point-to-plane problem
+    // linearized in the rotation.
+    ICPResult align( std::vector<vw::Vector3> const& source,
+                     vw::Matrix4x4 const& initial,
+                     ICPOptions const& opt = ICPOptions() ) const;
+  };
+
+}
+
+#endif//__ASP_CORE_ITERATIVE_CLOSEST_POINT_H__
@@ -0,0 +1,222 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file MeasureMerge.cc
+///
+
+#include <vw/Core/Exception.h>
+#include <asp/Core/MeasureMerge.h>
+#include <asp/Core/BlockSparseSolver.h>
+
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+using namespace vw;
+
+namespace {
+
+  // The pixel of a measure, or the cell it falls in
+  struct MeasureKey {
+    uint32 image;
+    int64 x, y;
+    bool operator==( MeasureKey const& other ) const {
+      return image == other.image && x == other.x && y == other.y;
+    }
+  };
+
+  size_t hash_value( MeasureKey const& key ) {
+    size_t seed = 0;
+    boost::hash_combine( seed, key.image );
+    boost::hash_combine( seed, key.x );
+    boost::hash_combine( seed, key.y );
+    return seed;
+  }
+
+  // Finds the representatives of the measures of a range of shards
+  class ShardMerge {
+    std::vector<asp::MergeMeasure> const& m_measures;
+    std::vector<std::vector<size_t> > const& m_shards;
+    double m_close;
+    std::vector<size_t>& m_representative;
+
+    MeasureKey exact_key( asp::MergeMeasure const& m ) const {
+      // Equal coordinates have equal bits, except for signed zeros
+      double x = m.x + 0.0, y = m.y + 0.0;
+      MeasureKey key;
+      key.image = m.image;
+      std::memcpy( &key.x, &x, sizeof(double) );
+      std::memcpy( &key.y, &y, sizeof(double) );
+      return key;
+    }
+
+    MeasureKey cell_key( asp::MergeMeasure const& m, int dx, int dy ) const {
+      MeasureKey key;
+      key.image = m.image;
+      key.x = int64( std::floor( m.x / m_close ) ) + dx;
+      key.y = int64( std::floor( m.y / m_close ) ) + dy;
+      return key;
+    }
+
+    void merge_exact( std::vector<size_t> const& shard ) const {
+      boost::unordered_map<MeasureKey, size_t> unique;
+      unique.reserve( shard.size() );
+      for ( size_t n = 0; n < shard.size(); n++ ) {
+        size_t m = shard[n];
+        // Inserting keeps the first measure of each pixel
+        m_representative[m] = unique.insert( std::make_pair( exact_key( m_measures[m] ), m ) ).first->second;
+      }
+    }
+
+    void merge_close( std::vector<size_t> const& shard ) const {
+      typedef boost::unordered_map<MeasureKey, std::vector<size_t> > CellMap;
+      CellMap cells;
+      double close2 = m_close * m_close;
+      for ( size_t n = 0; n < shard.size(); n++ ) {
+        size_t m = shard[n];
+        asp::MergeMeasure const& measure = m_measures[m];
+        size_t found = std::numeric_limits<size_t>::max();
+        for ( int dy = -1; dy <= 1; dy++ )
+          for ( int dx = -1; dx <= 1; dx++ ) {
+            CellMap::const_iterator cell = cells.find( cell_key( measure, dx, dy ) );
+            if ( cell == cells.end() ) continue;
+            // Cells hold their measures in increasing order
+            for ( size_t k = 0; k < cell->second.size() && cell->second[k] < found; k++ ) {
+              asp::MergeMeasure const& other = m_measures[cell->second[k]];
+              double ex = other.x - measure.x, ey = other.y - measure.y;
+              if ( ex * ex + ey * ey <= close2 ) {
+                found = cell->second[k];
+                break;
+              }
+            }
+          }
+        if ( found == std::numeric_limits<size_t>::max() ) {
+          cells[cell_key( measure, 0, 0 )].push_back( m );
+          found = m;
+        }
+        m_representative[m] = found;
+      }
+    }
+
+  public:
+    ShardMerge( std::vector<asp::MergeMeasure> const& measures,
+                std::vector<std::vector<size_t> > const& shards,
+                double close, std::vector<size_t>& representative ) :
+      m_measures(measures), m_shards(shards), m_close(close), m_representative(representative) {}
+
+    void operator()( size_t begin, size_t end ) const {
+      for ( size_t s = begin; s < end; s++ ) {
+        if ( m_close > 0 )
+          merge_close( m_shards[s] );
+        else
+          merge_exact( m_shards[s] );
+      }
+    }
+  };
+
+  size_t find_root( std::vector<size_t>& parent, size_t m ) {
+    while ( parent[m] != m ) {
+      parent[m] = parent[parent[m]];
+      m = parent[m];
+    }
+    return m;
+  }
+
+}
+
+namespace asp {
+
+  MeasureMergeResult merge_measures( std::vector<MergeMeasure> const& measures,
+                                     std::vector<size_t> const& point_start,
+                                     double close, size_t num_threads ) {
+    VW_ASSERT( !point_start.empty() && point_start.front() == 0 &&
+               point_start.back() == measures.size(),
+               ArgumentErr() << "merge_measures: point_start does not span the measures." );
+    MeasureMergeResult result;
+    result.representative.resize( measures.size() );
+
+    // All the measures of an image are in the same shard, in their
+    // input order.
+    size_t num_shards = std::max( size_t(1), 4 * num_threads );
+    std::vector<std::vector<size_t> > shards( num_shards );
+    for ( size_t m = 0; m < measures.size(); m++ )
+      shards[ measures[m].image % num_shards ].push_back( m );
+    parallel_range( num_shards, ShardMerge( measures, shards, close, result.representative ),
+                    num_threads );
+    shards.clear();
+
+    // Points that share a unique measure are joined
+    std::vector<size_t> parent( measures.size() ), size( measures.size(), 1 );
+    for ( size_t m = 0; m < measures.size(); m++ )
+      parent[m] = m;
+    size_t num_points = point_start.size() - 1;
+    for ( size_t p = 0; p < num_points; p++ ) {
+      if ( point_start[p] == point_start[p+1] ) continue;
+      size_t root = find_root( parent, result.representative[point_start[p]] );
+      for ( size_t m = point_start[p] + 1; m < point_start[p+1]; m++ ) {
+        size_t other = find_root( parent, result.representative[m] );
+        if ( other == root ) continue;
+        if ( size[other] > size[root] )
+          std::swap( other, root );
+        parent[other] = root;
+        size[root] += size[other];
+      }
+    }
+
+    // Number the groups by their first point. Points without
+    // measures are groups of their own.
+    std::vector<size_t> group( measures.size(), std::numeric_limits<size_t>::max() );
+    result.point_group.resize( num_points );
+    for ( size_t p = 0; p < num_points; p++ ) {
+      if ( point_start[p] == point_start[p+1] ) {
+        result.point_group[p] = result.num_groups++;
+        continue;
+      }
+      size_t root = find_root( parent, result.representative[point_start[p]] );
+      if ( group[root] == std::numeric_limits<size_t>::max() )
+        group[root] = result.num_groups++;
+      result.point_group[p] = group[root];
+    }
+    return result;
+  }
+
+  void group_unique_measures( MeasureMergeResult const& result,
+                              std::vector<size_t> const& point_start,
+                              std::vector<size_t>& group_start,
+                              std::vector<size_t>& order ) {
+    size_t num_points = point_start.size() - 1;
+    group_start.assign( result.num_groups + 1, 0 );
+    for ( size_t p = 0; p < num_points; p++ )
+      for ( size_t m = point_start[p]; m < point_start[p+1]; m++ )
+        if ( result.representative[m] == m )
+          group_start[ result.point_group[p] + 1 ]++;
+    for ( size_t g = 0; g < result.num_groups; g++ )
+      group_start[g+1] += group_start[g];
+
+    std::vector<size_t> next( group_start.begin(), group_start.end() - 1 );
+    order.resize( group_start.back() );
+    for ( size_t p = 0; p < num_points; p++ )
+      for ( size_t m = point_start[p]; m < point_start[p+1]; m++ )
+        if ( result.representative[m] == m )
+          order[ next[result.point_group[p]]++ ] = m;
+  }
+
+}
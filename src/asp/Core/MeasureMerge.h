@@ -0,0 +1,75 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file MeasureMerge.h
+///
+/// Finding the control points of several networks that share a
+/// measure, for merging the networks.
+
+#ifndef __ASP_CORE_MEASURE_MERGE_H__
+#define __ASP_CORE_MEASURE_MERGE_H__
+
+#include <vw/Core/FundamentalTypes.h>
+#include <vector>
+#include <cstddef>
+
+namespace asp {
+
+  // A measure: the image it is on and its pixel location
+  struct MergeMeasure {
+    vw::uint32 image;
+    double x, y;
+    MergeMeasure() : image(0), x(0), y(0) {}
+    MergeMeasure( vw::uint32 image, double x, double y ) : image(image), x(x), y(y) {}
+  };
+
+  struct MeasureMergeResult {
+    // For each measure, the earliest measure that it duplicates, or
+    // itself. Those that are themselves are the unique measures.
+    std::vector<size_t> representative;
+    // For each input point, the merged point it belongs to, numbered
+    // in the order of their first input point.
+    std::vector<size_t> point_group;
+    size_t num_groups;
+    MeasureMergeResult() : num_groups(0) {}
+  };
+
+  // Merges the input points that share a measure, directly or through
+  // other points. Point p has the measures [point_start[p],
+  // point_start[p+1]). Two measures are the same when they are on the
+  // same image, at the same pixel, or, if 'close' is positive, within
+  // 'close' pixels of each other. A measure is only compared with the
+  // unique measures before it.
+  //
+  // Measures are looked up in a hash of the pixels of each image, or
+  // of the cells 'close' pixels wide that they fall in. The images are
+  // split in shards that are processed on 'num_threads' threads.
+  MeasureMergeResult merge_measures( std::vector<MergeMeasure> const& measures,
+                                     std::vector<size_t> const& point_start,
+                                     double close, size_t num_threads );
+
+  // The unique measures of each merged point, in input order: those
+  // of point g are order[group_start[g]] to order[group_start[g+1]-1].
+  void group_unique_measures( MeasureMergeResult const& result,
+                              std::vector<size_t> const& point_start,
+                              std::vector<size_t>& group_start,
+                              std::vector<size_t>& order );
+
+}
+
+#endif//__ASP_CORE_MEASURE_MERGE_H__
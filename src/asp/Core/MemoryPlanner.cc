@@ -0,0 +1,187 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file MemoryPlanner.cc
+///
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/Settings.h>
+#include <asp/Core/Common.h>
+#include <asp/Core/MemoryPlanner.h>
+
+#include <algorithm>
+
+using namespace vw;
+
+namespace asp {
+
+  TileFootprint::TileFootprint() : name("stage"), input_bytes_per_pixel(4),
+                                   input_copies(1), halo(0,0), pyramid_levels(0),
+                                   output_bytes_per_pixel(4), fixed_bytes(0) {}
+
+  double TileFootprint::tile_bytes( Vector2i const& tile_size ) const {
+    double in_pixels = double(tile_size.x() + 2*halo.x()) *
+                       double(tile_size.y() + 2*halo.y());
+    // Each pyramid level has a quarter of the pixels of the previous one.
+    double pyramid_factor = 0, level_factor = 1;
+    for ( int level = 0; level <= pyramid_levels; level++ ) {
+      pyramid_factor += level_factor;
+      level_factor /= 4.0;
+    }
+    return fixed_bytes +
+      in_pixels * input_bytes_per_pixel * input_copies * pyramid_factor +
+      double(tile_size.x()) * double(tile_size.y()) * output_bytes_per_pixel;
+  }
+
+  TilePlan::TilePlan() : tile_size(0,0), num_threads(1), bytes_per_tile(0),
+                         total_bytes(0), fits(false) {}
+
+  std::ostream& operator<<( std::ostream& os, TilePlan const& plan ) {
+    os << plan.tile_size.x() << "x" << plan.tile_size.y() << " px tiles, "
+       << plan.num_threads << " threads, "
+       << plan.bytes_per_tile/(1024*1024) << " MiB per tile, "
+       << plan.total_bytes/(1024*1024) << " MiB total";
+    if ( !plan.fits )
+      os << " (exceeds budget)";
+    return os;
+  }
+
+  TilePlan plan_tiles( TileFootprint const& footprint,
+                       double budget_bytes, uint32 max_threads,
+                       int32 min_tile, int32 max_tile ) {
+    VW_ASSERT( min_tile > 0 && min_tile <= max_tile,
+               ArgumentErr() << "plan_tiles: Invalid tile size range.\n" );
+    if ( max_threads < 1 ) max_threads = 1;
+
+    // Try thread counts from the largest down. For each, take the
+    // largest power-of-two tile that fits.
+    for ( uint32 threads = max_threads; threads >= 1; threads-- ) {
+      TilePlan best;
+      for ( int32 tile = min_tile; tile <= max_tile; tile *= 2 ) {
+        double bytes = footprint.tile_bytes( Vector2i(tile, tile) );
+        if ( double(threads) * bytes > budget_bytes ) break;
+        best.tile_size      = Vector2i(tile, tile);
+        best.num_threads    = threads;
+        best.bytes_per_tile = bytes;
+        best.total_bytes    = double(threads) * bytes;
+        best.fits           = true;
+      }
+      if ( best.fits ) return best;
+    }
+
+    // Nothing fits. Do the least damage: one thread, smallest tile.
+    TilePlan plan;
+    plan.tile_size      = Vector2i(min_tile, min_tile);
+    plan.num_threads    = 1;
+    plan.bytes_per_tile = footprint.tile_bytes( plan.tile_size );
+    plan.total_bytes    = plan.bytes_per_tile;
+    plan.fits           = false;
+    return plan;
+  }
+
+  // resample_aa reads 1/sub_scale times as many pixels in each
+  // direction as it writes. Only the float source pixels are counted,
+  // as the hand-tuned rule stereo_pprc used before the planner did,
+  // so that its default budget gives the same tiles and threads.
+  TileFootprint subsample_footprint( double sub_scale ) {
+    TileFootprint fp;
+    fp.name = "subsampling";
+    double inv = 1.0/std::max(sub_scale, 1e-3);
+    fp.input_bytes_per_pixel  = 4*inv*inv;     // PixelGray<float>
+    fp.input_copies           = 1;
+    fp.output_bytes_per_pixel = 0;
+    return fp;
+  }
+
+  // The integer correlator keeps, per pyramid level, the two
+  // prefiltered images, their masks, and a cost image for every
+  // disparity being tested at a time, plus the best cost and result.
+  TileFootprint correlation_footprint( Vector2i const& corr_kernel,
+                                       Vector2i const& search_size,
+                                       int max_levels ) {
+    TileFootprint fp;
+    fp.name = "correlation";
+    fp.input_bytes_per_pixel  = 4 + 4 + 1 + 1; // Left/right float + masks
+    fp.input_copies           = 3;             // Raw, prefiltered, cost buffers
+    fp.halo = Vector2i( corr_kernel.x()/2 + std::abs(search_size.x()),
+                        corr_kernel.y()/2 + std::abs(search_size.y()) );
+    fp.pyramid_levels         = max_levels;
+    fp.output_bytes_per_pixel = 12 + 8;        // PixelMask<Vector2i>, best cost
+    return fp;
+  }
+
+  // The affine subpixel modes keep several per-pixel work images
+  // (gradients, weights, the affine parameters).
+  TileFootprint subpixel_footprint( Vector2i const& subpixel_kernel,
+                                    int subpixel_mode, int max_levels ) {
+    TileFootprint fp;
+    fp.name = "refinement";
+    fp.input_bytes_per_pixel  = 4 + 4 + 12;    // Left, right, integer disparity
+    fp.input_copies           = subpixel_mode >= 2 ? 6 : 2;
+    fp.halo                   = subpixel_kernel/2 + Vector2i(1, 1);
+    fp.pyramid_levels         = subpixel_mode >= 2 ? max_levels : 0;
+    fp.output_bytes_per_pixel = subpixel_mode >= 2 ? 24 : 12;
+    return fp;
+  }
+
+  // Outlier removal needs a halo of the filter kernel. Hole filling
+  // may need the bounding box of an entire hole, which is bounded by
+  // its maximum area.
+  TileFootprint filtering_footprint( Vector2i const& rm_half_kernel,
+                                     int fill_hole_max_size ) {
+    TileFootprint fp;
+    fp.name = "filtering";
+    fp.input_bytes_per_pixel  = 12;            // PixelMask<Vector2f>
+    fp.input_copies           = 2;
+    fp.halo                   = rm_half_kernel;
+    fp.output_bytes_per_pixel = 12;
+    fp.fixed_bytes            = 12.0 * std::max(fill_hole_max_size, 0);
+    return fp;
+  }
+
+  TileFootprint triangulation_footprint( bool has_lut_images ) {
+    TileFootprint fp;
+    fp.name = "triangulation";
+    fp.input_bytes_per_pixel  = 12 + (has_lut_images ? 16 : 0);
+    fp.input_copies           = 1;
+    fp.output_bytes_per_pixel = 48;            // Vector6
+    return fp;
+  }
+
+  bool apply_tile_plan( BaseOptions & opt, TileFootprint const& footprint ) {
+    if ( opt.memory_budget <= 0 )
+      return false;
+
+    uint32 max_threads = opt.num_threads != 0 ? opt.num_threads :
+      vw_settings().default_num_threads();
+    TilePlan plan = plan_tiles( footprint, opt.memory_budget*1024.0*1024.0,
+                                max_threads );
+
+    opt.raster_tile_size = plan.tile_size;
+    vw_settings().set_default_num_threads( plan.num_threads );
+
+    vw_out() << "\t--> Memory plan for " << footprint.name << ": " << plan << "\n";
+    if ( !plan.fits )
+      vw_out(WarningMessage) << "Cannot fit " << footprint.name
+                             << " within the memory budget of "
+                             << opt.memory_budget << " MiB.\n";
+    return true;
+  }
+
+}
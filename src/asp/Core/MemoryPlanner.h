@@ -0,0 +1,97 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file MemoryPlanner.h
+///
+/// Choose the raster tile size and number of threads for a block
+/// write so that the working set of all tiles in flight fits in a
+/// given memory budget.
+
+#ifndef __ASP_CORE_MEMORY_PLANNER_H__
+#define __ASP_CORE_MEMORY_PLANNER_H__
+
+#include <string>
+#include <iostream>
+#include <vw/Math/Vector.h>
+
+namespace asp {
+
+  struct BaseOptions; // Forward declaration
+
+  // Per-tile working set model of a view graph. Processing a tile of
+  // size W x H reads an input window of (W + 2*halo.x) x (H + 2*halo.y)
+  // pixels from each input, keeps 'input_copies' buffers of that size
+  // alive (prefiltered images, cost volumes, etc.), and a pyramid of
+  // 'pyramid_levels' levels over them. The output tile itself costs
+  // 'output_bytes_per_pixel' per pixel.
+  struct TileFootprint {
+    std::string  name;
+    double       input_bytes_per_pixel;
+    double       input_copies;
+    vw::Vector2i halo;
+    int          pyramid_levels;
+    double       output_bytes_per_pixel;
+    double       fixed_bytes;             // Independent of the tile size
+
+    TileFootprint();
+
+    // Bytes needed to process one tile of the given size
+    double tile_bytes( vw::Vector2i const& tile_size ) const;
+  };
+
+  struct TilePlan {
+    vw::Vector2i tile_size;
+    vw::uint32   num_threads;
+    double       bytes_per_tile;
+    double       total_bytes;
+    bool         fits;           // False if even the smallest plan exceeds the budget
+
+    TilePlan();
+  };
+
+  std::ostream& operator<<( std::ostream& os, TilePlan const& plan );
+
+  // Choose a power-of-two tile size in [min_tile, max_tile] and a
+  // thread count in [1, max_threads] such that
+  // num_threads*tile_bytes(tile_size) <= budget_bytes. All available
+  // threads are kept busy if possible, and among those plans the
+  // largest tile is picked, as bigger tiles waste less on halos.
+  TilePlan plan_tiles( TileFootprint const& footprint,
+                       double budget_bytes, vw::uint32 max_threads,
+                       vw::int32 min_tile = 64, vw::int32 max_tile = 2048 );
+
+  // Footprints for the stages of the stereo pipeline
+  TileFootprint subsample_footprint( double sub_scale );
+  TileFootprint correlation_footprint( vw::Vector2i const& corr_kernel,
+                                       vw::Vector2i const& search_size,
+                                       int max_levels );
+  TileFootprint subpixel_footprint( vw::Vector2i const& subpixel_kernel,
+                                    int subpixel_mode, int max_levels );
+  TileFootprint filtering_footprint( vw::Vector2i const& rm_half_kernel,
+                                     int fill_hole_max_size );
+  TileFootprint triangulation_footprint( bool has_lut_images );
+
+  // If the user gave a memory budget, plan the tiles of this stage
+  // with it, apply the plan to 'opt' and to the default number of
+  // threads, and report it. Returns false and changes nothing
+  // otherwise.
+  bool apply_tile_plan( BaseOptions & opt, TileFootprint const& footprint );
+
+}
+
+#endif//__ASP_CORE_MEMORY_PLANNER_H__
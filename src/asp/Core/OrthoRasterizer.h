@@ -22,6 +22,11 @@
 /// resamples the point cloud on a regular grid over the [x,y] plane
 /// of the point image; producing an evenly sampled ortho-image with
 /// interpolated z values.
+///
+/// The pixel type may carry several float channels, each fed by its
+/// own texture (see add_texture()). All channels are interpolated in
+/// the same pass over the triangles, so several products can be
+/// rasterized from a single traversal of the point cloud.
 
 #include <vw/Image/ImageView.h>
 #include <vw/Image/ImageViewRef.h>
@@ -30,10 +35,12 @@
 #include <vw/Math/Vector.h>
 #include <vw/Math/BBox.h>
 
-// The SoftwareRenderer actual "renders" the 3D scene, textures it,
+// The TriangleRasterizer actual "renders" the 3D scene, textures it,
 // and then returns a 2D orthographic view.
-#include <asp/Core/SoftwareRenderer.h>
+#include <asp/Core/TriangleRasterizer.h>
 #include <boost/math/special_functions/next.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/type_traits/is_same.hpp>
 
 namespace vw {
 namespace cartography {
@@ -41,7 +48,7 @@ namespace cartography {
   template <class PixelT, class ImageT>
   class OrthoRasterizerView : public ImageViewBase<OrthoRasterizerView<PixelT, ImageT> > {
     ImageT m_point_image;
-    ImageViewRef<float> m_texture;
+    std::vector<ImageViewRef<float> > m_textures; // One per channel of PixelT
     BBox3 m_bbox;           // Bounding box of point cloud
     double m_spacing;       // pointcloud units (usually m or deg) per pxel
     double m_default_value;
@@ -57,12 +64,19 @@ namespace cartography {
     // overlapping in the pc image X/Y domain to insure that
     // everything is triangulated.
 
+    static const int NUM_CHANNELS = CompoundNumChannels<PixelT>::value;
+    BOOST_STATIC_ASSERT(( boost::is_same<typename CompoundChannelType<PixelT>::type, float>::value ));
+    BOOST_STATIC_ASSERT(( NUM_CHANNELS <= vw::stereo::TriangleRasterizer::kMaxChannels ));
+
+    // Each channel is checked on its own, as it would be if it were
+    // rasterized alone.
     struct RemoveSoftInvalid : ReturnFixedType<PixelT> {
-      template <class T>
-      PixelT operator()( T const& v ) const {
-        if ( v == -32000 )
-          return PixelT();
-        return v;
+      PixelT operator()( PixelT const& v ) const {
+        PixelT result = v;
+        for ( int ch = 0; ch < NUM_CHANNELS; ch++ )
+          if ( compound_select_channel<float&>(result, ch) == -32000 )
+            compound_select_channel<float&>(result, ch) = 0;
+        return result;
       }
     };
 
@@ -146,7 +160,7 @@ namespace cartography {
     template <class TextureViewT>
     OrthoRasterizerView(ImageT point_image, TextureViewT texture, double spacing = 0.0,
                         const ProgressCallback& progress = ProgressCallback::dummy_instance()) :
-      m_point_image(point_image), m_texture(ImageView<float>(1,1)), // dummy value
+      m_point_image(point_image),
       m_default_value(0), m_minz_as_default(true), m_use_alpha(false) {
 
       set_texture(texture.impl());
@@ -193,10 +207,22 @@ namespace cartography {
     /// to point image pixels.
     template <class TextureViewT>
     void set_texture(TextureViewT texture) {
+      m_textures.clear();
+      add_texture(texture);
+    }
+
+    /// Append the channels of a texture to the channels being
+    /// rasterized. Once rasterization starts, the total number of
+    /// texture channels must match the number of channels of PixelT.
+    template <class TextureViewT>
+    void add_texture(TextureViewT texture) {
       VW_ASSERT(texture.impl().cols() == m_point_image.cols() && texture.impl().rows() == m_point_image.rows(),
-                ArgumentErr() << "Orthorasterizer: set_texture() failed."
+                ArgumentErr() << "Orthorasterizer: add_texture() failed."
                 << " Texture dimensions must match point image dimensions.");
-      m_texture = channel_cast<float>(channels_to_planes(texture.impl()));
+      ImageViewRef<float> texture_planes =
+        channel_cast<float>(channels_to_planes(texture.impl()));
+      for ( int32 p = 0; p < texture_planes.planes(); p++ )
+        m_textures.push_back( select_plane(texture_planes, p) );
     }
 
     inline int32 cols() const { return (int) (fabs(m_bbox.max().x() - m_bbox.min().x()) / m_spacing) + 1; }
@@ -214,37 +240,38 @@ namespace cartography {
     typedef CropView<ImageView<pixel_type> > prerasterize_type;
     inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
 
+      VW_ASSERT( int(m_textures.size()) == NUM_CHANNELS,
+                 LogicErr() << "OrthoRasterizer: " << m_textures.size()
+                 << " texture channels were set for a " << NUM_CHANNELS
+                 << "-channel raster." );
+
       BBox2i bbox_1 = bbox;
       bbox_1.expand(1);
 
       // Used to find which polygons are actually in the draw space.
       BBox3 local_3d_bbox     = pixel_to_point_bbox(bbox_1);
 
-      ImageView<float> render_buffer(bbox_1.width(), bbox_1.height());
+      // The rasterizer writes NUM_CHANNELS interleaved floats per
+      // pixel, north up, which is exactly the layout of an
+      // ImageView<PixelT>.
+      ImageView<PixelT> render_buffer(bbox_1.width(), bbox_1.height());
 
-      // Setup a software renderer and the orthographic view matrix
-      vw::stereo::SoftwareRenderer renderer(bbox_1.width(),
-                                            bbox_1.height(),
-                                            &render_buffer(0,0) );
-      renderer.Ortho2D(local_3d_bbox.min().x(), local_3d_bbox.max().x(),
-                       local_3d_bbox.min().y(), local_3d_bbox.max().y());
+      // Setup a rasterizer and the orthographic view matrix
+      vw::stereo::TriangleRasterizer renderer(bbox_1.width(),
+                                              bbox_1.height(), NUM_CHANNELS,
+                                              reinterpret_cast<float*>(&render_buffer(0,0)) );
+      renderer.set_ortho(local_3d_bbox.min().x(), local_3d_bbox.max().x(),
+                         local_3d_bbox.min().y(), local_3d_bbox.max().y());
 
       // Set up the default color value
       if (m_use_alpha) {
-        renderer.Clear(std::numeric_limits<float>::min());  // use this dummy value to denote transparency
+        renderer.clear(std::numeric_limits<float>::min());  // use this dummy value to denote transparency
       } else if (m_minz_as_default) {
-        renderer.Clear(m_bbox.min().z());
+        renderer.clear(m_bbox.min().z());
       } else {
-        renderer.Clear(m_default_value);
+        renderer.clear(m_default_value);
       }
 
-      static const int NUM_COLOR_COMPONENTS = 1;  // We only need gray scale
-      static const int NUM_VERTEX_COMPONENTS = 2; // DEMs are 2D
-
-      std::valarray<float> vertices(10), intensities(5);
-      renderer.SetVertexPointer(NUM_VERTEX_COMPONENTS, &vertices[0]);
-      renderer.SetColorPointer(NUM_COLOR_COMPONENTS, &intensities[0]);
-
       BBox2i point_image_boundary;
       BOOST_FOREACH( BBoxPair const& boundary,
                      m_point_image_boundaries ) {
@@ -262,8 +289,16 @@ namespace cartography {
       // Pull a copy of the input image
       ImageView<typename ImageT::pixel_type> point_copy =
         crop(m_point_image, point_image_boundary );
-      ImageView<float> texture_copy =
-        crop(m_texture, point_image_boundary );
+      std::vector<ImageView<float> > texture_copy(NUM_CHANNELS);
+      for ( int ch = 0; ch < NUM_CHANNELS; ch++ )
+        texture_copy[ch] = crop(m_textures[ch], point_image_boundary );
+
+      // The corners of a quad: UL, LL, LR, UR. Each is x, y, then
+      // one value per channel.
+      const int vs = renderer.vertex_size();
+      std::vector<double> quad(4*vs);
+      double *ul = &quad[0], *ll = &quad[vs], *lr = &quad[2*vs], *ur = &quad[3*vs];
+
       typedef typename ImageView<Vector3>::pixel_accessor PointAcc;
       PointAcc row_acc = point_copy.origin();
       for ( int32 row = 0; row < point_copy.rows()-1; ++row ) {
@@ -278,43 +313,38 @@ namespace cartography {
           if ( !boost::math::isnan((*point_ul).z()) &&
                !boost::math::isnan((*point_lr).z()) ) {
 
-            vertices[0] = (*point_ul).x(); // UL
-            vertices[1] = (*point_ul).y();
-            vertices[2] = (*point_ll).x(); // LL
-            vertices[3] = (*point_ll).y();
-            vertices[4] = (*point_lr).x(); // LR
-            vertices[5] = (*point_lr).y();
-            vertices[6] = (*point_ur).x(); // UR
-            vertices[7] = (*point_ur).y();
-            vertices[8] = (*point_ul).x(); // UL
-            vertices[9] = (*point_ul).y();
-
-            intensities[0] = texture_copy(col,  row);
-            intensities[1] = texture_copy(col,row+1);
-            intensities[2] = texture_copy(col+1,  row+1);
-            intensities[3] = texture_copy(col+1,row);
-            intensities[4] = texture_copy(col,row);
+            ul[0] = (*point_ul).x(); ul[1] = (*point_ul).y();
+            ll[0] = (*point_ll).x(); ll[1] = (*point_ll).y();
+            lr[0] = (*point_lr).x(); lr[1] = (*point_lr).y();
+            ur[0] = (*point_ur).x(); ur[1] = (*point_ur).y();
+
+            for ( int ch = 0; ch < NUM_CHANNELS; ch++ ) {
+              ImageView<float> const& texture = texture_copy[ch];
+              ul[2+ch] = texture(col,  row);
+              ll[2+ch] = texture(col,row+1);
+              lr[2+ch] = texture(col+1,row+1);
+              ur[2+ch] = texture(col+1,row);
+            }
 
             if ( !boost::math::isnan((*point_ll).z()) ) {
               // triangle 1 is: UL LL LR
-              renderer.DrawPolygon(0, 3);
+              renderer.add_triangle(ul, ll, lr);
             }
             if ( !boost::math::isnan((*point_ur).z()) ) {
               // triangle 2 is: LR, UR, UL
-              renderer.DrawPolygon(2, 3);
+              renderer.add_triangle(lr, ur, ul);
             }
           }
           point_ul.next_col();
         }
         row_acc.next_row();
       }
+      renderer.flush();
 
-      // The software renderer returns an image which will render
-      // upside down in most image formats, so we correct that here.
-      // We also introduce transparent pixels into the result where
+      // We introduce transparent pixels into the result where
       // necessary.
       ImageView<PixelT> result =
-        flip_vertical(per_pixel_filter(render_buffer, RemoveSoftInvalid()));
+        per_pixel_filter(render_buffer, RemoveSoftInvalid());
 
       // This may seem confusing, but we must crop here so that the
       // good pixel data is placed into the coordinates specified by
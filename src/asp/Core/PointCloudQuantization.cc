@@ -0,0 +1,81 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file PointCloudQuantization.cc
+///
+
+#include <vw/Core/Exception.h>
+#include <vw/FileIO/DiskImageResource.h>
+#include <asp/Core/PointCloudQuantization.h>
+
+#include <boost/scoped_ptr.hpp>
+#include <sstream>
+
+#include <gdal_priv.h>
+
+using namespace vw;
+
+namespace {
+  const char* const kOffsetKey = "ASP_POINT_OFFSET";
+  const char* const kScaleKey  = "ASP_POINT_SCALE";
+}
+
+namespace asp {
+
+  void write_point_cloud_quantization( DiskImageResourceGDAL& rsrc,
+                                       PointCloudQuantization const& quant ) {
+    VW_ASSERT( quant.is_quantized(),
+               ArgumentErr() << "Point cloud quantization scale must be positive." );
+
+    std::ostringstream offset, scale;
+    offset.precision(17);
+    scale.precision(17);
+    offset << quant.offset[0] << " " << quant.offset[1] << " " << quant.offset[2];
+    scale << quant.scale;
+
+    boost::shared_ptr<GDALDataset> dataset = rsrc.get_dataset_ptr();
+    if ( !dataset )
+      vw_throw( IOErr() << "Unable to write point cloud quantization: no file is open." );
+    if ( dataset->SetMetadataItem( kOffsetKey, offset.str().c_str() ) != CE_None ||
+         dataset->SetMetadataItem( kScaleKey, scale.str().c_str() ) != CE_None )
+      vw_throw( IOErr() << "Unable to write point cloud quantization to the file metadata." );
+  }
+
+  PointCloudQuantization read_point_cloud_quantization( std::string const& filename ) {
+    PointCloudQuantization quant;
+    boost::scoped_ptr<SrcImageResource> src( DiskImageResource::open(filename) );
+    DiskImageResourceGDAL* gdal = dynamic_cast<DiskImageResourceGDAL*>( src.get() );
+    if ( !gdal )
+      return quant;
+
+    boost::shared_ptr<GDALDataset> dataset = gdal->get_dataset_ptr();
+    if ( !dataset )
+      return quant;
+    const char* offset = dataset->GetMetadataItem( kOffsetKey );
+    const char* scale  = dataset->GetMetadataItem( kScaleKey );
+    if ( !offset || !scale )
+      return quant;
+
+    std::istringstream offset_is( offset ), scale_is( scale );
+    if ( !(offset_is >> quant.offset[0] >> quant.offset[1] >> quant.offset[2]) ||
+         !(scale_is >> quant.scale) || !(quant.scale > 0) )
+      vw_throw( IOErr() << "Invalid point cloud quantization metadata in " << filename << "." );
+    return quant;
+  }
+
+}
@@ -0,0 +1,165 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file PointCloudQuantization.h
+///
+/// Optional int32 storage of point clouds. Each point is stored as
+/// round((xyz - offset)/scale), relative to a local origin of the
+/// file, with the offset and scale kept in the GDAL metadata. Any
+/// channels after xyz, such as the triangulation error, are stored
+/// with the same scale and no offset.
+
+#ifndef __ASP_CORE_POINT_CLOUD_QUANTIZATION_H__
+#define __ASP_CORE_POINT_CLOUD_QUANTIZATION_H__
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vw/Math/Vector.h>
+#include <vw/Math/BBox.h>
+#include <vw/Image/ImageViewBase.h>
+#include <vw/Image/PerPixelViews.h>
+#include <vw/Image/PixelTypeInfo.h>
+#include <vw/FileIO/DiskImageResourceGDAL.h>
+
+// Allows FileIO to read and write quantized point clouds
+namespace vw {
+  template<> struct PixelFormatID<Vector<int32,3> > { static const PixelFormatEnum value = VW_PIXEL_GENERIC_3_CHANNEL; };
+  template<> struct PixelFormatID<Vector<int32,4> > { static const PixelFormatEnum value = VW_PIXEL_GENERIC_4_CHANNEL; };
+  template<> struct PixelFormatID<Vector<int32,6> > { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
+}
+
+namespace asp {
+
+  struct PointCloudQuantization {
+    vw::Vector3 offset;  // Local origin subtracted from xyz
+    double      scale;   // Meters per integer step; 0 if not quantized
+
+    PointCloudQuantization() : scale(0) {}
+    PointCloudQuantization( vw::Vector3 const& offset, double scale ) :
+      offset(offset), scale(scale) {}
+
+    bool is_quantized() const { return scale > 0; }
+
+    // The invalid point Vector3() is stored with all channels set to
+    // this value. Valid points never use it.
+    static vw::int32 nodata() { return std::numeric_limits<vw::int32>::min(); }
+  };
+
+  // Record the quantization in the metadata of a file being written.
+  // This must be done before any pixels are written.
+  void write_point_cloud_quantization( vw::DiskImageResourceGDAL& rsrc,
+                                       PointCloudQuantization const& quant );
+
+  // Read the quantization of a point cloud file. Files written as
+  // floating point give a quantization with is_quantized() false.
+  PointCloudQuantization read_point_cloud_quantization( std::string const& filename );
+
+  // Quantize a point. Points that are invalid, or so far from the
+  // origin that they do not fit in an int32, are stored as nodata.
+  // Other channels are clamped to the int32 range.
+  template <int N>
+  class QuantizePointFunc : public vw::ReturnFixedType<vw::Vector<vw::int32,N> > {
+    PointCloudQuantization m_quant;
+  public:
+    QuantizePointFunc( PointCloudQuantization const& quant ) : m_quant(quant) {}
+
+    vw::Vector<vw::int32,N> operator()( vw::Vector<double,N> const& pt ) const {
+      const double max_int = std::numeric_limits<vw::int32>::max();
+      vw::Vector<vw::int32,N> result;
+      bool valid = false;
+      for ( int i = 0; i < 3 && i < N; i++ )
+        valid = valid || pt[i] != 0;
+      for ( int i = 0; i < N && valid; i++ ) {
+        double q = (pt[i] - (i < 3 ? m_quant.offset[i] : 0)) / m_quant.scale;
+        q = q < 0 ? std::ceil(q - 0.5) : std::floor(q + 0.5);
+        if ( i < 3 && !(std::abs(q) <= max_int) )
+          valid = false;
+        else if ( q != q )
+          q = 0;
+        result[i] = vw::int32( std::max(-max_int, std::min(max_int, q)) );
+      }
+      if ( !valid )
+        for ( int i = 0; i < N; i++ )
+          result[i] = PointCloudQuantization::nodata();
+      return result;
+    }
+  };
+
+  template <class ImageT>
+  vw::UnaryPerPixelView<ImageT, QuantizePointFunc<vw::CompoundNumChannels<typename ImageT::pixel_type>::value> >
+  inline quantize_points( vw::ImageViewBase<ImageT> const& image,
+                          PointCloudQuantization const& quant ) {
+    typedef QuantizePointFunc<vw::CompoundNumChannels<typename ImageT::pixel_type>::value> func_type;
+    return vw::UnaryPerPixelView<ImageT, func_type>( image.impl(), func_type(quant) );
+  }
+
+  // Recover the first n of the m channels of a quantized point
+  template <int n, int m>
+  class DequantizePointFunc : public vw::ReturnFixedType<vw::Vector<double,n> > {
+    PointCloudQuantization m_quant;
+  public:
+    DequantizePointFunc( PointCloudQuantization const& quant ) : m_quant(quant) {}
+
+    vw::Vector<double,n> operator()( vw::Vector<vw::int32,m> const& pt ) const {
+      vw::Vector<double,n> result;
+      if ( pt[0] == PointCloudQuantization::nodata() )
+        return result;
+      for ( int i = 0; i < n; i++ )
+        result[i] = pt[i] * m_quant.scale + (i < 3 ? m_quant.offset[i] : 0);
+      return result;
+    }
+  };
+
+  template <int n, int m, class ImageT>
+  vw::UnaryPerPixelView<ImageT, DequantizePointFunc<n, m> >
+  inline dequantize_points( vw::ImageViewBase<ImageT> const& image,
+                            PointCloudQuantization const& quant ) {
+    return vw::UnaryPerPixelView<ImageT, DequantizePointFunc<n, m> >( image.impl(),
+                                                                     DequantizePointFunc<n, m>(quant) );
+  }
+
+  // A local origin for a point cloud that has not been computed yet:
+  // the mean of the valid points on a sparse grid of pixels. The grid
+  // is refined until some valid point is found.
+  template <class ImageT>
+  vw::Vector3 point_cloud_origin( vw::ImageViewBase<ImageT> const& image ) {
+    ImageT const& cloud = image.impl();
+    for ( vw::int32 samples = 16; samples <= 256; samples *= 4 ) {
+      vw::Vector3 sum;
+      vw::int32 count = 0;
+      for ( vw::int32 j = 0; j < samples; j++ ) {
+        vw::int32 row = vw::int32( (j + 0.5) * cloud.rows() / samples );
+        for ( vw::int32 i = 0; i < samples; i++ ) {
+          vw::int32 col = vw::int32( (i + 0.5) * cloud.cols() / samples );
+          vw::Vector3 point = vw::math::subvector( cloud(col, row), 0, 3 );
+          if ( point == vw::Vector3() ) continue;
+          sum += point;
+          count++;
+        }
+      }
+      if ( count > 0 )
+        return sum / double(count);
+    }
+    return vw::Vector3();
+  }
+
+}
+
+#endif//__ASP_CORE_POINT_CLOUD_QUANTIZATION_H__
@@ -0,0 +1,129 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file PointKdTree.cc
+///
+
+#include <vw/Core/Exception.h>
+#include <asp/Core/PointKdTree.h>
+
+#include <algorithm>
+#include <limits>
+
+using namespace vw;
+
+namespace {
+  // Orders point indices along one axis
+  struct AxisLess {
+    std::vector<vw::Vector3> const& points;
+    int axis;
+    AxisLess( std::vector<vw::Vector3> const& points, int axis ) : points(points), axis(axis) {}
+    bool operator()( vw::uint32 a, vw::uint32 b ) const { return points[a][axis] < points[b][axis]; }
+  };
+}
+
+namespace asp {
+
+  PointKdTree::PointKdTree( std::vector<Vector3> const& points ) {
+    VW_ASSERT( points.size() < size_t(std::numeric_limits<uint32>::max()),
+               ArgumentErr() << "PointKdTree: too many points." );
+    m_points = points;
+    m_indices.resize( points.size() );
+    for ( size_t i = 0; i < points.size(); i++ )
+      m_indices[i] = i;
+    m_axes.resize( points.size(), 0 );
+    build( 0, m_points.size() );
+
+    // Put the points in tree order
+    std::vector<Vector3> ordered( m_points.size() );
+    for ( size_t i = 0; i < m_indices.size(); i++ )
+      ordered[i] = points[m_indices[i]];
+    m_points.swap( ordered );
+  }
+
+  // Only m_indices is reordered while building, against the points in
+  // input order.
+  void PointKdTree::build( size_t begin, size_t end ) {
+    if ( end - begin <= kLeafSize )
+      return;
+
+    Vector3 lo = m_points[m_indices[begin]], hi = lo;
+    for ( size_t i = begin + 1; i < end; i++ ) {
+      Vector3 const& p = m_points[m_indices[i]];
+      for ( int k = 0; k < 3; k++ ) {
+        lo[k] = std::min( lo[k], p[k] );
+        hi[k] = std::max( hi[k], p[k] );
+      }
+    }
+    Vector3 extent = hi - lo;
+    int axis = 0;
+    if ( extent[1] > extent[axis] ) axis = 1;
+    if ( extent[2] > extent[axis] ) axis = 2;
+
+    size_t mid = begin + (end - begin) / 2;
+    std::nth_element( m_indices.begin() + begin, m_indices.begin() + mid,
+                      m_indices.begin() + end, AxisLess( m_points, axis ) );
+    m_axes[mid] = axis;
+    build( begin, mid );
+    build( mid + 1, end );
+  }
+
+  void PointKdTree::search( size_t begin, size_t end, Vector3 const& query,
+                            size_t& best, double& best_dist2 ) const {
+    if ( end - begin <= kLeafSize ) {
+      for ( size_t i = begin; i < end; i++ ) {
+        double dist2 = norm_2_sqr( m_points[i] - query );
+        if ( dist2 < best_dist2 ) {
+          best_dist2 = dist2;
+          best = i;
+        }
+      }
+      return;
+    }
+
+    size_t mid = begin + (end - begin) / 2;
+    double dist2 = norm_2_sqr( m_points[mid] - query );
+    if ( dist2 < best_dist2 ) {
+      best_dist2 = dist2;
+      best = mid;
+    }
+
+    // Search the side of the query first, and the other side only if
+    // it may hold a closer point.
+    double diff = query[m_axes[mid]] - m_points[mid][m_axes[mid]];
+    if ( diff < 0 ) {
+      search( begin, mid, query, best, best_dist2 );
+      if ( diff * diff < best_dist2 )
+        search( mid + 1, end, query, best, best_dist2 );
+    } else {
+      search( mid + 1, end, query, best, best_dist2 );
+      if ( diff * diff < best_dist2 )
+        search( begin, mid, query, best, best_dist2 );
+    }
+  }
+
+  long PointKdTree::nearest( Vector3 const& query, double& dist2, double max_dist ) const {
+    size_t best = m_points.size();
+    dist2 = max_dist * max_dist;
+    search( 0, m_points.size(), query, best, dist2 );
+    if ( best == m_points.size() )
+      return -1;
+    return long( m_indices[best] );
+  }
+
+}
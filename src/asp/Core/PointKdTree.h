@@ -0,0 +1,62 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file PointKdTree.h
+///
+/// A static kd-tree over 3D points for nearest neighbor queries.
+
+#ifndef __ASP_CORE_POINT_KD_TREE_H__
+#define __ASP_CORE_POINT_KD_TREE_H__
+
+#include <limits>
+#include <vector>
+#include <vw/Math/Vector.h>
+
+namespace asp {
+
+  // The points are copied and reordered into a balanced tree: the
+  // median of each range, along the axis of its largest extent, sits
+  // at the middle of the range and splits it in two. Small ranges are
+  // searched linearly. Queries are const and may run concurrently.
+  class PointKdTree {
+    std::vector<vw::Vector3>  m_points;  // In tree order
+    std::vector<vw::uint32>   m_indices; // Index of each point in the input
+    std::vector<vw::uint8>    m_axes;    // Split axis of the range centered here
+
+    void build( size_t begin, size_t end );
+    void search( size_t begin, size_t end, vw::Vector3 const& query,
+                 size_t& best, double& best_dist2 ) const;
+
+  public:
+    static const size_t kLeafSize = 8;
+
+    PointKdTree() {}
+    PointKdTree( std::vector<vw::Vector3> const& points );
+
+    size_t size() const { return m_points.size(); }
+
+    // The input index of the point nearest to 'query' that is closer
+    // than 'max_dist', or -1 if there is none. Its squared distance is
+    // returned in 'dist2'.
+    long nearest( vw::Vector3 const& query, double& dist2,
+                  double max_dist = std::numeric_limits<double>::infinity() ) const;
+  };
+
+}
+
+#endif//__ASP_CORE_POINT_KD_TREE_H__
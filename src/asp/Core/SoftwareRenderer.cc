@@ -92,37 +92,33 @@ struct Coords
   RealT x, y, z, w;
 };
 
-// Color structure.  Colors are composed of red, green, blue and alpha.
+// Color structure.  A color is a set of independent attribute
+// channels (e.g. height, error, intensity) that are all interpolated
+// across the triangle.
 struct Color
 {
   Color() {}
-  Color(float gray) { r = gray; g = 0.0; b = 0.0; a = 1.0; }
+  Color(float gray)
+  {
+    c[0] = gray;
+    for (int i = 1; i < SoftwareRenderer::kMaxColorComponents; ++i)
+      c[i] = 0.0;
+  }
   Color(float color[], int numComponents)
   {
-    switch (numComponents)
-    {
-    case 1:
-      r = color[0]; g = 0.0; b = 0.0; a = 1.0;
-      return;
-    case 3:
-      r = color[0]; g = color[1]; b = color[2]; a = 1.0;
-      return;
-    case 4:
-      r = color[0]; g = color[1]; b = color[2]; a = color[3];
-      return;
-    }
+    for (int i = 0; i < numComponents; ++i)
+      c[i] = color[i];
   }
-  RealT r, g, b, a;
+  RealT c[SoftwareRenderer::kMaxColorComponents];
 };
 
-// Interpolator record for color interpolators.  Used for primary and
-// secondary colors;
+// Interpolator record for color interpolators, one entry per channel.
 struct ColorIterator
 {
-  RealT rLittle, gLittle, bLittle, aLittle;
-  RealT rBig, gBig, bBig, aBig;
-  RealT drdx, dgdx, dbdx, dadx;
-  RealT drdy, dgdy, dbdy, dady;
+  RealT little[SoftwareRenderer::kMaxColorComponents];
+  RealT big[SoftwareRenderer::kMaxColorComponents];
+  RealT dx[SoftwareRenderer::kMaxColorComponents];
+  RealT dy[SoftwareRenderer::kMaxColorComponents];
 };
 
 // A fragment is a collection of all the data needed after
@@ -135,8 +131,7 @@ struct FragmentInfo
 {
   FragmentInfo() {}
   int x, y;                                // Screen x, y
-  // Colors of the fragment.  When in colorIndexMode only the r
-  // component is valid.
+  // Colors of the fragment, one value per channel.
   Color color;
 };
 
@@ -169,7 +164,8 @@ struct RasterInfo
 struct GraphicsState
 {
   GraphicsState() {}
-  float *buffer;
+  float *buffer;                // numChannels interleaved floats per pixel
+  int numChannels;
   int numPixels;
   int width;
   int height;
@@ -273,36 +269,21 @@ SetInitialParameters(GraphicsState *gc, const Vertex *a, RealT dx, RealT dy)
   RasterInfo *rasterInfo = &gc->rasterInfo;
   RealT big = rasterInfo->dxLeftBig;
   RealT little = rasterInfo->dxLeftLittle;
-  const Color *vertexColor;
-  Color *fragColor;
-  ColorIterator *iter;
   unsigned int modeFlags = rasterInfo->modeFlags;
 
-  if (big > little)
-  {
-    if (modeFlags & eShadeSmooth)
-    {
-      vertexColor = &a->color;
-      fragColor = &rasterInfo->frag.color;
-      iter = &rasterInfo->colorIter;
+  if (!(modeFlags & eShadeSmooth))
+    return;
 
-      fragColor->r = vertexColor->r + dx*iter->drdx + dy*iter->drdy;
-      iter->rLittle = iter->drdy + little * iter->drdx;
-      iter->rBig = iter->rLittle + iter->drdx;
-    }
-  }
-  else
-  {
-    if (modeFlags & eShadeSmooth)
-    {
-      vertexColor = &a->color;
-      fragColor = &rasterInfo->frag.color;
-      iter = &rasterInfo->colorIter;
+  const Color *vertexColor = &a->color;
+  Color *fragColor = &rasterInfo->frag.color;
+  ColorIterator *iter = &rasterInfo->colorIter;
+  RealT sign = (big > little) ? 1.0 : -1.0;
 
-      fragColor->r = vertexColor->r + dx*iter->drdx + dy*iter->drdy;
-      iter->rLittle = iter->drdy + little * iter->drdx;
-      iter->rBig = iter->rLittle - iter->drdx;
-    }
+  for (int i = 0; i < gc->numChannels; ++i)
+  {
+    fragColor->c[i] = vertexColor->c[i] + dx*iter->dx[i] + dy*iter->dy[i];
+    iter->little[i] = iter->dy[i] + little * iter->dx[i];
+    iter->big[i] = iter->little[i] + sign * iter->dx[i];
   }
 }
 
@@ -325,15 +306,26 @@ DrawFlatGraySpan(GraphicsState *gc)
   // Check to see if we just removed this line
   if ( length < 1 ) return;
 
-  std::fill_n(&(gc->buffer[gc->rasterInfo.frag.y * gc->width + x]),
-              length, float(gc->rasterInfo.frag.color.r));
+  const int numChannels = gc->numChannels;
+  float *span =
+    &(gc->buffer[(gc->rasterInfo.frag.y * gc->width + x) * numChannels]);
+  if (numChannels == 1) {
+    std::fill_n(span, length, float(gc->rasterInfo.frag.color.c[0]));
+    return;
+  }
+  for (int i = length; i; --i)
+    for (int j = 0; j < numChannels; ++j)
+      *span++ = float(gc->rasterInfo.frag.color.c[j]);
 }
 
 static void
 DrawGraySpan(GraphicsState *gc)
 {
-  RealT gray = gc->rasterInfo.frag.color.r;
-  RealT drdx = gc->rasterInfo.colorIter.drdx;
+  const int numChannels = gc->numChannels;
+  const RealT *dx = gc->rasterInfo.colorIter.dx;
+  RealT value[SoftwareRenderer::kMaxColorComponents];
+  for (int j = 0; j < numChannels; ++j)
+    value[j] = gc->rasterInfo.frag.color.c[j];
 
   // Evaluate the clipping in the X direction
   int length = gc->rasterInfo.length;
@@ -342,7 +334,8 @@ DrawGraySpan(GraphicsState *gc)
     int difference = gc->clipX0 - x;
     length -= difference;
     x = gc->clipX0;
-    gray += RealT(difference) * drdx;
+    for (int j = 0; j < numChannels; ++j)
+      value[j] += RealT(difference) * dx[j];
   }
   if ( x + length > gc->clipX1 ) { // Check to see the line goes off
                                    // the right
@@ -353,11 +346,13 @@ DrawGraySpan(GraphicsState *gc)
   if ( length < 1 ) return;
 
   float *span =
-    &(gc->buffer[gc->rasterInfo.frag.y * gc->width + x ] );
+    &(gc->buffer[(gc->rasterInfo.frag.y * gc->width + x) * numChannels]);
 
   for (int i = length; i; --i) {
-    *span++ = float(gray);
-    gray += drdx;
+    for (int j = 0; j < numChannels; ++j) {
+      *span++ = float(value[j]);
+      value[j] += dx[j];
+    }
   }
 }
 
@@ -500,13 +495,15 @@ FillSubTriangle(GraphicsState *gc,  int iyBottom, int iyTop)
       ixLeftFrac &= ~0x80000000;
 
       if (modeFlags & eShadeSmooth)
-        gc->rasterInfo.frag.color.r += gc->rasterInfo.colorIter.rBig;
+        for (int j = 0; j < gc->numChannels; ++j)
+          gc->rasterInfo.frag.color.c[j] += gc->rasterInfo.colorIter.big[j];
     }
     else                            // Use small step
     {
       ixLeft += dxLeftLittle;
       if (modeFlags & eShadeSmooth)
-        gc->rasterInfo.frag.color.r += gc->rasterInfo.colorIter.rLittle;
+        for (int j = 0; j < gc->numChannels; ++j)
+          gc->rasterInfo.frag.color.c[j] += gc->rasterInfo.colorIter.little[j];
     }
   }
   gc->rasterInfo.ixLeft = ixLeft;
@@ -557,19 +554,20 @@ FillTriangle(GraphicsState *gc, Vertex *a, Vertex *b, Vertex *c)
 
   if (modeFlags & eShadeSmooth)
   {
-    RealT drAC, drBC;
     Color *cColor = &c->color;             // & -LJE
 
-    // If gray scale the intensity is carried in the red component
-    drAC = aColor->r - cColor->r;
-    drBC = bColor->r - cColor->r;
-    gc->rasterInfo.colorIter.drdx = drAC * t2 - drBC * t1;
-    gc->rasterInfo.colorIter.drdy = drBC * t3 - drAC * t4;
+    // Each channel is interpolated independently
+    for (int j = 0; j < gc->numChannels; ++j)
+    {
+      RealT drAC = aColor->c[j] - cColor->c[j];
+      RealT drBC = bColor->c[j] - cColor->c[j];
+      gc->rasterInfo.colorIter.dx[j] = drAC * t2 - drBC * t1;
+      gc->rasterInfo.colorIter.dy[j] = drBC * t3 - drAC * t4;
+    }
   }
   else
   {
-    Color *flatColor = &gc->currentFlatColor; // & -LJE
-    gc->rasterInfo.frag.color.r = flatColor->r;
+    gc->rasterInfo.frag.color = gc->currentFlatColor;
   }
 
   // Snap each y coordinate to its pixel center
@@ -694,7 +692,8 @@ SoftwareRenderer::SoftwareRenderer(const int width, const int height, float *buf
   // FIX ME!!! Put this state info in the software renderer class
   GraphicsState *graphicsState = new GraphicsState;
   graphicsState->buffer = m_buffer;
-  graphicsState->currentFlatColor.r = m_currentFlatColor[0];
+  graphicsState->numChannels = 1;
+  graphicsState->currentFlatColor = ::Color(m_currentFlatColor[0]);
   graphicsState->width = m_bufferWidth;
   graphicsState->height = m_bufferHeight;
   graphicsState->rasterInfo.modeFlags = eShadeSmooth;
@@ -739,7 +738,8 @@ SoftwareRenderer::Ortho2D(const double left, const double right,
 
 void
 SoftwareRenderer::Clear(const float value) {
-  int bufferSize = m_bufferWidth * m_bufferHeight;
+  int bufferSize = m_bufferWidth * m_bufferHeight *
+    static_cast<GraphicsState*>(m_graphicsState)->numChannels;
   for (int i = 0; i < bufferSize; ++i)
     m_buffer[i] = value;
 }
@@ -756,7 +756,12 @@ SoftwareRenderer::SetVertexPointer(const int numComponents, float * const vertic
 void
 SoftwareRenderer::SetColorPointer(const int numComponents, float * const colors)
 {
+  if (numComponents < 1 || numComponents > kMaxColorComponents)
+    vw_throw(ArgumentErr() << "SoftwareRenderer: SetColorPointer supports 1 to "
+             << kMaxColorComponents << " color components, got " << numComponents << ".");
+
   m_numColorComponents = numComponents;
+  static_cast<GraphicsState*>(m_graphicsState)->numChannels = numComponents;
   m_triangleColorStep = kVerticesPerTriangle * m_numColorComponents;
 
   m_colorPointer = colors;
@@ -25,8 +25,14 @@
 namespace vw {
 namespace stereo {
 
+  // Rasterizes triangles into a float buffer, interpolating every
+  // color component of the vertices. With N color components (see
+  // SetColorPointer) the buffer holds N interleaved floats per pixel,
+  // so several attributes can be rendered in a single pass.
   struct SoftwareRenderer {
 
+      static const int kMaxColorComponents = 8;
+
       SoftwareRenderer(int bufferWidth, int bufferHeight, float *buffer = 0);
       ~SoftwareRenderer();
       void Ortho2D(const double left, const double right,
@@ -184,6 +184,8 @@ namespace asp {
        "Use rigorous least squares triangulation process. This is slow for ISIS processes.")
       ("compute-error-vector", po::bool_switch(&global.compute_error_vector)->default_value(false)->implicit_value(true),
        "Compute the triangulation error vector, not just its length.")
+      ("point-cloud-precision", po::value(&global.point_cloud_precision)->default_value(0.0),
+       "Store the point cloud as 32-bit integers relative to a local origin, in steps of this many meters (e.g., 0.001). The default of 0 stores it as 64-bit floats.")
       ;
   }
 
@@ -223,6 +225,9 @@ namespace asp {
                universe_center == "none",
                ArgumentErr() << "\"" << universe_center
                << "\" is not a valid option for UNIVERSE_CENTER." );
+
+    VW_ASSERT( point_cloud_precision >= 0,
+               ArgumentErr() << "POINT_CLOUD_PRECISION must not be negative." );
   }
 
   void StereoSettings::write_copy( int argc, char *argv[],
@@ -40,6 +40,8 @@ namespace asp {
     std::string stereo_session_string, stereo_default_filename;
     boost::shared_ptr<asp::StereoSession> session; // Used to extract cameras
     vw::BBox2i left_image_crop_win;                // Used to do stereo in a region
+    bool tif_intermediates;                        // Write -D, -RD, -F as GeoTIFF
+    bool telemetry;                                // Write <prefix>-telemetry.jsonl
 
     // Output
     std::string out_prefix;
@@ -150,6 +152,8 @@ namespace asp {
     float far_universe_radius;        // Radius of the universe in meters
     bool use_least_squares;           // Use a more rigorous triangulation
     bool compute_error_vector;        // Compute the triangulation error vector, not just its length
+    double point_cloud_precision;     // Store the point cloud as int32 in steps of this
+                                      // many meters. Zero stores it as float64.
 
     // DG Options
     bool disable_correct_velocity_aberration;
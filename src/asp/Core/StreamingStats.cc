@@ -0,0 +1,302 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file StreamingStats.cc
+///
+
+#include <vw/Core/Exception.h>
+#include <asp/Core/StreamingStats.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+using namespace vw;
+
+namespace asp {
+
+  QuantileSketch::QuantileSketch( double relative_accuracy, double min_value ) :
+    m_relative_accuracy(relative_accuracy), m_min_value(min_value),
+    m_positive_min_key(0), m_negative_min_key(0), m_zero_count(0), m_count(0) {
+    VW_ASSERT( relative_accuracy > 0 && relative_accuracy < 1,
+               ArgumentErr() << "QuantileSketch: the relative accuracy must be in (0, 1)." );
+    VW_ASSERT( min_value > 0,
+               ArgumentErr() << "QuantileSketch: the minimum value must be positive." );
+    m_gamma = (1 + relative_accuracy) / (1 - relative_accuracy);
+    m_inv_log_gamma = 1.0 / std::log(m_gamma);
+  }
+
+  // Bucket 'key' holds the magnitudes in (gamma^(key-1), gamma^key]
+  int32 QuantileSketch::key( double magnitude ) const {
+    return int32( std::ceil( std::log(magnitude) * m_inv_log_gamma ) );
+  }
+
+  // The value within relative_accuracy of every magnitude in the bucket
+  double QuantileSketch::value( int32 key ) const {
+    return 2.0 * std::pow(m_gamma, key) / (m_gamma + 1);
+  }
+
+  void QuantileSketch::add_to( std::vector<uint64>& buckets, int32& min_key,
+                               int32 key, uint64 count ) {
+    if ( buckets.empty() ) {
+      min_key = key;
+    } else if ( key < min_key ) {
+      buckets.insert( buckets.begin(), min_key - key, 0 );
+      min_key = key;
+    }
+    size_t index = key - min_key;
+    if ( index >= buckets.size() )
+      buckets.resize( index + 1, 0 );
+    buckets[index] += count;
+  }
+
+  void QuantileSketch::add( double value ) {
+    if ( value != value ) return; // NaN
+    double magnitude = std::abs(value);
+    if ( magnitude < m_min_value )
+      m_zero_count++;
+    else if ( value > 0 )
+      add_to( m_positive, m_positive_min_key, key(magnitude), 1 );
+    else
+      add_to( m_negative, m_negative_min_key, key(magnitude), 1 );
+    m_count++;
+  }
+
+  void QuantileSketch::merge( QuantileSketch const& other ) {
+    VW_ASSERT( m_relative_accuracy == other.m_relative_accuracy &&
+               m_min_value == other.m_min_value,
+               ArgumentErr() << "QuantileSketch: cannot merge sketches with different parameters." );
+    for ( size_t i = 0; i < other.m_positive.size(); i++ )
+      if ( other.m_positive[i] )
+        add_to( m_positive, m_positive_min_key, other.m_positive_min_key + int32(i),
+                other.m_positive[i] );
+    for ( size_t i = 0; i < other.m_negative.size(); i++ )
+      if ( other.m_negative[i] )
+        add_to( m_negative, m_negative_min_key, other.m_negative_min_key + int32(i),
+                other.m_negative[i] );
+    m_zero_count += other.m_zero_count;
+    m_count      += other.m_count;
+  }
+
+  double QuantileSketch::quantile( double q ) const {
+    if ( m_count == 0 )
+      return std::numeric_limits<double>::quiet_NaN();
+    q = std::max( 0.0, std::min( 1.0, q ) );
+    uint64 rank = uint64( q * double(m_count - 1) );
+
+    // Walk the values in increasing order: the negative buckets from
+    // the largest magnitude down, zero, then the positive buckets up.
+    uint64 seen = 0;
+    for ( size_t i = m_negative.size(); i-- > 0; ) {
+      seen += m_negative[i];
+      if ( seen > rank )
+        return -value( m_negative_min_key + int32(i) );
+    }
+    seen += m_zero_count;
+    if ( seen > rank )
+      return 0.0;
+    for ( size_t i = 0; i < m_positive.size(); i++ ) {
+      seen += m_positive[i];
+      if ( seen > rank )
+        return value( m_positive_min_key + int32(i) );
+    }
+    return value( m_positive_min_key + int32(m_positive.size()) - 1 );
+  }
+
+  double QuantileSketch::median_absolute_deviation() const {
+    if ( m_count == 0 )
+      return std::numeric_limits<double>::quiet_NaN();
+    double median = quantile( 0.5 );
+
+    // Deviations of the bucket values, with their counts
+    std::vector<std::pair<double, uint64> > deviations;
+    deviations.reserve( m_positive.size() + m_negative.size() + 1 );
+    for ( size_t i = 0; i < m_positive.size(); i++ )
+      if ( m_positive[i] )
+        deviations.push_back( std::make_pair( std::abs( value(m_positive_min_key + int32(i)) - median ),
+                                              m_positive[i] ) );
+    for ( size_t i = 0; i < m_negative.size(); i++ )
+      if ( m_negative[i] )
+        deviations.push_back( std::make_pair( std::abs( -value(m_negative_min_key + int32(i)) - median ),
+                                              m_negative[i] ) );
+    if ( m_zero_count )
+      deviations.push_back( std::make_pair( std::abs(median), m_zero_count ) );
+    std::sort( deviations.begin(), deviations.end() );
+
+    uint64 rank = (m_count - 1) / 2, seen = 0;
+    for ( size_t i = 0; i < deviations.size(); i++ ) {
+      seen += deviations[i].second;
+      if ( seen > rank )
+        return deviations[i].first;
+    }
+    return deviations.back().first;
+  }
+
+  BinnedHistogram::BinnedHistogram( double bin_width, size_t max_bins ) :
+    m_bin_width(bin_width), m_max_bins(max_bins), m_level(0), m_count(0) {
+    VW_ASSERT( bin_width > 0,
+               ArgumentErr() << "BinnedHistogram: the bin width must be positive." );
+    VW_ASSERT( max_bins > 1,
+               ArgumentErr() << "BinnedHistogram: there must be more than one bin." );
+  }
+
+  double BinnedHistogram::width() const {
+    return std::ldexp( m_bin_width, m_level );
+  }
+
+  // Merge the bins in pairs. Bin 'key' holds [key, key+1) * width, so
+  // it goes to the bin floor(key/2) of the doubled width.
+  void BinnedHistogram::coarsen() {
+    std::map<int64, uint64> bins;
+    for ( std::map<int64, uint64>::const_iterator it = m_bins.begin(); it != m_bins.end(); ++it ) {
+      int64 key = it->first >= 0 ? it->first / 2 : -( ( -it->first + 1 ) / 2 );
+      bins[key] += it->second;
+    }
+    m_bins.swap( bins );
+    m_level++;
+  }
+
+  void BinnedHistogram::add( double value ) {
+    if ( value != value ) return; // NaN
+    // Clamped so that infinities have a bin too
+    double key = std::floor( value / width() );
+    key = std::max( -4e18, std::min( 4e18, key ) );
+    m_bins[int64(key)]++;
+    m_count++;
+    while ( m_bins.size() > m_max_bins )
+      coarsen();
+  }
+
+  void BinnedHistogram::merge( BinnedHistogram const& other ) {
+    VW_ASSERT( m_bin_width == other.m_bin_width && m_max_bins == other.m_max_bins,
+               ArgumentErr() << "BinnedHistogram: cannot merge histograms with different parameters." );
+    if ( other.m_count == 0 )
+      return;
+    while ( m_level < other.m_level )
+      coarsen();
+    BinnedHistogram coarser;
+    BinnedHistogram const* source = &other;
+    if ( other.m_level < m_level ) {
+      coarser = other;
+      while ( coarser.m_level < m_level )
+        coarser.coarsen();
+      source = &coarser;
+    }
+    for ( std::map<int64, uint64>::const_iterator it = source->m_bins.begin();
+          it != source->m_bins.end(); ++it )
+      m_bins[it->first] += it->second;
+    m_count += other.m_count;
+    while ( m_bins.size() > m_max_bins )
+      coarsen();
+  }
+
+  double BinnedHistogram::quantile( double q ) const {
+    if ( m_count == 0 )
+      return std::numeric_limits<double>::quiet_NaN();
+    q = std::max( 0.0, std::min( 1.0, q ) );
+    uint64 rank = uint64( q * double(m_count - 1) ), seen = 0;
+    for ( std::map<int64, uint64>::const_iterator it = m_bins.begin(); it != m_bins.end(); ++it ) {
+      seen += it->second;
+      if ( seen > rank )
+        return value( it->first );
+    }
+    return value( m_bins.rbegin()->first );
+  }
+
+  double BinnedHistogram::mad() const {
+    if ( m_count == 0 )
+      return std::numeric_limits<double>::quiet_NaN();
+
+    // Find the bin of the median
+    uint64 rank = (m_count - 1) / 2, seen = 0;
+    std::map<int64, uint64>::const_iterator median = m_bins.begin();
+    for ( ; median != m_bins.end(); ++median ) {
+      seen += median->second;
+      if ( seen > rank )
+        break;
+    }
+
+    // The deviations of the bins grow going away from the median on
+    // either side, so merge the two sides in order of deviation.
+    typedef std::map<int64, uint64>::const_iterator Iter;
+    typedef std::map<int64, uint64>::const_reverse_iterator RevIter;
+    RevIter below( median );      // The bin before the median
+    Iter above( median ); ++above; // The bin after it
+    seen = median->second;
+    int64 deviation = 0;
+    while ( seen <= rank ) {
+      bool take_below = above == m_bins.end() ||
+        ( below != m_bins.rend() && median->first - below->first <= above->first - median->first );
+      if ( take_below ) {
+        deviation = median->first - below->first;
+        seen += below->second;
+        ++below;
+      } else {
+        deviation = above->first - median->first;
+        seen += above->second;
+        ++above;
+      }
+    }
+    return double(deviation) * width();
+  }
+
+  StreamingStats::StreamingStats( double relative_accuracy, double min_value ) :
+    m_count(0), m_mean(0), m_m2(0), m_sum_sq(0),
+    m_min(std::numeric_limits<double>::infinity()),
+    m_max(-std::numeric_limits<double>::infinity()),
+    m_sketch(relative_accuracy, min_value) {}
+
+  void StreamingStats::merge( StreamingStats const& other ) {
+    if ( other.m_count == 0 )
+      return;
+    uint64 count = m_count + other.m_count;
+    double delta = other.m_mean - m_mean;
+    m_mean   += delta * double(other.m_count) / double(count);
+    m_m2     += other.m_m2 + delta * delta * double(m_count) * double(other.m_count) / double(count);
+    m_sum_sq += other.m_sum_sq;
+    m_min     = std::min( m_min, other.m_min );
+    m_max     = std::max( m_max, other.m_max );
+    m_count   = count;
+    m_sketch.merge( other.m_sketch );
+  }
+
+  double StreamingStats::mean() const {
+    return m_count ? m_mean : std::numeric_limits<double>::quiet_NaN();
+  }
+
+  double StreamingStats::rms() const {
+    return m_count ? std::sqrt( m_sum_sq / double(m_count) )
+                   : std::numeric_limits<double>::quiet_NaN();
+  }
+
+  // The population standard deviation
+  double StreamingStats::stddev() const {
+    return m_count ? std::sqrt( m_m2 / double(m_count) )
+                   : std::numeric_limits<double>::quiet_NaN();
+  }
+
+  double StreamingStats::min() const {
+    return m_count ? m_min : std::numeric_limits<double>::quiet_NaN();
+  }
+
+  double StreamingStats::max() const {
+    return m_count ? m_max : std::numeric_limits<double>::quiet_NaN();
+  }
+
+}
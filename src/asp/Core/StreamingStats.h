@@ -0,0 +1,147 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file StreamingStats.h
+///
+/// Statistics of a stream of values that can be computed on tiles in
+/// parallel and merged afterwards.
+
+#ifndef __ASP_CORE_STREAMING_STATS_H__
+#define __ASP_CORE_STREAMING_STATS_H__
+
+#include <map>
+#include <vector>
+#include <vw/Core/FundamentalTypes.h>
+
+namespace asp {
+
+  // A quantile sketch with relative accuracy (after DDSketch). Values
+  // are counted in buckets whose bounds grow geometrically, so any
+  // quantile is returned within a relative error 'relative_accuracy'
+  // of a value of the right rank. Values smaller in magnitude than
+  // 'min_value' are counted as zero. Sketches with the same parameters
+  // merge exactly.
+  class QuantileSketch {
+    double m_relative_accuracy, m_min_value;
+    double m_gamma, m_inv_log_gamma;
+    // Dense bucket counts for the positive and negative values, the
+    // first one having key m_*_min_key.
+    std::vector<vw::uint64> m_positive, m_negative;
+    vw::int32 m_positive_min_key, m_negative_min_key;
+    vw::uint64 m_zero_count, m_count;
+
+    vw::int32 key( double magnitude ) const;
+    double value( vw::int32 key ) const;
+    static void add_to( std::vector<vw::uint64>& buckets, vw::int32& min_key,
+                        vw::int32 key, vw::uint64 count );
+
+  public:
+    QuantileSketch( double relative_accuracy = 0.005, double min_value = 1e-6 );
+
+    void add( double value );
+    void merge( QuantileSketch const& other );
+
+    vw::uint64 count() const { return m_count; }
+
+    // The value of rank q*(count-1), for q in [0, 1]. NaN if empty.
+    double quantile( double q ) const;
+
+    // The median of the absolute deviations from the median, within
+    // about relative_accuracy*(|median| + MAD), so it is only useful
+    // when the values are centered near zero. See BinnedHistogram.
+    // NaN if empty.
+    double median_absolute_deviation() const;
+  };
+
+  // A histogram of values in bins of a fixed width, which gives their
+  // median within half a bin and their median absolute deviation
+  // within a bin in a single pass, however far from zero they are.
+  // Only the bins that are hit are stored. Once there are more than
+  // 'max_bins' of them the width doubles, so outliers cost precision
+  // rather than memory. Histograms with the same parameters merge
+  // exactly, the finer one being coarsened to the width of the other.
+  class BinnedHistogram {
+    double m_bin_width;
+    size_t m_max_bins;
+    vw::int32 m_level; // The bins are m_bin_width * 2^m_level wide
+    std::map<vw::int64, vw::uint64> m_bins;
+    vw::uint64 m_count;
+
+    double width() const;
+    double value( vw::int64 key ) const { return ( double(key) + 0.5 ) * width(); }
+    void coarsen();
+
+  public:
+    BinnedHistogram( double bin_width = 1e-3, size_t max_bins = 1 << 18 );
+
+    void add( double value );
+    void merge( BinnedHistogram const& other );
+
+    vw::uint64 count() const { return m_count; }
+    // The current width of the bins
+    double bin_width() const { return width(); }
+
+    // All of these are NaN if no value was added.
+    // The center of the bin of the value of rank q*(count-1).
+    double quantile( double q ) const;
+    double median() const { return quantile( 0.5 ); }
+    double mad() const;
+    // Normalized median absolute deviation, which is the standard
+    // deviation for normally distributed values.
+    double nmad() const { return 1.4826 * mad(); }
+  };
+
+  // Count, moments, extremes and a quantile sketch of a stream of
+  // values. The mean and variance are accumulated as in Welford's
+  // algorithm, and merged as in Chan et al.
+  class StreamingStats {
+    vw::uint64 m_count;
+    double m_mean, m_m2, m_sum_sq, m_min, m_max;
+    QuantileSketch m_sketch;
+
+  public:
+    StreamingStats( double relative_accuracy = 0.005, double min_value = 1e-6 );
+
+    void add( double value ) {
+      if ( value != value ) return; // NaN
+      m_count++;
+      double delta = value - m_mean;
+      m_mean   += delta / double(m_count);
+      m_m2     += delta * (value - m_mean);
+      m_sum_sq += value * value;
+      if ( value < m_min ) m_min = value;
+      if ( value > m_max ) m_max = value;
+      m_sketch.add( value );
+    }
+    void merge( StreamingStats const& other );
+
+    // All of these are NaN if no value was added.
+    vw::uint64 count() const { return m_count; }
+    double mean() const;
+    double rms() const;
+    double stddev() const;
+    double min() const;
+    double max() const;
+    // Within relative_accuracy of a value of the right rank. Use a
+    // BinnedHistogram for the NMAD.
+    double quantile( double q ) const { return m_sketch.quantile( q ); }
+  };
+
+}
+
+#endif//__ASP_CORE_STREAMING_STATS_H__
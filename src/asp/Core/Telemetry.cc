@@ -0,0 +1,254 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file Telemetry.cc
+///
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Settings.h>
+#include <asp/Core/Telemetry.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+using namespace vw;
+
+namespace {
+
+  // Create a single instance of the Telemetry
+  vw::RunOnce telemetry_once = VW_RUNONCE_INIT;
+  boost::shared_ptr<asp::Telemetry> telemetry_ptr;
+  void init_telemetry() {
+    telemetry_ptr = boost::shared_ptr<asp::Telemetry>(new asp::Telemetry());
+  }
+
+  // For each tile being measured in this thread, the totals of the
+  // tiles nested in it that are already finished.
+  typedef std::vector<asp::ThreadUsage> NestedTotals;
+  boost::thread_specific_ptr<NestedTotals> nested_totals;
+
+  NestedTotals& nested() {
+    if ( !nested_totals.get() )
+      nested_totals.reset( new NestedTotals() );
+    return *nested_totals;
+  }
+
+  // Bytes this thread read to measure its own reads
+  boost::thread_specific_ptr<vw::uint64> own_reads_count;
+
+  vw::uint64& own_reads() {
+    if ( !own_reads_count.get() )
+      own_reads_count.reset( new vw::uint64(0) );
+    return *own_reads_count;
+  }
+
+  asp::ThreadUsage difference( asp::ThreadUsage const& a, asp::ThreadUsage const& b ) {
+    asp::ThreadUsage d;
+    d.wall_time  = a.wall_time - b.wall_time;
+    d.cpu_time   = a.cpu_time - b.cpu_time;
+    d.bytes_read = a.bytes_read > b.bytes_read ? a.bytes_read - b.bytes_read : 0;
+    return d;
+  }
+
+  std::string json_string( std::string const& s ) {
+    std::ostringstream ostr;
+    ostr << '"';
+    for ( size_t i = 0; i < s.size(); i++ ) {
+      unsigned char c = s[i];
+      if ( c == '"' || c == '\\' )
+        ostr << '\\' << c;
+      else if ( c < 0x20 )
+        ostr << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec;
+      else
+        ostr << c;
+    }
+    ostr << '"';
+    return ostr.str();
+  }
+
+  double process_cpu_time() {
+    struct rusage usage;
+    if ( getrusage( RUSAGE_SELF, &usage ) != 0 )
+      return 0;
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+  }
+
+}
+
+namespace asp {
+
+  ThreadUsage ThreadUsage::now() {
+    ThreadUsage usage;
+
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    usage.wall_time = tv.tv_sec + tv.tv_usec * 1e-6;
+
+    usage.cpu_time = 0;
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+    if ( clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts ) == 0 )
+      usage.cpu_time = ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+
+    // Linux counts the bytes each thread reads, whether or not they
+    // came from the page cache. Reading the count is itself a read,
+    // which is taken out again.
+    usage.bytes_read = 0;
+#if defined(__linux__)
+    char path[64], buffer[1024];
+    snprintf( path, sizeof(path), "/proc/self/task/%ld/io", long( syscall(SYS_gettid) ) );
+    int fd = ::open( path, O_RDONLY );
+    if ( fd >= 0 ) {
+      ssize_t size = ::read( fd, buffer, sizeof(buffer) - 1 );
+      ::close( fd );
+      if ( size > 0 ) {
+        buffer[size] = 0;
+        unsigned long long rchar;
+        const char* line = strstr( buffer, "rchar:" );
+        if ( line && sscanf( line, "rchar: %llu", &rchar ) == 1 ) {
+          uint64& overhead = own_reads();
+          usage.bytes_read = rchar - overhead;
+          overhead += size;
+        }
+      }
+    }
+#endif
+    return usage;
+  }
+
+  uint64 peak_rss_kb() {
+    struct rusage usage;
+    if ( getrusage( RUSAGE_SELF, &usage ) != 0 )
+      return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+  }
+
+  void Telemetry::open( std::string const& filename, std::string const& stage ) {
+    close();
+    Mutex::Lock lock( m_mutex );
+    m_file.open( filename.c_str(), std::ios::app );
+    if ( !m_file )
+      vw_throw( IOErr() << "Unable to open the telemetry file " << filename << ".\n" );
+    m_stage = stage;
+    m_open_time = ThreadUsage::now().wall_time;
+    m_file << std::fixed << std::setprecision(6)
+           << "{\"event\": \"start\", \"stage\": " << json_string(m_stage)
+           << ", \"time\": " << m_open_time
+           << ", \"threads\": " << vw_settings().default_num_threads()
+           << ", \"tile_size\": " << vw_settings().default_tile_size() << "}" << std::endl;
+    m_enabled = true;
+  }
+
+  void Telemetry::close() {
+    Mutex::Lock lock( m_mutex );
+    if ( !m_enabled )
+      return;
+    m_file << "{\"event\": \"finish\", \"stage\": " << json_string(m_stage)
+           << ", \"wall\": " << ThreadUsage::now().wall_time - m_open_time
+           << ", \"cpu\": " << process_cpu_time()
+           << ", \"peak_rss_kb\": " << peak_rss_kb() << "}" << std::endl;
+    m_file.close();
+    m_enabled = false;
+  }
+
+  void Telemetry::record( std::string const& view, BBox2i const& bbox, int depth,
+                          ThreadUsage const& begin, ThreadUsage const& end,
+                          ThreadUsage const& self, uint64 bytes_written ) {
+    ThreadUsage total = difference( end, begin );
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(6)
+         << "{\"stage\": " << json_string(m_stage) << ", \"view\": " << json_string(view)
+         << ", \"bbox\": [" << bbox.min().x() << ", " << bbox.min().y() << ", "
+         << bbox.width() << ", " << bbox.height() << "]"
+         << ", \"depth\": " << depth
+         << ", \"start\": " << begin.wall_time - m_open_time
+         << ", \"wall\": " << total.wall_time << ", \"cpu\": " << total.cpu_time
+         << ", \"self_wall\": " << self.wall_time << ", \"self_cpu\": " << self.cpu_time
+         << ", \"bytes_read\": " << total.bytes_read
+         << ", \"self_bytes_read\": " << self.bytes_read
+         << ", \"bytes_written\": " << bytes_written
+         << ", \"peak_rss_kb\": " << peak_rss_kb() << "}\n";
+
+    Mutex::Lock lock( m_mutex );
+    if ( !m_enabled )
+      return;
+    // Flushed line by line, so a run that is killed keeps its records
+    m_file << line.str() << std::flush;
+  }
+
+  Telemetry& telemetry() {
+    telemetry_once.run( init_telemetry );
+    return *telemetry_ptr;
+  }
+
+  TileTimer::TileTimer() : m_begin( ThreadUsage::now() ), m_done(false) {
+    NestedTotals& totals = nested();
+    m_depth = int( totals.size() );
+    ThreadUsage zero;
+    zero.wall_time = zero.cpu_time = 0;
+    zero.bytes_read = 0;
+    totals.push_back( zero );
+  }
+
+  TileTimer::~TileTimer() {
+    if ( !m_done )
+      nested().pop_back();
+  }
+
+  void TileTimer::finish( std::string const& view, BBox2i const& bbox, uint64 bytes_written ) {
+    ThreadUsage end = ThreadUsage::now();
+    NestedTotals& totals = nested();
+    ThreadUsage total = difference( end, m_begin );
+    ThreadUsage self = difference( total, totals.back() );
+    totals.pop_back();
+    m_done = true;
+    if ( !totals.empty() ) {
+      totals.back().wall_time  += total.wall_time;
+      totals.back().cpu_time   += total.cpu_time;
+      totals.back().bytes_read += total.bytes_read;
+    }
+    telemetry().record( view, bbox, m_depth, m_begin, end, self, bytes_written );
+  }
+
+  std::string write_label( std::string const& filename ) {
+    size_t slash = filename.find_last_of( '/' );
+    return "write " + ( slash == std::string::npos ? filename : filename.substr( slash + 1 ) );
+  }
+
+} // namespace asp
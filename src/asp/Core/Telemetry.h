@@ -0,0 +1,160 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file Telemetry.h
+///
+/// Per-tile timing, I/O and memory records of the views a process
+/// rasterizes, written as one JSON object per line.
+
+#ifndef __ASP_CORE_TELEMETRY_H__
+#define __ASP_CORE_TELEMETRY_H__
+
+#include <fstream>
+#include <string>
+#include <boost/utility.hpp>
+
+#include <vw/Core/FundamentalTypes.h>
+#include <vw/Core/Thread.h>
+#include <vw/Math/BBox.h>
+#include <vw/Image/ImageViewBase.h>
+
+namespace asp {
+
+  /// Resource use of the calling thread at one instant.
+  struct ThreadUsage {
+    double wall_time;      // Seconds since the epoch
+    double cpu_time;       // CPU seconds used by this thread
+    vw::uint64 bytes_read; // Bytes this thread read through system calls
+
+    static ThreadUsage now();
+  };
+
+  /// Peak resident set size of the process so far, in KiB.
+  vw::uint64 peak_rss_kb();
+
+  /// Records of one process. Each stage of stereo appends to the
+  /// same file, one line per tile of each instrumented view, with a
+  /// 'start' and a 'finish' line around them. Nothing is recorded
+  /// until a file is opened.
+  class Telemetry : private boost::noncopyable {
+    vw::Mutex m_mutex;
+    std::ofstream m_file;
+    std::string m_stage;
+    double m_open_time;
+    bool m_enabled;
+
+  public:
+    Telemetry() : m_open_time(0), m_enabled(false) {}
+    ~Telemetry() { close(); }
+
+    void open( std::string const& filename, std::string const& stage );
+    void close();
+    bool enabled() const { return m_enabled; }
+
+    void record( std::string const& view, vw::BBox2i const& bbox, int depth,
+                 ThreadUsage const& begin, ThreadUsage const& end,
+                 ThreadUsage const& self, vw::uint64 bytes_written );
+  };
+
+  /// The telemetry of this process.
+  Telemetry& telemetry();
+
+  /// Measures one tile of a view. Tiles of instrumented views nested
+  /// in the same thread are subtracted from the enclosing tile, so
+  /// its 'self' times are only its own work.
+  class TileTimer : private boost::noncopyable {
+    ThreadUsage m_begin;
+    int m_depth;
+    bool m_done;
+  public:
+    TileTimer();
+    ~TileTimer();
+    void finish( std::string const& view, vw::BBox2i const& bbox, vw::uint64 bytes_written );
+  };
+
+  /// Label of the view that writes a file.
+  std::string write_label( std::string const& filename );
+
+  /// Records each tile rasterized from a view. With telemetry off it
+  /// only forwards to the view it wraps. A parent view asking for a
+  /// prerasterized tile gets the child's own prerasterized tile, so
+  /// the view stays lazy; only the work the child does up front in
+  /// prerasterize() is timed then.
+  template <class ImageT>
+  class TelemetryView : public vw::ImageViewBase<TelemetryView<ImageT> > {
+    ImageT m_child;
+    std::string m_name;
+    bool m_count_bytes;
+
+  public:
+    typedef typename ImageT::pixel_type pixel_type;
+    typedef typename ImageT::result_type result_type;
+    typedef typename ImageT::pixel_accessor pixel_accessor;
+
+    TelemetryView( ImageT const& child, std::string const& name, bool count_bytes ) :
+      m_child(child), m_name(name), m_count_bytes(count_bytes) {}
+
+    inline vw::int32 cols() const { return m_child.cols(); }
+    inline vw::int32 rows() const { return m_child.rows(); }
+    inline vw::int32 planes() const { return m_child.planes(); }
+
+    inline pixel_accessor origin() const { return m_child.origin(); }
+    inline result_type operator()( vw::int32 i, vw::int32 j, vw::int32 p = 0 ) const {
+      return m_child( i, j, p );
+    }
+
+    typedef typename ImageT::prerasterize_type prerasterize_type;
+    inline prerasterize_type prerasterize( vw::BBox2i const& bbox ) const {
+      if ( !telemetry().enabled() )
+        return m_child.prerasterize( bbox );
+      TileTimer timer;
+      prerasterize_type tile = m_child.prerasterize( bbox );
+      timer.finish( m_name, bbox, 0 );
+      return tile;
+    }
+
+    template <class DestT>
+    inline void rasterize( DestT const& dest, vw::BBox2i const& bbox ) const {
+      if ( !telemetry().enabled() ) {
+        m_child.rasterize( dest, bbox );
+        return;
+      }
+      TileTimer timer;
+      m_child.rasterize( dest, bbox );
+      timer.finish( m_name, bbox, m_count_bytes ?
+                    vw::uint64(bbox.width()) * bbox.height() * planes() * sizeof(pixel_type) : 0 );
+    }
+  };
+
+  /// Record the tiles of a stage of a view graph under 'name'.
+  template <class ImageT>
+  TelemetryView<ImageT> telemetry_view( vw::ImageViewBase<ImageT> const& image,
+                                        std::string const& name ) {
+    return TelemetryView<ImageT>( image.impl(), name, false );
+  }
+
+  /// Record the tiles written to 'filename', with their size in bytes.
+  template <class ImageT>
+  TelemetryView<ImageT> telemetry_write_view( vw::ImageViewBase<ImageT> const& image,
+                                              std::string const& filename ) {
+    return TelemetryView<ImageT>( image.impl(), write_label(filename), true );
+  }
+
+} // namespace asp
+
+#endif//__ASP_CORE_TELEMETRY_H__
@@ -0,0 +1,273 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file TriangleRasterizer.cc
+///
+
+#include <algorithm>
+#include <cmath>
+
+#include <vw/Core/Exception.h>
+#include <asp/Core/TriangleRasterizer.h>
+
+using namespace vw;
+using namespace vw::stereo;
+
+namespace {
+  // Triangles narrower than this are tested at every sample. Wider
+  // ones find the ends of each row from where the edges cross it.
+  const int kNarrow = 4;
+
+  // Triangles set up together before rasterization
+  const size_t kBatchSize = 1024;
+}
+
+TriangleRasterizer::TriangleRasterizer(int width, int height, int num_channels,
+                                       float *buffer) :
+  m_width(width), m_height(height), m_num_channels(num_channels), m_buffer(buffer),
+  m_scale_x(1.0), m_scale_y(1.0), m_offset_x(0.0), m_offset_y(0.0), m_num_queued(0) {
+  if (num_channels < 1 || num_channels > kMaxChannels)
+    vw_throw(ArgumentErr() << "TriangleRasterizer: supports 1 to " << kMaxChannels
+             << " channels, got " << num_channels << ".");
+  m_vertices.resize(kBatchSize * 3 * vertex_size());
+  m_setup.resize(kBatchSize);
+}
+
+void TriangleRasterizer::set_ortho(double left, double right, double bottom, double top) {
+  if (right - left == 0.0 || top - bottom == 0.0)
+    vw_throw(LogicErr() << "TriangleRasterizer: set_ortho failed. Projection dimensions are zero.");
+  m_scale_x  = m_width  / (right - left);
+  m_scale_y  = m_height / (top - bottom);
+  m_offset_x = -left   * m_scale_x;
+  m_offset_y = -bottom * m_scale_y;
+}
+
+void TriangleRasterizer::clear(float value) {
+  std::fill(m_buffer, m_buffer + size_t(m_width) * m_height * m_num_channels, value);
+}
+
+void TriangleRasterizer::add_triangle(const double *v0, const double *v1, const double *v2) {
+  const int vs = vertex_size();
+  const double *v[3] = {v0, v1, v2};
+  double *dst = &m_vertices[m_num_queued * 3 * vs];
+  for (int k = 0; k < 3; k++, dst += vs) {
+    dst[0] = v[k][0] * m_scale_x + m_offset_x;
+    dst[1] = v[k][1] * m_scale_y + m_offset_y;
+    for (int j = 0; j < m_num_channels; j++)
+      dst[2 + j] = v[k][2 + j];
+  }
+  if (++m_num_queued == kBatchSize)
+    flush();
+}
+
+void TriangleRasterizer::flush() {
+  setup_batch();
+  const size_t triangle_size = 3 * vertex_size();
+  for (size_t t = 0; t < m_num_queued; t++) {
+    Setup const& setup = m_setup[t];
+    if (setup.col0 <= setup.col1 && setup.row0 <= setup.row1)
+      rasterize(setup, &m_vertices[t * triangle_size]);
+  }
+  m_num_queued = 0;
+}
+
+// Compute the edge functions and the pixel range of every queued
+// triangle. Edge k is the one opposite vertex k, oriented so that the
+// interior is positive; e_k / (2*area) is then the barycentric weight
+// of vertex k.
+//
+// An edge is evaluated relative to the lower of its two endpoints, as
+// a*(x-px) + b*(y-py). A triangle sharing the edge then computes
+// exactly the negated value at every sample, and with the tie rule
+// below each sample on the edge goes to exactly one of them. A mesh
+// is drawn without gaps or double coverage.
+void TriangleRasterizer::setup_batch() {
+  const int vs = vertex_size();
+  for (size_t t = 0; t < m_num_queued; t++) {
+    const double *tri = &m_vertices[t * 3 * vs];
+    Setup& s = m_setup[t];
+    s.col0 = s.row0 = 0; s.col1 = s.row1 = -1; // Nothing to draw yet
+
+    double x[3], y[3];
+    for (int k = 0; k < 3; k++) {
+      x[k] = tri[k * vs];
+      y[k] = tri[k * vs + 1];
+    }
+
+    // Column col samples x = col+1, row samples y = height-row. Most
+    // triangles of a mesh at the DEM resolution contain no sample at
+    // all, so they are dropped before anything more is computed.
+    double min_x = std::min(x[0], std::min(x[1], x[2]));
+    double max_x = std::max(x[0], std::max(x[1], x[2]));
+    double min_y = std::min(y[0], std::min(y[1], y[2]));
+    double max_y = std::max(y[0], std::max(y[1], y[2]));
+    if (!(min_x == min_x && max_x == max_x && min_y == min_y && max_y == max_y))
+      continue; // NaN vertex
+    double col0 = std::max(0.0,            std::ceil(min_x) - 1);
+    double col1 = std::min(m_width  - 1.0, std::floor(max_x) - 1);
+    double row0 = std::max(0.0,            m_height - std::floor(max_y));
+    double row1 = std::min(m_height - 1.0, m_height - std::ceil(min_y));
+    if (col0 > col1 || row0 > row1)
+      continue;
+
+    for (int k = 0; k < 3; k++) {
+      int p = (k + 1) % 3, q = (k + 2) % 3;
+      s.a[k] = y[p] - y[q];
+      s.b[k] = x[q] - x[p];
+      if (y[q] < y[p] || (y[q] == y[p] && x[q] < x[p]))
+        std::swap(p, q);
+      s.px[k] = x[p];
+      s.py[k] = y[p];
+    }
+    double area2 = s.a[0] * (x[0] - s.px[0]) + s.b[0] * (y[0] - s.py[0]);
+    if (area2 == 0.0 || !(area2 == area2))
+      continue;
+    if (area2 < 0) {
+      for (int k = 0; k < 3; k++) {
+        s.a[k] = -s.a[k]; s.b[k] = -s.b[k];
+      }
+      area2 = -area2;
+    }
+    s.inv_area = 1.0 / area2;
+
+    // (a,b) is the inward normal. A sample on the edge is covered if
+    // the interior lies to its left (a right edge) or below it (a top
+    // edge).
+    for (int k = 0; k < 3; k++)
+      s.inclusive[k] = s.a[k] < 0 || (s.a[k] == 0 && s.b[k] < 0);
+
+    // Where each edge crosses a row, as a column: cross = cx0 + cxs*y.
+    // When the crossing is closer than cx_tol to a column, the exact
+    // test decides which side of the edge that column is on.
+    if (col1 - col0 >= kNarrow) {
+      for (int k = 0; k < 3; k++) {
+        if (s.a[k] == 0)
+          continue;
+        s.cxs[k] = -s.b[k] / s.a[k];
+        s.cx0[k] = s.px[k] - 1 - s.cxs[k] * s.py[k];
+        s.cx_tol[k] = 1e-6 + 1e-12 * (std::abs(s.cx0[k]) + std::abs(s.cxs[k]) * m_height);
+      }
+    }
+    s.col0 = int(col0); s.col1 = int(col1);
+    s.row0 = int(row0); s.row1 = int(row1);
+  }
+}
+
+// Whether edge k covers the sample in column col. by is b*(y-py) for
+// the current row.
+inline bool TriangleRasterizer::edge_covers(Setup const& s, const double *by,
+                                            int k, int col) const {
+  const double e = s.a[k] * ((col + 1) - s.px[k]) + by[k];
+  return (e > 0) | (s.inclusive[k] & (e == 0));
+}
+
+void TriangleRasterizer::rasterize(Setup const& s, const double *tri) const {
+  const int n = m_num_channels, vs = vertex_size();
+
+  // Each channel is a plane over the window: value = e . attr / (2*area).
+  // From (col0,row0) it changes by dv per column and dr per row.
+  double v00[kMaxChannels], dv[kMaxChannels], dr[kMaxChannels];
+  const double x00 = s.col0 + 1, y00 = m_height - s.row0;
+  for (int j = 0; j < n; j++) {
+    v00[j] = dv[j] = dr[j] = 0;
+    for (int k = 0; k < 3; k++) {
+      const double attr = tri[k * vs + 2 + j] * s.inv_area;
+      v00[j] += (s.a[k] * (x00 - s.px[k]) + s.b[k] * (y00 - s.py[k])) * attr;
+      dv[j]  += s.a[k] * attr;
+      dr[j]  -= s.b[k] * attr;
+    }
+  }
+
+  const int span = s.col1 - s.col0;
+  for (int row = s.row0; row <= s.row1; row++) {
+    const double sample_y = m_height - row;
+    double by[3];
+    for (int k = 0; k < 3; k++)
+      by[k] = s.b[k] * (sample_y - s.py[k]);
+
+    // The covered samples of a row form one run [c0, c1], since each
+    // edge function is monotonic along the row even in floating point.
+    int c0, c1;
+    if (span < kNarrow) {
+      // Small triangles, most of a mesh: test every sample
+      c0 = s.col1 + 1; c1 = -1;
+      for (int col = s.col0; col <= s.col1; col++) {
+        const bool inside = edge_covers(s, by, 0, col) & edge_covers(s, by, 1, col) &
+                            edge_covers(s, by, 2, col);
+        c0 = inside ? std::min(c0, col) : c0;
+        c1 = inside ? col : c1;
+      }
+    } else {
+      // An edge covers the columns on one side of where it crosses the
+      // row. Only a crossing that nearly hits a sample needs the exact
+      // test, at the candidates around it.
+      c0 = s.col0; c1 = s.col1;
+      for (int k = 0; k < 3; k++) {
+        if (s.a[k] == 0) {
+          if (!edge_covers(s, by, k, s.col0))
+            c1 = -1;
+          continue;
+        }
+        const double cross = std::max(s.col0 - 2.0,
+                                      std::min(s.col1 + 2.0, s.cx0[k] + s.cxs[k] * sample_y));
+        const int c = int(cross + 3.0) - 3; // floor, cross > -3
+        const bool near = cross - c < s.cx_tol[k] || c + 1 - cross < s.cx_tol[k];
+        if (s.a[k] > 0) {
+          int first = c + 1;
+          if (near) {
+            const bool in0 = edge_covers(s, by, k, c - 1);
+            const bool in1 = edge_covers(s, by, k, c);
+            const bool in2 = edge_covers(s, by, k, c + 1);
+            first = in0 ? c - 1 : in1 ? c : in2 ? c + 1 : c + 2;
+          }
+          c0 = std::max(c0, first);
+        } else {
+          int last = c;
+          if (near) {
+            const bool in0 = edge_covers(s, by, k, c + 1);
+            const bool in1 = edge_covers(s, by, k, c);
+            const bool in2 = edge_covers(s, by, k, c - 1);
+            last = in0 ? c + 1 : in1 ? c : in2 ? c - 1 : c - 2;
+          }
+          c1 = std::min(c1, last);
+        }
+      }
+    }
+    if (c0 > c1)
+      continue;
+
+    float *out = m_buffer + size_t(row) * m_width * n;
+    const double r = row - s.row0;
+    if (n == 1) {
+      // The common case of a DEM alone. A plain loop the compiler can
+      // vectorize.
+      const double start = v00[0] + dr[0] * r - dv[0] * s.col0, step = dv[0];
+      for (int col = c0; col <= c1; col++)
+        out[col] = float(start + step * col);
+    } else {
+      double start[kMaxChannels];
+      for (int j = 0; j < n; j++)
+        start[j] = v00[j] + dr[j] * r - dv[j] * s.col0;
+      for (int col = c0; col <= c1; col++) {
+        float *px = out + size_t(col) * n;
+        for (int j = 0; j < n; j++)
+          px[j] = float(start[j] + dv[j] * col);
+      }
+    }
+  }
+}
@@ -0,0 +1,95 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file TriangleRasterizer.h
+///
+/// A half-space (edge function) triangle rasterizer used to render
+/// point clouds into DEMs. Triangles are queued with a fixed vertex
+/// layout and set up in batches. Small triangles are then tested at
+/// every sample of their bounding box; for larger ones the covered
+/// run of each row is found from where the edges cross it. Runs are
+/// filled with plain loops the compiler can vectorize. Up to
+/// kMaxChannels attributes are interpolated per vertex and written
+/// interleaved, with row 0 at the top of the projection (the
+/// orientation of a north-up image). Triangles that share an edge
+/// never both cover, or both miss, a sample on it.
+///
+/// The sampling convention matches SoftwareRenderer: output pixel
+/// (col,row) is sampled at the window point (col+1, height-row), and
+/// samples that fall exactly on an edge belong to the triangle only
+/// when the edge is a right or top edge.
+///
+
+#ifndef __ASP_CORE_TRIANGLE_RASTERIZER_H__
+#define __ASP_CORE_TRIANGLE_RASTERIZER_H__
+
+#include <cstddef>
+#include <vector>
+
+namespace vw {
+namespace stereo {
+
+  class TriangleRasterizer {
+  public:
+    static const int kMaxChannels = 8;
+
+    /// buffer holds width*height*num_channels floats.
+    TriangleRasterizer(int width, int height, int num_channels, float *buffer);
+
+    /// Map the rectangle [left,right] x [bottom,top] onto the buffer.
+    void set_ortho(double left, double right, double bottom, double top);
+
+    void clear(float value);
+
+    /// Number of doubles per vertex: x, y, then one value per channel.
+    int vertex_size() const { return 2 + m_num_channels; }
+
+    /// Queue a triangle. Each argument points to vertex_size()
+    /// doubles. Triangles are drawn in the order they were added.
+    void add_triangle(const double *v0, const double *v1, const double *v2);
+
+    /// Rasterize all queued triangles.
+    void flush();
+
+  private:
+    // Per-triangle constants computed in the setup pass
+    struct Setup {
+      double a[3], b[3];         // Edge functions e = a*(x-px) + b*(y-py)
+      double px[3], py[3];
+      bool   inclusive[3];       // Samples on the edge are covered
+      double cx0[3], cxs[3], cx_tol[3]; // Where edges cross a row
+      double inv_area;
+      int    col0, col1, row0, row1; // Inclusive pixel range to visit
+    };
+
+    void setup_batch();
+    void rasterize(Setup const& setup, const double *tri) const;
+    bool edge_covers(Setup const& setup, const double *by, int k, int col) const;
+
+    int m_width, m_height, m_num_channels;
+    float *m_buffer;
+    double m_scale_x, m_scale_y, m_offset_x, m_offset_y;
+
+    std::vector<double> m_vertices;  // Queued vertices in window coordinates
+    std::vector<Setup>  m_setup;
+    std::size_t m_num_queued;
+  };
+
+}} // namespace vw::stereo
+
+#endif // __ASP_CORE_TRIANGLE_RASTERIZER_H__
@@ -0,0 +1,174 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <vw/BundleAdjustment.h>
+#include <vw/Math.h>
+#include <asp/Core/AdjustParallelSparse.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <cmath>
+#include <cstdlib>
+
+using namespace vw;
+using namespace vw::ba;
+using namespace asp;
+
+namespace {
+
+  // Cameras looking straight down on a row of points. A camera is
+  // moved by a[0..2] and turned by the axis angle a[3..5].
+  class SyntheticModel : public ModelBase<SyntheticModel, 6, 3> {
+    typedef Vector<double,6> camera_vector_t;
+    typedef Vector<double,3> point_vector_t;
+
+    std::vector<Vector3> m_centers;
+    boost::shared_ptr<ControlNetwork> m_network;
+    std::vector<camera_vector_t> a;
+    std::vector<point_vector_t> b, b_target;
+
+  public:
+    SyntheticModel( std::vector<Vector3> const& centers,
+                    boost::shared_ptr<ControlNetwork> network ) :
+      m_centers(centers), m_network(network), a(centers.size()),
+      b(network->size()), b_target(network->size()) {
+      for ( size_t i = 0; i < network->size(); i++ ) {
+        b[i] = (*network)[i].position();
+        b_target[i] = b[i];
+      }
+    }
+
+    camera_vector_t A_parameters( int j ) const { return a[j]; }
+    point_vector_t B_parameters( int i ) const { return b[i]; }
+    void set_A_parameters( int j, camera_vector_t const& a_j ) { a[j] = a_j; }
+    void set_B_parameters( int i, point_vector_t const& b_i ) { b[i] = b_i; }
+    camera_vector_t A_target( int /*j*/ ) const { return camera_vector_t(); }
+    point_vector_t B_target( int i ) const { return b_target[i]; }
+
+    unsigned num_cameras() const { return a.size(); }
+    unsigned num_points() const { return b.size(); }
+
+    Matrix<double,6,6> A_inverse_covariance( unsigned /*j*/ ) const {
+      Matrix<double,6,6> result;
+      for ( size_t k = 0; k < 3; k++ ) {
+        result(k,k) = 1;
+        result(k+3,k+3) = 1e4;
+      }
+      return result;
+    }
+    Matrix<double,3,3> B_inverse_covariance( unsigned /*i*/ ) const {
+      return math::identity_matrix<3>();
+    }
+
+    Vector2 operator()( unsigned /*i*/, unsigned j,
+                        camera_vector_t const& a_j, point_vector_t const& b_i ) const {
+      Quat pose = math::axis_angle_to_quaternion( subvector( a_j, 3, 3 ) );
+      Vector3 v = pose.rotate( b_i - m_centers[j] - subvector( a_j, 0, 3 ) );
+      return 1000 * Vector2( v[0], v[1] ) / -v[2];
+    }
+
+    boost::shared_ptr<ControlNetwork> control_network() const { return m_network; }
+  };
+
+  double uniform( double scale ) {
+    return scale * ( (rand() % 2001) / 1000.0 - 1 );
+  }
+
+  // Eight cameras in a row, with a small error in their position and
+  // pose. Each point is seen by the two to five cameras within reach
+  // of it, and its position is off by a few tenths. A few points are
+  // ground control, at their true position.
+  void make_network( std::vector<Vector3>& centers, boost::shared_ptr<ControlNetwork>& network ) {
+    srand( 5 );
+    std::vector<Vector<double,6> > truth;
+    for ( size_t j = 0; j < 8; j++ ) {
+      centers.push_back( Vector3( 4.0 * j, 0, 20 ) );
+      Vector<double,6> a;
+      for ( size_t k = 0; k < 3; k++ ) {
+        a[k] = uniform( 0.2 );
+        a[k+3] = uniform( 2e-3 );
+      }
+      truth.push_back( a );
+    }
+    SyntheticModel true_cameras( centers, boost::shared_ptr<ControlNetwork>( new ControlNetwork("truth") ) );
+    for ( size_t j = 0; j < truth.size(); j++ )
+      true_cameras.set_A_parameters( j, truth[j] );
+
+    network.reset( new ControlNetwork("synthetic") );
+    for ( size_t i = 0; i < 60; i++ ) {
+      Vector3 point( -2 + 0.55 * i, uniform( 6 ), uniform( 1 ) );
+      bool gcp = i % 15 == 7;
+      ControlPoint cp( gcp ? ControlPoint::GroundControlPoint : ControlPoint::TiePoint );
+      cp.set_position( gcp ? point : point + Vector3( uniform(0.3), uniform(0.3), uniform(0.3) ) );
+      for ( size_t j = 0; j < centers.size(); j++ ) {
+        if ( std::fabs( centers[j][0] - point[0] ) > 9 )
+          continue;
+        Vector2 pixel = true_cameras( i, j, truth[j], point );
+        cp.add_measure( ControlMeasure( pixel[0], pixel[1], 1, 1, j ) );
+      }
+      network->add_control_point( cp );
+    }
+  }
+
+  template <class AdjusterT>
+  void adjust( AdjusterT& adjuster ) {
+    double abs_tol = 1e10, rel_tol = 1e10;
+    while ( adjuster.iterations() < 100 && rel_tol > 1e-20 )
+      adjuster.update( abs_tol, rel_tol );
+  }
+
+  void expect_same( SyntheticModel const& expected, SyntheticModel const& actual ) {
+    for ( size_t j = 0; j < expected.num_cameras(); j++ )
+      for ( size_t k = 0; k < 6; k++ )
+        EXPECT_NEAR( expected.A_parameters(j)[k], actual.A_parameters(j)[k], 1e-7 );
+    for ( size_t i = 0; i < expected.num_points(); i++ )
+      for ( size_t k = 0; k < 3; k++ )
+        EXPECT_NEAR( expected.B_parameters(i)[k], actual.B_parameters(i)[k], 1e-6 );
+  }
+
+}
+
+TEST( AdjustParallelSparse, MatchesAdjustSparse ) {
+  std::vector<Vector3> centers;
+  boost::shared_ptr<ControlNetwork> network;
+  make_network( centers, network );
+
+  SyntheticModel reference( centers, network );
+  AdjustSparse<SyntheticModel, L2Error> reference_adjuster( reference, L2Error(), true, true );
+  adjust( reference_adjuster );
+
+  // The adjustment moved the cameras well away from where they started
+  double moved = 0;
+  for ( size_t j = 0; j < reference.num_cameras(); j++ )
+    moved = std::max( moved, norm_2( subvector( reference.A_parameters(j), 0, 3 ) ) );
+  EXPECT_GT( moved, 0.05 );
+
+  LinearSolverOptions opt;
+  opt.threaded_model = true;
+  opt.num_threads = 4;
+  for ( int s = 0; s < 3; s++ ) {
+    opt.solver = s == 0 ? LinearSolverOptions::Cholesky : LinearSolverOptions::PCG;
+    opt.pcg.preconditioner = s == 2 ? PCGOptions::Jacobi : PCGOptions::BlockJacobi;
+    SyntheticModel model( centers, network );
+    AdjustParallelSparse<SyntheticModel, L2Error> adjuster( model, L2Error(), true, true );
+    adjuster.set_linear_solver_options( opt );
+    adjust( adjuster );
+    expect_same( reference, model );
+  }
+}
@@ -0,0 +1,154 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Core/BlockSparseSolver.h>
+
+#include <cmath>
+#include <cstdlib>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+  // A chain of blocks, each coupled to its neighbors and to a few far
+  // ones, or every block coupled to every other one. The diagonal is
+  // dominant, so that the matrix is positive definite.
+  BlockSparseMatrix make_matrix( size_t num_rows, size_t block_size, bool dense = false ) {
+    std::vector<std::vector<size_t> > pattern( num_rows );
+    for ( size_t i = 0; dense && i < num_rows; i++ )
+      for ( size_t j = 0; j < num_rows; j++ )
+        pattern[i].push_back( j );
+    for ( size_t i = 0; i + 1 < num_rows; i++ ) {
+      pattern[i].push_back( i + 1 );
+      pattern[i+1].push_back( i );
+    }
+    for ( size_t i = 0; i + 7 < num_rows; i += 5 ) {
+      pattern[i].push_back( i + 7 );
+      pattern[i+7].push_back( i );
+    }
+    BlockSparseMatrix S( block_size, pattern );
+
+    srand( 3 );
+    for ( size_t i = 0; i < num_rows; i++ ) {
+      for ( size_t n = S.row_begin(i); n < S.row_end(i); n++ ) {
+        size_t j = S.col(n);
+        if ( j > i ) continue;
+        double* Sij = S.values(n);
+        double* Sji = S.block( j, i );
+        for ( size_t r = 0; r < block_size; r++ )
+          for ( size_t c = 0; c < block_size; c++ ) {
+            double v = (rand() % 200 - 100) / 100.0;
+            if ( i == j && r == c )
+              v = double(block_size * num_rows);
+            if ( i == j && c > r )
+              continue;
+            Sij[r*block_size+c] = v;
+            Sji[c*block_size+r] = v;
+          }
+      }
+    }
+    return S;
+  }
+
+  double residual( BlockSparseMatrix const& S, std::vector<double> const& x,
+                   std::vector<double> const& rhs ) {
+    std::vector<double> y;
+    S.multiply( x, y );
+    double sum = 0;
+    for ( size_t i = 0; i < y.size(); i++ )
+      sum += (y[i] - rhs[i]) * (y[i] - rhs[i]);
+    return std::sqrt( sum );
+  }
+}
+
+TEST( BlockSparseSolver, Cholesky ) {
+  BlockSparseMatrix S = make_matrix( 60, 6 );
+  std::vector<double> rhs( S.rows() ), x;
+  for ( size_t i = 0; i < rhs.size(); i++ )
+    rhs[i] = std::sin( double(i) );
+
+  BlockCholesky chol;
+  chol.analyze( S );
+  EXPECT_GE( chol.num_blocks(), (S.num_blocks() + S.num_block_rows()) / 2 );
+  ASSERT_TRUE( chol.factor( S ) );
+  chol.solve( rhs, x );
+  EXPECT_LT( residual( S, x, rhs ), 1e-9 );
+
+  // Refactoring with the same pattern reuses the analysis
+  for ( size_t i = 0; i < S.num_block_rows(); i++ )
+    S.block( i, i )[0] += 1.0;
+  ASSERT_TRUE( chol.factor( S ) );
+  chol.solve( rhs, x );
+  EXPECT_LT( residual( S, x, rhs ), 1e-9 );
+
+  // Not positive definite
+  S.block( 0, 0 )[0] = -1.0;
+  EXPECT_FALSE( chol.factor( S ) );
+
+  // Large columns update in parallel
+  BlockSparseMatrix D = make_matrix( 50, 3, true );
+  std::vector<double> rhs_d( D.rows(), 1.0 );
+  BlockCholesky chol_d;
+  ASSERT_TRUE( chol_d.factor( D ) );
+  EXPECT_EQ( 50u * 51u / 2u, chol_d.num_blocks() );
+  chol_d.solve( rhs_d, x );
+  EXPECT_LT( residual( D, x, rhs_d ), 1e-9 );
+}
+
+TEST( BlockSparseSolver, PCG ) {
+  BlockSparseMatrix S = make_matrix( 60, 6 );
+  std::vector<double> rhs( S.rows() ), x;
+  for ( size_t i = 0; i < rhs.size(); i++ )
+    rhs[i] = std::cos( double(i) );
+
+  PCGOptions opt;
+  int block_iterations = pcg_solve( S, rhs, x, opt );
+  EXPECT_LT( block_iterations, opt.max_iterations );
+  EXPECT_LT( residual( S, x, rhs ), 1e-8 );
+
+  opt.preconditioner = PCGOptions::Jacobi;
+  x.clear();
+  EXPECT_LT( pcg_solve( S, rhs, x, opt ), opt.max_iterations );
+  EXPECT_LT( residual( S, x, rhs ), 1e-8 );
+}
+
+TEST( BlockSparseSolver, DenseBlocks ) {
+  // A = L L^T, for a known L
+  double L[9] = { 2, 0, 0,  1, 3, 0,  -1, 0.5, 1.5 };
+  double A[9];
+  for ( size_t i = 0; i < 3; i++ )
+    for ( size_t j = 0; j < 3; j++ ) {
+      A[i*3+j] = 0;
+      for ( size_t k = 0; k < 3; k++ )
+        A[i*3+j] += L[i*3+k] * L[j*3+k];
+    }
+  double x[3] = { 1, -2, 0.5 }, y[3];
+  for ( size_t i = 0; i < 3; i++ )
+    y[i] = A[i*3] * x[0] + A[i*3+1] * x[1] + A[i*3+2] * x[2];
+
+  ASSERT_TRUE( cholesky_in_place( A, 3 ) );
+  for ( size_t k = 0; k < 9; k++ )
+    EXPECT_NEAR( L[k], A[k], 1e-12 );
+  forward_solve( A, y, 3 );
+  backward_solve( A, y, 3 );
+  for ( size_t i = 0; i < 3; i++ )
+    EXPECT_NEAR( x[i], y[i], 1e-12 );
+
+  double B[4] = { 1, 2, 2, 1 };
+  EXPECT_FALSE( cholesky_in_place( B, 2 ) );
+}
@@ -0,0 +1,163 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/ColorRelief.h>
+
+#include <cmath>
+#include <cstdlib>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  // The HSV round trip as hsv_merge used to do it, with floats
+  void rgb_to_hsv( double r, double g, double b, double& h, double& s, double& v ) {
+    double mx = std::max( r, std::max(g, b) ), mn = std::min( r, std::min(g, b) );
+    v = mx;
+    s = mx > 0 ? (mx - mn) / mx : 0;
+    h = 0;
+    if ( mx == mn ) return;
+    if ( mx == r )      h = (g - b) / (mx - mn);
+    else if ( mx == g ) h = 2 + (b - r) / (mx - mn);
+    else                h = 4 + (r - g) / (mx - mn);
+    if ( h < 0 ) h += 6;
+  }
+
+  void hsv_to_rgb( double h, double s, double v, double& r, double& g, double& b ) {
+    int i = int(h) % 6;
+    double f = h - std::floor(h);
+    double p = v * (1 - s), q = v * (1 - s*f), t = v * (1 - s*(1 - f));
+    switch ( i ) {
+    case 0:  r = v; g = t; b = p; break;
+    case 1:  r = q; g = v; b = p; break;
+    case 2:  r = p; g = v; b = t; break;
+    case 3:  r = p; g = q; b = v; break;
+    case 4:  r = t; g = p; b = v; break;
+    default: r = v; g = p; b = q; break;
+    }
+  }
+
+}
+
+TEST(ColorRelief, ReplaceValueFloat) {
+  srand(5);
+  const size_t count = 1000;
+  std::vector<float> rgb( 3*count ), value( count ), out( 3*count );
+  for ( size_t i = 0; i < 3*count; i++ )
+    rgb[i] = rand() % 4 == 0 ? 0.0f : float(rand()) / RAND_MAX;
+  for ( size_t i = 0; i < count; i++ )
+    value[i] = float(rand()) / RAND_MAX;
+  hsv_replace_value( &rgb[0], &value[0], &out[0], count );
+
+  for ( size_t i = 0; i < count; i++ ) {
+    double h, s, v, r, g, b;
+    rgb_to_hsv( rgb[3*i], rgb[3*i+1], rgb[3*i+2], h, s, v );
+    hsv_to_rgb( h, s, value[i], r, g, b );
+    EXPECT_NEAR( r, out[3*i],   1e-5 );
+    EXPECT_NEAR( g, out[3*i+1], 1e-5 );
+    EXPECT_NEAR( b, out[3*i+2], 1e-5 );
+  }
+}
+
+TEST(ColorRelief, ReplaceValueInteger) {
+  uint8 rgb[12]  = { 200, 100, 50,   0, 0, 0,   10, 20, 40,   255, 255, 255 };
+  uint8 value[4] = { 100, 77, 255, 0 };
+  uint8 out[12];
+  hsv_replace_value( rgb, value, out, 4 );
+  uint8 expected[12] = { 100, 50, 25,   77, 77, 77,   64, 128, 255,   0, 0, 0 };
+  for ( int i = 0; i < 12; i++ )
+    EXPECT_EQ( expected[i], out[i] );
+
+  // In place, as the merge view does it
+  uint16 wide[3] = { 1000, 3000, 2000 };
+  uint16 wide_value = 60000;
+  hsv_replace_value( wide, &wide_value, wide, 1 );
+  EXPECT_EQ( 20000, wide[0] );
+  EXPECT_EQ( 60000, wide[1] );
+  EXPECT_EQ( 40000, wide[2] );
+}
+
+TEST(ColorRelief, ColorMap) {
+  ColorMap colormap;
+  colormap.add( 100, 0, 0, 255 );
+  colormap.add( 0, 255, 0, 0 );
+  colormap.set_nodata_color( 1, 2, 3 );
+  float elevation[5] = { -10, 0, 25, 100, -9999 };
+  uint8 rgb[15];
+  colormap.apply( elevation, 5, -9999, rgb );
+  uint8 expected[15] = { 255, 0, 0,   255, 0, 0,   191, 0, 64,   0, 0, 255,   1, 2, 3 };
+  for ( int i = 0; i < 15; i++ )
+    EXPECT_EQ( expected[i], rgb[i] );
+}
+
+TEST(ColorRelief, Hillshade) {
+  // A plane rising to the east at 45 degrees, lit from the west at 45
+  // degrees, faces the light. A missing pixel gets the nodata color
+  // and only flattens the slope of its neighbors.
+  const int32 cols = 6, rows = 5;
+  std::vector<float> dem( (cols+2) * (rows+2) );
+  for ( int32 row = 0; row < rows+2; row++ )
+    for ( int32 col = 0; col < cols+2; col++ )
+      dem[row*(cols+2) + col] = 2.0f * col;
+  dem[3*(cols+2) + 3] = -1;
+
+  ColorMap colormap;
+  colormap.add( 0, 255, 255, 255 );
+  colormap.set_nodata_color( 9, 9, 9 );
+  HillshadeOptions options;
+  options.azimuth = 270;
+  std::vector<uint8> rgb( 3*cols*rows );
+  color_relief( &dem[cols+2+1], cols+2, cols, rows, -1, 2.0, 2.0, options, colormap, &rgb[0] );
+  for ( int32 row = 0; row < rows; row++ ) {
+    for ( int32 col = 0; col < cols; col++ ) {
+      uint8 const* pixel = &rgb[3*(row*cols + col)];
+      if ( row == 2 && col == 2 ) {
+        EXPECT_EQ( 9, pixel[0] );
+      } else if ( std::abs(row - 2) <= 1 && std::abs(col - 2) <= 1 ) {
+        EXPECT_GT( pixel[0], 200 );
+      } else {
+        EXPECT_EQ( 255, pixel[0] );
+        EXPECT_EQ( 255, pixel[2] );
+      }
+    }
+  }
+
+  // Flat ground is lit by the cosine of the zenith angle.
+  std::fill( dem.begin(), dem.end(), 7.0f );
+  color_relief( &dem[cols+2+1], cols+2, cols, rows, -1, 1.0, 1.0, options, colormap, &rgb[0] );
+  EXPECT_EQ( 181, rgb[0] );
+  EXPECT_EQ( 181, rgb[3*cols*rows - 1] );
+}
+
+TEST(ColorRelief, ViewTiles) {
+  // Tiles must be shaded as if the whole DEM were done at once.
+  ImageView<float> dem( 37, 29 );
+  for ( int32 row = 0; row < dem.rows(); row++ )
+    for ( int32 col = 0; col < dem.cols(); col++ )
+      dem(col, row) = float( 50 * sin(0.2*col) * cos(0.15*row) + row );
+  ColorReliefView view( dem, -9999, 1.0, 1.0, HillshadeOptions(), ColorMap::jet(-50, 80) );
+
+  ImageView<PixelRGB<uint8> > whole = view;
+  BBox2i tile( 10, 7, 13, 11 );
+  ImageView<PixelRGB<uint8> > part = crop( view, tile );
+  for ( int32 row = 0; row < part.rows(); row++ )
+    for ( int32 col = 0; col < part.cols(); col++ )
+      EXPECT_EQ( whole(col + tile.min().x(), row + tile.min().y()), part(col, row) );
+}
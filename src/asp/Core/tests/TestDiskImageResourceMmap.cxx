@@ -0,0 +1,95 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <asp/Core/DiskImageResourceMmap.h>
+
+using namespace vw;
+
+namespace {
+  // Odd sizes so that the edge tiles are partial.
+  ImageView<PixelMask<Vector2f> > make_disparity() {
+    ImageView<PixelMask<Vector2f> > disparity(37,53);
+    for ( int row = 0; row < disparity.rows(); row++ )
+      for ( int col = 0; col < disparity.cols(); col++ ) {
+        disparity(col,row) = PixelMask<Vector2f>(Vector2f(col + 0.25, -row));
+        if ( (col + row) % 7 == 0 )
+          disparity(col,row).invalidate();
+      }
+    return disparity;
+  }
+}
+
+TEST(DiskImageResourceMmap, RoundTrip) {
+  UnlinkName file("disparity.mmap");
+  ImageView<PixelMask<Vector2f> > disparity = make_disparity();
+  {
+    asp::DiskImageResourceMmap rsrc(file, disparity.format(), Vector2i(16,16));
+    EXPECT_EQ( Vector2i(16,16), rsrc.block_write_size() );
+    block_write_image(rsrc, disparity);
+  }
+
+  asp::DiskImageResourceMmap rsrc(file);
+  EXPECT_EQ( disparity.cols(), rsrc.cols() );
+  EXPECT_EQ( disparity.rows(), rsrc.rows() );
+  EXPECT_EQ( Vector2i(16,16), rsrc.block_read_size() );
+
+  ImageView<PixelMask<Vector2f> > result(disparity.cols(), disparity.rows());
+  rsrc.read(result.buffer(), bounding_box(result));
+  EXPECT_SEQ_EQ( disparity, result );
+}
+
+TEST(DiskImageResourceMmap, CroppedRead) {
+  UnlinkName file("cropped.mmap");
+  ImageView<PixelMask<Vector2f> > disparity = make_disparity();
+  {
+    asp::DiskImageResourceMmap rsrc(file, disparity.format(), Vector2i(16,16));
+    rsrc.set_block_write_size(Vector2i(8,12));
+    block_write_image(rsrc, disparity);
+  }
+
+  // A window spanning several partial tiles
+  asp::DiskImageResourceMmap rsrc(file);
+  EXPECT_EQ( Vector2i(8,12), rsrc.block_read_size() );
+  BBox2i win(5,7,20,31);
+  ImageView<PixelMask<Vector2f> > result(win.width(), win.height());
+  rsrc.read(result.buffer(), win);
+  EXPECT_SEQ_EQ( crop(disparity, win), result );
+}
+
+TEST(DiskImageResourceMmap, DiskImageView) {
+  UnlinkName file("registered.mmap");
+  DiskImageResource::register_file_type(asp::DiskImageResourceMmap::extension(),
+                                        asp::DiskImageResourceMmap::type_static(),
+                                        &asp::DiskImageResourceMmap::construct_open,
+                                        &asp::DiskImageResourceMmap::construct_create);
+  ImageView<PixelMask<Vector2f> > disparity = make_disparity();
+  asp::BaseOptions opt;
+  opt.raster_tile_size = Vector2i(32,32);
+  asp::block_write_mmap_image(file, disparity, opt);
+
+  DiskImageView<PixelMask<Vector2f> > view(file);
+  EXPECT_SEQ_EQ( disparity, view );
+
+  // Integer disparities as written by stereo_corr
+  DiskImageView<PixelMask<Vector2i> > int_view(file);
+  EXPECT_EQ( PixelMask<Vector2i>(Vector2i(3,-5)), int_view(3,5) );
+}
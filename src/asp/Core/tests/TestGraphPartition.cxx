@@ -0,0 +1,90 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Core/GraphPartition.h>
+
+using namespace asp;
+
+namespace {
+  // A rows x cols grid, each vertex linked to its 4 neighbors
+  std::vector<std::vector<size_t> > grid_graph( size_t rows, size_t cols ) {
+    std::vector<std::vector<size_t> > graph( rows * cols );
+    for ( size_t r = 0; r < rows; r++ )
+      for ( size_t c = 0; c < cols; c++ ) {
+        size_t v = r * cols + c;
+        if ( c + 1 < cols ) {
+          graph[v].push_back( v + 1 );
+          graph[v + 1].push_back( v );
+        }
+        if ( r + 1 < rows ) {
+          graph[v].push_back( v + cols );
+          graph[v + cols].push_back( v );
+        }
+      }
+    return graph;
+  }
+
+  size_t cut_edges( std::vector<std::vector<size_t> > const& graph, std::vector<int> const& part ) {
+    size_t count = 0;
+    for ( size_t v = 0; v < graph.size(); v++ )
+      for ( size_t n = 0; n < graph[v].size(); n++ )
+        if ( part[v] != part[graph[v][n]] )
+          count++;
+    return count / 2;
+  }
+}
+
+TEST( GraphPartition, Grid ) {
+  std::vector<std::vector<size_t> > graph = grid_graph( 30, 40 );
+  for ( int num_parts = 1; num_parts <= 6; num_parts++ ) {
+    std::vector<int> part = partition_graph( graph, num_parts );
+    ASSERT_EQ( graph.size(), part.size() );
+
+    std::vector<size_t> sizes( num_parts, 0 );
+    for ( size_t v = 0; v < part.size(); v++ ) {
+      ASSERT_GE( part[v], 0 );
+      ASSERT_LT( part[v], num_parts );
+      sizes[part[v]]++;
+    }
+    // Balanced to within a few levels, which are at most 30 long
+    for ( int p = 0; p < num_parts; p++ )
+      EXPECT_NEAR( double(graph.size()) / num_parts, double(sizes[p]), 3 * 30.0 );
+
+    // Far fewer cuts than the 2330 edges, about a level per cut
+    EXPECT_LE( cut_edges( graph, part ), size_t( 2 * 30 * (num_parts - 1) ) );
+  }
+}
+
+TEST( GraphPartition, Disconnected ) {
+  // Two separate chains and an isolated vertex
+  std::vector<std::vector<size_t> > graph( 21 );
+  for ( size_t v = 0; v + 1 < 10; v++ ) {
+    graph[v].push_back( v + 1 );
+    graph[v + 1].push_back( v );
+    graph[v + 10].push_back( v + 11 );
+    graph[v + 11].push_back( v + 10 );
+  }
+  std::vector<int> part = partition_graph( graph, 2 );
+  std::vector<size_t> sizes( 2, 0 );
+  for ( size_t v = 0; v < part.size(); v++ )
+    sizes[part[v]]++;
+  EXPECT_NEAR( 10.5, double(sizes[0]), 1.0 );
+  EXPECT_LE( cut_edges( graph, part ), 1u );
+
+  EXPECT_THROW( partition_graph( graph, 0 ), vw::ArgumentErr );
+}
@@ -0,0 +1,106 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Core/PointKdTree.h>
+#include <asp/Core/IterativeClosestPoint.h>
+
+#include <cmath>
+#include <cstdlib>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+  // A wavy surface, so that no rigid motion slides along it
+  double height( double x, double y ) {
+    return 3.0 * std::sin( 0.31 * x ) * std::cos( 0.23 * y ) + 0.05 * x;
+  }
+
+  Vector3 surface_normal( double x, double y ) {
+    double dx = 3.0 * 0.31 * std::cos( 0.31 * x ) * std::cos( 0.23 * y ) + 0.05;
+    double dy = -3.0 * 0.23 * std::sin( 0.31 * x ) * std::sin( 0.23 * y );
+    return normalize( Vector3( -dx, -dy, 1 ) );
+  }
+
+  Matrix4x4 rigid_transform( double angle, Vector3 const& shift ) {
+    Matrix4x4 T = math::identity_matrix<4>();
+    T(0,0) = std::cos(angle); T(0,1) = -std::sin(angle);
+    T(1,0) = std::sin(angle); T(1,1) =  std::cos(angle);
+    for ( int i = 0; i < 3; i++ )
+      T(i,3) = shift[i];
+    return T;
+  }
+}
+
+TEST( PointKdTree, MatchesBruteForce ) {
+  srand( 7 );
+  std::vector<Vector3> points;
+  for ( int i = 0; i < 2000; i++ )
+    points.push_back( Vector3( rand() % 1000, rand() % 1000, rand() % 100 ) / 10.0 );
+  PointKdTree tree( points );
+  EXPECT_EQ( points.size(), tree.size() );
+
+  for ( int j = 0; j < 200; j++ ) {
+    Vector3 query = Vector3( rand() % 1200 - 100, rand() % 1200 - 100, rand() % 120 ) / 10.0;
+    size_t best = 0;
+    for ( size_t i = 1; i < points.size(); i++ )
+      if ( norm_2_sqr( points[i] - query ) < norm_2_sqr( points[best] - query ) )
+        best = i;
+
+    double dist2;
+    long found = tree.nearest( query, dist2 );
+    ASSERT_GE( found, 0 );
+    EXPECT_NEAR( norm_2_sqr( points[best] - query ), dist2, 1e-9 );
+    EXPECT_NEAR( norm_2_sqr( points[found] - query ), dist2, 1e-9 );
+
+    // Nothing is found closer than the nearest point
+    double limit = 0.99 * std::sqrt( dist2 );
+    EXPECT_EQ( -1, tree.nearest( query, dist2, limit ) );
+  }
+}
+
+TEST( PointToPlaneICP, RecoversRigidTransform ) {
+  std::vector<Vector3> reference, normals, source;
+  for ( double y = 0; y < 100; y += 0.5 )
+    for ( double x = 0; x < 100; x += 0.5 ) {
+      reference.push_back( Vector3( x, y, height( x, y ) ) );
+      normals.push_back( surface_normal( x, y ) );
+    }
+
+  // The source samples the same surface elsewhere, away from the
+  // edges, and is moved off it.
+  Matrix4x4 truth = rigid_transform( 0.01, Vector3( 0.4, -0.3, 0.5 ) );
+  Matrix4x4 inverse = rigid_transform( -0.01, Vector3() );
+  Vector3 back = apply_transform( inverse, Vector3( -0.4, 0.3, -0.5 ) );
+  for ( int i = 0; i < 3; i++ )
+    inverse(i,3) = back[i];
+  for ( double y = 20.25; y < 80; y += 1.5 )
+    for ( double x = 20.25; x < 80; x += 1.5 )
+      source.push_back( apply_transform( inverse, Vector3( x, y, height( x, y ) ) ) );
+
+  PointToPlaneICP icp( reference, normals );
+  ICPOptions opt;
+  ICPResult result = icp.align( source, math::identity_matrix<4>(), opt );
+
+  EXPECT_LT( result.iterations, opt.max_iterations );
+  EXPECT_EQ( source.size(), result.num_inliers );
+  EXPECT_LT( result.rms, 0.02 );
+  for ( int i = 0; i < 4; i++ )
+    for ( int j = 0; j < 4; j++ )
+      EXPECT_NEAR( truth(i,j), result.transform(i,j), 1e-2 );
+}
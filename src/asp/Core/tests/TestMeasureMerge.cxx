@@ -0,0 +1,128 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/MeasureMerge.h>
+
+#include <cstdlib>
+
+using namespace asp;
+
+namespace {
+  void add_point( std::vector<MergeMeasure>& measures, std::vector<size_t>& start,
+                  MergeMeasure const& a, MergeMeasure const& b ) {
+    measures.push_back( a );
+    measures.push_back( b );
+    start.push_back( measures.size() );
+  }
+}
+
+TEST( MeasureMerge, Exact ) {
+  std::vector<MergeMeasure> measures;
+  std::vector<size_t> start( 1, 0 );
+  // Points 0 and 2 share a measure, and 3 joins them through 2.
+  add_point( measures, start, MergeMeasure( 0, 10, 20 ), MergeMeasure( 1, 5, 5 ) );
+  add_point( measures, start, MergeMeasure( 0, 10, 21 ), MergeMeasure( 2, 5, 5 ) );
+  add_point( measures, start, MergeMeasure( 1, 5, 5 ), MergeMeasure( 3, 1, 1 ) );
+  add_point( measures, start, MergeMeasure( 3, 1, 1 ), MergeMeasure( 4, 7, 7 ) );
+  add_point( measures, start, MergeMeasure( 5, 10, 20 ), MergeMeasure( 6, 0, 0 ) );
+
+  for ( size_t threads = 1; threads <= 4; threads++ ) {
+    MeasureMergeResult result = merge_measures( measures, start, -1, threads );
+    EXPECT_EQ( 3u, result.num_groups );
+    EXPECT_EQ( 0u, result.point_group[0] );
+    EXPECT_EQ( 1u, result.point_group[1] );
+    EXPECT_EQ( 0u, result.point_group[2] );
+    EXPECT_EQ( 0u, result.point_group[3] );
+    EXPECT_EQ( 2u, result.point_group[4] );
+    EXPECT_EQ( 1u, result.representative[4] );
+    EXPECT_EQ( 5u, result.representative[6] );
+    EXPECT_EQ( 8u, result.representative[8] );
+
+    std::vector<size_t> group_start, order;
+    group_unique_measures( result, start, group_start, order );
+    ASSERT_EQ( 4u, group_start.size() );
+    EXPECT_EQ( 0u, group_start[0] );
+    EXPECT_EQ( 4u, group_start[1] );
+    EXPECT_EQ( 6u, group_start[2] );
+    EXPECT_EQ( 8u, group_start[3] );
+    ASSERT_EQ( 8u, order.size() );
+    size_t expected[] = { 0, 1, 5, 7, 2, 3, 8, 9 };
+    for ( size_t k = 0; k < order.size(); k++ )
+      EXPECT_EQ( expected[k], order[k] );
+  }
+}
+
+TEST( MeasureMerge, Close ) {
+  std::vector<MergeMeasure> measures;
+  std::vector<size_t> start( 1, 0 );
+  add_point( measures, start, MergeMeasure( 0, 10, 20 ), MergeMeasure( 1, 5, 5 ) );
+  // Across a cell boundary, within 0.5 pixels
+  add_point( measures, start, MergeMeasure( 0, 10.3, 20.3 ), MergeMeasure( 2, 5, 5 ) );
+  // Within 0.5 pixels of the measure above, but not of the first one
+  add_point( measures, start, MergeMeasure( 0, 10.6, 20.6 ), MergeMeasure( 3, 5, 5 ) );
+
+  MeasureMergeResult result = merge_measures( measures, start, 0.5, 2 );
+  EXPECT_EQ( 2u, result.num_groups );
+  EXPECT_EQ( 0u, result.point_group[1] );
+  EXPECT_EQ( 1u, result.point_group[2] );
+  EXPECT_EQ( 0u, result.representative[2] );
+  EXPECT_EQ( 4u, result.representative[4] );
+
+  result = merge_measures( measures, start, -1, 2 );
+  EXPECT_EQ( 3u, result.num_groups );
+}
+
+// Against comparing every pair of measures
+TEST( MeasureMerge, BruteForce ) {
+  srand( 3 );
+  std::vector<MergeMeasure> measures;
+  std::vector<size_t> start( 1, 0 );
+  for ( size_t p = 0; p < 400; p++ ) {
+    size_t count = 2 + rand() % 3;
+    for ( size_t k = 0; k < count; k++ )
+      measures.push_back( MergeMeasure( rand() % 7, rand() % 40 + 0.25 * ( rand() % 4 ),
+                                        rand() % 40 ) );
+    start.push_back( measures.size() );
+  }
+  double close = 0.6;
+  MeasureMergeResult result = merge_measures( measures, start, close, 3 );
+
+  std::vector<size_t> representative( measures.size() );
+  for ( size_t m = 0; m < measures.size(); m++ ) {
+    representative[m] = m;
+    for ( size_t o = 0; o < m; o++ ) {
+      if ( representative[o] != o || measures[o].image != measures[m].image ) continue;
+      double dx = measures[o].x - measures[m].x, dy = measures[o].y - measures[m].y;
+      if ( dx * dx + dy * dy <= close * close ) {
+        representative[m] = o;
+        break;
+      }
+    }
+    EXPECT_EQ( representative[m], result.representative[m] );
+  }
+
+  // Points sharing a unique measure are in the same group
+  for ( size_t p = 0; p < 400; p++ )
+    for ( size_t q = 0; q < p; q++ )
+      for ( size_t m = start[p]; m < start[p+1]; m++ )
+        for ( size_t o = start[q]; o < start[q+1]; o++ )
+          if ( representative[m] == representative[o] ) {
+            EXPECT_EQ( result.point_group[q], result.point_group[p] );
+          }
+}
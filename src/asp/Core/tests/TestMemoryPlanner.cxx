@@ -0,0 +1,90 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+
+#include <test/Helpers.h>
+#include <asp/Core/MemoryPlanner.h>
+
+#include <cmath>
+
+using namespace vw;
+using namespace asp;
+
+TEST( MemoryPlanner, tile_bytes ) {
+  TileFootprint fp;
+  fp.input_bytes_per_pixel  = 1;
+  fp.input_copies           = 1;
+  fp.halo                   = Vector2i(1,1);
+  fp.output_bytes_per_pixel = 2;
+  EXPECT_NEAR( 12*12 + 2*10*10, fp.tile_bytes( Vector2i(10,10) ), 1e-8 );
+
+  // Each pyramid level adds a quarter of the previous one
+  fp.pyramid_levels = 1;
+  EXPECT_NEAR( 12*12*1.25 + 2*10*10, fp.tile_bytes( Vector2i(10,10) ), 1e-8 );
+}
+
+TEST( MemoryPlanner, plan_fits_budget ) {
+  TileFootprint fp = correlation_footprint( Vector2i(21,21), Vector2i(100,20), 5 );
+
+  for ( double budget = 50; budget <= 4096; budget *= 2 ) {
+    TilePlan plan = plan_tiles( fp, budget*1024*1024, 8 );
+    if ( plan.fits )
+      EXPECT_LE( plan.total_bytes, budget*1024*1024 );
+    EXPECT_GE( plan.num_threads, 1u );
+    EXPECT_LE( plan.num_threads, 8u );
+    EXPECT_EQ( plan.tile_size.x(), plan.tile_size.y() );
+  }
+
+  // A larger budget never gives fewer threads or smaller tiles
+  TilePlan small = plan_tiles( fp, 256.0*1024*1024,  8 );
+  TilePlan large = plan_tiles( fp, 8192.0*1024*1024, 8 );
+  EXPECT_GE( large.num_threads, small.num_threads );
+  if ( large.num_threads == small.num_threads )
+    EXPECT_GE( large.tile_size.x(), small.tile_size.x() );
+  EXPECT_EQ( 8u, large.num_threads );
+}
+
+TEST( MemoryPlanner, plan_over_budget ) {
+  TileFootprint fp;
+  fp.fixed_bytes = 1e9;
+  TilePlan plan = plan_tiles( fp, 1e6, 4, 64, 1024 );
+  EXPECT_FALSE( plan.fits );
+  EXPECT_EQ( 1u, plan.num_threads );
+  EXPECT_EQ( Vector2i(64,64), plan.tile_size );
+}
+
+TEST( MemoryPlanner, subsample_matches_old_rule ) {
+  // The rule stereo_pprc used before the planner, for a 500 MB budget
+  for ( uint32 max_threads = 1; max_threads <= 16; max_threads *= 2 ) {
+    for ( double sub_scale = 0.01; sub_scale <= 0.6; sub_scale *= 1.7 ) {
+      uint32 threads = max_threads + 1;
+      int32 tile_power = 0;
+      while ( tile_power < 6 && threads > 1 ) {
+        threads--;
+        tile_power = int32( floor( log(500e6*sub_scale*sub_scale/(4.0*threads))/(2*log(2.0)) ) );
+      }
+      if ( tile_power < 6 )
+        continue;
+      int32 tile = std::min( 1 << tile_power, 256 );
+
+      TilePlan plan = plan_tiles( subsample_footprint( sub_scale ), 500e6, max_threads, 64, 256 );
+      EXPECT_EQ( threads, plan.num_threads );
+      EXPECT_EQ( tile, plan.tile_size.x() );
+    }
+  }
+}
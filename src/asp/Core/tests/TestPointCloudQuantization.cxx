@@ -0,0 +1,104 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <vw/Image/ImageView.h>
+#include <vw/FileIO/DiskImageView.h>
+#include <vw/FileIO/DiskImageResourceGDAL.h>
+#include <asp/Core/PointCloudQuantization.h>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+  // A patch of a cloud a few km across, far from the planet center
+  ImageView<Vector4> make_cloud() {
+    ImageView<Vector4> cloud(19,23);
+    for ( int row = 0; row < cloud.rows(); row++ )
+      for ( int col = 0; col < cloud.cols(); col++ ) {
+        if ( (col + 2*row) % 5 == 0 ) continue; // invalid points
+        cloud(col,row) = Vector4( 1737400.0 + 123.4567*col, -2000.0 + 98.7654*row,
+                                  3.0e5 - 0.1234*col*row, 0.01*(col + row) );
+      }
+    return cloud;
+  }
+}
+
+TEST( PointCloudQuantization, RoundTrip ) {
+  ImageView<Vector4> cloud = make_cloud();
+  PointCloudQuantization quant( point_cloud_origin(cloud), 0.001 );
+  ImageView<Vector<int32,4> > quantized = quantize_points( cloud, quant );
+  ImageView<Vector4> result = dequantize_points<4,4>( quantized, quant );
+
+  for ( int row = 0; row < cloud.rows(); row++ )
+    for ( int col = 0; col < cloud.cols(); col++ ) {
+      if ( subvector(cloud(col,row),0,3) == Vector3() ) {
+        EXPECT_EQ( PointCloudQuantization::nodata(), quantized(col,row)[0] );
+        EXPECT_VECTOR_NEAR( Vector4(), result(col,row), 1e-20 );
+      } else {
+        EXPECT_VECTOR_NEAR( cloud(col,row), result(col,row), 0.0005 + 1e-9 );
+      }
+    }
+
+  // Reading fewer channels than stored
+  Vector3 point = dequantize_points<3,4>( quantized, quant )(1,0);
+  EXPECT_VECTOR_NEAR( subvector(cloud(1,0),0,3), point, 0.0005 + 1e-9 );
+}
+
+TEST( PointCloudQuantization, OutOfRange ) {
+  // 1 mm steps reach about 2147 km from the origin
+  PointCloudQuantization quant( Vector3(1e6, 0, 0), 0.001 );
+  QuantizePointFunc<3> func( quant );
+  EXPECT_NE( PointCloudQuantization::nodata(), func( Vector3(3e6, 0, 0) )[0] );
+  EXPECT_EQ( PointCloudQuantization::nodata(), func( Vector3(4e6, 0, 0) )[0] );
+  EXPECT_EQ( PointCloudQuantization::nodata(), func( Vector3() )[1] );
+  EXPECT_EQ( -1000, func( Vector3(1e6 - 1.0, 0, 0) )[0] );
+}
+
+TEST( PointCloudQuantization, Origin ) {
+  ImageView<Vector3> cloud(10,10);
+  EXPECT_VECTOR_NEAR( Vector3(), point_cloud_origin(cloud), 1e-20 );
+  // A single valid pixel is enough
+  cloud(7,3) = Vector3(1,2,3);
+  EXPECT_VECTOR_NEAR( Vector3(1,2,3), point_cloud_origin(cloud), 1e-12 );
+}
+
+TEST( PointCloudQuantization, Metadata ) {
+  UnlinkName file("quantized.tif");
+  ImageView<Vector4> cloud = make_cloud();
+  PointCloudQuantization quant( Vector3(1737400.125, -2000.5, 3.0e5), 0.0025 );
+  {
+    ImageView<Vector<int32,4> > quantized = quantize_points( cloud, quant );
+    DiskImageResourceGDAL rsrc( file, quantized.format() );
+    write_point_cloud_quantization( rsrc, quant );
+    write_image( rsrc, quantized );
+  }
+
+  PointCloudQuantization read = read_point_cloud_quantization( file );
+  ASSERT_TRUE( read.is_quantized() );
+  EXPECT_VECTOR_NEAR( quant.offset, read.offset, 1e-9 );
+  EXPECT_NEAR( quant.scale, read.scale, 1e-15 );
+
+  DiskImageView<Vector<int32,4> > disk( file );
+  ImageView<Vector4> result = dequantize_points<4,4>( disk, read );
+  EXPECT_VECTOR_NEAR( cloud(1,0), result(1,0), 0.00125 + 1e-9 );
+
+  // Floating point files are not quantized
+  UnlinkName plain("plain.tif");
+  write_image( plain, ImageView<float>(4,4) );
+  EXPECT_FALSE( read_point_cloud_quantization( plain ).is_quantized() );
+}
@@ -20,9 +20,13 @@
 #include <boost/assign/std/vector.hpp>
 #include <vw/Image.h>
 #include <asp/Core/SoftwareRenderer.h>
+#include <asp/Core/TriangleRasterizer.h>
 
 #include <vw/FileIO.h>
 
+#include <cmath>
+#include <limits>
+
 using namespace vw;
 using namespace boost::assign;
 
@@ -182,3 +186,224 @@ TEST_F( SoftwareRenderTest, ExtremelyLargeTriangle ) {
     }
   }
 }
+
+TEST( SoftwareRender, MultiChannelMatchesSingleChannel ) {
+  // Render three attributes in one pass and compare each against a
+  // single channel render of the same triangle.
+  std::vector<float> vertices;
+  vertices += 0.5,1./3.,1./3.,2./3.,2./3.,2./3.;
+  std::vector<float> colors;
+  colors += 1.0,-2.0,10.0,  0.3,4.0,20.0,  0.6,8.0,30.0;
+
+  ImageView<PixelRGB<float> > multi_buffer(64,64);
+  stereo::SoftwareRenderer multi( 64, 64, &multi_buffer(0,0)[0] );
+  multi.Ortho2D( 0, 1, 0, 1 );
+  multi.SetVertexPointer( 2, &vertices[0] );
+  multi.SetColorPointer( 3, &colors[0] );
+  multi.Clear( -1.0 );
+  multi.DrawPolygon( 0, 3 );
+
+  for ( int ch = 0; ch < 3; ch++ ) {
+    std::vector<float> gray;
+    gray += colors[ch], colors[3+ch], colors[6+ch];
+    ImageView<float> single_buffer(64,64);
+    stereo::SoftwareRenderer single( 64, 64, &single_buffer(0,0) );
+    single.Ortho2D( 0, 1, 0, 1 );
+    single.SetVertexPointer( 2, &vertices[0] );
+    single.SetColorPointer( 1, &gray[0] );
+    single.Clear( -1.0 );
+    single.DrawPolygon( 0, 3 );
+    EXPECT_SEQ_EQ( single_buffer, select_channel(multi_buffer, ch) );
+  }
+
+  EXPECT_THROW( multi.SetColorPointer( 0, &colors[0] ), ArgumentErr );
+  EXPECT_THROW( multi.SetColorPointer( stereo::SoftwareRenderer::kMaxColorComponents + 1,
+                                       &colors[0] ), ArgumentErr );
+}
+
+// The TriangleRasterizer tests below compare against SoftwareRenderer,
+// which remains the reference implementation, and against a direct
+// point in triangle test at each sample.
+namespace {
+
+  // Small deterministic generator so the tests do not depend on rand()
+  struct Lcg {
+    uint32 state;
+    Lcg( uint32 seed ) : state(seed) {}
+    double operator()() {
+      state = state * 1664525u + 1013904223u;
+      return (state >> 8) / double(1 << 24);
+    }
+  };
+
+  // Distance in pixels from the window point (x,y) to the nearest
+  // edge of a triangle, and whether the point is inside it.
+  double edge_distance( const double* tx, const double* ty,
+                        double x, double y, bool& inside ) {
+    double dist = std::numeric_limits<double>::max();
+    int positive = 0, negative = 0;
+    for ( int k = 0; k < 3; k++ ) {
+      int p = (k+1)%3, q = (k+2)%3;
+      double a = ty[p]-ty[q], b = tx[q]-tx[p];
+      double e = a*(x-tx[p]) + b*(y-ty[p]);
+      positive += e > 0; negative += e < 0;
+      dist = std::min( dist, std::abs(e) / std::sqrt(a*a+b*b) );
+    }
+    inside = positive == 3 || negative == 3;
+    return dist;
+  }
+
+  // Render one triangle with both renderers, NUM_CHANNELS values per
+  // vertex, and compare. Samples within tol of an edge may differ in
+  // coverage since the renderers round differently.
+  template <int NUM_CHANNELS>
+  void compare_renderers( int width, int height, const float* vertices,
+                          const float* colors, double tol ) {
+    std::vector<float> reference(width*height*NUM_CHANNELS),
+      result(width*height*NUM_CHANNELS);
+    std::vector<float> xy( vertices, vertices+6 ), c( colors, colors+3*NUM_CHANNELS );
+
+    stereo::SoftwareRenderer old_renderer( width, height, &reference[0] );
+    old_renderer.Ortho2D( 0, 1, 0, 1 );
+    old_renderer.SetVertexPointer( 2, &xy[0] );
+    old_renderer.SetColorPointer( NUM_CHANNELS, &c[0] );
+    old_renderer.Clear( -1.0 );
+    old_renderer.DrawPolygon( 0, 3 );
+
+    stereo::TriangleRasterizer renderer( width, height, NUM_CHANNELS, &result[0] );
+    renderer.set_ortho( 0, 1, 0, 1 );
+    renderer.clear( -1.0 );
+    double v[3][2+NUM_CHANNELS];
+    double tx[3], ty[3];
+    for ( int k = 0; k < 3; k++ ) {
+      v[k][0] = vertices[2*k]; v[k][1] = vertices[2*k+1];
+      for ( int j = 0; j < NUM_CHANNELS; j++ )
+        v[k][2+j] = colors[k*NUM_CHANNELS+j];
+      tx[k] = v[k][0]*width; ty[k] = v[k][1]*height;
+    }
+    renderer.add_triangle( v[0], v[1], v[2] );
+    renderer.flush();
+
+    // SoftwareRenderer's row 0 is the bottom of the projection
+    for ( int row = 0; row < height; row++ ) {
+      for ( int col = 0; col < width; col++ ) {
+        const float* expected = &reference[((height-1-row)*width+col)*NUM_CHANNELS];
+        const float* actual   = &result[(row*width+col)*NUM_CHANNELS];
+        bool inside;
+        if ( edge_distance( tx, ty, col+1, height-row, inside ) < tol )
+          continue;
+        ASSERT_EQ( expected[0] != -1, actual[0] != -1 ) << col << "," << row;
+        if ( expected[0] == -1 )
+          continue;
+        for ( int j = 0; j < NUM_CHANNELS; j++ )
+          EXPECT_NEAR( expected[j], actual[j], 1e-3*(1+std::abs(expected[j])) )
+            << col << "," << row << " channel " << j;
+      }
+    }
+  }
+}
+
+TEST( TriangleRasterizer, MatchesSoftwareRenderer ) {
+  Lcg random(7);
+  for ( int t = 0; t < 500; t++ ) {
+    float vertices[6], colors[9];
+    for ( int i = 0; i < 6; i++ )
+      vertices[i] = 0.05 + 0.9*random();
+    for ( int i = 0; i < 9; i++ )
+      colors[i] = 100*random() - 50;
+    compare_renderers<1>( 61, 47, vertices, colors, 1e-4 );
+    compare_renderers<3>( 61, 47, vertices, colors, 1e-4 );
+  }
+}
+
+TEST( TriangleRasterizer, ClippedTriangles ) {
+  // Triangles partly outside the projection are clipped to it. Check
+  // coverage against a direct test at every sample.
+  const int width = 53, height = 41;
+  std::vector<float> buffer(width*height);
+  stereo::TriangleRasterizer renderer( width, height, 1, &buffer[0] );
+  renderer.set_ortho( 0, 1, 0, 1 );
+
+  Lcg random(11);
+  for ( int t = 0; t < 300; t++ ) {
+    double v[3][3], tx[3], ty[3];
+    for ( int k = 0; k < 3; k++ ) {
+      v[k][0] = 1.6*random() - 0.3;
+      v[k][1] = 1.6*random() - 0.3;
+      v[k][2] = 1.0;
+      tx[k] = v[k][0]*width; ty[k] = v[k][1]*height;
+    }
+    renderer.clear( 0.0 );
+    renderer.add_triangle( v[0], v[1], v[2] );
+    renderer.flush();
+    for ( int row = 0; row < height; row++ ) {
+      for ( int col = 0; col < width; col++ ) {
+        bool inside;
+        if ( edge_distance( tx, ty, col+1, height-row, inside ) < 1e-6 )
+          continue;
+        ASSERT_EQ( inside ? 1.0 : 0.0, buffer[row*width+col] ) << col << "," << row;
+      }
+    }
+  }
+}
+
+TEST( TriangleRasterizer, SharedEdgesCoverOnce ) {
+  // A mesh whose vertices and edges pass exactly through samples.
+  // Every sample inside the mesh belongs to exactly one triangle.
+  const int size = 24, cells = 6, step = size / cells;
+  std::vector<float> buffer(size*size), count(size*size, 0);
+  stereo::TriangleRasterizer renderer( size, size, 1, &buffer[0] );
+  renderer.set_ortho( 0, size, 0, size );
+
+  Lcg random(3);
+  for ( int i = 0; i < cells; i++ ) {
+    for ( int j = 0; j < cells; j++ ) {
+      double ul[3] = { double(j*step),     double((i+1)*step), 1 };
+      double ll[3] = { double(j*step),     double(i*step),     1 };
+      double lr[3] = { double((j+1)*step), double(i*step),     1 };
+      double ur[3] = { double((j+1)*step), double((i+1)*step), 1 };
+      // Split the quad along either diagonal, in either winding
+      const double* tris[2][3] = { { ul, ll, lr }, { lr, ur, ul } };
+      if ( random() < 0.5 ) {
+        const double* other[2][3] = { { ll, lr, ur }, { ur, ul, ll } };
+        std::copy( &other[0][0], &other[0][0]+6, &tris[0][0] );
+      }
+      for ( int t = 0; t < 2; t++ ) {
+        renderer.clear( 0.0 );
+        if ( random() < 0.5 )
+          renderer.add_triangle( tris[t][0], tris[t][1], tris[t][2] );
+        else
+          renderer.add_triangle( tris[t][2], tris[t][1], tris[t][0] );
+        renderer.flush();
+        for ( int p = 0; p < size*size; p++ )
+          count[p] += buffer[p];
+      }
+    }
+  }
+
+  // Samples on the outer boundary of the mesh are covered or not by
+  // the tie rule; everything else is covered exactly once.
+  for ( int row = 1; row < size; row++ )
+    for ( int col = 0; col < size-1; col++ )
+      EXPECT_EQ( 1.0, count[row*size+col] ) << col << "," << row;
+}
+
+TEST( TriangleRasterizer, Errors ) {
+  std::vector<float> buffer(16*16*stereo::TriangleRasterizer::kMaxChannels);
+  EXPECT_THROW( stereo::TriangleRasterizer( 16, 16, 0, &buffer[0] ), ArgumentErr );
+  EXPECT_THROW( stereo::TriangleRasterizer( 16, 16, stereo::TriangleRasterizer::kMaxChannels+1,
+                                            &buffer[0] ), ArgumentErr );
+  stereo::TriangleRasterizer renderer( 16, 16, 1, &buffer[0] );
+  EXPECT_THROW( renderer.set_ortho( 0, 0, 0, 1 ), LogicErr );
+
+  // Degenerate and NaN triangles draw nothing
+  renderer.set_ortho( 0, 1, 0, 1 );
+  renderer.clear( 0.0 );
+  double a[3] = { 0.1, 0.1, 1 }, b[3] = { 0.5, 0.5, 1 }, c[3] = { 0.9, 0.9, 1 };
+  double d[3] = { std::numeric_limits<double>::quiet_NaN(), 0.5, 1 };
+  renderer.add_triangle( a, b, c );
+  renderer.add_triangle( a, d, c );
+  renderer.flush();
+  for ( int p = 0; p < 16*16; p++ )
+    EXPECT_EQ( 0.0, buffer[p] );
+}
@@ -0,0 +1,174 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <test/Helpers.h>
+#include <asp/Core/StreamingStats.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+  // A deterministic, skewed sample with negative, zero and positive values
+  std::vector<double> make_values() {
+    std::vector<double> values;
+    for ( int i = 0; i < 10000; i++ ) {
+      double t = (i % 997) / 997.0;
+      values.push_back( 5.0 * t * t - 1.0 + (i % 13 == 0 ? 0.0 : 1e-3 * (i % 7)) );
+    }
+    values.push_back( 0.0 );
+    return values;
+  }
+
+  double exact_quantile( std::vector<double> values, double q ) {
+    std::sort( values.begin(), values.end() );
+    return values[ size_t( q * (values.size() - 1) ) ];
+  }
+}
+
+TEST( QuantileSketch, RelativeAccuracy ) {
+  std::vector<double> values = make_values();
+  QuantileSketch sketch( 0.01 );
+  for ( size_t i = 0; i < values.size(); i++ )
+    sketch.add( values[i] );
+  EXPECT_EQ( values.size(), sketch.count() );
+
+  double qs[] = { 0.0, 0.05, 0.25, 0.5, 0.75, 0.95, 1.0 };
+  for ( int i = 0; i < 7; i++ ) {
+    double expected = exact_quantile( values, qs[i] );
+    EXPECT_NEAR( expected, sketch.quantile( qs[i] ), 0.01 * std::abs(expected) + 1e-6 );
+  }
+}
+
+TEST( QuantileSketch, MergeIsExact ) {
+  std::vector<double> values = make_values();
+  QuantileSketch all, a, b;
+  for ( size_t i = 0; i < values.size(); i++ ) {
+    all.add( values[i] );
+    (i < 3000 ? a : b).add( values[i] );
+  }
+  a.merge( b );
+  EXPECT_EQ( all.count(), a.count() );
+  for ( int i = 0; i <= 20; i++ )
+    EXPECT_EQ( all.quantile( i / 20.0 ), a.quantile( i / 20.0 ) );
+  EXPECT_EQ( all.median_absolute_deviation(), a.median_absolute_deviation() );
+
+  EXPECT_THROW( a.merge( QuantileSketch( 0.02 ) ), ArgumentErr );
+}
+
+TEST( QuantileSketch, Empty ) {
+  QuantileSketch sketch;
+  EXPECT_TRUE( sketch.quantile( 0.5 ) != sketch.quantile( 0.5 ) );
+  sketch.add( std::numeric_limits<double>::quiet_NaN() );
+  EXPECT_EQ( 0u, sketch.count() );
+  EXPECT_THROW( QuantileSketch( 0 ), ArgumentErr );
+}
+
+TEST( StreamingStats, Moments ) {
+  std::vector<double> values = make_values();
+  StreamingStats stats, a, b;
+  double sum = 0, sum_sq = 0;
+  for ( size_t i = 0; i < values.size(); i++ ) {
+    sum    += values[i];
+    sum_sq += values[i] * values[i];
+    (i % 3 ? a : b).add( values[i] );
+  }
+  a.merge( b );
+  a.merge( stats ); // Merging nothing changes nothing
+
+  double n = values.size(), mean = sum / n;
+  EXPECT_EQ( values.size(), a.count() );
+  EXPECT_NEAR( mean, a.mean(), 1e-12 );
+  EXPECT_NEAR( std::sqrt(sum_sq / n), a.rms(), 1e-12 );
+  EXPECT_NEAR( std::sqrt(sum_sq / n - mean * mean), a.stddev(), 1e-9 );
+  EXPECT_EQ( *std::min_element( values.begin(), values.end() ), a.min() );
+  EXPECT_EQ( *std::max_element( values.begin(), values.end() ), a.max() );
+}
+
+TEST( BinnedHistogram, NMAD ) {
+  // For values -k..k the median is 0 and the MAD is k/2
+  BinnedHistogram histogram( 1e-3 );
+  for ( int i = -1000; i <= 1000; i++ )
+    histogram.add( i );
+  EXPECT_NEAR( 0.0, histogram.median(), 1e-3 );
+  EXPECT_NEAR( 1.4826 * 500, histogram.nmad(), 1.4826 * 1e-3 );
+
+  StreamingStats empty;
+  EXPECT_TRUE( empty.mean() != empty.mean() );
+  EXPECT_TRUE( BinnedHistogram().nmad() != BinnedHistogram().nmad() );
+  EXPECT_THROW( BinnedHistogram( 0 ), ArgumentErr );
+}
+
+TEST( BinnedHistogram, BiasedValues ) {
+  // Normally distributed values with a standard deviation of 0.3, far
+  // from zero compared to their spread, in two tiles.
+  double biases[] = { 0, 30, 50, 100, 500, -500 };
+  for ( int b = 0; b < 6; b++ ) {
+    std::vector<double> values;
+    uint32 state = 17;
+    for ( int i = 0; i < 10000; i++ ) {
+      double u[2];
+      for ( int k = 0; k < 2; k++ ) {
+        state = state * 1664525u + 1013904223u;
+        u[k] = ( state + 0.5 ) / 4294967296.0;
+      }
+      values.push_back( biases[b] + 0.3 * std::sqrt( -2 * std::log( u[0] ) ) * std::cos( 2 * M_PI * u[1] ) );
+    }
+
+    BinnedHistogram histogram, other;
+    for ( size_t i = 0; i < values.size(); i++ )
+      ( i < 4000 ? histogram : other ).add( values[i] );
+    histogram.merge( other );
+    EXPECT_EQ( values.size(), histogram.count() );
+
+    double median = exact_quantile( values, 0.5 );
+    std::vector<double> deviations;
+    for ( size_t i = 0; i < values.size(); i++ )
+      deviations.push_back( std::abs( values[i] - median ) );
+    double nmad = 1.4826 * exact_quantile( deviations, 0.5 );
+
+    EXPECT_NEAR( median, histogram.median(), 1e-3 ) << biases[b];
+    EXPECT_NEAR( nmad, histogram.nmad(), 1.4826 * 1e-3 ) << biases[b];
+  }
+}
+
+TEST( BinnedHistogram, Coarsen ) {
+  // The outliers make the bins wider, and merging coarsens the finer
+  // histogram, but the result does not depend on how it was split.
+  std::vector<double> values = make_values();
+  values.push_back( 1e4 );
+  values.push_back( -1e4 );
+  BinnedHistogram all( 1e-3, 64 ), a( 1e-3, 64 ), b( 1e-3, 64 );
+  for ( size_t i = 0; i < values.size(); i++ ) {
+    all.add( values[i] );
+    ( i < 100 ? a : b ).add( values[i] );
+  }
+  EXPECT_LT( a.bin_width(), b.bin_width() );
+  a.merge( b );
+  EXPECT_EQ( all.count(), a.count() );
+  EXPECT_EQ( all.bin_width(), a.bin_width() );
+  for ( int i = 0; i <= 20; i++ )
+    EXPECT_EQ( all.quantile( i / 20.0 ), a.quantile( i / 20.0 ) );
+  EXPECT_EQ( all.mad(), a.mad() );
+
+  double median = exact_quantile( values, 0.5 );
+  EXPECT_NEAR( median, all.median(), all.bin_width() / 2 );
+
+  EXPECT_THROW( a.merge( BinnedHistogram( 1e-3, 32 ) ), ArgumentErr );
+}
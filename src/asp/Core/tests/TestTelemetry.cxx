@@ -0,0 +1,133 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <vw/Image/ImageView.h>
+#include <asp/Core/Telemetry.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  // The value following "key": in a line written by Telemetry
+  double field( std::string const& line, std::string const& key ) {
+    size_t pos = line.find( "\"" + key + "\": " );
+    if ( pos == std::string::npos )
+      return -1;
+    return atof( line.c_str() + pos + key.size() + 4 );
+  }
+
+  bool has_view( std::string const& line, std::string const& view ) {
+    return line.find( "\"view\": \"" + view + "\"" ) != std::string::npos;
+  }
+
+  ImageView<float> ramp( int32 cols, int32 rows ) {
+    ImageView<float> image( cols, rows );
+    for ( int32 y = 0; y < rows; y++ )
+      for ( int32 x = 0; x < cols; x++ )
+        image(x,y) = x + 1000*y;
+    return image;
+  }
+
+  // Rasterize 'view' in 10x10 tiles, as a block writer would
+  template <class ViewT>
+  void rasterize_tiles( ViewT const& view, ImageView<float>& out ) {
+    for ( int32 y = 0; y < view.rows(); y += 10 )
+      for ( int32 x = 0; x < view.cols(); x += 10 ) {
+        BBox2i bbox( x, y, std::min(10, view.cols() - x), std::min(10, view.rows() - y) );
+        ImageView<float> tile( bbox.width(), bbox.height() );
+        view.rasterize( tile, bbox );
+        for ( int32 j = 0; j < tile.rows(); j++ )
+          for ( int32 i = 0; i < tile.cols(); i++ )
+            out(x+i, y+j) = tile(i,j);
+      }
+  }
+
+}
+
+TEST( Telemetry, Disabled ) {
+  ImageView<float> image = ramp( 25, 15 ), out( 25, 15 );
+  ASSERT_FALSE( telemetry().enabled() );
+  rasterize_tiles( telemetry_write_view( telemetry_view( image, "ramp" ), "out.tif" ), out );
+  for ( int32 y = 0; y < 15; y++ )
+    for ( int32 x = 0; x < 25; x++ )
+      EXPECT_EQ( image(x,y), out(x,y) );
+}
+
+TEST( Telemetry, PrerasterizeIsLazy ) {
+  ImageView<float> image = ramp( 25, 15 );
+  ASSERT_FALSE( telemetry().enabled() );
+  // A parent view gets the child's own tile, not a copy of it
+  ImageView<float> tile = telemetry_view( image, "ramp" ).prerasterize( BBox2i(10, 0, 10, 10) );
+  EXPECT_EQ( image.data(), tile.data() );
+}
+
+TEST( Telemetry, NestedTiles ) {
+  UnlinkName filename( "telemetry.jsonl" );
+  telemetry().open( filename, "stage \"one\"" );
+  EXPECT_TRUE( telemetry().enabled() );
+
+  ImageView<float> image = ramp( 25, 15 ), out( 25, 15 );
+  rasterize_tiles( telemetry_write_view( telemetry_view( image, "ramp" ), "dir/run-D.tif" ), out );
+  EXPECT_EQ( image(24,14), out(24,14) );
+
+  telemetry().close();
+  EXPECT_FALSE( telemetry().enabled() );
+
+  std::ifstream file( filename.c_str() );
+  std::vector<std::string> lines;
+  std::string line;
+  while ( std::getline( file, line ) )
+    lines.push_back( line );
+
+  // A start line, the write and the ramp for each of 3x2 tiles, and
+  // a finish line
+  ASSERT_EQ( 14u, lines.size() );
+  EXPECT_NE( std::string::npos, lines.front().find( "\"event\": \"start\"" ) );
+  EXPECT_NE( std::string::npos, lines.front().find( "\"stage\": \"stage \\\"one\\\"\"" ) );
+  EXPECT_NE( std::string::npos, lines.back().find( "\"event\": \"finish\"" ) );
+
+  int writes = 0, ramps = 0;
+  for ( size_t i = 1; i + 1 < lines.size(); i++ ) {
+    // The nested tile finishes first
+    if ( has_view( lines[i], "ramp" ) ) {
+      ramps++;
+      EXPECT_EQ( 1, field( lines[i], "depth" ) );
+      EXPECT_EQ( 0, field( lines[i], "bytes_written" ) );
+      EXPECT_TRUE( has_view( lines[i+1], "write run-D.tif" ) );
+      EXPECT_LE( field( lines[i], "wall" ), field( lines[i+1], "wall" ) );
+    } else {
+      ASSERT_TRUE( has_view( lines[i], "write run-D.tif" ) );
+      writes++;
+      EXPECT_EQ( 0, field( lines[i], "depth" ) );
+      EXPECT_LE( field( lines[i], "self_wall" ), field( lines[i], "wall" ) );
+      EXPECT_GT( field( lines[i], "peak_rss_kb" ), 0 );
+    }
+  }
+  EXPECT_EQ( 6, writes );
+  EXPECT_EQ( 6, ramps );
+
+  // The last tile is 5x5 floats
+  EXPECT_NE( std::string::npos, lines[12].find( "\"bbox\": [20, 10, 5, 5]" ) );
+  EXPECT_EQ( 100, field( lines[12], "bytes_written" ) );
+}
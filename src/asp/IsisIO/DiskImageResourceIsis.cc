@@ -25,10 +25,13 @@
 #endif
 
 #include <vw/Core/Exception.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/Image/PerPixelViews.h>
 
 #include <asp/IsisIO/DiskImageResourceIsis.h>
 
+#include <algorithm>
+
 // Isis Includes
 #include <Cube.h>
 #include <Portal.h>
@@ -38,17 +41,160 @@
 using namespace std;
 using namespace boost;
 
+namespace {
+  // ISIS keeps global state while opening a cube, so cubes are
+  // opened one at a time even though reads are concurrent.
+  vw::Mutex g_isis_open_mutex;
+
+  // Cache tiles of tiled cubes are square blocks of native tiles.
+  // Band sequential cubes use whole lines up to about this many bytes.
+  const int    TILED_CACHE_TILE = 256;
+  const size_t LINE_CACHE_BYTES = 4 * 1024 * 1024;
+}
+
 namespace vw {
 
+  // Borrows a cube handle that no other thread is reading from,
+  // opening a new one when all are busy.
+  class DiskImageResourceIsis::CubeHandle : private boost::noncopyable {
+    DiskImageResourceIsis const& m_rsrc;
+    boost::shared_ptr<Isis::Cube> m_cube;
+  public:
+    CubeHandle(DiskImageResourceIsis const& rsrc) : m_rsrc(rsrc) {
+      {
+        Mutex::Lock lock(m_rsrc.m_handle_mutex);
+        if ( !m_rsrc.m_free_cubes.empty() ) {
+          m_cube = m_rsrc.m_free_cubes.back();
+          m_rsrc.m_free_cubes.pop_back();
+          return;
+        }
+      }
+      Mutex::Lock lock(g_isis_open_mutex);
+      m_cube.reset( new Isis::Cube() );
+      m_cube->open( QString::fromStdString(m_rsrc.m_filename) );
+      VW_ASSERT( m_cube->isOpen(),
+                 IOErr() << "DiskImageResourceIsis: Could not open cube file: \""
+                 << m_rsrc.m_filename << "\"." );
+    }
+    ~CubeHandle() {
+      Mutex::Lock lock(m_rsrc.m_handle_mutex);
+      m_rsrc.m_free_cubes.push_back(m_cube);
+    }
+    Isis::Cube* operator->() const { return m_cube.get(); }
+  };
+
+  class DiskImageResourceIsis::ReadAheadTask : public Task, private boost::noncopyable {
+    DiskImageResourceIsis const& m_rsrc;
+    TilePtr m_tile;
+  public:
+    ReadAheadTask(DiskImageResourceIsis const& rsrc, TilePtr tile) :
+      m_rsrc(rsrc), m_tile(tile) {}
 
-  // We use a fixed tile size of 2048x2048 pixels here.  Although this
-  // may not be the native tile size of the ISIS cube, it seems to be
-  // much faster to let the ISIS driver aggregate smaller blocks by
-  // making a larger request rather than caching those blocks
-  // ourselves.
+    void operator()() {
+      Mutex::Lock lock(m_tile->mutex);
+      if ( m_tile->portal )
+        return;
+      // A failed read ahead is retried and reported by the reader
+      // that actually needs the tile.
+      try {
+        m_rsrc.load_tile(*m_tile);
+      } catch ( const std::exception& ) {}
+    }
+  };
+
+  DiskImageResourceIsis::~DiskImageResourceIsis() {
+    if ( m_read_ahead )
+      m_read_ahead->join_all();
+  }
+
+  // Reads are served from the tile cache, so this is the cache tile
+  // size rather than the native tile size of the cube.
   Vector2i DiskImageResourceIsis::block_read_size() const
   {
-    return Vector2i(2048,2048);
+    return m_native_block_size;
+  }
+
+  void DiskImageResourceIsis::set_cache_size(size_t bytes) {
+    Mutex::Lock lock(m_cache_mutex);
+    m_cache_limit = bytes;
+    evict();
+  }
+
+  BBox2i DiskImageResourceIsis::tile_bbox(int64 index) const {
+    int tx = int(index % m_tiles.x()), ty = int(index / m_tiles.x());
+    BBox2i bbox(tx * m_native_block_size.x(), ty * m_native_block_size.y(),
+                m_native_block_size.x(), m_native_block_size.y());
+    bbox.crop( BBox2i(0, 0, m_format.cols, m_format.rows) );
+    return bbox;
+  }
+
+  // Portals hold the raw pixels and a copy converted to double.
+  static size_t tile_bytes(BBox2i const& bbox, int bytes_per_pixel) {
+    return size_t(bbox.width()) * bbox.height() * (bytes_per_pixel + sizeof(double));
+  }
+
+  // Drop least recently used tiles until the cache fits. Must be
+  // called with the cache mutex held.
+  void DiskImageResourceIsis::evict() const {
+    while ( m_cache_bytes > m_cache_limit && m_lru.size() > 1 ) {
+      int64 index = m_lru.back();
+      m_lru.pop_back();
+      m_cache_bytes -= tile_bytes(m_cache[index].tile->bbox, m_bytes_per_pixel);
+      m_cache.erase(index);
+    }
+  }
+
+  // Look up a tile, adding an empty one if it is not cached, and mark
+  // it most recently used.
+  DiskImageResourceIsis::TilePtr
+  DiskImageResourceIsis::find_tile(int64 index, bool& created) const {
+    Mutex::Lock lock(m_cache_mutex);
+    std::map<int64, CacheEntry>::iterator it = m_cache.find(index);
+    created = it == m_cache.end();
+    if ( !created ) {
+      m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+      return it->second.tile;
+    }
+
+    CacheEntry& entry = m_cache[index];
+    entry.tile.reset( new CacheTile() );
+    entry.tile->bbox = tile_bbox(index);
+    m_lru.push_front(index);
+    entry.lru = m_lru.begin();
+    m_cache_bytes += tile_bytes(entry.tile->bbox, m_bytes_per_pixel);
+    TilePtr tile = entry.tile;
+    evict();
+    return tile;
+  }
+
+  // Read a tile from the cube. Must be called with the tile mutex held.
+  void DiskImageResourceIsis::load_tile(CacheTile& tile) const {
+    // Note that ISIS cube pixel indices appear to be 1-based.
+    boost::shared_ptr<Isis::Portal> portal
+      ( new Isis::Portal( tile.bbox.width(), tile.bbox.height(), m_cube->pixelType() ) );
+    portal->SetPosition(tile.bbox.min().x()+1, tile.bbox.min().y()+1, 1);
+    CubeHandle cube(*this);
+    cube->read(*portal);
+    tile.portal = portal;
+  }
+
+  DiskImageResourceIsis::TilePtr DiskImageResourceIsis::get_tile(int64 index) const {
+    bool created;
+    TilePtr tile = find_tile(index, created);
+    Mutex::Lock lock(tile->mutex);
+    if ( !tile->portal )
+      load_tile(*tile);
+    return tile;
+  }
+
+  // Queue a background read of a tile that is not cached yet.
+  void DiskImageResourceIsis::read_ahead(int64 index) const {
+    if ( !m_read_ahead || index >= int64(m_tiles.x()) * m_tiles.y() )
+      return;
+    bool created;
+    TilePtr tile = find_tile(index, created);
+    if ( created )
+      m_read_ahead->add_task( boost::shared_ptr<Task>( new ReadAheadTask(*this, tile) ) );
   }
 
   /// Bind the resource to a file for writing.
@@ -111,34 +257,67 @@ namespace vw {
     default:
       vw_throw(IOErr() << "DiskImageResourceIsis: Unknown pixel type.");
     }
+
+    // Cache tiles follow the storage layout of the cube so that each
+    // one is a contiguous read for ISIS.
+    if ( m_cube->format() == Isis::Cube::Bsq ) {
+      size_t line_bytes = size_t(m_bytes_per_pixel) * m_format.cols;
+      int lines = int( std::max( size_t(1), LINE_CACHE_BYTES / line_bytes ) );
+      m_native_block_size = Vector2i( m_format.cols, std::min( lines, m_format.rows ) );
+    } else {
+      m_native_block_size = Vector2i( std::min( TILED_CACHE_TILE, m_format.cols ),
+                                      std::min( TILED_CACHE_TILE, m_format.rows ) );
+    }
+    m_tiles = Vector2i( (m_format.cols + m_native_block_size.x() - 1) / m_native_block_size.x(),
+                        (m_format.rows + m_native_block_size.y() - 1) / m_native_block_size.y() );
+    m_read_ahead.reset( new FifoWorkQueue(1) );
   }
 
-  /// Read the disk image into the given buffer.
+  /// Read the disk image into the given buffer. Each cached tile the
+  /// bbox touches is converted straight into its part of the buffer.
   void DiskImageResourceIsis::read(ImageBuffer const& dest, BBox2i const& bbox) const
   {
-    VW_ASSERT(bbox.max().x() <= m_cube->sampleCount() ||
-              bbox.max().y() <= m_cube->lineCount(),
+    VW_ASSERT(bbox.min().x() >= 0 && bbox.min().y() >= 0 &&
+              bbox.max().x() <= m_format.cols && bbox.max().y() <= m_format.rows,
               IOErr() << "DiskImageResourceIsis: requested bbox " << bbox
-              << " exceeds image dimensions [" << m_cube->sampleCount()
-              << " " << m_cube->lineCount() << "]");
-
-    // Read in the requested tile from the cube file.  Note that ISIS
-    // cube pixel indices appear to be 1-based.
-    Isis::Portal buffer( bbox.width(), bbox.height(),
-                         m_cube->pixelType() );
-    buffer.SetPosition(bbox.min().x()+1, bbox.min().y()+1, 1);
-    m_cube->read(buffer);
-
-    // Create generic image buffer from the Isis data.
-    ImageBuffer src;
-    src.data = buffer.RawBuffer();
-    src.format = m_format;
-    src.format.cols = bbox.width();
-    src.format.rows = bbox.height();
-    src.cstride = m_bytes_per_pixel;
-    src.rstride = m_bytes_per_pixel * bbox.width();
-    src.pstride = m_bytes_per_pixel * bbox.width() * bbox.height();
-    convert(dest, src);
+              << " exceeds image dimensions [" << m_format.cols
+              << " " << m_format.rows << "]");
+    if ( bbox.empty() )
+      return;
+
+    int bx = m_native_block_size.x(), by = m_native_block_size.y();
+    int64 index = 0;
+    for ( int ty = bbox.min().y() / by; ty <= (bbox.max().y() - 1) / by; ty++ ) {
+      for ( int tx = bbox.min().x() / bx; tx <= (bbox.max().x() - 1) / bx; tx++ ) {
+        index = int64(ty) * m_tiles.x() + tx;
+        TilePtr tile = get_tile(index);
+        BBox2i piece = tile->bbox;
+        piece.crop(bbox);
+
+        // Create generic image buffer from the Isis data.
+        ImageBuffer src;
+        src.format = m_format;
+        src.format.cols = piece.width();
+        src.format.rows = piece.height();
+        src.cstride = m_bytes_per_pixel;
+        src.rstride = m_bytes_per_pixel * tile->bbox.width();
+        src.pstride = src.rstride * tile->bbox.height();
+        src.data = static_cast<uint8*>(tile->portal->RawBuffer())
+          + (piece.min().y() - tile->bbox.min().y()) * src.rstride
+          + (piece.min().x() - tile->bbox.min().x()) * src.cstride;
+
+        ImageBuffer dst = dest;
+        dst.format.cols = piece.width();
+        dst.format.rows = piece.height();
+        dst.data = static_cast<uint8*>(dest.data)
+          + (piece.min().y() - bbox.min().y()) * dest.rstride
+          + (piece.min().x() - bbox.min().x()) * dest.cstride;
+        convert(dst, src);
+      }
+    }
+
+    // Readers mostly move through the image in raster order.
+    read_ahead(index + 1);
   }
 
   // Write the given buffer into the disk image.
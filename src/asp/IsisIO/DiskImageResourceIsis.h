@@ -26,26 +26,41 @@
 
 #include <vw/Image/PixelTypes.h>
 #include <vw/FileIO/DiskImageResource.h>
+#include <vw/Core/Thread.h>
+
+#include <list>
+#include <map>
+#include <vector>
 
 namespace Isis {
   class Cube;
+  class Portal;
 }
 
 namespace vw {
 
+  class FifoWorkQueue;
+
+  /// Reads ISIS cubes through a tile cache. Tiles are read into ISIS
+  /// portals, kept in a least recently used cache and converted from
+  /// there straight into the caller's buffer. Every concurrent reader
+  /// gets its own cube handle, so reads from several threads proceed
+  /// in parallel, and the tile after each one requested in raster
+  /// order is read ahead in the background.
   class DiskImageResourceIsis : public DiskImageResource {
   public:
 
-    DiskImageResourceIsis(std::string const& filename) : DiskImageResource(filename) {
+    DiskImageResourceIsis(std::string const& filename)
+      : DiskImageResource(filename), m_cache_limit(DEFAULT_CACHE_BYTES), m_cache_bytes(0) {
       open(filename);
     }
 
     DiskImageResourceIsis(std::string const& filename, ImageFormat const& format)
-      : DiskImageResource(filename) {
+      : DiskImageResource(filename), m_cache_limit(DEFAULT_CACHE_BYTES), m_cache_bytes(0) {
       create(filename, format);
     }
 
-    virtual ~DiskImageResourceIsis() {}
+    virtual ~DiskImageResourceIsis();
 
     /// Returns the type of disk image resource.
     static std::string type_static() { return "ISIS"; }
@@ -80,11 +95,54 @@ namespace vw {
     // Additional cube informat
     bool is_map_projected() const;
 
+    /// Bound on the bytes of decoded tiles kept by this resource. At
+    /// least one tile is always kept.
+    void set_cache_size(size_t bytes);
+    size_t cache_size() const { return m_cache_limit; }
+
   private:
+    static const size_t DEFAULT_CACHE_BYTES = 64 * 1024 * 1024;
+
+    struct CacheTile {
+      Mutex mutex;                           // Held while the tile is read
+      boost::shared_ptr<Isis::Portal> portal;
+      BBox2i bbox;
+    };
+    typedef boost::shared_ptr<CacheTile> TilePtr;
+    typedef std::list<int64> LruList;
+    struct CacheEntry {
+      TilePtr tile;
+      LruList::iterator lru;
+    };
+
+    class CubeHandle;
+    class ReadAheadTask;
+
+    TilePtr find_tile(int64 index, bool& created) const;
+    TilePtr get_tile(int64 index) const;
+    void load_tile(CacheTile& tile) const;
+    void read_ahead(int64 index) const;
+    void evict() const;
+    BBox2i tile_bbox(int64 index) const;
+
     boost::shared_ptr<Isis::Cube> m_cube;
     std::string m_filename;
     int m_bytes_per_pixel;
     Vector2i m_native_block_size;
+    Vector2i m_tiles;
+
+    // Tile cache, most recently used first
+    mutable Mutex m_cache_mutex;
+    mutable std::map<int64, CacheEntry> m_cache;
+    mutable LruList m_lru;
+    size_t m_cache_limit;
+    mutable size_t m_cache_bytes;
+
+    // Cube handles not in use by a reader
+    mutable Mutex m_handle_mutex;
+    mutable std::vector<boost::shared_ptr<Isis::Cube> > m_free_cubes;
+
+    boost::shared_ptr<FifoWorkQueue> m_read_ahead;
   };
 
 } // namespace vw
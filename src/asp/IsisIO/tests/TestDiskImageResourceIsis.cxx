@@ -0,0 +1,107 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+
+#include <vw/Core/ThreadPool.h>
+#include <vw/Image/ImageView.h>
+#include <asp/IsisIO/DiskImageResourceIsis.h>
+
+#include <cstdlib>
+
+using namespace vw;
+
+namespace {
+
+  // Reads a set of boxes and counts pixels that differ from the
+  // reference read of the whole cube.
+  class ReadTask : public Task, private boost::noncopyable {
+    DiskImageResourceIsis const& m_rsrc;
+    ImageView<float> const& m_reference;
+    std::vector<BBox2i> m_boxes;
+    int& m_mismatches;
+  public:
+    ReadTask( DiskImageResourceIsis const& rsrc, ImageView<float> const& reference,
+              std::vector<BBox2i> const& boxes, int& mismatches ) :
+      m_rsrc(rsrc), m_reference(reference), m_boxes(boxes), m_mismatches(mismatches) {}
+
+    void operator()() {
+      m_mismatches = 0;
+      for ( size_t i = 0; i < m_boxes.size(); i++ ) {
+        BBox2i const& bbox = m_boxes[i];
+        ImageView<float> result( bbox.width(), bbox.height() );
+        m_rsrc.read( result.buffer(), bbox );
+        for ( int row = 0; row < result.rows(); row++ )
+          for ( int col = 0; col < result.cols(); col++ )
+            if ( result(col,row) != m_reference(col + bbox.min().x(), row + bbox.min().y()) )
+              m_mismatches++;
+      }
+    }
+  };
+
+  std::vector<BBox2i> random_boxes( int cols, int rows, int count ) {
+    std::vector<BBox2i> boxes;
+    for ( int i = 0; i < count; i++ ) {
+      int x = rand() % cols, y = rand() % rows;
+      int w = 1 + rand() % (cols - x), h = 1 + rand() % (rows - y);
+      boxes.push_back( BBox2i(x, y, w, h) );
+    }
+    return boxes;
+  }
+
+}
+
+TEST(DiskImageResourceIsis, CachedReads) {
+  DiskImageResourceIsis rsrc("E0201461.tiny.cub");
+  ImageView<float> reference( rsrc.cols(), rsrc.rows() );
+  rsrc.read( reference.buffer(), bounding_box(reference) );
+
+  // A second read of the whole cube comes from the cache.
+  ImageView<float> again( rsrc.cols(), rsrc.rows() );
+  rsrc.read( again.buffer(), bounding_box(again) );
+  EXPECT_SEQ_EQ( reference, again );
+
+  // Reads that straddle tile edges with a single tile kept.
+  rsrc.set_cache_size( 1 );
+  int mismatches = 0;
+  srand(7);
+  ReadTask task( rsrc, reference, random_boxes( rsrc.cols(), rsrc.rows(), 20 ), mismatches );
+  task();
+  EXPECT_EQ( 0, mismatches );
+}
+
+TEST(DiskImageResourceIsis, ConcurrentReads) {
+  DiskImageResourceIsis rsrc("E0201461.tiny.cub");
+  ImageView<float> reference( rsrc.cols(), rsrc.rows() );
+  rsrc.read( reference.buffer(), bounding_box(reference) );
+
+  DiskImageResourceIsis shared("E0201461.tiny.cub");
+  shared.set_cache_size( 4 * 1024 * 1024 );
+  const int num_tasks = 8;
+  std::vector<int> mismatches( num_tasks, -1 );
+  srand(11);
+  FifoWorkQueue queue( 4 );
+  for ( int i = 0; i < num_tasks; i++ )
+    queue.add_task( boost::shared_ptr<Task>
+                    ( new ReadTask( shared, reference,
+                                    random_boxes( rsrc.cols(), rsrc.rows(), 10 ),
+                                    mismatches[i] ) ) );
+  queue.join_all();
+  for ( int i = 0; i < num_tasks; i++ )
+    EXPECT_EQ( 0, mismatches[i] );
+}
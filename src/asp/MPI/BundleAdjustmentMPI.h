@@ -18,77 +18,237 @@
 
 /// \file BundleAdjustmentMPI.h
 ///
-/// Header to define MPI interactions
+/// The reduced camera system of bundle adjustment split by cameras
+/// over the processes of an MPI job, and its solution by distributed
+/// preconditioned conjugate gradients.
 
 #ifndef __ASP_MPI_BUNDLE_ADJUSTMENT_MPI_H__
 #define __ASP_MPI_BUNDLE_ADJUSTMENT_MPI_H__
 
 #include <boost/mpi.hpp>
-#include <iostream>
-#include <boost/serialization/string.hpp>
+#include <boost/serialization/vector.hpp>
 namespace mpi = boost::mpi;
-#include <boost/foreach.hpp>
 
-#include <asp/IsisIO/IsisAdjustCameraModel.h>
+#include <vw/Core/Exception.h>
+#include <asp/Core/BlockSparseSolver.h>
 
-enum MPISlaveTask {
-  LoadCameraModels,
-  LoadControlNetwork,
-  SolveJacobian,
-  SolveUpdateError,
-  Finish
-};
+#include <algorithm>
+#include <cmath>
+#include <functional>
 
-namespace vw {
-namespace camera {
+namespace asp {
 
-  class MPISlave {
-    mpi::communicator & m_world;
-    std::vector<boost::shared_ptr<CameraModel> > m_cameras;
-    unsigned m_camera_start;
+  // A symmetric BlockSparseMatrix whose block rows are owned by the
+  // ranks of a communicator. Every rank knows the whole sparsity
+  // pattern, but stores only its own rows, and exchanges with the
+  // other ranks only the vector entries that those rows reference.
+  // Vectors are full length on every rank, and valid at the owned
+  // rows.
+  class DistributedBlockMatrix {
+    mpi::communicator m_world;
+    size_t m_block_size;
+    std::vector<int> m_owner;
+    std::vector<size_t> m_rows;
+    BlockSparseMatrix m_matrix;
+    std::vector<std::vector<size_t> > m_send, m_recv;  // Rows to send to and receive from each rank
+
+    typedef std::vector<std::vector<double> > Messages;
+
+    void unpack_rows( std::vector<double> const& message, std::vector<double>& x,
+                      std::vector<size_t> const& rows ) const {
+      VW_ASSERT( message.size() == rows.size() * m_block_size,
+                 vw::LogicErr() << "DistributedBlockMatrix: unexpected message size." );
+      for ( size_t n = 0; n < rows.size(); n++ )
+        std::copy( &message[n*m_block_size], &message[n*m_block_size] + m_block_size,
+                   &x[rows[n]*m_block_size] );
+    }
 
   public:
-    MPISlave( mpi::communicator & world) : m_world(world) {
-      vw_out(DebugMessage,"mpi_slave") << "\tSlave " << m_world.rank()
-                                       << " : Starting\n";
-      int task;
-      while (true) {
-        broadcast(m_world, task, 0);
-        if ( task == LoadCameraModels ) {
-          vw_out(DebugMessage,"mpi_slave") << "\tSlave " << m_world.rank()
-                                           << " : Loading Camera Models\n";
-          m_cameras.resize(0);
-          std::vector<std::string> camera_files;
-          broadcast(m_world, camera_files, 0);
-          m_camera_start = (m_world.rank()-1)*float(camera_files.size())/float(m_world.size()-1);
-          unsigned cam_e = m_world.rank()*float(camera_files.size())/float(m_world.size()-1);
-          for ( unsigned i = m_camera_start; i < cam_e; i++ ) {
-            vw_out(DebugMessage,"mpi_slave") << "\tSlave " << m_world.rank()
-                                             << " : Loading "
-                                             << camera_files[i] << "\n";
-            boost::shared_ptr<asp::BaseEquation> posF( new asp::PolyEquation(0) );
-            boost::shared_ptr<asp::BaseEquation> poseF( new asp::PolyEquation(0) );
-            m_cameras.push_back( boost::shared_ptr<IsisAdjustCameraModel>( new IsisAdjustCameraModel( camera_files[i],
-                                                                                                      posF, poseF )));
-          }
-        } else if ( task == LoadControlNetwork ) {
-          vw_out(DebugMessage,"mpi_slave") << "\tSlave " << m_world.rank()
-                                           << " : Loading Control Network\n";
-        } else if ( task == SolveJacobian ) {
-          vw_out(DebugMessage,"mpi_slave") << "\tSlave " << m_world.rank()
-                                           << " : Solving Jacobian\n";
-        } else if ( task == SolveUpdateError ) {
-          vw_out(DebugMessage,"mpi_slave") << "\tSlave " << m_world.rank()
-                                           << " : Solving Update Error\n";
-        } else if ( task == Finish ) {
-          vw_out(DebugMessage,"mpi_slave") << "\tSlave " << m_world.rank()
-                                           << " : Finished\n";
-          break;
+    DistributedBlockMatrix() : m_block_size(0) {}
+
+    // 'pattern' is that of the whole matrix, and 'owner' the rank of
+    // each block row.
+    DistributedBlockMatrix( mpi::communicator const& world, size_t block_size,
+                            std::vector<std::vector<size_t> > const& pattern,
+                            std::vector<int> const& owner ) :
+      m_world(world), m_block_size(block_size), m_owner(owner),
+      m_send(world.size()), m_recv(world.size()) {
+      VW_ASSERT( owner.size() == pattern.size(),
+                 vw::ArgumentErr() << "DistributedBlockMatrix: expecting an owner per block row." );
+      std::vector<std::vector<size_t> > local_pattern( pattern.size() );
+      for ( size_t i = 0; i < pattern.size(); i++ ) {
+        if ( owner[i] != world.rank() ) continue;
+        m_rows.push_back( i );
+        local_pattern[i] = pattern[i];
+        // The pattern is symmetric: the ranks owning the columns of
+        // this row need it, and have what this row needs.
+        for ( size_t n = 0; n < pattern[i].size(); n++ ) {
+          int r = owner[pattern[i][n]];
+          if ( r == world.rank() ) continue;
+          m_recv[r].push_back( pattern[i][n] );
+          m_send[r].push_back( i );
+        }
+      }
+      for ( int r = 0; r < world.size(); r++ ) {
+        std::sort( m_recv[r].begin(), m_recv[r].end() );
+        m_recv[r].erase( std::unique( m_recv[r].begin(), m_recv[r].end() ), m_recv[r].end() );
+        std::sort( m_send[r].begin(), m_send[r].end() );
+        m_send[r].erase( std::unique( m_send[r].begin(), m_send[r].end() ), m_send[r].end() );
+      }
+      m_matrix = BlockSparseMatrix( block_size, local_pattern );
+    }
+
+    mpi::communicator const& world() const { return m_world; }
+    size_t block_size() const { return m_block_size; }
+    size_t rows() const { return m_owner.size() * m_block_size; }
+    int owner( size_t i ) const { return m_owner[i]; }
+    std::vector<size_t> const& owned_rows() const { return m_rows; }
+
+    // The owned rows, indexed globally. The other rows are empty.
+    BlockSparseMatrix& local() { return m_matrix; }
+    BlockSparseMatrix const& local() const { return m_matrix; }
+
+    // The number of vector blocks received from other ranks by each product
+    size_t halo_size() const {
+      size_t count = 0;
+      for ( size_t r = 0; r < m_recv.size(); r++ )
+        count += m_recv[r].size();
+      return count;
+    }
+
+    // Fetches, from their owners, the entries of x that the owned rows reference
+    void exchange( std::vector<double>& x ) const {
+      Messages out( m_world.size() ), in;
+      for ( int r = 0; r < m_world.size(); r++ )
+        for ( size_t n = 0; n < m_send[r].size(); n++ )
+          out[r].insert( out[r].end(), &x[m_send[r][n]*m_block_size],
+                         &x[m_send[r][n]*m_block_size] + m_block_size );
+      mpi::all_to_all( m_world, out, in );
+      for ( int r = 0; r < m_world.size(); r++ )
+        unpack_rows( in[r], x, m_recv[r] );
+    }
+
+    // y = S x at the owned rows. Overwrites the entries of x fetched
+    // from other ranks.
+    void multiply( std::vector<double>& x, std::vector<double>& y ) const {
+      exchange( x );
+      m_matrix.multiply( x, y, 1 );
+    }
+
+    // Sum over all ranks of the products at the owned rows
+    double dot( std::vector<double> const& a, std::vector<double> const& b ) const {
+      double sum = 0;
+      for ( size_t n = 0; n < m_rows.size(); n++ )
+        for ( size_t c = 0; c < m_block_size; c++ ) {
+          size_t k = m_rows[n]*m_block_size + c;
+          sum += a[k] * b[k];
+        }
+      return mpi::all_reduce( m_world, sum, std::plus<double>() );
+    }
+
+    // Adds to the owned rows the 'rows' of 'contrib' and of 'rhs'
+    // computed by every rank. 'contrib' has the pattern of the whole
+    // matrix at those rows.
+    void add_contributions( BlockSparseMatrix const& contrib, std::vector<double> const& rhs_contrib,
+                            std::vector<size_t> const& rows, std::vector<double>& rhs ) {
+      size_t bb = m_block_size * m_block_size;
+      Messages out( m_world.size() ), in;
+      for ( size_t n = 0; n < rows.size(); n++ ) {
+        size_t i = rows[n];
+        std::vector<double>& message = out[m_owner[i]];
+        message.push_back( double(i) );
+        message.insert( message.end(), contrib.values( contrib.row_begin(i) ),
+                        contrib.values( contrib.row_begin(i) ) + (contrib.row_end(i) - contrib.row_begin(i)) * bb );
+        message.insert( message.end(), &rhs_contrib[i*m_block_size],
+                        &rhs_contrib[i*m_block_size] + m_block_size );
+      }
+      mpi::all_to_all( m_world, out, in );
+
+      for ( int r = 0; r < m_world.size(); r++ ) {
+        size_t k = 0;
+        while ( k < in[r].size() ) {
+          size_t i = size_t( in[r][k++] );
+          VW_ASSERT( i < m_owner.size() && m_owner[i] == m_world.rank(),
+                     vw::LogicErr() << "DistributedBlockMatrix: received a row owned elsewhere." );
+          double* values = m_matrix.values( m_matrix.row_begin(i) );
+          size_t count = (m_matrix.row_end(i) - m_matrix.row_begin(i)) * bb;
+          for ( size_t c = 0; c < count; c++ )
+            values[c] += in[r][k++];
+          for ( size_t c = 0; c < m_block_size; c++ )
+            rhs[i*m_block_size + c] += in[r][k++];
         }
       }
     }
   };
 
-}}
+  // Solves S x = rhs by conjugate gradients, preconditioned by the
+  // owned diagonal blocks, as pcg_solve does on one process. Returns
+  // the number of iterations. x is valid at the owned rows.
+  inline int distributed_pcg_solve( DistributedBlockMatrix const& S, std::vector<double> const& rhs,
+                                    std::vector<double>& x, PCGOptions const& opt = PCGOptions() ) {
+    size_t b = S.block_size(), stride = preconditioner_size( opt.preconditioner, b );
+    std::vector<size_t> const& rows = S.owned_rows();
+    VW_ASSERT( rhs.size() == S.rows(), vw::ArgumentErr() << "distributed_pcg_solve: vector size mismatch." );
+
+    // Every rank must reach the all_reduce, so the ranks throw together
+    std::vector<double> precond( rows.size() * stride );
+    int not_pd = 0;
+    for ( size_t n = 0; n < rows.size() && !not_pd; n++ )
+      if ( !factor_preconditioner( opt.preconditioner, S.local().block( rows[n], rows[n] ),
+                                   &precond[n*stride], b ) )
+        not_pd = 1;
+    if ( mpi::all_reduce( S.world(), not_pd, mpi::maximum<int>() ) )
+      vw::vw_throw( vw::ArgumentErr() << "distributed_pcg_solve: the matrix is not positive definite." );
+
+    if ( x.size() != rhs.size() )
+      x.assign( rhs.size(), 0.0 );
+    std::vector<double> r( rhs.size(), 0.0 ), z( rhs.size(), 0.0 ), p( rhs.size(), 0.0 ), q;
+    S.multiply( x, q );
+    for ( size_t n = 0; n < rows.size(); n++ )
+      for ( size_t c = 0; c < b; c++ ) {
+        size_t k = rows[n]*b + c;
+        r[k] = rhs[k] - q[k];
+      }
+
+    double rhs_norm = std::sqrt( S.dot( rhs, rhs ) );
+    if ( rhs_norm == 0 ) {
+      std::fill( x.begin(), x.end(), 0.0 );
+      return 0;
+    }
+
+    double rz = 0;
+    int iteration = 0;
+    for ( ; iteration < opt.max_iterations; iteration++ ) {
+      if ( std::sqrt( S.dot( r, r ) ) <= opt.tolerance * rhs_norm )
+        break;
+
+      for ( size_t n = 0; n < rows.size(); n++ ) {
+        double* zn = &z[rows[n]*b];
+        std::copy( &r[rows[n]*b], &r[rows[n]*b] + b, zn );
+        apply_preconditioner( opt.preconditioner, &precond[n*stride], zn, b );
+      }
+
+      double rz_new = S.dot( r, z );
+      double beta = iteration == 0 ? 0.0 : rz_new / rz;
+      rz = rz_new;
+      for ( size_t n = 0; n < rows.size(); n++ )
+        for ( size_t c = 0; c < b; c++ ) {
+          size_t k = rows[n]*b + c;
+          p[k] = z[k] + beta * p[k];
+        }
+
+      S.multiply( p, q );
+      double alpha = rz / S.dot( p, q );
+      for ( size_t n = 0; n < rows.size(); n++ )
+        for ( size_t c = 0; c < b; c++ ) {
+          size_t k = rows[n]*b + c;
+          x[k] += alpha * p[k];
+          r[k] -= alpha * q[k];
+        }
+    }
+    return iteration;
+  }
+
+}
 
 #endif//__ASP_MPI_BUNDLE_ADJUSTMENT_MPI_H__
@@ -18,556 +18,342 @@
 
 /// \file BundleAdjustmentMPISparse.h
 ///
-/// Sparse implementation of bundle adjustment. Faster yo!
+/// Sparse Levenberg-Marquardt bundle adjustment distributed over the
+/// processes of an MPI job. The cameras are split between the ranks
+/// by nested dissection of the camera graph, and each point belongs
+/// to the rank that owns most of its cameras. A rank linearizes only
+/// its own points, sends the blocks they contribute to the reduced
+/// camera system to the owners of those cameras, and the system is
+/// solved by distributed PCG.
+///
+/// Every rank holds the whole model and control network, but keeps
+/// only its own points up to date. Call collect_points() before
+/// reading the points on the root.
 
 #ifndef __ASP_MPI_BUNDLE_ADJUSTMENT_MPI_SPARSE_H__
 #define __ASP_MPI_BUNDLE_ADJUSTMENT_MPI_SPARSE_H__
 
-// Vision Workbench
-#include <vw/Camera/BundleAdjustmentBase.h>
-#include <vw/Math/MatrixSparseSkyline.h>
+#include <vw/BundleAdjustment/ControlNetwork.h>
 #include <vw/Core/Debugging.h>
+#include <asp/Core/AdjustParallelSparse.h>
+#include <asp/Core/GraphPartition.h>
+#include <asp/MPI/BundleAdjustmentMPI.h>
 
-// Boost
-#include <boost/numeric/ublas/matrix_sparse.hpp>
-#include <boost/numeric/ublas/vector_sparse.hpp>
-#include <boost/numeric/ublas/io.hpp>
-#include <boost/version.hpp>
-#if BOOST_VERSION<=103200
-// Mapped matrix doesn't exist in 1.32, but Sparse Matrix does
-//
-// Unfortunately some other tests say this doesn't work
-#define boost_sparse_matrix boost::numeric::ublas::sparse_matrix
-#define boost_sparse_vector boost::numeric::ublas::sparse_vector
-#else
-// Sparse Matrix was renamed Mapped Matrix in later editions
-#define boost_sparse_matrix boost::numeric::ublas::mapped_matrix
-#define boost_sparse_vector boost::numeric::ublas::mapped_vector
-#endif
-
-namespace vw {
-namespace camera {
+#include <algorithm>
+#include <cmath>
+
+namespace asp {
 
   template <class BundleAdjustModelT, class RobustCostT>
-  class BundleAdjustmentMPISparse : public BundleAdjustmentBase<BundleAdjustModelT, RobustCostT> {
+  class BundleAdjustmentMPISparse : public SparseAdjustBase<BundleAdjustModelT, RobustCostT> {
+    typedef SparseAdjustBase<BundleAdjustModelT, RobustCostT> Base;
+    using Base::CN;
+    using Base::PN;
+    typedef typename Base::matrix_2_camera      matrix_2_camera;
+    typedef typename Base::matrix_camera_camera matrix_camera_camera;
+    typedef typename Base::matrix_camera_point  matrix_camera_point;
+    typedef typename Base::vector_camera        vector_camera;
+    typedef typename Base::vector_point         vector_point;
+
+    using Base::m_points;
+    using Base::m_point_start;
+    using Base::m_measure_camera;
+    using Base::m_A;
+    using Base::m_B;
+    using Base::m_epsilon;
+    using Base::m_U;
+    using Base::m_V;
+    using Base::m_V_inverse;
+    using Base::m_epsilon_a;
+    using Base::m_epsilon_b;
+    using Base::m_delta_a;
+
+    mpi::communicator m_world;
+    PCGOptions m_pcg;
+    std::vector<int> m_camera_owner, m_point_owner;
+    std::vector<size_t> m_touched_cameras;  // Cameras that see a local point
+
+    // The reduced camera system S delta_a = e over all ranks, and the
+    // contributions of the local points to it. U and epsilon_a are
+    // only kept at the owned cameras.
+    DistributedBlockMatrix m_S;
+    BlockSparseMatrix m_contrib;
+    std::vector<double> m_e, m_rhs_contrib;
+    double m_error;
+
+    bool owns_camera( size_t j ) const { return m_camera_owner[j] == m_world.rank(); }
+
+    void clear_contributions() {
+      for ( size_t n = 0; n < m_touched_cameras.size(); n++ ) {
+        size_t j = m_touched_cameras[n];
+        std::fill( m_contrib.values( m_contrib.row_begin(j) ),
+                   m_contrib.values( m_contrib.row_begin(j) ) +
+                   ( m_contrib.row_end(j) - m_contrib.row_begin(j) ) * CN * CN, 0.0 );
+        std::fill( &m_rhs_contrib[j*CN], &m_rhs_contrib[j*CN] + CN, 0.0 );
+      }
+    }
 
-    math::MatrixSparseSkyline<double> m_S;
-    std::vector<uint> m_ideal_ordering;
-    Vector<uint> m_ideal_skyline;
-    bool m_found_ideal_ordering;
+    // Jacobians, errors, the point blocks V and epsilon_b, and the
+    // contributions to U and epsilon_a. Returns the error of the
+    // local points.
+    double linearize_points() {
+      clear_contributions();
+      double error = 0;
+      for ( size_t p = 0; p < m_points.size(); p++ ) {
+        error += this->linearize_point(p);
+        for ( size_t m = m_point_start[p]; m < m_point_start[p+1]; m++ ) {
+          size_t j = m_measure_camera[m];
+          matrix_2_camera weighted_A = this->camera_jacobian_weighted(m);
+          matrix_camera_camera U = transpose(m_A[m]) * weighted_A;
+          vector_camera epsilon_a = transpose(weighted_A) * m_epsilon[m];
+          double* U_jj = m_contrib.block( j, j );
+          for ( size_t r = 0; r < CN; r++ ) {
+            for ( size_t c = 0; c < CN; c++ )
+              U_jj[r*CN + c] += U(r,c);
+            m_rhs_contrib[j*CN + r] += epsilon_a[r];
+          }
+        }
+      }
+      return error;
+    }
 
-  public:
+    // The contributions -W V^-1 W^T to S and -W V^-1 epsilon_b to e,
+    // where W = A^T Sigma^-1 B
+    void reduce_points() {
+      clear_contributions();
+      for ( size_t p = 0; p < m_points.size(); p++ ) {
+        this->invert_point(p);
+        for ( size_t m = m_point_start[p]; m < m_point_start[p+1]; m++ ) {
+          size_t j = m_measure_camera[m];
+          matrix_camera_point Y = transpose( this->camera_jacobian_weighted(m) ) * m_B[m] * m_V_inverse[p];
+          vector_camera Y_eps = Y * m_epsilon_b[p];
+          for ( size_t r = 0; r < CN; r++ )
+            m_rhs_contrib[j*CN + r] -= Y_eps[r];
+
+          for ( size_t o = m_point_start[p]; o < m_point_start[p+1]; o++ ) {
+            matrix_camera_camera YW = Y * transpose( transpose( this->camera_jacobian_weighted(o) ) * m_B[o] );
+            double* S_jk = m_contrib.block( j, m_measure_camera[o] );
+            for ( size_t r = 0; r < CN; r++ )
+              for ( size_t c = 0; c < CN; c++ )
+                S_jk[r*CN + c] -= YW(r,c);
+          }
+        }
+      }
+    }
 
-    BundleAdjustmentMPISparse( BundleAdjustModelT & model,
-                               RobustCostT const& robust_cost_func,
-                               bool use_camera_constraint=true,
-                               bool use_gcp_constraint=true) :
-    BundleAdjustmentMPIBase<BundleAdjustModelT,RobustCostT>( model, robust_cost_func,
-                                                             use_camera_constraint,
-                                                             use_gcp_constraint ) {
-      m_found_ideal_ordering = false;
+    // The error of the local points, at the parameters moved by the step
+    double evaluate_points() {
+      double error = 0;
+      for ( size_t p = 0; p < m_points.size(); p++ )
+        error += this->evaluate_point(p);
+      return error;
     }
 
-    math::MatrixSparseSkyline<double> S() const { return m_S; }
+    // The camera constraint error of the owned cameras, moved by the step or not
+    double camera_error( bool moved ) const {
+      double error = 0;
+      for ( size_t n = 0; n < m_S.owned_rows().size(); n++ )
+        error += Base::camera_error( m_S.owned_rows()[n], moved );
+      return error;
+    }
 
-    // Covariance Calculator
-    // ___________________________________________________________
-    // This routine inverts a sparse matrix S, and prints the individual
-    // covariance matrices for each camera
-    void covCalc(){
-      // camera params
-      unsigned num_cam_params = BundleAdjustModelT::camera_params_n;
-      unsigned num_cameras = this->m_model.num_cameras();
+  public:
 
-      unsigned inverse_size = num_cam_params * num_cameras;
+    BundleAdjustmentMPISparse( mpi::communicator const& world,
+                               BundleAdjustModelT & model,
+                               RobustCostT const& robust_cost_func,
+                               bool use_camera_constraint=true,
+                               bool use_gcp_constraint=true ) :
+      Base( model, robust_cost_func, use_camera_constraint, use_gcp_constraint ),
+      m_world(world), m_error(0) {
+      vw::ba::ControlNetwork const& cnet = *this->m_control_net;
+      size_t num_cameras = this->m_model.num_cameras();
+      VW_ASSERT( cnet.size() == this->m_model.num_points(),
+                 vw::LogicErr() << "BundleAdjustmentMPISparse: Number of bundles does not match the number of points in the bundle adjustment model." );
+
+      // Cameras are coupled in S when they see a common point
+      std::vector<std::vector<size_t> > pattern( num_cameras );
+      for ( size_t i = 0; i < cnet.size(); i++ )
+        for ( vw::ba::ControlPoint::const_iterator m = cnet[i].begin(); m != cnet[i].end(); ++m ) {
+          VW_ASSERT( m->image_id() < num_cameras,
+                     vw::ArgumentErr() << "BundleAdjustmentMPISparse: image index out of bounds." );
+          for ( vw::ba::ControlPoint::const_iterator o = cnet[i].begin(); o != cnet[i].end(); ++o )
+            pattern[m->image_id()].push_back( o->image_id() );
+        }
+      for ( size_t j = 0; j < num_cameras; j++ ) {
+        std::sort( pattern[j].begin(), pattern[j].end() );
+        pattern[j].erase( std::unique( pattern[j].begin(), pattern[j].end() ), pattern[j].end() );
+      }
 
-      typedef Matrix<double, BundleAdjustModelT::camera_params_n, BundleAdjustModelT::camera_params_n> matrix_camera_camera;
+      // Every rank computes the same ownership
+      m_camera_owner = partition_graph( pattern, world.size() );
+      m_S = DistributedBlockMatrix( world, CN, pattern, m_camera_owner );
+
+      std::vector<int> votes( world.size() );
+      std::vector<bool> touched( num_cameras, false );
+      for ( size_t i = 0; i < cnet.size(); i++ ) {
+        std::fill( votes.begin(), votes.end(), 0 );
+        for ( vw::ba::ControlPoint::const_iterator m = cnet[i].begin(); m != cnet[i].end(); ++m )
+          votes[m_camera_owner[m->image_id()]]++;
+        m_point_owner.push_back( std::max_element( votes.begin(), votes.end() ) - votes.begin() );
+        if ( m_point_owner.back() != world.rank() )
+          continue;
+
+        this->add_point( i );
+        size_t p = m_points.size() - 1;
+        for ( size_t m = m_point_start[p]; m < m_point_start[p+1]; m++ )
+          touched[m_measure_camera[m]] = true;
+      }
+      this->allocate();
+
+      // The contributions are sent whole rows at a time, so they have
+      // the rows of the full pattern that the local points touch.
+      std::vector<std::vector<size_t> > contrib_pattern( num_cameras );
+      for ( size_t j = 0; j < num_cameras; j++ )
+        if ( touched[j] ) {
+          m_touched_cameras.push_back( j );
+          contrib_pattern[j] = pattern[j];
+        }
+      m_contrib = BlockSparseMatrix( CN, contrib_pattern );
 
-      // final vector of camera covariance matrices
-      vw::Vector< matrix_camera_camera > sparse_cov(num_cameras);
+      m_e.resize( num_cameras * CN );
+      m_rhs_contrib.resize( num_cameras * CN );
+    }
 
-      // Get the S matrix from the model
-      math::MatrixSparseSkyline<double> S = this->S();  // Make copy as solve is destructive
-      Matrix<double> Id(inverse_size, inverse_size);
-      Id.set_identity();
-      Matrix<double> Cov = multi_sparse_solve(S, Id);
+    void set_pcg_options( PCGOptions const& opt ) { m_pcg = opt; }
 
-      //pick out covariances of individual cameras
-      for ( unsigned i = 0; i < num_cameras; i++ )
-        sparse_cov(i) = submatrix(Cov, i*num_cam_params, i*num_cam_params, num_cam_params, num_cam_params);
+    int camera_owner( size_t j ) const { return m_camera_owner[j]; }
+    int point_owner( size_t i ) const { return m_point_owner[i]; }
+    size_t num_local_points() const { return m_points.size(); }
+    size_t num_owned_cameras() const { return m_S.owned_rows().size(); }
+    size_t halo_size() const { return m_S.halo_size(); }
 
-      std::cout << "Covariance matrices for cameras are:"
-                << sparse_cov << "\n\n";
-    }
+    // The total error over all ranks before the last update
+    double error() const { return m_error; }
 
     // UPDATE IMPLEMENTATION
     //-------------------------------------------------------------
-    // This is the sparse levenberg marquardt update step.  Returns
-    // the average improvement in the cost function.
-    double update(double &abs_tol, double &rel_tol) {
+    // This is the sparse levenberg marquardt update step, called on
+    // every rank at once. Returns the squared norm of the step, or 0
+    // if it was rejected.
+    double update( double &abs_tol, double &rel_tol ) {
       ++this->m_iterations;
-      Timer* time;
-
-      VW_DEBUG_ASSERT(this->m_control_net->size() == this->m_model.num_points(), LogicErr() << "BundleAdjustment::update() : Number of bundles does not match the number of points in the bundle adjustment model.");
-
-      // Jacobian Matrices and error values
-      typedef Matrix<double, 2, BundleAdjustModelT::camera_params_n> matrix_2_camera;
-      typedef Matrix<double, 2, BundleAdjustModelT::point_params_n> matrix_2_point;
-      boost_sparse_matrix< matrix_2_camera  > A(this->m_model.num_points(), this->m_model.num_cameras());
-      boost_sparse_matrix< matrix_2_point > B(this->m_model.num_points(), this->m_model.num_cameras());
-      boost_sparse_matrix<Vector2> epsilon(this->m_model.num_points(), this->m_model.num_cameras());
-      boost_sparse_matrix<Vector2> new_epsilon(this->m_model.num_points(), this->m_model.num_cameras());
-
-      // Intermediate Matrices and vectors
-      typedef Matrix<double,BundleAdjustModelT::camera_params_n,BundleAdjustModelT::camera_params_n> matrix_camera_camera;
-      typedef Matrix<double,BundleAdjustModelT::point_params_n,BundleAdjustModelT::point_params_n> matrix_point_point;
-      typedef Matrix<double,BundleAdjustModelT::camera_params_n,BundleAdjustModelT::point_params_n> matrix_camera_point;
-      boost_sparse_vector< matrix_camera_camera > U(this->m_model.num_cameras());
-      boost_sparse_vector< matrix_point_point > V(this->m_model.num_points());
-      boost_sparse_matrix< matrix_camera_point > W(this->m_model.num_cameras(), this->m_model.num_points());
-
-      // Copies of Intermediate Marices
-      typedef Vector<double,BundleAdjustModelT::camera_params_n> vector_camera;
-      typedef Vector<double,BundleAdjustModelT::point_params_n> vector_point;
-      boost_sparse_vector< vector_camera > epsilon_a(this->m_model.num_cameras());
-      boost_sparse_vector< vector_point > epsilon_b(this->m_model.num_points());
-      boost_sparse_matrix< matrix_camera_point > Y(this->m_model.num_cameras(), this->m_model.num_points());
-
-      unsigned num_cam_params = BundleAdjustModelT::camera_params_n;
-      unsigned num_pt_params = BundleAdjustModelT::point_params_n;
-
-      unsigned delta_length = U.size() * num_cam_params + V.size() * num_pt_params;
-
-      Vector<double> g(delta_length);
-      unsigned current_g_length = 0;
-
-      Vector<double> delta(delta_length);
-      unsigned current_delta_length = 0;
-
-      // Fletcher LM parameteres
-      double dS = 0; //Predicted improvement for Fletcher modification
-
-      // Populate the Jacobian, which is broken into two sparse
-      // matrices A & B, as well as the error matrix and the W
-      // matrix.
-      time = new Timer("Solve for Image Error, Jacobian, U, V, and W:", DebugMessage, "bundle_adjust");
-      unsigned i = 0;
-      double error_total = 0; // assume this is r^T\Sigma^{-1}r
-
-      for (typename ControlNetwork::const_iterator iter = this->m_control_net->begin();
-           iter != this->m_control_net->end(); ++iter) {
-        for (typename ControlPoint::const_iterator measure_iter = iter->begin();
-             measure_iter != iter->end(); ++measure_iter) {
-
-          unsigned j = measure_iter->image_id();
-
-          VW_DEBUG_ASSERT( j >=0 && j < this->m_model.num_cameras(),
-                           ArgumentErr() << "BundleAdjustment::update() : image index out of bounds.");
-
-          // Store jacobian values
-          A(i,j) = this->m_model.A_jacobian(i,j,this->m_model.A_parameters(j),
-                                            this->m_model.B_parameters(i));
-          B(i,j) = this->m_model.B_jacobian(i,j,this->m_model.A_parameters(j),
-                                            this->m_model.B_parameters(i));
-
-          // Apply robust cost function weighting
-          Vector2 unweighted_error = measure_iter->dominant() -
-            this->m_model(i,j,this->m_model.A_parameters(j),this->m_model.B_parameters(i));
-
-          double mag = norm_2(unweighted_error);
-          double weight = sqrt(this->m_robust_cost_func(mag)) / mag;
-          epsilon(i,j) = unweighted_error * weight;
-
-          Matrix2x2 inverse_cov;
-          Vector2 pixel_sigma = measure_iter->sigma();
-          Vector2 epsilon_inst = epsilon(i,j);
-          inverse_cov(0,0) = 1/(pixel_sigma(0)*pixel_sigma(0));
-          inverse_cov(1,1) = 1/(pixel_sigma(1)*pixel_sigma(1));
-          error_total += .5 * transpose(epsilon_inst) *
-            inverse_cov * epsilon_inst;
-
-          // Store intermediate values
-          U(j) += transpose(static_cast< matrix_2_camera >(A(i,j))) *
-            inverse_cov * static_cast< matrix_2_camera >(A(i,j));
-          V(i) += transpose(static_cast< matrix_2_point >(B(i,j))) *
-            inverse_cov * static_cast< matrix_2_point >(B(i,j));
-          W(j,i) = transpose(static_cast< matrix_2_camera >(A(i,j))) *
-            inverse_cov * static_cast< matrix_2_point >(B(i,j));
-
-          epsilon_a(j) += transpose(static_cast< matrix_2_camera >(A(i,j))) *
-            inverse_cov * epsilon_inst;
-          epsilon_b(i) += transpose(static_cast< matrix_2_point >(B(i,j))) *
-            inverse_cov * epsilon_inst;
-
+      vw::Timer* time;
+      std::vector<size_t> const& owned = m_S.owned_rows();
+
+      time = new vw::Timer("Solve for Image Error, Jacobian, U, V:", vw::DebugMessage, "bundle_adjust");
+      double local_error = linearize_points();
+      m_S.local().set_zero();
+      std::fill( m_e.begin(), m_e.end(), 0.0 );
+      m_S.add_contributions( m_contrib, m_rhs_contrib, m_touched_cameras, m_e );
+      for ( size_t n = 0; n < owned.size(); n++ ) {
+        size_t j = owned[n];
+        double const* U_jj = m_S.local().block( j, j );
+        for ( size_t r = 0; r < CN; r++ ) {
+          for ( size_t c = 0; c < CN; c++ )
+            m_U[j](r,c) = U_jj[r*CN + c];
+          m_epsilon_a[j][r] = m_e[j*CN + r];
+        }
+        if ( this->m_use_camera_constraint ) {
+          matrix_camera_camera inverse_cov = this->m_model.A_inverse_covariance(j);
+          vector_camera eps_a = this->m_model.A_target(j) - this->m_model.A_parameters(j);
+          m_U[j] += inverse_cov;
+          m_epsilon_a[j] += inverse_cov * eps_a;
         }
-        ++i;
       }
-
+      local_error += camera_error( false );
+      double error_total = mpi::all_reduce( m_world, local_error, std::plus<double>() );
+      m_error = error_total;
       delete time;
 
       // set initial lambda, and ignore if the user has touched it
       if ( this->m_iterations == 1 && this->m_lambda == 1e-3 ) {
-        time = new Timer("Solving for Lambda:", DebugMessage, "bundle_adjust");
         double max = 0.0;
-        for (unsigned i = 0; i < U.size(); ++i)
-          for (unsigned j = 0; j < BundleAdjustModelT::camera_params_n; ++j){
-            if (fabs(static_cast<matrix_camera_camera>(U(i))(j,j)) > max)
-              max = fabs(static_cast<matrix_camera_camera>(U(i))(j,j));
-          }
-        for (unsigned i = 0; i < V.size(); ++i)
-          for (unsigned j = 0; j < BundleAdjustModelT::point_params_n; ++j) {
-            if ( fabs(static_cast<matrix_point_point>(V(i))(j,j)) > max)
-              max = fabs(static_cast<matrix_point_point>(V(i))(j,j));
-          }
-        this->m_lambda = max * 1e-10;
-        delete time;
+        for ( size_t n = 0; n < owned.size(); n++ )
+          for ( size_t c = 0; c < CN; c++ )
+            max = std::max( max, std::fabs( m_U[owned[n]](c,c) ) );
+        for ( size_t p = 0; p < m_points.size(); p++ )
+          for ( size_t c = 0; c < PN; c++ )
+            max = std::max( max, std::fabs( m_V[p](c,c) ) );
+        this->m_lambda = mpi::all_reduce( m_world, max, mpi::maximum<double>() ) * 1e-10;
       }
 
-      // Add in the camera position and pose constraint terms and covariances.
-      time = new Timer("Solving for Camera and GCP error:",DebugMessage,"bundle_adjust");
-      if ( this->m_use_camera_constraint )
-        for ( unsigned j = 0; j < U.size(); ++j ) {
-          matrix_camera_camera inverse_cov;
-          inverse_cov = this->m_model.A_inverse_covariance(j);
-          matrix_camera_camera C;
-          C.set_identity();
-          U(j) += transpose(C) * inverse_cov * C;
-          vector_camera eps_a = this->m_model.A_initial(j)-this->m_model.A_parameters(j);
-          error_total += .5  * transpose(eps_a) * inverse_cov * eps_a;
-          epsilon_a(j) += transpose(C) * inverse_cov * eps_a;
+      time = new vw::Timer("Build Sparse", vw::DebugMessage, "bundle_adjust");
+      reduce_points();
+      m_S.local().set_zero();
+      for ( size_t n = 0; n < owned.size(); n++ ) {
+        size_t j = owned[n];
+        double* S_jj = m_S.local().block( j, j );
+        for ( size_t r = 0; r < CN; r++ ) {
+          for ( size_t c = 0; c < CN; c++ )
+            S_jj[r*CN + c] = m_U[j](r,c);
+          S_jj[r*CN + r] += this->m_lambda;
+          m_e[j*CN + r] = m_epsilon_a[j][r];
         }
-
-      // Add in the 3D point position constraint terms and
-      // covariances. We only add constraints for Ground Control
-      // Points (GCPs), not for 3D tie points.
-      if (this->m_use_gcp_constraint)
-        for ( unsigned i = 0; i < V.size(); ++i )
-          if ((*this->m_control_net)[i].type() == ControlPoint::GroundControlPoint) {
-            matrix_point_point inverse_cov;
-            inverse_cov = this->m_model.B_inverse_covariance(i);
-            matrix_point_point D;
-            D.set_identity();
-            V(i) +=  transpose(D) * inverse_cov * D;
-            vector_point eps_b = this->m_model.B_initial(i)-this->m_model.B_parameters(i);
-            error_total += .5 * transpose(eps_b) * inverse_cov * eps_b;
-            epsilon_b(i) += transpose(D) * inverse_cov * eps_b;
-          }
-      delete time;
-
-      // flatten both epsilon_b and epsilon_a into a vector
-      time = new Timer("Flatten eps_a, eps_b, and augmenting with lambda",DebugMessage,"bundle_adjust");
-      for (unsigned j = 0; j < U.size(); j++){
-        subvector(g, current_g_length, num_cam_params) = static_cast<vector_camera>(epsilon_a(j));
-        current_g_length += num_cam_params;
-      }
-      for (unsigned i = 0; i < V.size(); i++){
-        subvector(g, current_g_length, num_pt_params) = static_cast<vector_point>(epsilon_b(i));
-        current_g_length += num_pt_params;
-      }
-
-      //e at this point should be -g_a
-
-      // "Augment" the diagonal entries of the U and V matrices with
-      // the parameter lambda.
-      {
-        matrix_camera_camera u_lambda;
-        u_lambda.set_identity();
-        u_lambda *= this->m_lambda;
-        for ( i = 0; i < U.size(); ++i )
-          U(i) += u_lambda;
-      }
-
-      {
-        matrix_point_point v_lambda;
-        v_lambda.set_identity();
-        v_lambda *= this->m_lambda;
-        for ( i = 0; i < V.size(); ++i )
-          V(i) += v_lambda;
       }
+      m_S.add_contributions( m_contrib, m_rhs_contrib, m_touched_cameras, m_e );
       delete time;
 
-      // Create the 'e' vector in S * delta_a = e.  The first step is
-      // to "flatten" our block structure to a vector that contains
-      // scalar entries.
-      time = new Timer("Create special e vector", DebugMessage, "bundle_adjust");
-      Vector<double> e(this->m_model.num_cameras() * BundleAdjustModelT::camera_params_n);
-      for (unsigned j = 0; j < epsilon_a.size(); ++j) {
-        subvector(e, j*BundleAdjustModelT::camera_params_n, BundleAdjustModelT::camera_params_n) =
-          static_cast<vector_camera>(epsilon_a(j));
-      }
-
-      //Second Pass.  Compute Y and finish constructing e.
-      i = 0;
-      for (typename ControlNetwork::const_iterator iter = this->m_control_net->begin();
-           iter != this->m_control_net->end(); ++iter) {
-        for (typename ControlPoint::const_iterator measure_iter = (*iter).begin();
-             measure_iter != (*iter).end(); ++measure_iter) {
-          unsigned j = measure_iter->image_id();
-
-          // Compute the blocks of Y
-          Matrix<double> V_temp = static_cast<matrix_point_point>(V(i));
-          chol_inverse(V_temp);
-          Y(j,i) = static_cast<matrix_camera_point>(W(j,i)) * transpose(V_temp) * V_temp;
-
-          // "Flatten the block structure to compute 'e'.
-          vector_camera temp = static_cast<matrix_camera_point>(Y(j,i))*static_cast<vector_point>(epsilon_b(i));
-          subvector(e, j*num_cam_params, num_cam_params) -= temp;
-        }
-        ++i;
-      }
+      time = new vw::Timer("Solve Delta A", vw::DebugMessage, "bundle_adjust");
+      std::vector<double> owned_delta_a( m_delta_a.size(), 0.0 );
+      int iterations = distributed_pcg_solve( m_S, m_e, m_delta_a, m_pcg );
+      for ( size_t n = 0; n < owned.size(); n++ )
+        for ( size_t c = 0; c < CN; c++ )
+          owned_delta_a[owned[n]*CN + c] = m_delta_a[owned[n]*CN + c];
+      mpi::all_reduce( m_world, &owned_delta_a[0], int(owned_delta_a.size()),
+                       &m_delta_a[0], std::plus<double>() );
+      vw::vw_out(vw::DebugMessage, "bundle_adjust") << "PCG iterations: " << iterations << "\n";
       delete time;
 
-      // --- BUILD SPARSE, SOLVE A'S UPDATE STEP -------------------------
-      time = new Timer("Build Sparse", DebugMessage, "bundle_adjust");
-
-      // The S matrix is a m x m block matrix with blocks that are
-      // camera_params_n x camera_params_n in size.  It has a sparse
-      // skyline structure, which makes it more efficient to solve
-      // through L*D*L^T decomposition and forward/back substitution
-      // below.
-      math::MatrixSparseSkyline<double> S(this->m_model.num_cameras()*num_cam_params,
-                                          this->m_model.num_cameras()*num_cam_params);
-      i = 0;
-      for (typename ControlNetwork::const_iterator iter = this->m_control_net->begin();
-           iter != this->m_control_net->end(); ++iter) {
-        for (typename ControlPoint::const_iterator j_measure_iter = (*iter).begin();
-             j_measure_iter != (*iter).end(); ++j_measure_iter) {
-          unsigned j = j_measure_iter->image_id();
-
-          for (typename ControlPoint::const_iterator k_measure_iter = (*iter).begin();
-               k_measure_iter != (*iter).end(); ++k_measure_iter) {
-            unsigned k = k_measure_iter->image_id();
-
-            // Compute the block entry...
-            matrix_camera_camera temp = -static_cast< matrix_camera_point >(Y(j,i)) *
-              transpose( static_cast<matrix_camera_point>(W(k,i)) );
-            // ... and "flatten" this matrix into the scalar entries of S
-            for (unsigned aa = 0; aa < num_cam_params; ++aa) {
-              for (unsigned bb = 0; bb < num_cam_params; ++bb) {
-                // FIXME: This if clause is required at the moment to
-                // ensure that we do not use the += on the symmetric
-                // entries of the SparseSkylineMatrix.  These
-                // symmetric entries are shallow, hence this code
-                // would add the value twice if we're not careful
-                // here.
-                if (k*num_cam_params + bb <=
-                    j*num_cam_params + aa) {
-                  S(j*num_cam_params + aa,
-                    k*num_cam_params + bb) += temp(aa,bb);
-
-                  //  S_old(j*BundleAdjustModelT::camera_params_n + aa,
-                  //  k*BundleAdjustModelT::camera_params_n + bb) += temp_old(aa,bb);
-
-                }
-              }
-            }
-          }
-        }
-        ++i;
-      }
-
-      // Augment the diagonal entries S(i,i) with U(i)
-      for (unsigned i = 0; i < this->m_model.num_cameras(); ++i) {
-        // ... and "flatten" this matrix into the scalar entries of S
-        for (unsigned aa = 0; aa < num_cam_params; ++aa) {
-          for (unsigned bb = 0; bb < num_cam_params; ++bb) {
-            // FIXME: This if clause is required at the moment to
-            // ensure that we do not use the += on the symmetric
-            // entries of the SparseSkylineMatrix.  These
-            // symmetric entries are shallow, hence this code
-            // would add the value twice if we're not careful
-            // here.
-            if (i*num_cam_params + bb <=
-                i*num_cam_params + aa) {
-              S(i*num_cam_params + aa,
-                i*num_cam_params + bb) += static_cast<matrix_camera_camera>(U(i))(aa,bb);
-            }
-          }
-        }
-      }
-
-      m_S = S; // S is modified in sparse solve. Keeping a copy.
+      time = new vw::Timer("Solve Delta B", vw::DebugMessage, "bundle_adjust");
+      for ( size_t p = 0; p < m_points.size(); p++ )
+        this->back_substitute_point(p);
       delete time;
 
-      // Computing ideal ordering
-      if (!m_found_ideal_ordering) {
-        time = new Timer("Solving Cuthill-Mckee", DebugMessage, "bundle_adjust");
-        m_ideal_ordering = cuthill_mckee_ordering(S,num_cam_params);
-        math::MatrixReorganize<math::MatrixSparseSkyline<double> > mod_S( S, m_ideal_ordering );
-        m_ideal_skyline = solve_for_skyline(mod_S);
-
-        m_found_ideal_ordering = true;
-        delete time;
-      }
-
-      time = new Timer("Solve Delta A", DebugMessage, "bundle_adjust");
-
-      // Compute the LDL^T decomposition and solve using sparse methods.
-      math::MatrixReorganize<math::MatrixSparseSkyline<double> > modified_S( S, m_ideal_ordering );
-      Vector<double> delta_a = sparse_solve( modified_S,
-                                             reorganize(e, m_ideal_ordering),
-                                             m_ideal_skyline );
-      delta_a = reorganize(delta_a, modified_S.inverse());
+      // The gradient g = (epsilon_a, epsilon_b), the predicted
+      // improvement dS, and the step size
+      StepStatistics step;
+      for ( size_t n = 0; n < owned.size(); n++ )
+        this->add_camera_step( owned[n], step );
+      this->add_point_steps( step );
+      double dS = mpi::all_reduce( m_world, step.dS, std::plus<double>() );
+      rel_tol = mpi::all_reduce( m_world, step.norm_2_sqr, std::plus<double>() );
+      abs_tol = mpi::all_reduce( m_world, step.g_max, mpi::maximum<double>() ) -
+        mpi::all_reduce( m_world, step.g_min, mpi::minimum<double>() );
+
+      time = new vw::Timer("Solve for Updated Error", vw::DebugMessage, "bundle_adjust");
+      double new_error_total =
+        mpi::all_reduce( m_world, evaluate_points() + camera_error( true ), std::plus<double>() );
       delete time;
 
-      // Save S; used for covariance calculations
-      subvector(delta, current_delta_length, e.size()) = delta_a;
-      current_delta_length += e.size();
-      // --- SOLVE B'S UPDATE STEP ---------------------------------
-
-      // Back Solving for Delta B
-      time = new Timer("Solve Delta B", DebugMessage, "bundle_adjust");
-      boost_sparse_vector<vector_point > delta_b(this->m_model.num_points());
-
-      i = 0;
-      for (typename ControlNetwork::const_iterator iter = this->m_control_net->begin();
-           iter != this->m_control_net->end(); ++iter) {
-
-        vector_point temp;
-        for (typename ControlPoint::const_iterator j_measure_iter = (*iter).begin();
-             j_measure_iter != (*iter).end(); ++j_measure_iter) {
-          unsigned j = j_measure_iter->image_id();
-
-          temp += transpose( static_cast<matrix_camera_point>(W(j,i)) ) *
-            subvector( delta_a, j*num_cam_params, num_cam_params );
-        }
-
-        Vector<double> delta_temp = static_cast<vector_point>(epsilon_b(i)) - temp;
-
-        Matrix<double> hessian = static_cast<matrix_point_point>(V(i));
-        solve(delta_temp, hessian);
-        delta_b(i) = delta_temp;
-
-        subvector(delta, current_delta_length, num_pt_params) = delta_temp;
-        current_delta_length += num_pt_params;
-
-        ++i;
-      }
-      delete time;
+      // Fletcher modification. All ranks move all cameras, but only
+      // their own points.
+      double R = ( error_total - new_error_total ) / dS;
+      return this->fletcher_update( R ) ? rel_tol : 0;
+    }
 
-      dS = .5 * transpose(delta) *(this->m_lambda * delta + g);
-
-      // -------------------------------
-      // Compute the update error vector and predicted change
-      // -------------------------------
-      time = new Timer("Solve for Updated Error", DebugMessage, "bundle_adjust");
-      i = 0;
-      double new_error_total = 0;
-      for (typename ControlNetwork::const_iterator iter = this->m_control_net->begin();
-           iter != this->m_control_net->end(); ++iter) {
-        for (typename ControlPoint::const_iterator measure_iter = (*iter).begin();
-             measure_iter != (*iter).end(); ++measure_iter) {
-
-          unsigned j = measure_iter->image_id();
-
-          // Compute error vector
-          vector_camera new_a = this->m_model.A_parameters(j) +
-            subvector(delta_a, num_cam_params*j, num_cam_params);
-          Vector<double> del_a = subvector(delta_a, num_cam_params*j, num_cam_params);
-
-          vector_point new_b = this->m_model.B_parameters(i) +
-            static_cast<vector_point>(delta_b(i));
-
-          // Apply robust cost function weighting
-          Vector2 unweighted_error = measure_iter->dominant() -
-            this->m_model(i,j,new_a,new_b);
-          double mag = norm_2(unweighted_error);
-          double weight = sqrt(this->m_robust_cost_func(mag)) / mag;
-          new_epsilon(i,j) = weight * unweighted_error;
-
-          Matrix2x2 inverse_cov;
-          Vector2 pixel_sigma = measure_iter->sigma();
-          Vector2 epsilon_inst = new_epsilon(i,j);
-          inverse_cov(0,0) = 1/(pixel_sigma(0)*pixel_sigma(0));
-          inverse_cov(1,1) = 1/(pixel_sigma(1)*pixel_sigma(1));
-
-          new_error_total += .5 * transpose(epsilon_inst) *
-            inverse_cov * epsilon_inst;
-        }
-        ++i;
+    // Sends the positions of the points to the root, where the model
+    // then holds all of them.
+    void collect_points( int root = 0 ) {
+      std::vector<double> local;
+      for ( size_t p = 0; p < m_points.size(); p++ ) {
+        vector_point b_i = this->m_model.B_parameters( m_points[p] );
+        local.push_back( double(m_points[p]) );
+        local.insert( local.end(), b_i.begin(), b_i.end() );
       }
-
-      // Camera Constraints
-      if ( this->m_use_camera_constraint )
-        for (unsigned j = 0; j < U.size(); ++j) {
-
-          vector_camera new_a = this->m_model.A_parameters(j) +
-            subvector(delta_a, num_cam_params*j, num_cam_params);
-          vector_camera eps_a = this->m_model.A_initial(j)-new_a;
-
-          matrix_camera_camera inverse_cov;
-          inverse_cov = this->m_model.A_inverse_covariance(j);
-          new_error_total += .5 * transpose(eps_a) * inverse_cov * eps_a;
+      std::vector<std::vector<double> > all;
+      mpi::gather( m_world, local, all, root );
+      if ( m_world.rank() != root )
+        return;
+      for ( size_t r = 0; r < all.size(); r++ )
+        for ( size_t k = 0; k < all[r].size(); k += PN + 1 ) {
+          vector_point b_i;
+          std::copy( &all[r][k+1], &all[r][k+1] + PN, b_i.begin() );
+          this->m_model.set_B_parameters( size_t(all[r][k]), b_i );
         }
-
-      // GCP Error
-      if ( this->m_use_gcp_constraint )
-        for ( unsigned i = 0; i < V.size(); ++i )
-          if ( (*this->m_control_net)[i].type() ==
-               ControlPoint::GroundControlPoint) {
-
-            vector_point new_b = this->m_model.B_parameters(i) +
-              static_cast<vector_point>(delta_b(i));
-            vector_point eps_b = this->m_model.B_initial(i)-new_b;
-            matrix_point_point inverse_cov;
-            inverse_cov = this->m_model.B_inverse_covariance(i);
-            new_error_total += .5 * transpose(eps_b) * inverse_cov * eps_b;
-          }
-      delete time;
-
-      //Fletcher modification
-      double Splus = new_error_total;     //Compute new objective
-      double SS = error_total;            //Compute old objective
-      double R = (SS - Splus)/dS;         // Compute ratio
-
-      if ( R > 0 ) {
-
-        time = new Timer("Setting Parameters",DebugMessage,"bundle_adjust");
-        for (unsigned j=0; j<this->m_model.num_cameras(); ++j)
-          this->m_model.set_A_parameters(j, this->m_model.A_parameters(j) +
-                                         subvector(delta_a, num_cam_params*j,num_cam_params));
-        for (unsigned i=0; i<this->m_model.num_points(); ++i)
-          this->m_model.set_B_parameters(i, this->m_model.B_parameters(i) +
-                                         static_cast<vector_point>(delta_b(i)));
-        delete time;
-
-        // Summarize the stats from this step in the iteration
-        abs_tol = vw::math::max(g) + vw::math::max(-g);
-        rel_tol = transpose(delta)*delta;
-
-        if ( this->m_control == 0 ) {
-          double temp = 1 - pow((2*R - 1),3);
-          if (temp < 1.0/3.0)
-            temp = 1.0/3.0;
-
-          this->m_lambda *= temp;
-          this->m_nu = 2;
-        } else if (this->m_control == 1) {
-          this->m_lambda /= 10;
-        }
-
-        return rel_tol;
-
-      } else { // here we didn't make progress
-
-        abs_tol = vw::math::max(g) + vw::math::max(-g);
-        rel_tol = transpose(delta)*delta;
-
-        if ( this->m_control == 0 ) {
-          this->m_lambda *= this->m_nu;
-          this->m_nu*=2;
-        } else if ( this->m_control == 1 ) {
-          this->m_lambda *= 10;
-        }
-
-        return ScalarTypeLimits<double>::highest();
-      }
-
-      return 0;
     }
-
   };
 
-}} // namespace vw::camera
+}
 
 #endif//__ASP_MPI_BUNDLE_ADJUSTMENT_MPI_SPARSE_H__
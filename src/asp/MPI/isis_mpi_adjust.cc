@@ -16,127 +16,301 @@
 // __END_LICENSE__
 
 
-#include <vw/Core.h>
-using namespace vw;
+/// \file isis_mpi_adjust.cc
+///
+/// Bundle adjustment of ISIS3 cube files distributed over the
+/// processes of an MPI job. Every rank loads all of the cameras and
+/// the control network, and works on its share of them. It runs on a
+/// single machine with, for example:
+///
+///   mpirun -np 4 isis_mpi_adjust [options] <isis cube files> ...
+
+#include <asp/Core/Macros.h>
+#include <asp/Core/Common.h>
+#include <asp/Core/AdjustParallelSparse.h>
+#include <asp/Tools/isis_adjust.h>
+#include <asp/MPI/BundleAdjustmentMPISparse.h>
 
-#include <boost/program_options.hpp>
 namespace po = boost::program_options;
+namespace fs = boost::filesystem;
 
-#include <vw/BundleAdjustment/ControlNetworkLoader.h>
-#include <asp/MPI/BundleAdjustmentMPI.h>
-
-// This sifts out from a vector of strings, a listing of GCPs.  This
-// should be useful for those programs who accept their data in a mass
-// input vector.
-std::vector<std::string>
-sort_out_gcps( std::vector<std::string>& image_files ) {
-  std::vector<std::string> gcp_files;
-  std::vector<std::string>::iterator it = image_files.begin();
-  while ( it != image_files.end() ) {
-    if ( boost::iends_with(*it, ".gcp") ){
-      gcp_files.push_back( *it );
-      it = image_files.erase( it );
-    } else
-      it++;
-  }
+using namespace vw;
+using namespace vw::camera;
+using namespace vw::ba;
 
-  return gcp_files;
-}
+struct Options : public asp::BaseOptions {
+  Options() : lambda(-1) {}
+  std::string cnet_file, cost_function, output_prefix, preconditioner;
+  std::vector<std::string> input_names, gcp_names, gcp_cnet_names, directory_names;
+  double cam_position_sigma, cam_pose_sigma, gcp_scalar, lambda, robust_threshold;
+  int max_iterations, min_matches;
+  bool disable_camera, disable_gcp, write_isis_cnet;
 
-int main ( int argc, char* argv[] ) {
-  mpi::environment env(argc,argv);
-  mpi::communicator world;
-  std::vector<std::string> input_file_names;
-  std::vector<std::string> gcp_file_names;
-
-  // All MPI's slave work is in
-  // BundleAdjustmentMPI.
-  if (world.rank() > 0) {
-    camera::MPISlave slave(world);
-    return 0;
-  }
+  std::vector<std::string> camera_serials;
+  boost::shared_ptr<ControlNetwork> cnet;
+  std::vector< boost::shared_ptr< IsisAdjustCameraModel > > camera_models;
+};
 
-  // Main starts here
-  po::options_description general_options("Options");
+void handle_arguments( int argc, char *argv[], Options& opt ) {
+  po::options_description general_options("");
   general_options.add_options()
-    ("help,h", "Display this help message.");
+    ("cnet,c", po::value(&opt.cnet_file), "Load a control network from a file")
+    ("cost-function", po::value(&opt.cost_function)->default_value("L2"),
+     "Choose a robust cost function from [PseudoHuber, Huber, L1, L2, Cauchy]")
+    ("preconditioner", po::value(&opt.preconditioner)->default_value("BlockJacobi"),
+     "Choose the preconditioner of the distributed PCG from [BlockJacobi, Jacobi]")
+    ("directory,d", po::value(&opt.directory_names),
+     "Directory(-ies) to search for match files. Defaults with current directory.")
+    ("disable-camera-const", po::bool_switch(&opt.disable_camera)->default_value(false),
+     "Disable camera constraint error")
+    ("disable-gcp-const", po::bool_switch(&opt.disable_gcp)->default_value(false),
+     "Disable GCP constraint error")
+    ("gcp-scalar", po::value(&opt.gcp_scalar)->default_value(1.0),
+     "Sets a scalar to multiply to the sigmas (uncertainty) defined for the gcps. GCP sigmas are defined in the .gcp files.")
+    ("lambda,l", po::value(&opt.lambda), "Set the intial value of the LM parameter g_lambda")
+    ("min-matches", po::value(&opt.min_matches)->default_value(5),
+     "Set the minimum number of matches between images that will be considered.")
+    ("max-iterations", po::value(&opt.max_iterations)->default_value(25), "Set the maximum number of iterations.")
+    ("output-prefix,o", po::value(&opt.output_prefix)->default_value("isis_adjust"),
+     "Output files use this prefix. The first rank also passes the control network to the others through it.")
+    ("position-sigma", po::value(&opt.cam_position_sigma)->default_value(100.0),
+     "Set the sigma (uncertainty) of the spacecraft position. (meters)")
+    ("pose-sigma", po::value(&opt.cam_pose_sigma)->default_value(0.1),
+     "Set the sigma (uncertainty) of the spacecraft pose. (radians)")
+    ("robust-threshold", po::value(&opt.robust_threshold)->default_value(10.0),
+     "Set the threshold for robust cost functions.")
+    ("write-isis-cnet-also", po::bool_switch(&opt.write_isis_cnet)->default_value(false),
+     "Writes an ISIS style control network");
+  general_options.add( asp::BaseOptionsDescription(opt) );
 
-  po::options_description hidden_options("");
-  hidden_options.add_options()
-    ("input-files", po::value<std::vector<std::string> >(&input_file_names));
+  po::options_description positional("");
+  positional.add_options()
+    ("input-files", po::value(&opt.input_names));
 
-  po::options_description options("Allowed Options");
-  options.add(general_options).add(hidden_options);
+  po::positional_options_description positional_desc;
+  positional_desc.add("input-files", -1);
 
-  po::positional_options_description p;
-  p.add("input-files", -1);
+  std::string usage("[options] <isis cube files> ...\n\n"
+                    "Run it under MPI, as in: mpirun -np <processes> isis_mpi_adjust [options] <isis cube files> ...");
+  asp::check_command_line( argc, argv, opt, general_options, general_options,
+                           positional, positional_desc, usage );
 
-  std::ostringstream usage;
-  usage << "Usage: " << argv[0] << " [options] <filenames>..." << std::endl << std::endl;
-  usage << general_options << std::endl;
+  if ( opt.input_names.empty() )
+    vw_throw( ArgumentErr() << "Missing input cube files!\n"
+              << usage << general_options );
+  sort_out_gcp( opt.input_names, opt.gcp_names );
+  sort_out_gcpcnets( opt.input_names, opt.gcp_cnet_names );
 
-  po::variables_map vm;
-  try {
-    po::store(po::command_line_parser( argc, argv ).options(options).positional(p).run(), vm);
-    po::notify( vm );
-  } catch (po::error const& e) {
-    std::cout << "An error occured while parsing command line arguments.\n";
-    std::cout << "\t" << e.what() << "\n\n";
-    std::cout << usage.str();
-    int task = Finish;
-    broadcast(world, task, 0);
-    return 1;
+  boost::to_lower( opt.cost_function );
+  if ( !( opt.cost_function == "pseudohuber" ||
+          opt.cost_function == "huber" ||
+          opt.cost_function == "l1" ||
+          opt.cost_function == "l2" ||
+          opt.cost_function == "cauchy" ) )
+    vw_throw( ArgumentErr() << "Unknown robust cost function: " << opt.cost_function
+              << ". Options are : [ PseudoHuber, Huber, L1, L2, Cauchy]\n" );
+  asp::linear_solver_options( "PCG", opt.preconditioner );
+  if ( opt.directory_names.empty() )
+    opt.directory_names.push_back( std::string(".") );
+}
+
+// Camera id numbers for the measures of a control network read from file
+void assign_image_ids( Options& opt ) {
+  BOOST_FOREACH( ControlPoint & cp, *opt.cnet ) {
+    BOOST_FOREACH( ControlMeasure & cm, cp ) {
+      bool found = false;
+      for ( unsigned s = 0; s < opt.camera_serials.size(); ++s ) {
+        if ( cm.serial() == opt.camera_serials[s] ) {
+          cm.set_image_id( s );
+          found = true;
+          break;
+        }
+      }
+      if (!found)
+        vw_throw( InputErr() << "ISIS MPI Adjust doesn't seem to have a camera for serial, \""
+                  << cm.serial() << "\", found in loaded Control Network" );
+    }
   }
+}
 
-  if ( vm.count("help") ) {
-    vw_out() << usage.str();
-    int task = Finish;
-    broadcast(world, task, 0);
-    return 1;
-  } else if ( input_file_names.size() < 1 ) {
-    vw_out() << "Forgot to provide input files!\n";
-    vw_out() << usage.str();
-    int task = Finish;
-    broadcast(world, task, 0);
-    return 1;
+// Loads or builds the control network on the first rank, which is
+// the one that reads the match files.
+void build_cnet( Options& opt, std::vector< boost::shared_ptr<CameraModel> > const& camera_models ) {
+  opt.cnet.reset( new ControlNetwork("IsisAdjust") );
+  if ( !opt.cnet_file.empty() ) {
+    vw_out() << "Loading control network from file: " << opt.cnet_file << "\n";
+    if ( boost::iends_with( opt.cnet_file, ".net" ) )
+      opt.cnet->read_isis( opt.cnet_file );
+    else if ( boost::iends_with( opt.cnet_file, ".cnet" ) )
+      opt.cnet->read_binary( opt.cnet_file );
+    else
+      vw_throw( IOErr() << "Unknown Control Network file extension, \""
+                << fs::path( opt.cnet_file ).extension().string() << "\"." );
+    assign_image_ids( opt );
+    BOOST_FOREACH( ControlPoint & cp, *opt.cnet ) {
+      if ( cp.position() == Vector3() )
+        triangulate_control_point( cp, camera_models,
+                                   8.726646E-2 ); // require 5 degrees
+    }
+  } else {
+    vw_out() << "Building Control Network:\n";
+    vw_out() << "-------------------------\n";
+    build_control_network( *opt.cnet, camera_models,
+                           opt.input_names, opt.min_matches,
+                           opt.directory_names );
   }
 
-  // Loading camera models
-  gcp_file_names = sort_out_gcps( input_file_names );
-  {
-    int task = LoadCameraModels;
-    broadcast(world, task, 0);
-    broadcast(world, input_file_names, 0);
+  add_ground_control_points( (*opt.cnet), opt.input_names,
+                             opt.gcp_names.begin(), opt.gcp_names.end() );
+  add_ground_control_cnets( (*opt.cnet), opt.input_names,
+                            opt.gcp_cnet_names.begin(),
+                            opt.gcp_cnet_names.end() );
+
+  BOOST_FOREACH( ControlPoint & cp, *opt.cnet ) {
+    BOOST_FOREACH( ControlMeasure & cm, cp ) {
+      if ( cm.ephemeris_time() == 0 ) {
+        cm.set_description( "px" );
+        cm.set_serial( opt.camera_serials[cm.image_id()] );
+        cm.set_pixels_dominant(true);
+      }
+    }
   }
+  if ( opt.cnet->size() == 0 )
+    vw_throw( IOErr() << "Control network build error: no control points." );
+}
+
+template <class CostT>
+void do_ba( mpi::communicator const& world, CostT const& cost_function, Options const& opt ) {
+  typedef IsisBundleAdjustmentModel<3,3> ModelType;
+  ModelType ba_model( opt.camera_models, opt.cnet, opt.input_names,
+                      opt.cam_position_sigma, opt.cam_pose_sigma,
+                      opt.gcp_scalar );
+  asp::BundleAdjustmentMPISparse<ModelType, CostT>
+    bundle_adjuster( world, ba_model, cost_function, !opt.disable_camera, !opt.disable_gcp );
+  if ( opt.lambda > 0 )
+    bundle_adjuster.set_lambda( opt.lambda );
+  if ( cost_function.name_tag() != "L2Error" )
+    bundle_adjuster.set_control( 1 ); // Shutting off fast Fletcher-style control
+  bundle_adjuster.set_pcg_options( asp::linear_solver_options( "PCG", opt.preconditioner ).pcg );
+
+  std::vector<size_t> cameras, points, halo;
+  mpi::gather( world, bundle_adjuster.num_owned_cameras(), cameras, 0 );
+  mpi::gather( world, bundle_adjuster.num_local_points(), points, 0 );
+  mpi::gather( world, bundle_adjuster.halo_size(), halo, 0 );
+  if ( world.rank() == 0 )
+    for ( int r = 0; r < world.size(); r++ )
+      vw_out() << "Rank " << r << ": " << cameras[r] << " cameras, " << points[r]
+               << " points, receives " << halo[r] << " camera blocks per product.\n";
 
-  // Building control network & saving control network
-
-  // Telling slaves to load control network and to load up their
-  // respective camera models.
-
-  // Performing task
-  int task;
-  for (uint i = 0; i < 3; i++ ) {
-    task = SolveJacobian;
-    Thread::sleep_ms(500);
-    broadcast(world, task, 0);
-    std::vector<std::vector<int> > all_data;
-    std::vector<int> my_data;
-    my_data.push_back(0);
-    my_data.push_back(12);
-    //gather(world, my_data, all_data, 0);
-    for ( uint i = 0; i < all_data.size(); i++ ) {
-      vw_out() << "Job " << i << " : produced " << all_data[i].size() << "\n";
+  // All ranks take the same decisions, from reduced quantities
+  double abs_tol = 1e10, rel_tol = 1e10;
+  int no_improvement_count = 0;
+  while ( true ) {
+    std::string reason;
+    if ( bundle_adjuster.iterations() >= opt.max_iterations )
+      reason = "Triggered 'Max Iterations'";
+    else if ( abs_tol < 0.01 )
+      reason = "Triggered 'Abs Tol < 0.01'";
+    else if ( rel_tol < 1e-6 )
+      reason = "Triggered 'Rel Tol < 1e-6'";
+    else if ( no_improvement_count > 4 )
+      reason = "Triggered break, unable to improve after 5 iterations";
+    if ( !reason.empty() ) {
+      if ( world.rank() == 0 )
+        vw_out() << reason << "\n";
+      break;
     }
-    vw_out() << "\n";
 
-    Thread::sleep_ms(500);
-    task = SolveUpdateError;
-    broadcast(world, task, 0);
+    double overall_delta = bundle_adjuster.update( abs_tol, rel_tol );
+    if ( world.rank() == 0 )
+      vw_out() << "Iteration " << bundle_adjuster.iterations() << ": error "
+               << bundle_adjuster.error() << ", lambda " << bundle_adjuster.lambda()
+               << ( overall_delta == 0 ? " (rejected)" : "" ) << "\n";
+
+    if ( overall_delta == 0 )
+      no_improvement_count++;
+    else
+      no_improvement_count = 0;
   }
-  Thread::sleep_ms(500);
-  task = Finish;
-  broadcast(world, task, 0);
+
+  bundle_adjuster.collect_points( 0 );
+  if ( world.rank() != 0 )
+    return;
+
+  // Re-apply GCP measure to control network
+  for ( size_t i = 0; i < opt.cnet->size(); i++ ) {
+    if ( (*opt.cnet)[i].type() == ControlPoint::GroundControlPoint ) {
+      (*opt.cnet)[i].set_position( ba_model.B_target(i) );
+    }
+  }
+
+  for ( size_t i = 0; i < ba_model.num_cameras(); ++i )
+    ba_model.write_adjustment( i, fs::path( opt.input_names[i] ).replace_extension("isis_adjust").string() );
+}
+
+int main( int argc, char* argv[] ) {
+  mpi::environment env(argc,argv);
+  mpi::communicator world;
+
+  Options opt;
+  try {
+    handle_arguments( argc, argv, opt );
+
+    std::vector< boost::shared_ptr<CameraModel> > camera_models;
+    BOOST_FOREACH( std::string const& input, opt.input_names ) {
+      vw_out(DebugMessage,"asp") << "Loading: " << input << "\n";
+      boost::shared_ptr<asp::BaseEquation> posF( new asp::PolyEquation(0) );
+      boost::shared_ptr<asp::BaseEquation> poseF( new asp::PolyEquation(0) );
+      boost::shared_ptr<IsisAdjustCameraModel> p( new IsisAdjustCameraModel( input, posF, poseF ) );
+      camera_models.push_back( p );
+      opt.camera_models.push_back( p );
+      opt.camera_serials.push_back( p->serial_number() );
+    }
+
+    // The first rank builds the network and hands it to the others
+    // through a file, so that all of them see the same points.
+    std::string cnet_file = opt.output_prefix + ".cnet";
+    int built = 0;
+    if ( world.rank() == 0 ) {
+      try {
+        build_cnet( opt, camera_models );
+        opt.cnet->write_binary( opt.output_prefix );
+        built = 1;
+      } catch ( ... ) {
+        mpi::broadcast( world, built, 0 );
+        throw;
+      }
+    }
+    mpi::broadcast( world, built, 0 );
+    if ( !built )
+      return 1;
+    if ( world.rank() != 0 ) {
+      opt.cnet.reset( new ControlNetwork("IsisAdjust") );
+      opt.cnet->read_binary( cnet_file );
+      assign_image_ids( opt );
+    }
+
+    if ( opt.cost_function == "pseudohuber" ) {
+      do_ba( world, PseudoHuberError(opt.robust_threshold), opt );
+    } else if ( opt.cost_function == "huber" ) {
+      do_ba( world, HuberError(opt.robust_threshold), opt );
+    } else if ( opt.cost_function == "l1" ) {
+      do_ba( world, L1Error(), opt );
+    } else if ( opt.cost_function == "l2" ) {
+      do_ba( world, L2Error(), opt );
+    } else if ( opt.cost_function == "cauchy" ) {
+      do_ba( world, CauchyError(opt.robust_threshold), opt );
+    }
+
+    if ( world.rank() == 0 ) {
+      opt.cnet->write_binary( opt.output_prefix );
+      if ( opt.write_isis_cnet ) {
+        vw_out() << "Writing ISIS-style Control Network.\n";
+        opt.cnet->write_isis( opt.output_prefix );
+      }
+    }
+
+  } ASP_STANDARD_CATCHES;
 
   return 0;
 }
@@ -0,0 +1,191 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/GraphPartition.h>
+#include <asp/MPI/BundleAdjustmentMPI.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+using namespace vw;
+using namespace asp;
+
+// Run on one process by 'make check', and on 2 to 4 by 'make
+// check-mpi'. Every rank builds the same matrix, and checks its own
+// rows against the serial solver.
+namespace {
+
+  // Initializes MPI before the tests run, and finalizes it at exit
+  mpi::environment env;
+
+  // A chain of blocks, each coupled to its neighbors and to a few far
+  // ones. The diagonal is dominant, so that the matrix is positive
+  // definite.
+  std::vector<std::vector<size_t> > make_pattern( size_t num_rows ) {
+    std::vector<std::vector<size_t> > pattern( num_rows );
+    for ( size_t i = 0; i < num_rows; i++ )
+      pattern[i].push_back( i );
+    for ( size_t i = 0; i + 1 < num_rows; i++ ) {
+      pattern[i].push_back( i + 1 );
+      pattern[i+1].push_back( i );
+    }
+    for ( size_t i = 0; i + 7 < num_rows; i += 5 ) {
+      pattern[i].push_back( i + 7 );
+      pattern[i+7].push_back( i );
+    }
+    for ( size_t i = 0; i < num_rows; i++ )
+      std::sort( pattern[i].begin(), pattern[i].end() );
+    return pattern;
+  }
+
+  BlockSparseMatrix make_matrix( std::vector<std::vector<size_t> > const& pattern,
+                                 size_t block_size ) {
+    size_t num_rows = pattern.size();
+    BlockSparseMatrix S( block_size, pattern );
+    srand( 3 );
+    for ( size_t i = 0; i < num_rows; i++ ) {
+      for ( size_t n = S.row_begin(i); n < S.row_end(i); n++ ) {
+        size_t j = S.col(n);
+        if ( j > i ) continue;
+        double* Sij = S.values(n);
+        double* Sji = S.block( j, i );
+        for ( size_t r = 0; r < block_size; r++ )
+          for ( size_t c = 0; c < block_size; c++ ) {
+            double v = (rand() % 200 - 100) / 100.0;
+            if ( i == j && r == c )
+              v = double(block_size * num_rows);
+            if ( i == j && c > r )
+              continue;
+            Sij[r*block_size+c] = v;
+            Sji[c*block_size+r] = v;
+          }
+      }
+    }
+    return S;
+  }
+
+  // The owned rows of S, copied from the serial matrix
+  void copy_owned_rows( BlockSparseMatrix const& serial, DistributedBlockMatrix& S ) {
+    size_t bb = serial.block_size() * serial.block_size();
+    for ( size_t n = 0; n < S.owned_rows().size(); n++ ) {
+      size_t i = S.owned_rows()[n];
+      for ( size_t m = serial.row_begin(i); m < serial.row_end(i); m++ )
+        std::copy( serial.values(m), serial.values(m) + bb, S.local().block( i, serial.col(m) ) );
+    }
+  }
+
+  void expect_owned_near( DistributedBlockMatrix const& S, std::vector<double> const& expected,
+                          std::vector<double> const& actual, double tolerance ) {
+    ASSERT_EQ( expected.size(), actual.size() );
+    for ( size_t n = 0; n < S.owned_rows().size(); n++ )
+      for ( size_t c = 0; c < S.block_size(); c++ ) {
+        size_t k = S.owned_rows()[n] * S.block_size() + c;
+        EXPECT_NEAR( expected[k], actual[k], tolerance );
+      }
+  }
+
+}
+
+TEST( BundleAdjustmentMPI, Multiply ) {
+  mpi::communicator world;
+  std::vector<std::vector<size_t> > pattern = make_pattern( 40 );
+  BlockSparseMatrix serial = make_matrix( pattern, 6 );
+  DistributedBlockMatrix S( world, 6, pattern, partition_graph( pattern, world.size() ) );
+  copy_owned_rows( serial, S );
+
+  std::vector<double> x( serial.rows() ), expected, y;
+  for ( size_t k = 0; k < x.size(); k++ )
+    x[k] = std::cos( double(k) );
+  serial.multiply( x, expected );
+
+  // Only the owned entries are set, the others must be fetched
+  std::vector<double> local( x.size(), 0.0 );
+  for ( size_t n = 0; n < S.owned_rows().size(); n++ )
+    for ( size_t c = 0; c < 6; c++ )
+      local[S.owned_rows()[n]*6 + c] = x[S.owned_rows()[n]*6 + c];
+  S.multiply( local, y );
+  expect_owned_near( S, expected, y, 1e-12 );
+
+  double dot = 0;
+  for ( size_t k = 0; k < x.size(); k++ )
+    dot += x[k] * expected[k];
+  EXPECT_NEAR( dot, S.dot( x, expected ), 1e-9 * std::fabs( dot ) );
+}
+
+TEST( BundleAdjustmentMPI, AddContributions ) {
+  mpi::communicator world;
+  std::vector<std::vector<size_t> > pattern = make_pattern( 40 );
+  BlockSparseMatrix serial = make_matrix( pattern, 6 );
+  DistributedBlockMatrix S( world, 6, pattern, partition_graph( pattern, world.size() ) );
+
+  // Each rank adds a share of every row, and the shares sum to one
+  double share = 2.0 * (world.rank() + 1) / ( world.size() * (world.size() + 1) );
+  BlockSparseMatrix contrib = serial;
+  std::vector<double> rhs( serial.rows() ), rhs_contrib( serial.rows() ), sum( serial.rows(), 0.0 );
+  std::vector<size_t> rows( pattern.size() );
+  for ( size_t k = 0; k < rhs.size(); k++ ) {
+    rhs[k] = std::sin( double(k) );
+    rhs_contrib[k] = share * rhs[k];
+  }
+  for ( size_t n = 0; n < contrib.num_blocks(); n++ )
+    for ( size_t k = 0; k < 36; k++ )
+      contrib.values(n)[k] *= share;
+  for ( size_t i = 0; i < rows.size(); i++ )
+    rows[i] = i;
+  S.add_contributions( contrib, rhs_contrib, rows, sum );
+
+  expect_owned_near( S, rhs, sum, 1e-12 );
+  for ( size_t n = 0; n < S.owned_rows().size(); n++ ) {
+    size_t i = S.owned_rows()[n];
+    for ( size_t m = serial.row_begin(i); m < serial.row_end(i); m++ )
+      for ( size_t k = 0; k < 36; k++ )
+        EXPECT_NEAR( serial.values(m)[k], S.local().block( i, serial.col(m) )[k], 1e-12 );
+  }
+}
+
+TEST( BundleAdjustmentMPI, PCG ) {
+  mpi::communicator world;
+  std::vector<std::vector<size_t> > pattern = make_pattern( 40 );
+  BlockSparseMatrix serial = make_matrix( pattern, 6 );
+  DistributedBlockMatrix S( world, 6, pattern, partition_graph( pattern, world.size() ) );
+  copy_owned_rows( serial, S );
+
+  std::vector<double> rhs( serial.rows() ), expected;
+  for ( size_t k = 0; k < rhs.size(); k++ )
+    rhs[k] = std::cos( double(k) );
+  BlockCholesky chol;
+  ASSERT_TRUE( chol.factor( serial ) );
+  chol.solve( rhs, expected );
+
+  PCGOptions opt;
+  for ( int p = 0; p < 2; p++ ) {
+    opt.preconditioner = p == 0 ? PCGOptions::BlockJacobi : PCGOptions::Jacobi;
+    std::vector<double> x;
+    EXPECT_LT( distributed_pcg_solve( S, rhs, x, opt ), opt.max_iterations );
+    expect_owned_near( S, expected, x, 1e-9 );
+  }
+
+  // Every rank throws, also those whose own rows are fine
+  std::vector<size_t> const& rows = S.owned_rows();
+  if ( world.rank() == world.size() - 1 && !rows.empty() )
+    S.local().block( rows.back(), rows.back() )[0] = -1.0;
+  std::vector<double> x;
+  EXPECT_THROW( distributed_pcg_solve( S, rhs, x, opt ), ArgumentErr );
+}
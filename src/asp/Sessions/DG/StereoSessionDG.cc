@@ -22,6 +22,7 @@
 // Ames Stereo Pipeline
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/InterestPointMatching.h>
+#include <asp/Core/DiskImageResourceMmap.h>
 #include <asp/Sessions/DG/LinescanDGModel.h>
 #include <asp/Sessions/DG/StereoSessionDG.h>
 #include <asp/Sessions/DG/XML.h>
@@ -36,6 +37,8 @@
 
 // Std
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <string>
 
 // Other
@@ -47,6 +50,8 @@
 
 // Boost
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/functional/hash.hpp>
 
 using namespace vw;
 using namespace asp;
@@ -308,16 +313,90 @@ namespace asp {
              OriginalCameraIndex( *rpc_model, org_image_bbox ) ), map_image_bbox );
   }
 
+  // Hash of everything a LUT image depends on. The file sizes and
+  // modification times stand in for the file contents, which would
+  // be too expensive to hash.
+  std::string StereoSessionDG::lut_hash( std::string const& image_file,
+                                         std::string const& camera_file ) const {
+    std::size_t seed = 0;
+    std::string files[] = { image_file, camera_file, m_input_dem };
+    for ( int i = 0; i < 3; i++ ) {
+      boost::hash_combine( seed, files[i] );
+      if ( fs::exists( files[i] ) ) {
+        boost::hash_combine( seed, (boost::uintmax_t)fs::file_size( files[i] ) );
+        boost::hash_combine( seed, (long)fs::last_write_time( files[i] ) );
+      }
+    }
+    std::ostringstream os;
+    os << std::hex << seed;
+    return os.str();
+  }
+
+  bool StereoSessionDG::has_valid_lut_file( std::string const& lut_file,
+                                            std::string const& hash ) const {
+    std::string hash_file = lut_file + ".hash";
+    if ( !fs::exists( lut_file ) || !fs::exists( hash_file ) )
+      return false;
+    std::ifstream is( hash_file.c_str() );
+    std::string stored_hash;
+    if ( !(is >> stored_hash) || stored_hash != hash )
+      return false;
+    try {
+      DiskImageView<Vector2f> test( lut_file );
+    } catch ( vw::Exception const& e ) {
+      // Truncated or corrupted file.
+      return false;
+    }
+    return true;
+  }
+
+  // Rasterize the LUT in parallel into the native memory-mapped
+  // format, whose tiles are read back with a plain copy, since the
+  // LUT is randomly accessed during triangulation.
+  void StereoSessionDG::write_lut_image( std::string const& image_file,
+                                         std::string const& camera_file,
+                                         std::string const& lut_file ) const {
+    std::string hash = lut_hash( image_file, camera_file );
+    if ( has_valid_lut_file( lut_file, hash ) ) {
+      vw_out() << "\t--> Using cached LUT file: " << lut_file << "\n";
+      return;
+    }
+
+    // Make sure an interrupted write does not leave behind a hash
+    // that validates a partial file.
+    fs::remove( lut_file + ".hash" );
+
+    block_write_mmap_image( lut_file, generate_lut_image( image_file, camera_file ),
+                            m_options,
+                            TerminalProgressCallback("asp", "\t  LUT: ") );
+
+    std::ofstream os( (lut_file + ".hash").c_str() );
+    os << hash << "\n";
+  }
+
+  // Use the LUT rasterized in preprocessing if it is still valid,
+  // otherwise fall back to computing it on the fly.
+  ImageViewRef<Vector2f>
+  StereoSessionDG::load_lut_image( std::string const& image_file,
+                                   std::string const& camera_file,
+                                   std::string const& lut_file ) const {
+    if ( has_valid_lut_file( lut_file, lut_hash( image_file, camera_file ) ) )
+      return DiskImageView<Vector2f>( lut_file );
+    vw_out(DebugMessage,"asp") << "No valid LUT file " << lut_file
+                               << ". Computing the LUT on the fly.\n";
+    return generate_lut_image( image_file, camera_file );
+  }
+
   ImageViewRef<Vector2f> StereoSessionDG::lut_image_left() const {
     if ( !m_rpc_map_projected )
       vw_throw( LogicErr() << "StereoSessionDG: This is not a map projected session. LUT table should not be used here" );
-    return generate_lut_image( m_left_image_file, m_left_camera_file );
+    return load_lut_image( m_left_image_file, m_left_camera_file, m_out_prefix + "-L-lut" + DiskImageResourceMmap::extension() );
   }
 
   ImageViewRef<Vector2f> StereoSessionDG::lut_image_right() const {
     if ( !m_rpc_map_projected )
       vw_throw( LogicErr() << "StereoSessionDG: This is not a map projected session. LUT table should not be used here" );
-    return generate_lut_image( m_right_image_file, m_right_camera_file );
+    return load_lut_image( m_right_image_file, m_right_camera_file, m_out_prefix + "-R-lut" + DiskImageResourceMmap::extension() );
   }
 
   void StereoSessionDG::pre_preprocessing_hook(std::string const& left_input_file,
@@ -339,6 +418,14 @@ namespace asp {
     left_output_file = m_out_prefix + "-L.tif";
     right_output_file = m_out_prefix + "-R.tif";
 
+    // Rasterize the LUT images once so that the later stages don't
+    // have to project the DEM through the RPC models again.
+    if ( m_rpc_map_projected ) {
+      vw_out() << "\t--> Writing LUT images.\n";
+      write_lut_image( m_left_image_file,  m_left_camera_file,  m_out_prefix + "-L-lut" + DiskImageResourceMmap::extension() );
+      write_lut_image( m_right_image_file, m_right_camera_file, m_out_prefix + "-R-lut" + DiskImageResourceMmap::extension() );
+    }
+
     // If these files already exist, don't bother writting them again.
     bool rebuild = false;
     try {
@@ -494,11 +581,6 @@ namespace asp {
                               apply_mask(crop(edge_extend(Rimg, ConstantEdgeExtension()), bounding_box(Limg)), output_nodata),
                               output_nodata, m_options,
                               TerminalProgressCallback("asp","\t  R:  ") );
-
-    // We could write the LUT images at this point, but I'm going to
-    // let triangulation render them on the fly. This will save a lot
-    // of storage and possibly make the triangulation faster since we
-    // don't mutex on these massive files
   }
 
   // Helper function to read RPC models.
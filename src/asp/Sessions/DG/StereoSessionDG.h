@@ -76,6 +76,18 @@ namespace asp {
     bool m_rpc_map_projected;
 
     vw::ImageViewRef<vw::Vector2f> generate_lut_image( std::string const&, std::string const& ) const;
+
+    // The LUT images are rasterized once during preprocessing and
+    // reused by later stages and later runs. A sidecar file records a
+    // hash of the inputs the LUT was made from, so a stale LUT is
+    // never picked up.
+    std::string lut_hash( std::string const& image_file, std::string const& camera_file ) const;
+    bool has_valid_lut_file( std::string const& lut_file, std::string const& hash ) const;
+    void write_lut_image( std::string const& image_file, std::string const& camera_file,
+                          std::string const& lut_file ) const;
+    vw::ImageViewRef<vw::Vector2f> load_lut_image( std::string const& image_file,
+                                                   std::string const& camera_file,
+                                                   std::string const& lut_file ) const;
     static RPCModel* read_rpc_model( std::string const& image_file, std::string const& camera_file );
 
   };
@@ -30,6 +30,7 @@
 // Stereo Pipeline
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/InterestPointMatching.h>
+#include <asp/Core/DiskImageResourceMmap.h>
 #include <asp/Sessions/ISIS/StereoSessionIsis.h>
 #include <asp/IsisIO/IsisCameraModel.h>
 #include <asp/IsisIO/IsisAdjustCameraModel.h>
@@ -354,7 +355,7 @@ asp::StereoSessionIsis::pre_filtering_hook(std::string const& input_file,
     // (use at your own risk)
     // ****************************************************
     vw_out() << "\t--> Masking pixels that are less than 0.0.  (NOTE: Use this option with Apollo Metric Camera frames only!)\n";
-    output_file = m_out_prefix + "-R-masked.exr";
+    output_file = m_out_prefix + "-R-masked" + DiskImageResourceMmap::extension();
 
     std::string shadowLmask_name =
       write_shadow_mask( m_options, m_out_prefix, m_left_image_file,
@@ -371,14 +372,8 @@ asp::StereoSessionIsis::pre_filtering_hook(std::string const& input_file,
       stereo::disparity_mask(disparity_disk_image,
                              shadowLmask, shadowRmask );
 
-    DiskImageResourceOpenEXR disparity_map_rsrc(output_file, disparity_map.format() );
-    Vector2i block_size(std::min<size_t>(vw_settings().default_tile_size(),
-                                         disparity_map.cols()),
-                        std::min<size_t>(vw_settings().default_tile_size(),
-                                         disparity_map.rows()));
-    disparity_map_rsrc.set_block_write_size(block_size);
-    block_write_image( disparity_map_rsrc, disparity_map,
-                       TerminalProgressCallback( "asp", "\t--> Saving Mask :") );
+    block_write_mmap_image( output_file, disparity_map, m_options,
+                            TerminalProgressCallback( "asp", "\t--> Saving Mask :") );
   }
 }
 
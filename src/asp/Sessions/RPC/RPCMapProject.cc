@@ -0,0 +1,270 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <asp/Sessions/RPC/RPCMapProject.h>
+#include <vw/Image/Manipulation.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace vw;
+
+namespace asp {
+
+  namespace {
+
+    // The mapping over one tile, with the DEM under it in memory.
+    class TileMapping {
+      RPCInverseGrid const& m_grid;
+      Vector2i m_tile_origin;
+      ImageView<PixelMask<float> > m_heights;
+      Vector2i m_dem_origin;
+      ImageView<int32> m_no_data;   // Summed counts of DEM posts with no data
+      bool m_any_no_data;
+
+    public:
+      TileMapping( RPCInverseGrid const& grid, BBox2i const& bbox ) :
+        m_grid(grid), m_tile_origin(bbox.min()), m_any_no_data(false) {
+        // The DEM pixels under the border of the tile
+        BBox2 footprint;
+        for ( int32 i = 0; i < bbox.width(); i++ ) {
+          footprint.grow( dem_pixel( Vector2( bbox.min().x() + i, bbox.min().y() ) ) );
+          footprint.grow( dem_pixel( Vector2( bbox.min().x() + i, bbox.max().y() - 1 ) ) );
+        }
+        for ( int32 j = 0; j < bbox.height(); j++ ) {
+          footprint.grow( dem_pixel( Vector2( bbox.min().x(), bbox.min().y() + j ) ) );
+          footprint.grow( dem_pixel( Vector2( bbox.max().x() - 1, bbox.min().y() + j ) ) );
+        }
+
+        BBox2i dem_box( Vector2i( int32( floor( footprint.min().x() ) ) - 2,
+                                  int32( floor( footprint.min().y() ) ) - 2 ),
+                        Vector2i( int32( ceil( footprint.max().x() ) ) + 4,
+                                  int32( ceil( footprint.max().y() ) ) + 4 ) );
+        dem_box.crop( bounding_box( m_grid.dem() ) );
+        if ( dem_box.empty() )
+          return;
+        m_heights = crop( m_grid.dem(), dem_box );
+        m_dem_origin = dem_box.min();
+
+        m_no_data.set_size( m_heights.cols() + 1, m_heights.rows() + 1 );
+        for ( int32 i = 0; i <= m_heights.cols(); i++ )
+          m_no_data(i,0) = 0;
+        for ( int32 j = 0; j < m_heights.rows(); j++ ) {
+          m_no_data(0,j+1) = 0;
+          for ( int32 i = 0; i < m_heights.cols(); i++ )
+            m_no_data(i+1,j+1) = m_no_data(i,j+1) + m_no_data(i+1,j) - m_no_data(i,j) +
+              ( is_valid( m_heights(i,j) ) ? 0 : 1 );
+        }
+        m_any_no_data = m_no_data( m_heights.cols(), m_heights.rows() ) > 0;
+      }
+
+      Vector2 dem_pixel( Vector2 const& pixel ) const {
+        return m_grid.dem_georef().lonlat_to_pixel( m_grid.image_georef().pixel_to_lonlat( pixel ) );
+      }
+
+      // Whether the DEM has data everywhere under the cell with
+      // corners at (x0,y0) and (x1,y1) of the tile, with a post to
+      // spare for the curvature of the mapping.
+      bool has_dem( int32 x0, int32 y0, int32 x1, int32 y1 ) const {
+        if ( !m_any_no_data )
+          return true;
+        BBox2 footprint;
+        footprint.grow( dem_pixel( Vector2( m_tile_origin.x() + x0, m_tile_origin.y() + y0 ) ) );
+        footprint.grow( dem_pixel( Vector2( m_tile_origin.x() + x1, m_tile_origin.y() + y0 ) ) );
+        footprint.grow( dem_pixel( Vector2( m_tile_origin.x() + x0, m_tile_origin.y() + y1 ) ) );
+        footprint.grow( dem_pixel( Vector2( m_tile_origin.x() + x1, m_tile_origin.y() + y1 ) ) );
+        Vector2 origin( m_dem_origin.x(), m_dem_origin.y() );
+        footprint.min() -= origin;
+        footprint.max() -= origin;
+        if ( !( footprint.min().x() >= 1 && footprint.min().y() >= 1 &&
+                footprint.max().x() + 3 < m_heights.cols() &&
+                footprint.max().y() + 3 < m_heights.rows() ) )
+          return false;
+        int32 min_x = int32( footprint.min().x() ) - 1, min_y = int32( footprint.min().y() ) - 1,
+          max_x = int32( footprint.max().x() ) + 3, max_y = int32( footprint.max().y() ) + 3;
+        return m_no_data(max_x,max_y) - m_no_data(min_x,max_y) -
+          m_no_data(max_x,min_y) + m_no_data(min_x,min_y) == 0;
+      }
+
+      // The camera pixel of a pixel of the tile, from the bilinearly
+      // interpolated height of the DEM.
+      PixelMask<Vector2> operator()( int32 i, int32 j ) const {
+        Vector2 lonlat =
+          m_grid.image_georef().pixel_to_lonlat( Vector2( m_tile_origin.x() + i,
+                                                          m_tile_origin.y() + j ) );
+        Vector2 dem = m_grid.dem_georef().lonlat_to_pixel( lonlat ) - m_dem_origin;
+        if ( !( dem.x() >= 0 && dem.y() >= 0 ) )
+          return PixelMask<Vector2>();
+        int32 x = int32( dem.x() ), y = int32( dem.y() );
+        if ( x + 1 >= m_heights.cols() || y + 1 >= m_heights.rows() )
+          return PixelMask<Vector2>();
+        PixelMask<float> const &h00 = m_heights(x,y),   &h10 = m_heights(x+1,y),
+                               &h01 = m_heights(x,y+1), &h11 = m_heights(x+1,y+1);
+        if ( !is_valid(h00) || !is_valid(h10) || !is_valid(h01) || !is_valid(h11) )
+          return PixelMask<Vector2>();
+        double tx = dem.x() - x, ty = dem.y() - y;
+        double height = ( 1 - ty ) * ( ( 1 - tx ) * h00.child() + tx * h10.child() ) +
+          ty * ( ( 1 - tx ) * h01.child() + tx * h11.child() );
+        return PixelMask<Vector2>( m_grid.rpc().geodetic_to_pixel( Vector3( lonlat.x(), lonlat.y(),
+                                                                            height ) ) );
+      }
+    };
+
+    // The mapping at (x,y) interpolated from the corners of a cell
+    Vector2 bilinear( PixelMask<Vector2> const* corners, int32 x0, int32 y0,
+                      int32 x1, int32 y1, int32 x, int32 y ) {
+      double tx = x1 > x0 ? double( x - x0 ) / ( x1 - x0 ) : 0;
+      double ty = y1 > y0 ? double( y - y0 ) / ( y1 - y0 ) : 0;
+      return ( 1 - ty ) * ( ( 1 - tx ) * corners[0].child() + tx * corners[1].child() ) +
+        ty * ( ( 1 - tx ) * corners[2].child() + tx * corners[3].child() );
+    }
+
+    bool close( PixelMask<Vector2> const& exact, PixelMask<Vector2> const* corners,
+                int32 x0, int32 y0, int32 x1, int32 y1, int32 x, int32 y, double tolerance ) {
+      return is_valid( exact ) &&
+        norm_2( exact.child() - bilinear( corners, x0, y0, x1, y1, x, y ) ) <= tolerance;
+    }
+
+    // Fill the pixels of the cell with corners at (x0,y0) and
+    // (x1,y1), inclusive. The corners are ordered (x0,y0), (x1,y0),
+    // (x0,y1), (x1,y1).
+    void fill_cell( TileMapping const& mapping, double tolerance,
+                    int32 x0, int32 y0, int32 x1, int32 y1,
+                    PixelMask<Vector2> const* corners,
+                    ImageView<PixelMask<Vector2> >& result ) {
+      bool split_x = x1 - x0 > 2, split_y = y1 - y0 > 2;
+      if ( !split_x && !split_y ) {
+        for ( int32 y = y0; y <= y1; y++ )
+          for ( int32 x = x0; x <= x1; x++ )
+            result(x,y) = mapping( x, y );
+        return;
+      }
+
+      int32 xm = split_x ? ( x0 + x1 ) / 2 : x0, ym = split_y ? ( y0 + y1 ) / 2 : y0;
+      PixelMask<Vector2> top, bottom, left, right, center;
+      bool valid = is_valid( corners[0] ) && is_valid( corners[1] ) &&
+        is_valid( corners[2] ) && is_valid( corners[3] ) &&
+        mapping.has_dem( x0, y0, x1, y1 );
+      if ( split_x ) {
+        top    = mapping( xm, y0 );
+        bottom = mapping( xm, y1 );
+        valid = valid && close( top, corners, x0, y0, x1, y1, xm, y0, tolerance ) &&
+          close( bottom, corners, x0, y0, x1, y1, xm, y1, tolerance );
+      }
+      if ( split_y ) {
+        left  = mapping( x0, ym );
+        right = mapping( x1, ym );
+        valid = valid && close( left, corners, x0, y0, x1, y1, x0, ym, tolerance ) &&
+          close( right, corners, x0, y0, x1, y1, x1, ym, tolerance );
+      }
+      if ( split_x && split_y ) {
+        center = mapping( xm, ym );
+        valid = valid && close( center, corners, x0, y0, x1, y1, xm, ym, tolerance );
+      }
+
+      // The midpoints agree where the mapping has an inflection in
+      // the cell, so check the quarter points across it too.
+      if ( valid && split_x ) {
+        int32 y = split_y ? ym : y0;
+        valid = close( mapping( ( x0 + xm ) / 2, y ), corners, x0, y0, x1, y1, ( x0 + xm ) / 2, y, tolerance ) &&
+          close( mapping( ( xm + x1 ) / 2, y ), corners, x0, y0, x1, y1, ( xm + x1 ) / 2, y, tolerance );
+      }
+      if ( valid && split_y ) {
+        int32 x = split_x ? xm : x0;
+        valid = close( mapping( x, ( y0 + ym ) / 2 ), corners, x0, y0, x1, y1, x, ( y0 + ym ) / 2, tolerance ) &&
+          close( mapping( x, ( ym + y1 ) / 2 ), corners, x0, y0, x1, y1, x, ( ym + y1 ) / 2, tolerance );
+      }
+
+      if ( valid ) {
+        for ( int32 y = y0; y <= y1; y++ )
+          for ( int32 x = x0; x <= x1; x++ )
+            result(x,y) = PixelMask<Vector2>( bilinear( corners, x0, y0, x1, y1, x, y ) );
+        return;
+      }
+
+      if ( split_x && split_y ) {
+        PixelMask<Vector2> c00[4] = { corners[0], top, left, center };
+        PixelMask<Vector2> c10[4] = { top, corners[1], center, right };
+        PixelMask<Vector2> c01[4] = { left, center, corners[2], bottom };
+        PixelMask<Vector2> c11[4] = { center, right, bottom, corners[3] };
+        fill_cell( mapping, tolerance, x0, y0, xm, ym, c00, result );
+        fill_cell( mapping, tolerance, xm, y0, x1, ym, c10, result );
+        fill_cell( mapping, tolerance, x0, ym, xm, y1, c01, result );
+        fill_cell( mapping, tolerance, xm, ym, x1, y1, c11, result );
+      } else if ( split_x ) {
+        PixelMask<Vector2> c0[4] = { corners[0], top, corners[2], bottom };
+        PixelMask<Vector2> c1[4] = { top, corners[1], bottom, corners[3] };
+        fill_cell( mapping, tolerance, x0, y0, xm, y1, c0, result );
+        fill_cell( mapping, tolerance, xm, y0, x1, y1, c1, result );
+      } else {
+        PixelMask<Vector2> c0[4] = { corners[0], corners[1], left, right };
+        PixelMask<Vector2> c1[4] = { left, right, corners[2], corners[3] };
+        fill_cell( mapping, tolerance, x0, y0, x1, ym, c0, result );
+        fill_cell( mapping, tolerance, x0, ym, x1, y1, c1, result );
+      }
+    }
+
+  }
+
+  RPCInverseGrid::RPCInverseGrid( RPCModel const& rpc,
+                                  cartography::GeoReference const& image_georef,
+                                  cartography::GeoReference const& dem_georef,
+                                  ImageViewRef<PixelMask<float> > const& dem,
+                                  double tolerance, int32 spacing ) :
+    m_rpc(rpc), m_image_georef(image_georef), m_dem_georef(dem_georef), m_dem(dem),
+    m_tolerance(tolerance), m_spacing(spacing) {
+    VW_ASSERT( spacing >= 1, ArgumentErr() << "RPCInverseGrid: the grid spacing must be positive.\n" );
+  }
+
+  void RPCInverseGrid::pixels( BBox2i const& bbox, ImageView<PixelMask<Vector2> >& result ) const {
+    result.set_size( bbox.width(), bbox.height() );
+    TileMapping mapping( *this, bbox );
+
+    if ( m_tolerance <= 0 || m_spacing == 1 ) {
+      for ( int32 j = 0; j < bbox.height(); j++ )
+        for ( int32 i = 0; i < bbox.width(); i++ )
+          result(i,j) = mapping( i, j );
+      return;
+    }
+
+    // The exact mapping on the coarse grid, with the last row and
+    // column of nodes on the edges of the tile
+    std::vector<int32> xs, ys;
+    for ( int32 x = 0; x < bbox.width() - 1; x += m_spacing )
+      xs.push_back( x );
+    xs.push_back( bbox.width() - 1 );
+    for ( int32 y = 0; y < bbox.height() - 1; y += m_spacing )
+      ys.push_back( y );
+    ys.push_back( bbox.height() - 1 );
+
+    ImageView<PixelMask<Vector2> > nodes( xs.size(), ys.size() );
+    for ( size_t j = 0; j < ys.size(); j++ )
+      for ( size_t i = 0; i < xs.size(); i++ )
+        nodes(i,j) = mapping( xs[i], ys[j] );
+
+    // A tile one pixel wide or high has cells with no width or height
+    size_t cells_x = std::max( xs.size(), size_t(2) ) - 1,
+      cells_y = std::max( ys.size(), size_t(2) ) - 1;
+    for ( size_t j = 0; j < cells_y; j++ )
+      for ( size_t i = 0; i < cells_x; i++ ) {
+        size_t i1 = std::min( i + 1, xs.size() - 1 ), j1 = std::min( j + 1, ys.size() - 1 );
+        PixelMask<Vector2> corners[4] = { nodes(i,j), nodes(i1,j), nodes(i,j1), nodes(i1,j1) };
+        fill_cell( mapping, m_tolerance, xs[i], ys[j], xs[i1], ys[j1], corners, result );
+      }
+  }
+
+}
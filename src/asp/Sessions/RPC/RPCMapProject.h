@@ -0,0 +1,169 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#ifndef __STEREO_SESSION_RPC_MAP_PROJECT_H__
+#define __STEREO_SESSION_RPC_MAP_PROJECT_H__
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/Algorithms.h>
+#include <vw/Image/ImageViewRef.h>
+#include <vw/Image/Interpolation.h>
+#include <vw/Image/EdgeExtension.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Cartography/GeoReference.h>
+#include <asp/Sessions/RPC/RPCModel.h>
+
+#include <cmath>
+
+namespace asp {
+
+  // Where each pixel of a map projected image was seen by an RPC
+  // camera, over a DEM. The exact mapping is only evaluated on a
+  // coarse grid of output pixels; a grid cell is bilinearly
+  // interpolated once the mapping at its edge midpoints and center
+  // agrees with the interpolation to within the tolerance, and split
+  // in four otherwise. Cells with no DEM under a corner are split
+  // down to single pixels. Only the DEM under a tile is read, and the
+  // grid holds no state between calls, so tiles may be computed
+  // concurrently.
+  class RPCInverseGrid {
+    RPCModel m_rpc;
+    vw::cartography::GeoReference m_image_georef, m_dem_georef;
+    vw::ImageViewRef<vw::PixelMask<float> > m_dem;
+    double m_tolerance;
+    vw::int32 m_spacing;
+  public:
+    // A tolerance of zero evaluates the mapping at every pixel.
+    RPCInverseGrid( RPCModel const& rpc,
+                    vw::cartography::GeoReference const& image_georef,
+                    vw::cartography::GeoReference const& dem_georef,
+                    vw::ImageViewRef<vw::PixelMask<float> > const& dem,
+                    double tolerance, vw::int32 spacing = 32 );
+
+    // Camera pixels of the map projected pixels in bbox. Pixels with
+    // no DEM under them are invalid.
+    void pixels( vw::BBox2i const& bbox,
+                 vw::ImageView<vw::PixelMask<vw::Vector2> >& result ) const;
+
+    RPCModel const& rpc() const { return m_rpc; }
+    vw::cartography::GeoReference const& image_georef() const { return m_image_georef; }
+    vw::cartography::GeoReference const& dem_georef() const { return m_dem_georef; }
+    vw::ImageViewRef<vw::PixelMask<float> > const& dem() const { return m_dem; }
+  };
+
+  // Samples the camera image at the pixels found by the grid. Each
+  // tile reads just the part of the camera image it sees, so memory
+  // stays bounded by the tile size and the tiles can be written in
+  // parallel. Pixels off the DEM or off the image are pixel_type(),
+  // which is invalid for masked pixels.
+  template <class ImageT>
+  class RPCMapProjectView : public vw::ImageViewBase<RPCMapProjectView<ImageT> > {
+    ImageT m_image;
+    RPCInverseGrid m_grid;
+    vw::int32 m_cols, m_rows;
+
+    // Beyond this many camera image pixels per output pixel, a tile
+    // samples the camera image in place instead of reading a copy.
+    static const vw::int32 MAX_SOURCE_RATIO = 64;
+
+    template <class SourceT>
+    void sample( SourceT const& source, vw::Vector2 const& offset,
+                 vw::ImageView<vw::PixelMask<vw::Vector2> > const& pixels,
+                 vw::ImageView<typename ImageT::pixel_type>& tile ) const {
+      vw::BBox2 image_box( -1, -1, m_image.cols() + 1, m_image.rows() + 1 );
+      for ( vw::int32 j = 0; j < tile.rows(); j++ )
+        for ( vw::int32 i = 0; i < tile.cols(); i++ ) {
+          vw::PixelMask<vw::Vector2> const& pixel = pixels(i,j);
+          if ( is_valid(pixel) && image_box.contains( pixel.child() ) )
+            tile(i,j) = source( pixel.child().x() - offset.x(),
+                                pixel.child().y() - offset.y() );
+        }
+    }
+
+  public:
+    typedef typename ImageT::pixel_type pixel_type;
+    typedef pixel_type result_type;
+    typedef vw::ProceduralPixelAccessor<RPCMapProjectView<ImageT> > pixel_accessor;
+
+    RPCMapProjectView( ImageT const& image, RPCInverseGrid const& grid,
+                       vw::int32 cols, vw::int32 rows ) :
+      m_image(image), m_grid(grid), m_cols(cols), m_rows(rows) {}
+
+    inline vw::int32 cols() const { return m_cols; }
+    inline vw::int32 rows() const { return m_rows; }
+    inline vw::int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this,0,0); }
+
+    inline result_type operator()( vw::int32 i, vw::int32 j, vw::int32 p=0 ) const {
+      return prerasterize( vw::BBox2i(i,j,1,1) )(i,j,p);
+    }
+
+    typedef vw::CropView<vw::ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize( vw::BBox2i const& bbox ) const {
+      using namespace vw;
+      ImageView<PixelMask<Vector2> > pixels;
+      m_grid.pixels( bbox, pixels );
+
+      // The part of the camera image the tile sees
+      int32 buffer = BicubicInterpolation::pixel_buffer;
+      BBox2i source;
+      for ( int32 j = 0; j < pixels.rows(); j++ )
+        for ( int32 i = 0; i < pixels.cols(); i++ ) {
+          if ( !is_valid( pixels(i,j) ) )
+            continue;
+          Vector2 const& pixel = pixels(i,j).child();
+          if ( !( pixel.x() > -buffer && pixel.x() < m_image.cols() + buffer &&
+                  pixel.y() > -buffer && pixel.y() < m_image.rows() + buffer ) )
+            continue;
+          Vector2i corner( int32( floor( pixel.x() ) ), int32( floor( pixel.y() ) ) );
+          source.grow( BBox2i( corner.x() - buffer, corner.y() - buffer,
+                               2*buffer + 2, 2*buffer + 2 ) );
+        }
+      source.crop( bounding_box( m_image ) );
+
+      ImageView<pixel_type> tile( bbox.width(), bbox.height() );
+      fill( tile, pixel_type() );
+      if ( !source.empty() ) {
+        ValueEdgeExtension<pixel_type> edge( (pixel_type()) );
+        if ( source.area() <= MAX_SOURCE_RATIO * bbox.area() ) {
+          ImageView<pixel_type> image = crop( m_image, source );
+          sample( interpolate( image, BicubicInterpolation(), edge ),
+                  source.min(), pixels, tile );
+        } else {
+          sample( interpolate( m_image, BicubicInterpolation(), edge ),
+                  Vector2(), pixels, tile );
+        }
+      }
+      return prerasterize_type( tile, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
+    }
+    template <class DestT>
+    inline void rasterize( DestT const& dest, vw::BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+  };
+
+  template <class ImageT>
+  RPCMapProjectView<ImageT>
+  rpc_map_project( vw::ImageViewBase<ImageT> const& image, RPCInverseGrid const& grid,
+                   vw::int32 cols, vw::int32 rows ) {
+    return RPCMapProjectView<ImageT>( image.impl(), grid, cols, rows );
+  }
+
+}
+
+#endif//__STEREO_SESSION_RPC_MAP_PROJECT_H__
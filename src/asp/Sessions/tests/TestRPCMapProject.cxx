@@ -0,0 +1,142 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Sessions/RPC/RPCMapProject.h>
+
+#include <cmath>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  // A camera looking down at an angle, over 100x100 pixels
+  RPCModel synthetic_rpc() {
+    RPCModel::CoeffVec sample_num, line_num, den;
+    sample_num[1] = 1;     // lon
+    sample_num[3] = 0.2;   // height
+    sample_num[4] = 0.05;  // lon*lat
+    line_num[2]   = -1;    // lat
+    line_num[8]   = 0.03;  // lat*lat
+    den[0] = 1;
+    den[1] = 0.01;
+    return RPCModel( cartography::Datum("WGS84"), line_num, den, sample_num, den,
+                     Vector2(50, 50), Vector2(40, 40),
+                     Vector3(-105.29, 39.745, 2300), Vector3(0.01, 0.01, 500) );
+  }
+
+  cartography::GeoReference lonlat_georef( double lon, double lat, double spacing ) {
+    cartography::GeoReference georef;
+    georef.set_well_known_geogcs("WGS84");
+    Matrix3x3 transform = math::identity_matrix<3>();
+    transform(0,0) = spacing;
+    transform(1,1) = -spacing;
+    transform(0,2) = lon;
+    transform(1,2) = lat;
+    georef.set_transform( transform );
+    return georef;
+  }
+
+  // Rolling terrain with a hole of no data
+  ImageView<PixelMask<float> > synthetic_dem() {
+    ImageView<PixelMask<float> > dem( 120, 120 );
+    for ( int32 j = 0; j < dem.rows(); j++ )
+      for ( int32 i = 0; i < dem.cols(); i++ ) {
+        dem(i,j) = PixelMask<float>( 2250 + 0.4*i + 30*sin( i / 25.0 ) * cos( j / 40.0 ) );
+        if ( ( i - 70 ) * ( i - 70 ) + ( j - 50 ) * ( j - 50 ) < 64 )
+          dem(i,j).invalidate();
+      }
+    return dem;
+  }
+
+}
+
+TEST( RPCMapProject, GridMatchesExact ) {
+  RPCModel rpc = synthetic_rpc();
+  cartography::GeoReference dem_georef = lonlat_georef( -105.302, 39.757, 2e-4 );
+  cartography::GeoReference image_georef = lonlat_georef( -105.3, 39.755, 5e-5 );
+  ImageViewRef<PixelMask<float> > dem = synthetic_dem();
+
+  double tolerance = 0.05;
+  RPCInverseGrid exact( rpc, image_georef, dem_georef, dem, 0 );
+  RPCInverseGrid grid( rpc, image_georef, dem_georef, dem, tolerance );
+
+  // Tiles of odd sizes, one of them a single row
+  BBox2i tiles[] = { BBox2i( 37, 21, 96, 80 ), BBox2i( 0, 0, 256, 256 ),
+                     BBox2i( 200, 150, 65, 1 ) };
+  for ( int t = 0; t < 3; t++ ) {
+    ImageView<PixelMask<Vector2> > expected, pixels;
+    exact.pixels( tiles[t], expected );
+    grid.pixels( tiles[t], pixels );
+    ASSERT_EQ( expected.cols(), pixels.cols() );
+    ASSERT_EQ( expected.rows(), pixels.rows() );
+
+    int32 invalid = 0;
+    double max_error = 0;
+    for ( int32 j = 0; j < pixels.rows(); j++ )
+      for ( int32 i = 0; i < pixels.cols(); i++ ) {
+        ASSERT_EQ( is_valid( expected(i,j) ), is_valid( pixels(i,j) ) );
+        if ( !is_valid( expected(i,j) ) ) {
+          invalid++;
+          continue;
+        }
+        max_error = std::max( max_error, norm_2( expected(i,j).child() - pixels(i,j).child() ) );
+      }
+    EXPECT_LT( max_error, 2*tolerance );
+    if ( t == 1 )
+      EXPECT_GT( invalid, 0 );
+  }
+}
+
+TEST( RPCMapProject, View ) {
+  RPCModel rpc = synthetic_rpc();
+  cartography::GeoReference dem_georef = lonlat_georef( -105.302, 39.757, 2e-4 );
+  cartography::GeoReference image_georef = lonlat_georef( -105.3, 39.755, 5e-5 );
+  ImageViewRef<PixelMask<float> > dem = synthetic_dem();
+  RPCInverseGrid grid( rpc, image_georef, dem_georef, dem, 0 );
+
+  // Bicubic interpolation is exact on a ramp
+  ImageView<PixelMask<float> > image( 100, 100 );
+  for ( int32 j = 0; j < image.rows(); j++ )
+    for ( int32 i = 0; i < image.cols(); i++ )
+      image(i,j) = PixelMask<float>( 2*i + 3*j );
+
+  ImageView<PixelMask<float> > projected = rpc_map_project( image, grid, 500, 500 );
+  ImageView<PixelMask<Vector2> > pixels;
+  grid.pixels( BBox2i( 0, 0, 500, 500 ), pixels );
+
+  int32 valid = 0;
+  for ( int32 j = 0; j < projected.rows(); j++ )
+    for ( int32 i = 0; i < projected.cols(); i++ ) {
+      PixelMask<Vector2> const& pixel = pixels(i,j);
+      bool inside = is_valid( pixel ) &&
+        pixel.child().x() >= 1 && pixel.child().x() <= 97 &&
+        pixel.child().y() >= 1 && pixel.child().y() <= 97;
+      if ( !inside )
+        continue;
+      ASSERT_TRUE( is_valid( projected(i,j) ) );
+      EXPECT_NEAR( 2*pixel.child().x() + 3*pixel.child().y(), projected(i,j).child(), 1e-3 );
+      valid++;
+    }
+  EXPECT_GT( valid, 1000 );
+
+  // Past the east and south edges of the DEM
+  EXPECT_FALSE( is_valid( pixels(499,499) ) );
+  EXPECT_FALSE( is_valid( projected(499,499) ) );
+}
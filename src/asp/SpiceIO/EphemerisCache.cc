@@ -0,0 +1,272 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file EphemerisCache.cc
+///
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <fstream>
+
+#include <vw/Core/Exception.h>
+#include <asp/SpiceIO/EphemerisCache.h>
+
+using namespace vw;
+
+namespace {
+
+  const char STATE_MAGIC[8] = {'A','S','P','S','T','A','T','E'};
+  const int32 STATE_VERSION = 2;
+
+  // Followed by the bodies and kernels strings, each padded to 8
+  // bytes, and the samples.
+  struct StateCacheHeader {
+    char   magic[8];
+    int32  version;
+    int32  bodies_length;
+    int64  count;
+    double begin_time, interval;
+    int32  kernels_length;
+    int32  reserved;
+  };
+
+  size_t pad8(size_t n) { return (n + 7) & ~size_t(7); }
+
+  // Slerp between two unit quaternions stored as (w,x,y,z), taking the
+  // short way around. The angle comes from the component of b
+  // orthogonal to a, which stays accurate for closely spaced samples.
+  void slerp4(double const* a, double const* b, double s, double* out) {
+    double dot = a[0]*b[0] + a[1]*b[1] + a[2]*b[2] + a[3]*b[3];
+    double sign = dot < 0 ? -1.0 : 1.0;
+    dot *= sign;
+    double perp = 0;
+    for (int i = 0; i < 4; ++i) {
+      double d = sign*b[i] - dot*a[i];
+      perp += d*d;
+    }
+    double theta = atan2(sqrt(perp), dot);
+    double wa = 1.0 - s, wb = s;
+    if (theta > 1e-12) {
+      double st = sin(theta);
+      wa = sin((1.0 - s)*theta) / st;
+      wb = sin(s*theta) / st;
+    }
+    double norm = 0;
+    for (int i = 0; i < 4; ++i) {
+      out[i] = wa*a[i] + sign*wb*b[i];
+      norm += out[i]*out[i];
+    }
+    norm = sqrt(norm);
+    for (int i = 0; i < 4; ++i)
+      out[i] /= norm;
+  }
+
+}
+
+namespace asp {
+namespace spice {
+
+  MappedFile::MappedFile(std::string const& filename)
+    : m_fd(-1), m_data(0), m_size(0) {
+    m_fd = ::open(filename.c_str(), O_RDONLY);
+    if (m_fd < 0)
+      vw_throw(IOErr() << "MappedFile: Failed to open \"" << filename << "\": "
+               << strerror(errno));
+    struct stat st;
+    if (fstat(m_fd, &st) != 0 || st.st_size == 0) {
+      ::close(m_fd);
+      vw_throw(IOErr() << "MappedFile: \"" << filename << "\" is empty or unreadable.");
+    }
+    m_size = st.st_size;
+    m_data = mmap(0, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (m_data == MAP_FAILED) {
+      m_data = 0;
+      ::close(m_fd);
+      vw_throw(IOErr() << "MappedFile: Failed to map \"" << filename << "\": "
+               << strerror(errno));
+    }
+  }
+
+  MappedFile::~MappedFile() {
+    if (m_data)
+      munmap(m_data, m_size);
+    if (m_fd >= 0)
+      ::close(m_fd);
+  }
+
+  void write_file_atomic(std::string const& filename,
+                         std::vector<char> const& contents) {
+    std::string tmp = filename + ".tmp";
+    {
+      std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+      if (!out.is_open())
+        vw_throw(IOErr() << "Failed to open \"" << tmp << "\" for writing.");
+      out.write(&contents[0], contents.size());
+      if (!out.good())
+        vw_throw(IOErr() << "Failed to write \"" << tmp << "\".");
+    }
+    if (rename(tmp.c_str(), filename.c_str()) != 0) {
+      unlink(tmp.c_str());
+      vw_throw(IOErr() << "Failed to rename \"" << tmp << "\" to \"" << filename
+               << "\": " << strerror(errno));
+    }
+  }
+
+  BodyStateTable::BodyStateTable(double begin_time, double interval,
+                                 std::vector<Vector3> const& position,
+                                 std::vector<Vector3> const& velocity,
+                                 std::vector<Quaternion<double> > const& pose,
+                                 std::string const& bodies,
+                                 std::string const& kernels)
+    : m_begin_time(begin_time), m_interval(interval), m_size(position.size()),
+      m_bodies(bodies), m_kernels(kernels), m_offset(0) {
+    VW_ASSERT(interval > 0,
+              ArgumentErr() << "BodyStateTable: Sample interval must be positive.");
+    VW_ASSERT(m_size >= 2,
+              ArgumentErr() << "BodyStateTable: At least two samples are required.");
+    VW_ASSERT(velocity.size() == m_size && pose.size() == m_size,
+              ArgumentErr() << "BodyStateTable: Position, velocity and pose sizes differ.");
+
+    m_storage.resize(m_size*SAMPLE_DOUBLES);
+    for (size_t i = 0; i < m_size; ++i) {
+      double* s = &m_storage[i*SAMPLE_DOUBLES];
+      for (int j = 0; j < 3; ++j) {
+        s[j]   = position[i][j];
+        s[3+j] = velocity[i][j];
+      }
+      for (int j = 0; j < 4; ++j)
+        s[6+j] = pose[i][j];
+    }
+  }
+
+  BodyStateTable::BodyStateTable(std::string const& filename)
+    : m_file(new MappedFile(filename)) {
+    VW_ASSERT(m_file->size() >= sizeof(StateCacheHeader),
+              IOErr() << "BodyStateTable: \"" << filename << "\" is truncated.");
+    StateCacheHeader header;
+    memcpy(&header, m_file->data(), sizeof(header));
+    VW_ASSERT(memcmp(header.magic, STATE_MAGIC, sizeof(STATE_MAGIC)) == 0,
+              IOErr() << "BodyStateTable: \"" << filename << "\" is not a body state cache.");
+    VW_ASSERT(header.version == STATE_VERSION,
+              IOErr() << "BodyStateTable: \"" << filename << "\" has unsupported version "
+              << header.version << ".");
+    VW_ASSERT(header.count >= 2 && header.bodies_length >= 0 &&
+              header.kernels_length >= 0 && header.interval > 0,
+              IOErr() << "BodyStateTable: \"" << filename << "\" has a corrupt header.");
+
+    m_begin_time = header.begin_time;
+    m_interval   = header.interval;
+    m_size       = header.count;
+    size_t kernels_offset = sizeof(header) + pad8(header.bodies_length);
+    m_offset     = kernels_offset + pad8(header.kernels_length);
+    VW_ASSERT(m_file->size() >= m_offset + m_size*SAMPLE_DOUBLES*sizeof(double),
+              IOErr() << "BodyStateTable: \"" << filename << "\" is truncated.");
+    m_bodies.assign(m_file->data() + sizeof(header), header.bodies_length);
+    m_kernels.assign(m_file->data() + kernels_offset, header.kernels_length);
+  }
+
+  void BodyStateTable::write(std::string const& filename) const {
+    StateCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, STATE_MAGIC, sizeof(STATE_MAGIC));
+    header.version       = STATE_VERSION;
+    header.bodies_length = m_bodies.size();
+    header.count         = m_size;
+    header.begin_time    = m_begin_time;
+    header.interval      = m_interval;
+    header.kernels_length = m_kernels.size();
+
+    size_t kernels_offset = sizeof(header) + pad8(m_bodies.size());
+    size_t offset = kernels_offset + pad8(m_kernels.size());
+    size_t data_bytes = m_size*SAMPLE_DOUBLES*sizeof(double);
+    std::vector<char> contents(offset + data_bytes, 0);
+    memcpy(&contents[0], &header, sizeof(header));
+    if (!m_bodies.empty())
+      memcpy(&contents[sizeof(header)], m_bodies.data(), m_bodies.size());
+    if (!m_kernels.empty())
+      memcpy(&contents[kernels_offset], m_kernels.data(), m_kernels.size());
+    memcpy(&contents[offset], samples(), data_bytes);
+    write_file_atomic(filename, contents);
+  }
+
+  double const* BodyStateTable::samples() const {
+    if (m_file)
+      return reinterpret_cast<double const*>(m_file->data() + m_offset);
+    return &m_storage[0];
+  }
+
+  bool BodyStateTable::covers(double time) const {
+    double slack = 1e-9*m_interval;
+    return time >= m_begin_time - slack && time <= end_time() + slack;
+  }
+
+  void BodyStateTable::state(double time,
+                             Vector3 &position,
+                             Vector3 &velocity,
+                             Quaternion<double> &pose) const {
+    if (!covers(time))
+      vw_throw(ArgumentErr() << "BodyStateTable: Time " << time << " is outside of ["
+               << m_begin_time << ", " << end_time() << "].");
+
+    // Locate the knot interval, clamping so the last knot is usable.
+    double u = (time - m_begin_time) / m_interval;
+    double k = floor(u);
+    if (k < 0) k = 0;
+    if (k > double(m_size - 2)) k = double(m_size - 2);
+    size_t i = size_t(k);
+    double s = u - k;
+
+    double const* a = samples() + i*SAMPLE_DOUBLES;
+    double const* b = a + SAMPLE_DOUBLES;
+    double h = m_interval;
+
+    // Cubic Hermite basis and its derivative.
+    double s2 = s*s, s3 = s2*s;
+    double h00 = 2*s3 - 3*s2 + 1, h10 = s3 - 2*s2 + s;
+    double h01 = -2*s3 + 3*s2,    h11 = s3 - s2;
+    double d00 = 6*s2 - 6*s,      d10 = 3*s2 - 4*s + 1;
+    double d01 = -6*s2 + 6*s,     d11 = 3*s2 - 2*s;
+    for (int j = 0; j < 3; ++j) {
+      position[j] = h00*a[j] + h10*h*a[3+j] + h01*b[j] + h11*h*b[3+j];
+      velocity[j] = (d00*a[j] + d01*b[j]) / h + d10*a[3+j] + d11*b[3+j];
+    }
+
+    double q[4];
+    slerp4(a + 6, b + 6, s, q);
+    pose = Quaternion<double>(q[0], q[1], q[2], q[3]);
+  }
+
+  void BodyStateTable::state(std::vector<double> const& times,
+                             std::vector<Vector3> &position,
+                             std::vector<Vector3> &velocity,
+                             std::vector<Quaternion<double> > &pose) const {
+    position.resize(times.size());
+    velocity.resize(times.size());
+    pose.resize(times.size());
+    for (size_t i = 0; i < times.size(); ++i)
+      state(times[i], position[i], velocity[i], pose[i]);
+  }
+
+}} // namespace asp::spice
@@ -0,0 +1,113 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file EphemerisCache.h
+///
+/// Memory-mapped binary caches for SPICE derived data. A
+/// BodyStateTable holds the position, velocity and pose of a body
+/// sampled at a fixed interval and interpolates between the samples,
+/// so repeated state queries do not have to go back to the kernels.
+///
+
+#ifndef __ASP_SPICEIO_EPHEMERIS_CACHE_H__
+#define __ASP_SPICEIO_EPHEMERIS_CACHE_H__
+
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <vw/Math/Vector.h>
+#include <vw/Math/Quaternion.h>
+
+namespace asp {
+namespace spice {
+
+  /// A read-only memory mapping of a whole file.
+  class MappedFile : private boost::noncopyable {
+    int m_fd;
+    void* m_data;
+    size_t m_size;
+  public:
+    explicit MappedFile(std::string const& filename);
+    ~MappedFile();
+
+    char const* data() const { return static_cast<char const*>(m_data); }
+    size_t size() const { return m_size; }
+  };
+
+  /// Write a file through a temporary name and rename it into place,
+  /// so that a reader never maps a partially written cache.
+  void write_file_atomic(std::string const& filename,
+                         std::vector<char> const& contents);
+
+  /// Body states sampled at a fixed interval. Positions are
+  /// interpolated with cubic Hermite splines through the sampled
+  /// velocities and poses with spherical linear interpolation.
+  class BodyStateTable {
+  public:
+    /// Build a table from states sampled at begin_time + i*interval.
+    /// The bodies string identifies what was sampled, and the kernels
+    /// string the kernels it was sampled from. Both are stored with
+    /// the cache so a stale cache can be detected.
+    BodyStateTable(double begin_time, double interval,
+                   std::vector<vw::Vector3> const& position,
+                   std::vector<vw::Vector3> const& velocity,
+                   std::vector<vw::Quaternion<double> > const& pose,
+                   std::string const& bodies,
+                   std::string const& kernels = "");
+
+    /// Map a cache previously written with write().
+    explicit BodyStateTable(std::string const& filename);
+
+    void write(std::string const& filename) const;
+
+    double begin_time() const { return m_begin_time; }
+    double end_time() const { return m_begin_time + m_interval*double(m_size-1); }
+    double interval() const { return m_interval; }
+    size_t size() const { return m_size; }
+    std::string const& bodies() const { return m_bodies; }
+    std::string const& kernels() const { return m_kernels; }
+    bool covers(double time) const;
+
+    void state(double time,
+               vw::Vector3 &position,
+               vw::Vector3 &velocity,
+               vw::Quaternion<double> &pose) const;
+
+    void state(std::vector<double> const& times,
+               std::vector<vw::Vector3> &position,
+               std::vector<vw::Vector3> &velocity,
+               std::vector<vw::Quaternion<double> > &pose) const;
+
+  private:
+    // Each sample is position, velocity and pose (w,x,y,z).
+    enum { SAMPLE_DOUBLES = 10 };
+
+    double const* samples() const;
+
+    double m_begin_time, m_interval;
+    size_t m_size;
+    std::string m_bodies, m_kernels;
+    std::vector<double> m_storage;
+    boost::shared_ptr<MappedFile> m_file;
+    size_t m_offset;
+  };
+
+}} // namespace asp::spice
+
+#endif // __ASP_SPICEIO_EPHEMERIS_CACHE_H__
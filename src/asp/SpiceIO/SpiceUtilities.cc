@@ -26,13 +26,18 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <list>
 #include <string>
 
 #include <vw/Core/Exception.h>
 #include <vw/Core/Debugging.h>
 
+#include <boost/filesystem/operations.hpp>
+#include <algorithm>
+
 #include <string.h>
+#include <sys/stat.h>
 
 using namespace std;
 using namespace vw;
@@ -45,6 +50,9 @@ namespace spice {
 
   enum { LONG_MSG_LEN = 1840 };
 
+  // The longest kernel file name we record. SPICE allows 255 chars.
+  enum { FILE_NAME_LEN = 255 };
+
   void CHECK_SPICE_ERROR() {
     char longms[LONG_MSG_LEN + 1];
 
@@ -231,6 +239,100 @@ namespace spice {
     CHECK_SPICE_ERROR();
   }
 
+  // The kernels furnished so far, one per line with their size and
+  // modification time, so that a cache made from other kernels, or
+  // from kernels changed since, can be told apart.
+  std::string furnished_kernels() {
+    SpiceInt count = 0;
+    ktotal_c("ALL", &count);
+    CHECK_SPICE_ERROR();
+
+    std::ostringstream os;
+    for (SpiceInt i = 0; i < count; ++i) {
+      SpiceChar file[FILE_NAME_LEN + 1], type[33], source[FILE_NAME_LEN + 1];
+      SpiceInt handle;
+      SpiceBoolean found = SPICEFALSE;
+      kdata_c(i, "ALL", FILE_NAME_LEN + 1, 33, FILE_NAME_LEN + 1,
+              file, type, source, &handle, &found);
+      CHECK_SPICE_ERROR();
+      if (!found)
+        continue;
+      os << file;
+      struct stat st;
+      if (stat(file, &st) == 0)
+        os << " " << st.st_size << " " << st.st_mtime;
+      os << "\n";
+    }
+    return os.str();
+  }
+
+  BodyStateTable sample_body_state(double begin_time, double end_time, double interval,
+                                   std::string const& spacecraft,
+                                   std::string const& reference_frame,
+                                   std::string const& planet,
+                                   std::string const& instrument) {
+    VW_ASSERT(interval > 0, ArgumentErr() << "sample_body_state: Interval must be positive.");
+    VW_ASSERT(end_time >= begin_time,
+              ArgumentErr() << "sample_body_state: End time precedes begin time.");
+
+    // Place knots on both sides of the range so it is fully covered.
+    size_t count = std::max(size_t(2), size_t(ceil((end_time - begin_time) / interval)) + 1);
+    std::vector<Vector3> position(count), velocity(count);
+    std::vector<Quat> pose(count);
+    for (size_t i = 0; i < count; ++i)
+      body_state(begin_time + double(i)*interval, position[i], velocity[i], pose[i],
+                 spacecraft, reference_frame, planet, instrument);
+
+    return BodyStateTable(begin_time, interval, position, velocity, pose,
+                          spacecraft + "|" + reference_frame + "|" +
+                          planet + "|" + instrument, furnished_kernels());
+  }
+
+  void body_state(std::vector<double> const& times,
+                  std::vector<Vector3> &position,
+                  std::vector<Vector3> &velocity,
+                  std::vector<Quat> &pose,
+                  std::string const& spacecraft,
+                  std::string const& reference_frame,
+                  std::string const& planet,
+                  std::string const& instrument,
+                  double interval,
+                  std::string const& cache_file) {
+    if (times.empty()) {
+      position.clear();
+      velocity.clear();
+      pose.clear();
+      return;
+    }
+
+    double begin_time = *std::min_element(times.begin(), times.end());
+    double end_time   = *std::max_element(times.begin(), times.end());
+    std::string bodies = spacecraft + "|" + reference_frame + "|" +
+      planet + "|" + instrument;
+
+    if (!cache_file.empty() && boost::filesystem::exists(cache_file)) {
+      try {
+        BodyStateTable table(cache_file);
+        if (table.bodies() == bodies && table.kernels() == furnished_kernels() &&
+            table.interval() <= interval*(1 + 1e-9) &&
+            table.covers(begin_time) && table.covers(end_time)) {
+          vw_out(DebugMessage, "spice") << "Using body state cache " << cache_file << "\n";
+          table.state(times, position, velocity, pose);
+          return;
+        }
+      } catch (const IOErr& e) {
+        vw_out(WarningMessage, "spice") << "Ignoring body state cache: " << e.what() << "\n";
+      }
+    }
+
+    BodyStateTable table = sample_body_state(begin_time, end_time, interval,
+                                             spacecraft, reference_frame,
+                                             planet, instrument);
+    if (!cache_file.empty())
+      table.write(cache_file);
+    table.state(times, position, velocity, pose);
+  }
+
   // Load all relevent SPICE kernels.
   //
   // Someday, rather than hard coding these values, the user might be
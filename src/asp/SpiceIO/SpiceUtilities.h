@@ -28,6 +28,7 @@
 #include <vw/Core/Exception.h>
 #include <vw/Math/Vector.h>
 #include <vw/Math/Quaternion.h>
+#include <asp/SpiceIO/EphemerisCache.h>
 
 namespace asp {
 namespace spice {
@@ -43,6 +44,8 @@ namespace spice {
   // Function prototypes
   void load_kernels(std::list<std::string> &kernels);
   void load_kernels(std::string const& kernels_file, std::string const& prefix="");
+  /// The furnished kernels, one per line with their size and mtime.
+  std::string furnished_kernels();
   double sclk_to_et(std::string sclk, int naif_id);
   std::string et_to_utc(double ephemeris_time);
   double utc_to_et(std::string const& utc);
@@ -69,6 +72,30 @@ namespace spice {
                   std::string const& planet,
                   std::string const& instrument);
 
+  /// Sample the state of a body from begin_time through end_time so
+  /// that it can be interpolated anywhere in that range.
+  BodyStateTable sample_body_state(double begin_time, double end_time, double interval,
+                                   std::string const& spacecraft,
+                                   std::string const& reference_frame,
+                                   std::string const& planet,
+                                   std::string const& instrument);
+
+  /// Look up the state of a body at many times. The kernels are
+  /// sampled once every interval seconds over the span of the times
+  /// and the samples are interpolated. If cache_file is given, the
+  /// samples are read from it when it covers the span at the same or
+  /// a finer interval and written to it otherwise.
+  void body_state(std::vector<double> const& times,
+                  std::vector<vw::Vector3> &position,
+                  std::vector<vw::Vector3> &velocity,
+                  std::vector<vw::Quaternion<double> > &pose,
+                  std::string const& spacecraft,
+                  std::string const& reference_frame,
+                  std::string const& planet,
+                  std::string const& instrument,
+                  double interval,
+                  std::string const& cache_file = "");
+
 }} // namespace asp::spice
 
 #endif // __SPICE_H__
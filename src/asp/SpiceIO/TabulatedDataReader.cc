@@ -19,13 +19,40 @@
 /// \file TabulatedDataReader.cc
 ///
 
-#include <asp/SpiceIO/TabulatedDataReader.h>
-#include <boost/algorithm/string.hpp>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
 #include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+#include <asp/SpiceIO/TabulatedDataReader.h>
+#include <asp/SpiceIO/EphemerisCache.h>
 
 using namespace std;
+using namespace vw;
+
+namespace {
+
+  const char TABLE_MAGIC[8] = {'A','S','P','T','A','B','L','E'};
+  const int32 TABLE_VERSION = 1;
 
-#define LINE_MAXSIZE 4096
+  struct TableCacheHeader {
+    char  magic[8];
+    int32 version;
+    int32 delimeters_length;
+    int64 source_size, source_mtime;
+    int64 text_size, num_lines, num_fields;
+  };
+
+  size_t pad8(size_t n) { return (n + 7) & ~size_t(7); }
+
+  bool is_space(char c) { return isspace(static_cast<unsigned char>(c)) != 0; }
+
+}
 
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
 /*               TabulatedDataReader Class Methods               */
@@ -36,50 +63,217 @@ namespace asp {
 namespace spice {
 
   TabulatedDataReader::TabulatedDataReader( const std::string &filename,
-                                            const std::string &delimeters = ",") {
-    m_delimeters = delimeters;
+                                            const std::string &delimeters,
+                                            const std::string &cache_file )
+    : m_delimeters(delimeters), m_text(0), m_text_size(0), m_num_lines(0),
+      m_lines(0), m_line_fields(0), m_fields(0) {
+
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+      vw_throw(IOErr() << "Failed to open tabulated data record: " << filename << ".");
+
+    if (!cache_file.empty() && load_cache(cache_file, st.st_size, st.st_mtime))
+      return;
 
-    m_file.open(filename.c_str());
-    if ( !m_file.is_open() ) {
-      throw vw::IOErr() << "Failed to open tabulated data record: " << filename << ".";
+    parse(filename);
+
+    if (!cache_file.empty()) {
+      try {
+        write_cache(cache_file, st.st_size, st.st_mtime);
+      } catch (const IOErr& e) {
+        vw_out(WarningMessage, "spice") << "Could not write table cache "
+                                        << cache_file << ": " << e.what() << "\n";
+      }
     }
   }
 
+  void TabulatedDataReader::close() {
+    m_file.reset();
+    m_text_storage.clear();
+    m_index_storage.clear();
+    m_query_lines.clear();
+    m_text = 0;
+    m_text_size = m_num_lines = 0;
+    m_lines = m_line_fields = m_fields = 0;
+  }
+
+  // Read the whole table and record line and field boundaries in one pass.
+  void TabulatedDataReader::parse(std::string const& filename) {
+    ifstream file(filename.c_str(), ios::binary);
+    if ( !file.is_open() )
+      vw_throw(IOErr() << "Failed to open tabulated data record: " << filename << ".");
+    m_text_storage.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    VW_ASSERT(m_text_storage.size() < size_t(0xffffffffu),
+              IOErr() << "Tabulated data record is too large: " << filename << ".");
+
+    vector<uint32> lines, line_fields, fields;
+    bool is_delim[256];
+    for (int c = 0; c < 256; ++c)
+      is_delim[c] = false;
+    for (size_t i = 0; i < m_delimeters.size(); ++i)
+      is_delim[static_cast<unsigned char>(m_delimeters[i])] = true;
+
+    size_t size = m_text_storage.size();
+    char const* text = size ? &m_text_storage[0] : 0;
+    size_t begin = 0;
+    while (begin < size) {
+      size_t end = begin;
+      while (end < size && text[end] != '\n')
+        ++end;
+
+      lines.push_back(begin);
+      lines.push_back(end);
+      line_fields.push_back(fields.size() / 2);
+
+      // Split at every delimeter, keeping empty fields, then trim.
+      size_t field = begin;
+      while (true) {
+        size_t field_end = field;
+        while (field_end < end && !is_delim[static_cast<unsigned char>(text[field_end])])
+          ++field_end;
+        size_t b = field, e = field_end;
+        while (b < e && is_space(text[b]))
+          ++b;
+        while (e > b && is_space(text[e-1]))
+          --e;
+        fields.push_back(b);
+        fields.push_back(e);
+        if (field_end == end)
+          break;
+        field = field_end + 1;
+      }
+      begin = end + 1;
+    }
+    line_fields.push_back(fields.size() / 2);
+
+    m_num_lines = lines.size() / 2;
+    m_index_storage.reserve(lines.size() + line_fields.size() + fields.size());
+    m_index_storage.insert(m_index_storage.end(), lines.begin(), lines.end());
+    m_index_storage.insert(m_index_storage.end(), line_fields.begin(), line_fields.end());
+    m_index_storage.insert(m_index_storage.end(), fields.begin(), fields.end());
+
+    m_text = text;
+    m_text_size = size;
+    m_lines = &m_index_storage[0];
+    m_line_fields = m_lines + lines.size();
+    m_fields = m_line_fields + line_fields.size();
+  }
+
+  bool TabulatedDataReader::load_cache(std::string const& cache_file,
+                                       int64 source_size, int64 source_mtime) {
+    boost::shared_ptr<MappedFile> file;
+    try {
+      file.reset(new MappedFile(cache_file));
+    } catch (const IOErr&) {
+      return false;
+    }
+
+    TableCacheHeader header;
+    if (file->size() < sizeof(header))
+      return false;
+    memcpy(&header, file->data(), sizeof(header));
+    if (memcmp(header.magic, TABLE_MAGIC, sizeof(TABLE_MAGIC)) != 0 ||
+        header.version != TABLE_VERSION ||
+        header.source_size != source_size || header.source_mtime != source_mtime ||
+        header.delimeters_length != int32(m_delimeters.size()) ||
+        header.num_lines < 0 || header.num_fields < header.num_lines ||
+        header.text_size != source_size)
+      return false;
+
+    size_t delim_offset = sizeof(header);
+    size_t text_offset  = delim_offset + pad8(header.delimeters_length);
+    size_t index_offset = text_offset + pad8(header.text_size);
+    size_t index_count  = 2*header.num_lines + header.num_lines + 1 + 2*header.num_fields;
+    if (file->size() < index_offset + index_count*sizeof(uint32) ||
+        m_delimeters.compare(0, string::npos, file->data() + delim_offset,
+                             header.delimeters_length) != 0)
+      return false;
+
+    m_file = file;
+    m_text = m_file->data() + text_offset;
+    m_text_size = header.text_size;
+    m_num_lines = header.num_lines;
+    m_lines = reinterpret_cast<uint32 const*>(m_file->data() + index_offset);
+    m_line_fields = m_lines + 2*m_num_lines;
+    m_fields = m_line_fields + m_num_lines + 1;
+    vw_out(DebugMessage, "spice") << "Loaded table cache " << cache_file << "\n";
+    return true;
+  }
+
+  void TabulatedDataReader::write_cache(std::string const& cache_file,
+                                        int64 source_size, int64 source_mtime) const {
+    TableCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TABLE_MAGIC, sizeof(TABLE_MAGIC));
+    header.version           = TABLE_VERSION;
+    header.delimeters_length = m_delimeters.size();
+    header.source_size       = source_size;
+    header.source_mtime      = source_mtime;
+    header.text_size         = m_text_size;
+    header.num_lines         = m_num_lines;
+    header.num_fields        = m_line_fields[m_num_lines];
+
+    size_t text_offset  = sizeof(header) + pad8(m_delimeters.size());
+    size_t index_offset = text_offset + pad8(m_text_size);
+    size_t index_bytes  = m_index_storage.size()*sizeof(uint32);
+    vector<char> contents(index_offset + index_bytes, 0);
+    memcpy(&contents[0], &header, sizeof(header));
+    if (!m_delimeters.empty())
+      memcpy(&contents[sizeof(header)], m_delimeters.data(), m_delimeters.size());
+    if (m_text_size)
+      memcpy(&contents[text_offset], m_text, m_text_size);
+    if (index_bytes)
+      memcpy(&contents[index_offset], &m_index_storage[0], index_bytes);
+    write_file_atomic(cache_file, contents);
+  }
+
+  void TabulatedDataReader::line_fields(size_t line, std::vector<std::string> &result) const {
+    VW_ASSERT(line < m_num_lines,
+              ArgumentErr() << "TabulatedDataReader: Line " << line << " is out of range.");
+    result.clear();
+    for (uint32 f = m_line_fields[line]; f < m_line_fields[line+1]; ++f)
+      result.push_back(string(m_text + m_fields[2*f], m_text + m_fields[2*f+1]));
+  }
 
   // Returns 1 on success, 0 on failure
   int TabulatedDataReader::find_line_with_text(std::string query,
                                                std::vector<std::string> &result) {
-    // Reset file pointer to the top of the file
-    m_file.seekg(0);
-
-    int found = 0;
-    char line[LINE_MAXSIZE];
-
-    // Read through the lines until the search returns a match
-    while ( !found && !m_file.eof() ) {
-      m_file.getline(line, LINE_MAXSIZE);
-
-      // If the text is found, cut up this line using the delimeters
-      // and return true.
-      if(boost::find_first(line, query)) {
-        string str_line(line);
-        cout << str_line << endl;
-        boost::split( result, str_line, boost::is_any_of(m_delimeters) );
-        vector<string>::iterator iter = result.begin();
-
-        //      unsigned int c = 0;
-        for (iter = result.begin(); iter != result.end(); iter++) {
-          boost::trim(*iter);
-          //      cout << c << ":   " << *iter << "\n";
-          //      c++;
+    if (query.empty() || !m_text)
+      return 0;
+
+    int line = -1;
+    map<string, int>::const_iterator cached = m_query_lines.find(query);
+    if (cached != m_query_lines.end()) {
+      line = cached->second;
+    } else {
+      // Search the whole text and map the first match that does not
+      // straddle a line break back to its line.
+      char const* end = m_text + m_text_size;
+      char const* hit = m_text;
+      while ((hit = std::search(hit, end, query.begin(), query.end())) != end) {
+        size_t offset = hit - m_text;
+        // Line begin offsets are at even positions of m_lines.
+        size_t lo = 0, hi = m_num_lines;
+        while (hi - lo > 1) {
+          size_t mid = (lo + hi) / 2;
+          if (m_lines[2*mid] <= offset) lo = mid; else hi = mid;
         }
-        found = 1;
+        if (offset + query.size() <= m_lines[2*lo+1]) {
+          line = int(lo);
+          break;
+        }
+        ++hit;
       }
+      m_query_lines[query] = line;
     }
 
-    return found;
+    if (line < 0)
+      return 0;
+
+    vw_out(DebugMessage, "spice")
+      << string(m_text + m_lines[2*line], m_text + m_lines[2*line+1]) << "\n";
+    line_fields(line, result);
+    return 1;
   }
 
 }} //end namespace asp::spice
-
-
@@ -18,35 +18,80 @@
 
 /// \file TabulatedDataReader.h
 ///
+/// Reads delimited text tables such as the ephemeris records shipped
+/// with some missions. The table is read and split into fields once;
+/// queries search the in-memory text and are memoized. Optionally the
+/// parsed table is kept in a memory-mapped binary cache next to the
+/// source so later runs skip the parse entirely.
+///
+
+#ifndef __ASP_SPICEIO_TABULATED_DATA_READER_H__
+#define __ASP_SPICEIO_TABULATED_DATA_READER_H__
 
 #include <string>
 #include <vector>
-#include <iostream>
-#include <fstream>
+#include <map>
+#include <boost/shared_ptr.hpp>
+#include <vw/Core/FundamentalTypes.h>
 
 namespace asp {
 namespace spice {
 
+  class MappedFile;
+
   class TabulatedDataReader {
   public:
     /* Constructor / Destructor */
-    TabulatedDataReader( const std::string &filename, const std::string &delimeters);
+
+    /// If cache_file is not empty, the parsed table is loaded from it
+    /// when it is up to date with the source and delimeters, and
+    /// written to it otherwise.
+    TabulatedDataReader( const std::string &filename,
+                         const std::string &delimeters = ",",
+                         const std::string &cache_file = "" );
     ~TabulatedDataReader() { close(); }
 
-    void close() {
-      if (m_file.is_open()) {
-        m_file.close();
-      }
-    }
+    void close();
 
     /* Accessors */
+
+    /// Finds the first line containing query and splits it into
+    /// trimmed fields. Returns 1 on success, 0 on failure.
     int find_line_with_text(std::string query,
                             std::vector<std::string> &result);
 
+    size_t num_lines() const { return m_num_lines; }
+    void line_fields(size_t line, std::vector<std::string> &result) const;
+
+    /// True if the table came from the binary cache.
+    bool loaded_from_cache() const { return bool(m_file); }
+
   private:
+    void parse(std::string const& filename);
+    bool load_cache(std::string const& cache_file,
+                    vw::int64 source_size, vw::int64 source_mtime);
+    void write_cache(std::string const& cache_file,
+                     vw::int64 source_size, vw::int64 source_mtime) const;
+
     std::string m_delimeters;
 
-    std::ifstream m_file;
+    // The table is either owned in the vectors below or mapped from
+    // the cache; the pointers refer to whichever holds it. Lines are
+    // [begin,end) offsets into the text, m_line_fields[i] is the index
+    // of the first field of line i and fields are trimmed [begin,end)
+    // offsets.
+    std::vector<char> m_text_storage;
+    std::vector<vw::uint32> m_index_storage;
+    boost::shared_ptr<MappedFile> m_file;
+    char const* m_text;
+    size_t m_text_size, m_num_lines;
+    vw::uint32 const* m_lines;
+    vw::uint32 const* m_line_fields;
+    vw::uint32 const* m_fields;
+
+    std::map<std::string, int> m_query_lines;
   };
 
 }} // end namespace asp::spice
+
+#endif // __ASP_SPICEIO_TABULATED_DATA_READER_H__
@@ -0,0 +1,127 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/SpiceIO/EphemerisCache.h>
+
+#include <cmath>
+
+using namespace vw;
+using namespace asp::spice;
+
+namespace {
+
+  // A circular equatorial orbit with the body rotating once per orbit.
+  const double RADIUS = 3.4e6;
+  const double RATE   = 2*M_PI / 7000.0;
+
+  void orbit(double t, Vector3& position, Vector3& velocity, Quaternion<double>& pose) {
+    double a = RATE*t;
+    position = Vector3(RADIUS*cos(a), RADIUS*sin(a), 0);
+    velocity = Vector3(-RADIUS*RATE*sin(a), RADIUS*RATE*cos(a), 0);
+    pose = Quaternion<double>(cos(a/2), 0, 0, sin(a/2));
+  }
+
+  BodyStateTable sample_orbit(double begin_time, double interval, size_t count) {
+    std::vector<Vector3> position(count), velocity(count);
+    std::vector<Quaternion<double> > pose(count);
+    for (size_t i = 0; i < count; ++i)
+      orbit(begin_time + i*interval, position[i], velocity[i], pose[i]);
+    return BodyStateTable(begin_time, interval, position, velocity, pose,
+                          "MRO|IAU_MARS|MARS|MRO_HIRISE",
+                          "mro_psp.bsp 104857600 1325376000\nmro_sc_psp.bc 2097152 1325376000\n");
+  }
+
+}
+
+TEST(EphemerisCache, Interpolation) {
+  BodyStateTable table = sample_orbit(1000, 10, 101);
+  EXPECT_EQ( 101u, table.size() );
+  EXPECT_DOUBLE_EQ( 2000, table.end_time() );
+  EXPECT_TRUE( table.covers(2000) );
+  EXPECT_FALSE( table.covers(999) );
+
+  std::vector<double> times;
+  for (double t = 1000; t <= 2000; t += 3.7)
+    times.push_back(t);
+  times.push_back(2000);
+
+  std::vector<Vector3> position, velocity;
+  std::vector<Quaternion<double> > pose;
+  table.state(times, position, velocity, pose);
+  ASSERT_EQ( times.size(), position.size() );
+
+  for (size_t i = 0; i < times.size(); ++i) {
+    Vector3 p, v;
+    Quaternion<double> q;
+    orbit(times[i], p, v, q);
+    for (int j = 0; j < 3; ++j) {
+      EXPECT_NEAR( p[j], position[i][j], 1e-3 );
+      EXPECT_NEAR( v[j], velocity[i][j], 1e-4 );
+    }
+    for (int j = 0; j < 4; ++j)
+      EXPECT_NEAR( q[j], pose[i][j], 1e-12 );
+  }
+
+  Vector3 p, v;
+  Quaternion<double> q;
+  EXPECT_THROW( table.state(2001, p, v, q), ArgumentErr );
+}
+
+TEST(EphemerisCache, ShortestRotation) {
+  // The same rotation with opposite signs must not interpolate the
+  // long way around.
+  std::vector<Vector3> position(2), velocity(2);
+  std::vector<Quaternion<double> > pose(2);
+  pose[0] = Quaternion<double>(1, 0, 0, 0);
+  pose[1] = Quaternion<double>(-cos(0.05), 0, 0, -sin(0.05));
+  BodyStateTable table(0, 1, position, velocity, pose, "");
+
+  Vector3 p, v;
+  Quaternion<double> q;
+  table.state(0.5, p, v, q);
+  EXPECT_NEAR( 1, fabs(q[0]*cos(0.025) + q[3]*sin(0.025)), 1e-12 );
+}
+
+TEST(EphemerisCache, RoundTrip) {
+  UnlinkName file("orbit.cache");
+  BodyStateTable table = sample_orbit(-50, 0.5, 37);
+  table.write(file);
+
+  BodyStateTable mapped(file);
+  EXPECT_EQ( table.size(), mapped.size() );
+  EXPECT_EQ( table.begin_time(), mapped.begin_time() );
+  EXPECT_EQ( table.interval(), mapped.interval() );
+  EXPECT_EQ( table.bodies(), mapped.bodies() );
+  EXPECT_EQ( table.kernels(), mapped.kernels() );
+
+  for (double t = -50; t <= -32; t += 0.3) {
+    Vector3 p1, v1, p2, v2;
+    Quaternion<double> q1, q2;
+    table.state(t, p1, v1, q1);
+    mapped.state(t, p2, v2, q2);
+    for (int j = 0; j < 3; ++j) {
+      EXPECT_EQ( p1[j], p2[j] );
+      EXPECT_EQ( v1[j], v2[j] );
+    }
+    for (int j = 0; j < 4; ++j)
+      EXPECT_EQ( q1[j], q2[j] );
+  }
+
+  EXPECT_THROW( BodyStateTable("ephemeris.csv"), IOErr );
+}
@@ -0,0 +1,98 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/SpiceIO/TabulatedDataReader.h>
+
+#include <fstream>
+
+using namespace vw;
+using namespace asp::spice;
+
+TEST(TabulatedDataReader, FindLine) {
+  TabulatedDataReader reader("ephemeris.csv", ",");
+  EXPECT_FALSE( reader.loaded_from_cache() );
+  EXPECT_EQ( 6u, reader.num_lines() );
+
+  std::vector<std::string> fields;
+  ASSERT_EQ( 1, reader.find_line_with_text("SCLK_0001", fields) );
+  ASSERT_EQ( 5u, fields.size() );
+  EXPECT_EQ( "SCLK_0001", fields[0] );
+  EXPECT_EQ( "110.5", fields[1] );
+  EXPECT_EQ( "86.3", fields[3] );
+  EXPECT_EQ( "0.0", fields[4] );
+
+  // Empty fields are kept and the first matching line wins, even when
+  // the text also appears later in the table.
+  ASSERT_EQ( 1, reader.find_line_with_text("SCLK_0003", fields) );
+  ASSERT_EQ( 5u, fields.size() );
+  EXPECT_EQ( "", fields[1] );
+  EXPECT_EQ( "3386.3", fields[2] );
+
+  // Repeated queries are answered from the memo.
+  ASSERT_EQ( 1, reader.find_line_with_text("SCLK_0003", fields) );
+  EXPECT_EQ( "SCLK_0003", fields[0] );
+
+  EXPECT_EQ( 0, reader.find_line_with_text("SCLK_0004", fields) );
+  EXPECT_EQ( 0, reader.find_line_with_text("", fields) );
+  // A match must lie within a single line.
+  EXPECT_EQ( 0, reader.find_line_with_text("0.0\nSCLK", fields) );
+}
+
+TEST(TabulatedDataReader, BinaryCache) {
+  UnlinkName cache("ephemeris.csv.cache");
+  std::vector<std::string> expected, fields;
+  {
+    TabulatedDataReader reader("ephemeris.csv", ",", cache);
+    EXPECT_FALSE( reader.loaded_from_cache() );
+    ASSERT_EQ( 1, reader.find_line_with_text("SCLK_0002", expected) );
+  }
+
+  TabulatedDataReader reader("ephemeris.csv", ",", cache);
+  EXPECT_TRUE( reader.loaded_from_cache() );
+  EXPECT_EQ( 6u, reader.num_lines() );
+  ASSERT_EQ( 1, reader.find_line_with_text("SCLK_0002", fields) );
+  EXPECT_EQ( expected, fields );
+  EXPECT_EQ( 0, reader.find_line_with_text("SCLK_0004", fields) );
+
+  // A cache made with other delimeters is not reused.
+  TabulatedDataReader other("ephemeris.csv", ", ", cache);
+  EXPECT_FALSE( other.loaded_from_cache() );
+}
+
+TEST(TabulatedDataReader, StaleCache) {
+  UnlinkName table("stale.csv");
+  UnlinkName cache("stale.csv.cache");
+  {
+    std::ofstream out(table.c_str());
+    out << "A,1\nB,2\n";
+  }
+  {
+    TabulatedDataReader reader(table, ",", cache);
+    EXPECT_FALSE( reader.loaded_from_cache() );
+  }
+  {
+    std::ofstream out(table.c_str());
+    out << "A,1\nB,2\nC,3\n";
+  }
+  TabulatedDataReader reader(table, ",", cache);
+  EXPECT_FALSE( reader.loaded_from_cache() );
+  std::vector<std::string> fields;
+  ASSERT_EQ( 1, reader.find_line_with_text("C", fields) );
+  EXPECT_EQ( "3", fields[1] );
+}
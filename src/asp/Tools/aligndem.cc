@@ -16,6 +16,7 @@
 // __END_LICENSE__
 
 
+#include <vw/Core/ThreadPool.h>
 #include <vw/FileIO.h>
 #include <vw/Image.h>
 #include <vw/Cartography.h>
@@ -26,9 +27,13 @@
 #include <asp/ControlNetTK/Equalization.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/Macros.h>
+#include <asp/Core/IterativeClosestPoint.h>
+#include <cmath>
 #include <limits>
 
 #include <boost/filesystem.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
 namespace fs = boost::filesystem;
 namespace po = boost::program_options;
 
@@ -153,6 +158,12 @@ struct Options : public asp::BaseOptions {
   double dem1_nodata, dem2_nodata;
   size_t max_points;
 
+  // Settings
+  string alignment_method;
+  size_t icp_source_points, icp_reference_points;
+  int icp_levels, icp_iterations;
+  double icp_max_displacement;
+
   // Output
   string output_prefix;
 };
@@ -162,6 +173,12 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   general_options.add_options()
     ("max-match-points", po::value(&opt.max_points)->default_value(800), "The max number of points that will be enforced after matching.")
     ("default-value", po::value(&opt.dem1_nodata), "The value of missing pixels in the first dem")
+    ("alignment-method", po::value(&opt.alignment_method)->default_value("ip"), "How to align the dems. [ip, icp]. ip matches interest points between the orthoimages, icp aligns the dem surfaces directly and needs no orthoimages.")
+    ("icp-source-points", po::value(&opt.icp_source_points)->default_value(1000000), "The number of points of the first dem aligned by icp.")
+    ("icp-reference-points", po::value(&opt.icp_reference_points)->default_value(4000000), "The number of points of the second dem they are aligned to.")
+    ("icp-levels", po::value(&opt.icp_levels)->default_value(3), "The number of coarse to fine levels of icp. Each coarser level uses a quarter of the points.")
+    ("icp-iterations", po::value(&opt.icp_iterations)->default_value(20), "The max number of icp iterations at each level.")
+    ("icp-max-displacement", po::value(&opt.icp_max_displacement)->default_value(0), "Ignore points farther than this from the second dem, in meters. 0 means no limit.")
     ("output-prefix,o", po::value(&opt.output_prefix), "Specify the output prefix.");
   general_options.add( asp::BaseOptionsDescription(opt) );
 
@@ -178,30 +195,277 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   positional_desc.add("dem2", 1);
   positional_desc.add("ortho2", 1);
 
-  std::string usage("<dem1> <ortho1> <dem2> <ortho2>");
+  std::string usage("<dem1> <ortho1> <dem2> <ortho2>\n  or: --alignment-method icp <dem1> <dem2>");
   po::variables_map vm =
     asp::check_command_line( argc, argv, opt, general_options, general_options,
                              positional, positional_desc, usage );
 
-  if ( opt.dem1_name.empty() || opt.dem2_name.empty() ||
-       opt.ortho1_name.empty() || opt.ortho2_name.empty() )
-    vw_throw( ArgumentErr() << "Missing input files.\n"
+  if ( opt.alignment_method == "icp" ) {
+    // Only two dems are given, the second one lands in ortho1
+    if ( opt.dem2_name.empty() && opt.ortho2_name.empty() ) {
+      opt.dem2_name = opt.ortho1_name;
+      opt.ortho1_name.clear();
+    }
+    if ( opt.dem1_name.empty() || opt.dem2_name.empty() )
+      vw_throw( ArgumentErr() << "Missing input files.\n"
+                << usage << general_options );
+    if ( opt.icp_source_points < 1 || opt.icp_reference_points < 1 ||
+         opt.icp_levels < 1 || opt.icp_iterations < 1 || opt.icp_max_displacement < 0 )
+      vw_throw( ArgumentErr() << "The icp point counts, levels and iterations must be positive.\n"
+                << usage << general_options );
+  } else if ( opt.alignment_method == "ip" ) {
+    if ( opt.dem1_name.empty() || opt.dem2_name.empty() ||
+         opt.ortho1_name.empty() || opt.ortho2_name.empty() )
+      vw_throw( ArgumentErr() << "Missing input files.\n"
+                << usage << general_options );
+  } else {
+    vw_throw( ArgumentErr() << "Unknown alignment method: " << opt.alignment_method << "\n"
               << usage << general_options );
+  }
   if ( opt.output_prefix.empty() )
     opt.output_prefix = change_extension(fs::path(opt.dem1_name), "").string();
 }
 
+// Align DEM1 to DEM2 through matched interest points of their
+// orthoimages, with RANSAC rejecting the bad matches.
+Matrix<double> ip_alignment( Options const& opt, size_t& num_inliers ) {
+  DiskImageResourceGDAL ortho1_rsrc(opt.ortho1_name), ortho2_rsrc(opt.ortho2_name),
+    dem1_rsrc(opt.dem1_name), dem2_rsrc(opt.dem2_name);
+
+  typedef DiskImageView<double> dem_type;
+  dem_type dem1_dmg(opt.dem1_name), dem2_dmg(opt.dem2_name);
+
+  typedef InterpolationView<EdgeExtensionView<dem_type, ConstantEdgeExtension>, BilinearInterpolation> bilinear_type;
+  typedef InterpolationView<EdgeExtensionView<dem_type, ConstantEdgeExtension>, NearestPixelInterpolation> nearest_type;
+  bilinear_type dem1_interp =
+    interpolate(dem1_dmg, BilinearInterpolation(), ConstantEdgeExtension());
+  bilinear_type dem2_interp =
+    interpolate(dem2_dmg, BilinearInterpolation(), ConstantEdgeExtension());
+  nearest_type dem1_nearest =
+    interpolate(dem1_dmg, NearestPixelInterpolation(), ConstantEdgeExtension());
+  nearest_type dem2_nearest =
+    interpolate(dem2_dmg, NearestPixelInterpolation(), ConstantEdgeExtension());
+
+  GeoReference ortho1_georef, ortho2_georef, dem1_georef, dem2_georef;
+  read_georeference(ortho1_georef, ortho1_rsrc);
+  read_georeference(ortho2_georef, ortho2_rsrc);
+  read_georeference(dem1_georef, dem1_rsrc);
+  read_georeference(dem2_georef, dem2_rsrc);
+
+  std::vector<InterestPoint> matched_ip1, matched_ip2;
+
+  match_orthoimages(opt.output_prefix,
+                    opt.ortho1_name, opt.ortho2_name,
+                    matched_ip1, matched_ip2, opt.max_points);
+
+  vw_out() << "\t--> Rejecting outliers using RANSAC.\n";
+  std::vector<Vector4> ransac_ip1, ransac_ip2;
+  for (size_t i = 0; i < matched_ip1.size(); i++) {
+    Vector2 point1 = ortho1_georef.pixel_to_lonlat(Vector2(matched_ip1[i].x, matched_ip1[i].y));
+    Vector2 point2 = ortho2_georef.pixel_to_lonlat(Vector2(matched_ip2[i].x, matched_ip2[i].y));
+
+    Vector2 dem_pixel1 = dem1_georef.lonlat_to_pixel(point1);
+    Vector2 dem_pixel2 = dem2_georef.lonlat_to_pixel(point2);
+
+    if ( dem1_nearest(dem_pixel1.x(),dem_pixel1.y()) != opt.dem1_nodata &&
+         dem2_nearest(dem_pixel2.x(),dem_pixel2.y()) != opt.dem2_nodata ) {
+
+      double alt1 = dem1_georef.datum().radius(point1.x(), point1.y()) + dem1_interp(dem_pixel1.x(), dem_pixel1.y());
+      double alt2 = dem2_georef.datum().radius(point2.x(), point2.y()) + dem2_interp(dem_pixel2.x(), dem_pixel2.y());
+
+      Vector3 xyz1 = lon_lat_radius_to_xyz(Vector3(point1.x(), point1.y(), alt1));
+      Vector3 xyz2 = lon_lat_radius_to_xyz(Vector3(point2.x(), point2.y(), alt2));
+
+      ransac_ip1.push_back(Vector4(xyz1.x(), xyz1.y(), xyz1.z(), 1));
+      ransac_ip2.push_back(Vector4(xyz2.x(), xyz2.y(), xyz2.z(), 1));
+    } else {
+      vw_out() << "Actually dropped something.\n";
+    }
+  }
+
+  std::vector<size_t> indices;
+  Matrix<double> trans;
+  math::RandomSampleConsensus<math::AffineFittingFunctorN<3>,math::L2NormErrorMetric>
+    ransac( math::AffineFittingFunctorN<3>(), math::L2NormErrorMetric(), 100, 10, ransac_ip1.size()/2, true);
+  trans = ransac(ransac_ip1, ransac_ip2);
+  indices = ransac.inlier_indices(trans, ransac_ip1, ransac_ip2);
+
+  vw_out() << "\t    * Ransac Result: " << trans << "\n";
+  vw_out() << "\t                     # inliers: " << indices.size() << "\n";
+
+  num_inliers = indices.size();
+  return trans;
+}
+
+namespace asp {
+
+  // Samples one block of a DEM every 'step' pixels, on a grid shared
+  // by all blocks, as cartesian points. If normals are asked for, each
+  // comes from the neighbors 'step' pixels away, and points without
+  // all four of them are dropped.
+  class DemSampleTask : public Task, private boost::noncopyable {
+    ImageViewRef<PixelMask<double> > m_dem;
+    GeoReference m_georef;
+    BBox2i m_bbox;
+    int32 m_step;
+    bool m_with_normals;
+    std::vector<Vector3> m_points, m_normals;
+    Mutex& m_mutex;
+    const ProgressCallback& m_progress;
+    float m_inc_amt;
+
+    Vector3 to_xyz( int32 col, int32 row, double height ) const {
+      Vector2 lonlat = m_georef.pixel_to_lonlat( Vector2(col, row) );
+      return lon_lat_radius_to_xyz( Vector3( lonlat.x(), lonlat.y(),
+                                             m_georef.datum().radius( lonlat.x(), lonlat.y() ) + height ) );
+    }
+
+  public:
+    DemSampleTask( ImageViewRef<PixelMask<double> > const& dem, GeoReference const& georef,
+                   BBox2i const& bbox, int32 step, bool with_normals,
+                   Mutex& mutex, const ProgressCallback& progress, float inc_amt ) :
+      m_dem(dem), m_georef(georef), m_bbox(bbox), m_step(step), m_with_normals(with_normals),
+      m_mutex(mutex), m_progress(progress), m_inc_amt(inc_amt) {}
+
+    std::vector<Vector3> const& points() const { return m_points; }
+    std::vector<Vector3> const& normals() const { return m_normals; }
+
+    void operator()() {
+      BBox2i read_box = m_bbox;
+      if ( m_with_normals ) {
+        read_box.expand( m_step );
+        read_box.crop( bounding_box(m_dem) );
+      }
+      ImageView<PixelMask<double> > dem = crop( m_dem, read_box );
+
+      int32 col0 = m_step * ((m_bbox.min().x() + m_step - 1) / m_step);
+      int32 row0 = m_step * ((m_bbox.min().y() + m_step - 1) / m_step);
+      for ( int32 row = row0; row < m_bbox.max().y(); row += m_step ) {
+        for ( int32 col = col0; col < m_bbox.max().x(); col += m_step ) {
+          int32 c = col - read_box.min().x(), r = row - read_box.min().y();
+          if ( !is_valid(dem(c, r)) )
+            continue;
+          if ( !m_with_normals ) {
+            m_points.push_back( to_xyz( col, row, dem(c, r).child() ) );
+            continue;
+          }
+
+          if ( c < m_step || r < m_step ||
+               c + m_step >= dem.cols() || r + m_step >= dem.rows() )
+            continue;
+          PixelMask<double> const& west  = dem(c - m_step, r);
+          PixelMask<double> const& east  = dem(c + m_step, r);
+          PixelMask<double> const& north = dem(c, r - m_step);
+          PixelMask<double> const& south = dem(c, r + m_step);
+          if ( !is_valid(west) || !is_valid(east) || !is_valid(north) || !is_valid(south) )
+            continue;
+          Vector3 normal =
+            cross_prod( to_xyz( col + m_step, row, east.child() ) - to_xyz( col - m_step, row, west.child() ),
+                        to_xyz( col, row + m_step, south.child() ) - to_xyz( col, row - m_step, north.child() ) );
+          if ( norm_2(normal) == 0 )
+            continue;
+          m_points.push_back( to_xyz( col, row, dem(c, r).child() ) );
+          m_normals.push_back( normalize(normal) );
+        }
+      }
+
+      Mutex::Lock lock(m_mutex);
+      m_progress.report_incremental_progress(m_inc_amt);
+    }
+  };
+
+  // About 'num_points' samples of a DEM, read block by block in
+  // parallel. The points keep the block order, so they do not depend
+  // on the thread timing.
+  void sample_dem( std::string const& dem_name, double nodata, size_t num_points,
+                   bool with_normals, Options const& opt,
+                   std::vector<Vector3>& points, std::vector<Vector3>& normals ) {
+    DiskImageView<double> dem_dmg(dem_name);
+    GeoReference georef;
+    read_georeference(georef, dem_name);
+    ImageViewRef<PixelMask<double> > dem = create_mask(dem_dmg, nodata);
+
+    double num_pixels = double(dem.cols()) * double(dem.rows());
+    int32 step = std::max( 1, int32( std::ceil( std::sqrt( num_pixels / double(num_points) ) ) ) );
+    vw_out() << "\t--> Sampling " << dem_name << " every " << step << " pixels.\n";
+
+    std::vector<BBox2i> blocks = image_blocks( dem, opt.raster_tile_size[0] * 4,
+                                               opt.raster_tile_size[1] * 4 );
+    std::vector<boost::shared_ptr<DemSampleTask> > tasks;
+    Mutex mutex;
+    TerminalProgressCallback progress("asp", "\t    Sampling: ");
+    float inc_amt = 1.0 / float(blocks.size());
+    FifoWorkQueue queue( vw_settings().default_num_threads() );
+    for ( size_t i = 0; i < blocks.size(); i++ ) {
+      boost::shared_ptr<DemSampleTask>
+        task( new DemSampleTask( dem, georef, blocks[i], step, with_normals,
+                                 mutex, progress, inc_amt ) );
+      tasks.push_back( task );
+      queue.add_task( task );
+    }
+    queue.join_all();
+    progress.report_finished();
+
+    points.clear();
+    normals.clear();
+    for ( size_t i = 0; i < tasks.size(); i++ ) {
+      points.insert( points.end(), tasks[i]->points().begin(), tasks[i]->points().end() );
+      normals.insert( normals.end(), tasks[i]->normals().begin(), tasks[i]->normals().end() );
+    }
+    vw_out() << "\t    * " << points.size() << " points.\n";
+  }
+
+}
+
+// Align DEM1 to DEM2 by point-to-plane ICP of their surfaces, coarse
+// to fine: each coarser level aligns a quarter of the points of the
+// next one, and seeds it.
+Matrix<double> icp_alignment( Options const& opt, size_t& num_inliers ) {
+  std::vector<Vector3> source, reference, normals, unused;
+  asp::sample_dem( opt.dem1_name, opt.dem1_nodata, opt.icp_source_points, false, opt,
+                   source, unused );
+  asp::sample_dem( opt.dem2_name, opt.dem2_nodata, opt.icp_reference_points, true, opt,
+                   reference, normals );
+  if ( source.empty() || reference.empty() )
+    vw_throw( ArgumentErr() << "No valid points to align in the input dems.\n" );
+
+  vw_out() << "\t--> Building the kd-tree of " << reference.size() << " points.\n";
+  asp::PointToPlaneICP icp( reference, normals );
+
+  asp::ICPOptions icp_opt;
+  icp_opt.max_iterations = opt.icp_iterations;
+  if ( opt.icp_max_displacement > 0 )
+    icp_opt.max_distance = opt.icp_max_displacement;
+
+  asp::ICPResult result;
+  result.transform = math::identity_matrix<4>();
+  for ( int level = opt.icp_levels - 1; level >= 0; level-- ) {
+    size_t stride = size_t(1) << (2 * level);
+    std::vector<Vector3> level_source;
+    for ( size_t i = 0; i < source.size(); i += stride )
+      level_source.push_back( source[i] );
+
+    result = icp.align( level_source, result.transform, icp_opt );
+    vw_out() << "\t--> ICP level " << level << ": " << level_source.size() << " points, "
+             << result.iterations << " iterations, " << result.num_inliers << " inliers, "
+             << "RMS " << result.rms << " m\n";
+  }
+
+  vw_out() << "\t    * ICP Result: " << result.transform << "\n";
+  num_inliers = result.num_inliers;
+  return result.transform;
+}
+
 int main( int argc, char *argv[] ) {
 
   Options opt;
   try {
     handle_arguments( argc, argv, opt );
 
-    DiskImageResourceGDAL ortho1_rsrc(opt.ortho1_name), ortho2_rsrc(opt.ortho2_name),
-      dem1_rsrc(opt.dem1_name), dem2_rsrc(opt.dem2_name);
+    DiskImageResourceGDAL dem1_rsrc(opt.dem1_name), dem2_rsrc(opt.dem2_name);
 
     // Pull out dem nodatas
-    if ( opt.dem1_nodata == std::numeric_limits<double>::quiet_NaN() &&
+    if ( std::isnan(opt.dem1_nodata) &&
          dem1_rsrc.has_nodata_read() ) {
       opt.dem1_nodata = dem1_rsrc.nodata_read();
       vw_out() << "\tFound DEM1 input nodata value: "
@@ -216,76 +480,25 @@ int main( int argc, char *argv[] ) {
       opt.dem2_nodata = opt.dem1_nodata;
     }
 
-    typedef DiskImageView<double> dem_type;
-    dem_type dem1_dmg(opt.dem1_name), dem2_dmg(opt.dem2_name);
-
-    typedef InterpolationView<EdgeExtensionView<dem_type, ConstantEdgeExtension>, BilinearInterpolation> bilinear_type;
-    typedef InterpolationView<EdgeExtensionView<dem_type, ConstantEdgeExtension>, NearestPixelInterpolation> nearest_type;
-    bilinear_type dem1_interp =
-      interpolate(dem1_dmg, BilinearInterpolation(), ConstantEdgeExtension());
-    bilinear_type dem2_interp =
-      interpolate(dem2_dmg, BilinearInterpolation(), ConstantEdgeExtension());
-    nearest_type dem1_nearest =
-      interpolate(dem1_dmg, NearestPixelInterpolation(), ConstantEdgeExtension());
-    nearest_type dem2_nearest =
-      interpolate(dem2_dmg, NearestPixelInterpolation(), ConstantEdgeExtension());
-
-    GeoReference ortho1_georef, ortho2_georef, dem1_georef, dem2_georef;
-    read_georeference(ortho1_georef, ortho1_rsrc);
-    read_georeference(ortho2_georef, ortho2_rsrc);
-    read_georeference(dem1_georef, dem1_rsrc);
-    read_georeference(dem2_georef, dem2_rsrc);
-
-    std::vector<InterestPoint> matched_ip1, matched_ip2;
-
-    match_orthoimages(opt.output_prefix,
-                      opt.ortho1_name, opt.ortho2_name,
-                      matched_ip1, matched_ip2, opt.max_points);
-
-    vw_out() << "\t--> Rejecting outliers using RANSAC.\n";
-    std::vector<Vector4> ransac_ip1, ransac_ip2;
-    for (size_t i = 0; i < matched_ip1.size(); i++) {
-      Vector2 point1 = ortho1_georef.pixel_to_lonlat(Vector2(matched_ip1[i].x, matched_ip1[i].y));
-      Vector2 point2 = ortho2_georef.pixel_to_lonlat(Vector2(matched_ip2[i].x, matched_ip2[i].y));
-
-      Vector2 dem_pixel1 = dem1_georef.lonlat_to_pixel(point1);
-      Vector2 dem_pixel2 = dem2_georef.lonlat_to_pixel(point2);
-
-      if ( dem1_nearest(dem_pixel1.x(),dem_pixel1.y()) != opt.dem1_nodata &&
-           dem2_nearest(dem_pixel2.x(),dem_pixel2.y()) != opt.dem2_nodata ) {
-
-        double alt1 = dem1_georef.datum().radius(point1.x(), point1.y()) + dem1_interp(dem_pixel1.x(), dem_pixel1.y());
-        double alt2 = dem2_georef.datum().radius(point2.x(), point2.y()) + dem2_interp(dem_pixel2.x(), dem_pixel2.y());
-
-        Vector3 xyz1 = lon_lat_radius_to_xyz(Vector3(point1.x(), point1.y(), alt1));
-        Vector3 xyz2 = lon_lat_radius_to_xyz(Vector3(point2.x(), point2.y(), alt2));
-
-        ransac_ip1.push_back(Vector4(xyz1.x(), xyz1.y(), xyz1.z(), 1));
-        ransac_ip2.push_back(Vector4(xyz2.x(), xyz2.y(), xyz2.z(), 1));
-      } else {
-        vw_out() << "Actually dropped something.\n";
-      }
-    }
-
-    std::vector<size_t> indices;
+    size_t num_inliers;
     Matrix<double> trans;
-    math::RandomSampleConsensus<math::AffineFittingFunctorN<3>,math::L2NormErrorMetric>
-      ransac( math::AffineFittingFunctorN<3>(), math::L2NormErrorMetric(), 100, 10, ransac_ip1.size()/2, true);
-    trans = ransac(ransac_ip1, ransac_ip2);
-    indices = ransac.inlier_indices(trans, ransac_ip1, ransac_ip2);
-
-    vw_out() << "\t    * Ransac Result: " << trans << "\n";
-    vw_out() << "\t                     # inliers: " << indices.size() << "\n";
+    if ( opt.alignment_method == "icp" )
+      trans = icp_alignment( opt, num_inliers );
+    else
+      trans = ip_alignment( opt, num_inliers );
 
     { // Saving transform to human readable text
       std::string filename = (fs::path(opt.dem1_name).branch_path() / (fs::basename(fs::path(opt.dem1_name)) + "__" + fs::basename(fs::path(opt.dem2_name)) + "-Matrix.txt")).string();
       std::ofstream ofile( filename.c_str() );
       ofile << std::setprecision(15) << std::flush;
-      ofile << "# inliers: " << indices.size() << endl;
+      ofile << "# inliers: " << num_inliers << endl;
       ofile << trans << endl;
       ofile.close();
     }
 
+    DiskImageView<double> dem1_dmg(opt.dem1_name);
+    GeoReference dem1_georef;
+    read_georeference(dem1_georef, dem1_rsrc);
     ImageViewRef<PixelMask<double> > dem1_masked(create_mask(dem1_dmg, opt.dem1_nodata));
 
     ImageViewRef<Vector3> point_cloud =
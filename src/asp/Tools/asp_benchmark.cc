@@ -0,0 +1,617 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file asp_benchmark.cc
+///
+/// Runs the stereo and camera kernels on deterministic synthetic data
+/// and writes one JSON line per kernel with its throughput and the
+/// peak memory of the process, so releases can be compared without
+/// real datasets.
+
+#include <asp/Tools/stereo_corr.h>
+#include <asp/Tools/stereo_fltr.h>
+#include <asp/Tools/stereo_tri.h>
+
+#include <vw/Core/Stopwatch.h>
+#include <vw/Image.h>
+#include <vw/Image/BlockRasterize.h>
+#include <vw/Math.h>
+#include <vw/Camera/CameraModel.h>
+#include <vw/Camera/Extrinsics.h>
+#include <vw/Cartography/Datum.h>
+#include <vw/Stereo/SubpixelView.h>
+#include <vw/Stereo/EMSubpixelCorrelatorView.h>
+
+#include <asp/Core/Macros.h>
+#include <asp/Core/Common.h>
+#include <asp/Core/StereoSettings.h>
+#include <asp/Core/Telemetry.h>
+#include <asp/Core/BlobIndexThreaded.h>
+#include <asp/Core/InpaintView.h>
+#include <asp/Core/OrthoRasterizer.h>
+#include <asp/Core/SoftwareRenderer.h>
+#include <asp/Core/TriangleRasterizer.h>
+#include <asp/ControlNetTK/Equalization.h>
+#include <asp/Sessions/DG/LinescanDGModel.h>
+#include <asp/Sessions/RPC/RPCModel.h>
+#include <asp/Sessions/RPC/RPCStereoModel.h>
+
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <boost/algorithm/string.hpp>
+
+using namespace vw;
+using namespace vw::cartography;
+namespace po = boost::program_options;
+
+struct Options : asp::BaseOptions {
+  std::string kernels, output_file;
+  int32 size, trials;
+  bool list;
+};
+
+// The synthetic scene. A pair of epipolar aligned images of a
+// textured terrain, the disparity between them, and cameras that see
+// the same terrain, all generated from fixed seeds.
+struct Scene {
+  int32 cols, rows;
+  ImageView<PixelGray<float> > left, right;
+  ImageView<uint8> mask;
+  ImageView<PixelMask<Vector2i> > seed, integer_disparity;
+  ImageView<PixelMask<Vector2f> > disparity, noisy_disparity;
+  ImageView<Vector3> terrain;
+  ImageView<Vector3> mesh;   // Jittered grid over [0,1]^2, with heights
+
+  boost::shared_ptr<camera::CameraModel> rpc1, rpc2, dg;
+  ImageView<Vector3> rpc_points, dg_points;
+  ImageView<Vector2> rpc_pixels, dg_pixels;
+
+  // Matches spread over the left image, only built when the
+  // equalization is run
+  std::vector<ip::InterestPoint> left_ip, right_ip;
+};
+
+namespace {
+
+  // Horizontal parallax of the RPC pair, as a fraction of the image
+  // width per unit of normalized height.
+  const double PARALLAX = 0.02;
+
+  // The seed image is this many times smaller, as L_sub is.
+  const int32 SEED_SCALE = 4;
+
+  // Projections are far slower per item than pixel kernels, so they
+  // run on a sparser grid.
+  const int32 CAMERA_STRIDE = 4;
+
+  // The equalization reduces this many matches to a thousand, so
+  // nearly all of them are removed one at a time.
+  const size_t NUM_MATCHES = 1000000;
+  const size_t EQUALIZED_MATCHES = 1000;
+
+  double hash( int32 x, int32 y, uint32 salt ) {
+    uint32 h = uint32(x) * 73856093u ^ uint32(y) * 19349663u ^ salt * 83492791u;
+    h ^= h >> 13;
+    h *= 0x5bd1e995u;
+    h ^= h >> 15;
+    return h / 4294967296.0;
+  }
+
+  // Bilinearly interpolated lattice noise in [0, 1)
+  double noise( double x, double y, uint32 salt ) {
+    int32 ix = int32(floor(x)), iy = int32(floor(y));
+    double fx = x - ix, fy = y - iy;
+    return (1-fy)*((1-fx)*hash(ix,iy,salt)   + fx*hash(ix+1,iy,salt)) +
+           fy    *((1-fx)*hash(ix,iy+1,salt) + fx*hash(ix+1,iy+1,salt));
+  }
+
+  double texture( double x, double y ) {
+    return 0.6*noise(x/3, y/3, 1) + 0.4*noise(x, y, 2);
+  }
+
+  // Normalized terrain height in [-0.9, 0.9]
+  double height( Scene const& scene, double x, double y ) {
+    double u = 2*M_PI*x/scene.cols, v = 2*M_PI*y/scene.rows;
+    return 0.6*sin(1.5*u)*cos(v) + 0.3*sin(2.7*(u+v));
+  }
+
+  double disparity_at( Scene const& scene, double x, double y ) {
+    return -PARALLAX*scene.cols*height(scene, x, y);
+  }
+
+  // An RPC camera whose sample moves with height by 'parallax', so
+  // two of them with opposite signs form a stereo pair.
+  boost::shared_ptr<camera::CameraModel> rpc_camera( Scene const& scene, double parallax ) {
+    asp::RPCModel::CoeffVec line_num, line_den, samp_num, samp_den;
+    line_num[2] = -1;        // lines grow to the south
+    line_num[4] = 1e-3;      // and a little curvature
+    samp_num[1] = 1;
+    samp_num[3] = parallax;
+    samp_num[7] = 1e-3;
+    line_den[0] = samp_den[0] = 1;
+    line_den[3] = samp_den[3] = 1e-4;
+    return boost::shared_ptr<camera::CameraModel>
+      (new asp::RPCModel( Datum("WGS84"), line_num, line_den, samp_num, samp_den,
+                          Vector2(scene.cols, scene.rows)/2, Vector2(scene.cols, scene.rows)/2,
+                          Vector3(-105.29, 39.75, 2000), Vector3(0.01, 0.01, 500) ));
+  }
+
+  // A pushbroom camera flying south at 500 km, looking straight down
+  // with 0.5 m pixels.
+  boost::shared_ptr<camera::CameraModel> dg_camera( Scene const& scene, bool correct_velocity_aberration ) {
+    const double altitude = 5e5, speed = 7000, gsd = 0.5, dt = 0.1;
+    std::vector<Vector3> position, velocity;
+    std::vector<Quat> pose;
+    for ( int32 i = 0; i < 40; i++ ) {
+      double t = -1 + i*dt;
+      position.push_back( Vector3(0, -speed*t, altitude) );
+      velocity.push_back( Vector3(0, -speed, 0) );
+      // Camera +Z down, +X east and +Y along the flight
+      pose.push_back( Quat(0, 1, 0, 0) );
+    }
+    std::vector<std::pair<double, double> > tlc;
+    tlc.push_back( std::make_pair(0.0, 0.0) );
+    tlc.push_back( std::make_pair(speed/gsd, 1.0) );
+
+    typedef asp::LinescanDGModel<camera::PiecewiseAPositionInterpolation,
+      camera::LinearPiecewisePositionInterpolation, camera::SLERPPoseInterpolation,
+      camera::TLCTimeInterpolation> camera_type;
+    return boost::shared_ptr<camera::CameraModel>
+      (new camera_type( camera::PiecewiseAPositionInterpolation(position, velocity, -1, dt),
+                        camera::LinearPiecewisePositionInterpolation(velocity, -1, dt),
+                        camera::SLERPPoseInterpolation(pose, -1, dt),
+                        camera::TLCTimeInterpolation(tlc, 0),
+                        Vector2i(scene.cols, scene.rows), Vector2(-scene.cols/2.0, 0),
+                        altitude/gsd, correct_velocity_aberration ));
+  }
+
+  void build_scene( int32 size, Scene& scene ) {
+    scene.cols = scene.rows = size;
+    scene.left.set_size( size, size );
+    scene.right.set_size( size, size );
+    scene.mask.set_size( size, size );
+    scene.integer_disparity.set_size( size, size );
+    scene.disparity.set_size( size, size );
+    scene.noisy_disparity.set_size( size, size );
+    scene.terrain.set_size( size, size );
+    scene.mesh.set_size( size, size );
+
+    for ( int32 y = 0; y < size; y++ )
+      for ( int32 x = 0; x < size; x++ ) {
+        double d = disparity_at(scene, x, y);
+        scene.left(x,y)  = PixelGray<float>( texture(x, y) );
+        scene.right(x,y) = PixelGray<float>( texture(x - d, y) );
+        scene.mask(x,y)  = 255;
+        scene.disparity(x,y) = PixelMask<Vector2f>(Vector2f(d, 0));
+        scene.integer_disparity(x,y) = PixelMask<Vector2i>(Vector2i(int32(round(d)), 0));
+        scene.terrain(x,y) = Vector3(0.5*x, -0.5*y, 100*height(scene, x, y));
+        scene.mesh(x,y) = Vector3((x + 0.3*(hash(x, y, 7) - 0.5))/(size - 1),
+                                  (y + 0.3*(hash(x, y, 8) - 0.5))/(size - 1),
+                                  100*height(scene, x, y));
+
+        // Outliers for the clean up, and holes a few pixels across
+        // every 32 pixels or so for the inpainting.
+        PixelMask<Vector2f> noisy = scene.disparity(x,y);
+        if ( hash(x, y, 3) < 0.01 )
+          noisy.child()[0] += hash(x, y, 4) < 0.5 ? -30 : 30;
+        int32 cx = x/32*32 + 16, cy = y/32*32 + 16;
+        double radius = 2 + 6*hash(cx, cy, 5);
+        if ( hash(cx, cy, 6) < 0.3 && (x-cx)*(x-cx) + (y-cy)*(y-cy) < radius*radius )
+          invalidate(noisy);
+        scene.noisy_disparity(x,y) = noisy;
+      }
+
+    scene.seed.set_size( (size + SEED_SCALE - 1)/SEED_SCALE, (size + SEED_SCALE - 1)/SEED_SCALE );
+    for ( int32 y = 0; y < scene.seed.rows(); y++ )
+      for ( int32 x = 0; x < scene.seed.cols(); x++ )
+        scene.seed(x,y) = PixelMask<Vector2i>
+          (Vector2i(int32(round(disparity_at(scene, (x+0.5)*SEED_SCALE, (y+0.5)*SEED_SCALE)/SEED_SCALE)), 0));
+
+    // Projections on the terrain seen by the cameras
+    scene.rpc1 = rpc_camera( scene,  PARALLAX );
+    scene.rpc2 = rpc_camera( scene, -PARALLAX );
+    scene.dg   = dg_camera( scene, !asp::stereo_settings().disable_correct_velocity_aberration );
+    asp::RPCModel const* rpc = dynamic_cast<asp::RPCModel const*>( scene.rpc1.get() );
+    int32 sparse = (size + CAMERA_STRIDE - 1)/CAMERA_STRIDE;
+    scene.rpc_points.set_size( sparse, sparse );
+    scene.rpc_pixels.set_size( sparse, sparse );
+    scene.dg_points.set_size( sparse, sparse );
+    scene.dg_pixels.set_size( sparse, sparse );
+    for ( int32 j = 0; j < sparse; j++ )
+      for ( int32 i = 0; i < sparse; i++ ) {
+        Vector2 pix( i*CAMERA_STRIDE + 0.25, j*CAMERA_STRIDE + 0.75 );
+        double h = height( scene, pix.x(), pix.y() );
+        Vector3 lonlat = elem_prod( Vector3( 2*pix.x()/size - 1 - PARALLAX*h,
+                                             1 - 2*pix.y()/size, h ),
+                                    rpc->lonlatheight_scale() ) + rpc->lonlatheight_offset();
+        scene.rpc_points(i,j) = rpc->datum().geodetic_to_cartesian( lonlat );
+        scene.rpc_pixels(i,j) = pix;
+
+        Vector3 center = scene.dg->camera_center( pix ), dir = scene.dg->pixel_to_vector( pix );
+        scene.dg_points(i,j) = center + dir*((100*h - center.z())/dir.z());
+        scene.dg_pixels(i,j) = pix;
+      }
+  }
+
+  // A third of the matches in a cluster, as on a textured patch, with
+  // many tied interests.
+  void build_matches( Scene& scene ) {
+    scene.left_ip.resize( NUM_MATCHES );
+    scene.right_ip.resize( NUM_MATCHES );
+    for ( size_t i = 0; i < NUM_MATCHES; i++ ) {
+      ip::InterestPoint& left = scene.left_ip[i];
+      double u = hash( int32(i), 0, 9 ), v = hash( int32(i), 1, 9 );
+      if ( i % 3 == 0 ) {
+        left.x = 0.1*scene.cols + 0.05*scene.cols*u;
+        left.y = 0.2*scene.rows + 0.05*scene.rows*v;
+      } else {
+        left.x = scene.cols*u;
+        left.y = scene.rows*v;
+      }
+      left.interest = float( int32( 20*hash( int32(i), 2, 9 ) ) ) - 2;
+      scene.right_ip[i] = left;
+      scene.right_ip[i].x -= disparity_at( scene, left.x, left.y );
+    }
+  }
+
+  // Rasterize with the tile size and threads the tools use
+  template <class ViewT>
+  ImageView<typename ViewT::pixel_type> rasterize_tiles( ImageViewBase<ViewT> const& view ) {
+    int32 tile = vw_settings().default_tile_size();
+    return block_rasterize( view.impl(), Vector2i(tile, tile),
+                            vw_settings().default_num_threads() );
+  }
+
+  template <class ViewT>
+  size_t count_valid( ImageViewBase<ViewT> const& view ) {
+    size_t count = 0;
+    for ( int32 y = 0; y < view.impl().rows(); y++ )
+      for ( int32 x = 0; x < view.impl().cols(); x++ )
+        if ( is_valid( view.impl()(x,y) ) )
+          count++;
+    return count;
+  }
+
+  struct PointToPixelFunc : public ReturnFixedType<Vector2> {
+    camera::CameraModel const* m_camera;
+    PointToPixelFunc( camera::CameraModel const* camera ) : m_camera(camera) {}
+    Vector2 operator()( Vector3 const& point ) const { return m_camera->point_to_pixel( point ); }
+  };
+
+  struct PixelToVectorFunc : public ReturnFixedType<Vector3> {
+    camera::CameraModel const* m_camera;
+    PixelToVectorFunc( camera::CameraModel const* camera ) : m_camera(camera) {}
+    Vector3 operator()( Vector2 const& pix ) const { return m_camera->pixel_to_vector( pix ); }
+  };
+
+  // Kernels. Each one processes the scene once and returns how many
+  // pixels or points it processed.
+
+  size_t run_correlation( Scene const& scene ) {
+    asp::StereoSettings& settings = asp::stereo_settings();
+    stereo::CostFunctionType cost_mode;
+    if      (settings.cost_mode == 0) cost_mode = stereo::ABSOLUTE_DIFFERENCE;
+    else if (settings.cost_mode == 1) cost_mode = stereo::SQUARED_DIFFERENCE;
+    else cost_mode = stereo::CROSS_CORRELATION;
+
+    ImageView<PixelMask<Vector2i> > disparity =
+      rasterize_tiles( seeded_correlation( scene.left, scene.right, scene.mask, scene.mask,
+                                           scene.seed, scene.seed,
+                                           stereo::LaplacianOfGaussian(settings.slogW),
+                                           bounding_box(scene.left), cost_mode ) );
+    return size_t(disparity.cols()) * disparity.rows();
+  }
+
+  size_t run_subpixel_parabola( Scene const& scene ) {
+    asp::StereoSettings& settings = asp::stereo_settings();
+    ImageView<PixelMask<Vector2f> > disparity =
+      rasterize_tiles( stereo::parabola_subpixel( scene.integer_disparity, scene.left, scene.right,
+                                                  stereo::LaplacianOfGaussian(settings.slogW),
+                                                  settings.subpixel_kernel ) );
+    return size_t(disparity.cols()) * disparity.rows();
+  }
+
+  size_t run_subpixel_bayes_em( Scene const& scene ) {
+    asp::StereoSettings& settings = asp::stereo_settings();
+    ImageView<PixelMask<Vector2f> > disparity =
+      rasterize_tiles( stereo::bayes_em_subpixel( scene.integer_disparity, scene.left, scene.right,
+                                                  stereo::LaplacianOfGaussian(settings.slogW),
+                                                  settings.subpixel_kernel,
+                                                  settings.subpixel_max_levels ) );
+    return size_t(disparity.cols()) * disparity.rows();
+  }
+
+  size_t run_subpixel_em( Scene const& scene ) {
+    asp::StereoSettings& settings = asp::stereo_settings();
+    typedef stereo::EMSubpixelCorrelatorView<float32> EMCorrelator;
+    EMCorrelator em_correlator( channels_to_planes(scene.left), channels_to_planes(scene.right),
+                                pixel_cast<PixelMask<Vector2f> >(scene.integer_disparity), -1 );
+    em_correlator.set_em_iter_max( settings.subpixel_em_iter );
+    em_correlator.set_inner_iter_max( settings.subpixel_affine_iter );
+    em_correlator.set_kernel_size( settings.subpixel_kernel );
+    em_correlator.set_pyramid_levels( settings.subpixel_pyramid_levels );
+    ImageView<PixelMask<Vector<float, 5> > > disparity = rasterize_tiles( em_correlator );
+    return size_t(disparity.cols()) * disparity.rows();
+  }
+
+  template <int N>
+  size_t disparity_cleanup( Scene const& scene ) {
+    asp::StereoSettings& settings = asp::stereo_settings();
+    typedef ImageView<PixelMask<Vector2f> > input_type;
+    ImageView<PixelMask<Vector2f> > disparity =
+      rasterize_tiles( MultipleDisparityCleanUp<input_type, N>()
+                       ( scene.noisy_disparity, settings.rm_half_kernel.x(),
+                         settings.rm_half_kernel.y(), settings.rm_threshold,
+                         settings.rm_min_matches/100.0 ) );
+    return size_t(disparity.cols()) * disparity.rows();
+  }
+
+  size_t run_disparity_cleanup( Scene const& scene ) {
+    switch ( asp::stereo_settings().rm_cleanup_passes ) {
+    case 1: return disparity_cleanup<1>( scene );
+    case 2: return disparity_cleanup<2>( scene );
+    case 3: return disparity_cleanup<3>( scene );
+    default:
+      vw_throw( ArgumentErr() << "The benchmark supports 1 to 3 clean up passes.\n" );
+    }
+    return 0;
+  }
+
+  size_t run_blob_index( Scene const& scene ) {
+    asp::BlobIndexThreaded bindex( invert_mask( scene.noisy_disparity ),
+                                   asp::stereo_settings().fill_hole_max_size );
+    VW_ASSERT( bindex.num_blobs() > 0, LogicErr() << "The synthetic disparity has no holes.\n" );
+    return size_t(scene.cols) * scene.rows;
+  }
+
+  size_t run_inpaint( Scene const& scene ) {
+    asp::BlobIndexThreaded bindex( invert_mask( scene.noisy_disparity ),
+                                   asp::stereo_settings().fill_hole_max_size );
+    ImageView<PixelMask<Vector2f> > disparity =
+      rasterize_tiles( asp::inpaint( scene.noisy_disparity, bindex, true, PixelMask<Vector2f>() ) );
+    return size_t(disparity.cols()) * disparity.rows();
+  }
+
+  size_t run_triangulation( Scene const& scene ) {
+    typedef ImageView<PixelMask<Vector2f> > DisparityT;
+    ImageView<Vector6> points =
+      rasterize_tiles( stereo_error_triangulate<DisparityT, asp::RPCStereoModel>
+                       ( scene.disparity, scene.rpc1.get(), scene.rpc2.get() ) );
+    return count_valid( scene.disparity );
+  }
+
+  size_t run_ortho_rasterize( Scene const& scene ) {
+    OrthoRasterizerView<Vector<float, 1>, ImageView<Vector3> >
+      rasterizer( scene.terrain, select_channel(scene.terrain, 2), 0.5 );
+    rasterizer.set_use_minz_as_default( false );
+    ImageView<Vector<float, 1> > dem = rasterize_tiles( rasterizer );
+    return size_t(scene.terrain.cols()) * scene.terrain.rows();
+  }
+
+  // Both renderers draw the mesh as point2dem does a tile, with cells
+  // of about one pixel, two triangles per cell.
+  size_t run_software_renderer( Scene const& scene ) {
+    std::vector<float> buffer( size_t(scene.cols) * scene.rows );
+    stereo::SoftwareRenderer renderer( scene.cols, scene.rows, &buffer[0] );
+    renderer.Ortho2D( 0, 1, 0, 1 );
+    renderer.Clear( -1.0 );
+    float vertices[10], colors[5];
+    renderer.SetVertexPointer( 2, vertices );
+    renderer.SetColorPointer( 1, colors );
+    for ( int32 y = 0; y < scene.rows - 1; y++ )
+      for ( int32 x = 0; x < scene.cols - 1; x++ ) {
+        Vector3 corners[5] = { scene.mesh(x,y), scene.mesh(x,y+1), scene.mesh(x+1,y+1),
+                               scene.mesh(x+1,y), scene.mesh(x,y) };
+        for ( int k = 0; k < 5; k++ ) {
+          vertices[2*k]   = corners[k].x();
+          vertices[2*k+1] = corners[k].y();
+          colors[k]       = corners[k].z();
+        }
+        renderer.DrawPolygon( 0, 3 );
+        renderer.DrawPolygon( 2, 3 );
+      }
+    return 2*size_t(scene.cols - 1)*(scene.rows - 1);
+  }
+
+  size_t run_triangle_rasterizer( Scene const& scene ) {
+    std::vector<float> buffer( size_t(scene.cols) * scene.rows );
+    stereo::TriangleRasterizer renderer( scene.cols, scene.rows, 1, &buffer[0] );
+    renderer.set_ortho( 0, 1, 0, 1 );
+    renderer.clear( -1.0 );
+    double quad[4][3];
+    for ( int32 y = 0; y < scene.rows - 1; y++ )
+      for ( int32 x = 0; x < scene.cols - 1; x++ ) {
+        Vector3 corners[4] = { scene.mesh(x,y), scene.mesh(x,y+1),
+                               scene.mesh(x+1,y+1), scene.mesh(x+1,y) };
+        for ( int k = 0; k < 4; k++ )
+          for ( int c = 0; c < 3; c++ )
+            quad[k][c] = corners[k][c];
+        renderer.add_triangle( quad[0], quad[1], quad[2] );
+        renderer.add_triangle( quad[2], quad[3], quad[0] );
+      }
+    renderer.flush();
+    return 2*size_t(scene.cols - 1)*(scene.rows - 1);
+  }
+
+  size_t project( ImageView<Vector3> const& points, camera::CameraModel const* camera ) {
+    ImageView<Vector2> pixels = rasterize_tiles( per_pixel_filter( points, PointToPixelFunc(camera) ) );
+    return size_t(pixels.cols()) * pixels.rows();
+  }
+
+  size_t unproject( ImageView<Vector2> const& pixels, camera::CameraModel const* camera ) {
+    ImageView<Vector3> dirs = rasterize_tiles( per_pixel_filter( pixels, PixelToVectorFunc(camera) ) );
+    return size_t(dirs.cols()) * dirs.rows();
+  }
+
+  size_t run_rpc_point_to_pixel( Scene const& scene ) {
+    return project( scene.rpc_points, scene.rpc1.get() );
+  }
+  size_t run_rpc_pixel_to_vector( Scene const& scene ) {
+    return unproject( scene.rpc_pixels, scene.rpc1.get() );
+  }
+  size_t run_dg_point_to_pixel( Scene const& scene ) {
+    return project( scene.dg_points, scene.dg.get() );
+  }
+  size_t run_dg_pixel_to_vector( Scene const& scene ) {
+    return unproject( scene.dg_pixels, scene.dg.get() );
+  }
+
+  // The matches are copied, as equalization() reduces them in place
+  size_t run_equalization( Scene const& scene ) {
+    std::vector<ip::InterestPoint> left_ip = scene.left_ip, right_ip = scene.right_ip;
+    asp::cnettk::equalization( left_ip, right_ip, EQUALIZED_MATCHES );
+    VW_ASSERT( left_ip.size() == EQUALIZED_MATCHES,
+               LogicErr() << "The equalization kept " << left_ip.size() << " matches.\n" );
+    return scene.left_ip.size();
+  }
+
+  struct Kernel {
+    const char* name;
+    const char* unit;
+    size_t (*run)( Scene const& );
+  };
+
+  // The stereo kernels in pipeline order, then those of the match tools
+  const Kernel KERNELS[] = {
+    { "correlation",         "pixels", &run_correlation },
+    { "subpixel_parabola",   "pixels", &run_subpixel_parabola },
+    { "subpixel_bayes_em",   "pixels", &run_subpixel_bayes_em },
+    { "subpixel_em",         "pixels", &run_subpixel_em },
+    { "disparity_cleanup",   "pixels", &run_disparity_cleanup },
+    { "blob_index",          "pixels", &run_blob_index },
+    { "inpaint",             "pixels", &run_inpaint },
+    { "triangulation",       "points", &run_triangulation },
+    { "ortho_rasterize",     "points", &run_ortho_rasterize },
+    { "software_renderer",   "triangles", &run_software_renderer },
+    { "triangle_rasterizer", "triangles", &run_triangle_rasterizer },
+    { "rpc_point_to_pixel",  "points", &run_rpc_point_to_pixel },
+    { "rpc_pixel_to_vector", "points", &run_rpc_pixel_to_vector },
+    { "dg_point_to_pixel",   "points", &run_dg_point_to_pixel },
+    { "dg_pixel_to_vector",  "points", &run_dg_pixel_to_vector },
+    { "equalization",        "points", &run_equalization }
+  };
+  const size_t NUM_KERNELS = sizeof(KERNELS) / sizeof(KERNELS[0]);
+
+}
+
+void handle_arguments( int argc, char *argv[], Options& opt ) {
+  po::options_description general_options("");
+  general_options.add_options()
+    ("kernels", po::value(&opt.kernels)->default_value("all"), "Comma separated kernels to run, or 'all'.")
+    ("size", po::value(&opt.size)->default_value(512), "Width and height of the synthetic images.")
+    ("trials", po::value(&opt.trials)->default_value(3), "Number of timed runs of each kernel. The fastest one is reported.")
+    ("output-file,o", po::value(&opt.output_file), "Append the results to this file instead of printing them.")
+    ("list", po::bool_switch(&opt.list)->default_value(false), "List the kernels and exit.");
+  general_options.add( asp::BaseOptionsDescription(opt) );
+
+  // The kernels take their parameters from the same options as stereo
+  general_options.add( asp::CorrelationDescription() );
+  general_options.add( asp::SubpixelDescription() );
+  general_options.add( asp::FilteringDescription() );
+  general_options.add( asp::DGDescription() );
+
+  po::options_description positional("");
+  po::positional_options_description positional_desc;
+
+  std::string usage("[options]");
+  asp::check_command_line( argc, argv, opt, general_options, general_options,
+                           positional, positional_desc, usage );
+
+  if ( opt.size < 64 )
+    vw_throw( ArgumentErr() << "The synthetic images must be at least 64 pixels wide.\n" );
+  if ( opt.trials < 1 )
+    vw_throw( ArgumentErr() << "Need at least one trial.\n" );
+}
+
+int main( int argc, char *argv[] ) {
+
+  Options opt;
+  try {
+    handle_arguments( argc, argv, opt );
+
+    if ( opt.list ) {
+      for ( size_t k = 0; k < NUM_KERNELS; k++ )
+        vw_out() << KERNELS[k].name << "\n";
+      return 0;
+    }
+
+    std::vector<Kernel> kernels;
+    if ( opt.kernels == "all" ) {
+      kernels.assign( KERNELS, KERNELS + NUM_KERNELS );
+    } else {
+      std::vector<std::string> names;
+      boost::split( names, opt.kernels, boost::is_any_of(",") );
+      for ( size_t i = 0; i < names.size(); i++ ) {
+        size_t k = 0;
+        while ( k < NUM_KERNELS && names[i] != KERNELS[k].name )
+          k++;
+        if ( k == NUM_KERNELS )
+          vw_throw( ArgumentErr() << "Unknown kernel: " << names[i] << ". See --list.\n" );
+        kernels.push_back( KERNELS[k] );
+      }
+    }
+
+    // Seeds always come from the synthetic low resolution disparity
+    asp::stereo_settings().seed_mode = 1;
+
+    Scene scene;
+    build_scene( opt.size, scene );
+    for ( size_t k = 0; k < kernels.size(); k++ )
+      if ( kernels[k].run == &run_equalization )
+        build_matches( scene );
+
+    std::ofstream file;
+    if ( !opt.output_file.empty() ) {
+      file.open( opt.output_file.c_str(), std::ios::app );
+      if ( !file )
+        vw_throw( IOErr() << "Unable to open " << opt.output_file << ".\n" );
+    }
+    std::ostream& out = opt.output_file.empty() ? std::cout : file;
+
+    for ( size_t k = 0; k < kernels.size(); k++ ) {
+      double best = std::numeric_limits<double>::max(), total = 0;
+      size_t items = 0;
+      for ( int32 t = 0; t < opt.trials; t++ ) {
+        Stopwatch sw;
+        sw.start();
+        items = kernels[k].run( scene );
+        sw.stop();
+        best = std::min( best, sw.elapsed_seconds() );
+        total += sw.elapsed_seconds();
+      }
+
+      // Peak RSS only grows, so run one kernel per process to compare
+      // kernels with each other rather than across releases.
+      out << std::setprecision(6)
+          << "{\"kernel\": \"" << kernels[k].name << "\""
+          << ", \"cols\": " << scene.cols << ", \"rows\": " << scene.rows
+          << ", \"threads\": " << vw_settings().default_num_threads()
+          << ", \"tile_size\": " << vw_settings().default_tile_size()
+          << ", \"trials\": " << opt.trials
+          << ", \"unit\": \"" << kernels[k].unit << "\", \"count\": " << items
+          << ", \"best_seconds\": " << best
+          << ", \"mean_seconds\": " << total / opt.trials
+          << ", \"rate\": " << ( best > 0 ? items / best : 0 )
+          << ", \"peak_rss_kb\": " << asp::peak_rss_kb() << "}" << std::endl;
+    }
+
+  } ASP_STANDARD_CATCHES;
+
+  return 0;
+}
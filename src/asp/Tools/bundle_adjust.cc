@@ -20,6 +20,7 @@
 ///
 
 #include <asp/Core/Macros.h>
+#include <asp/Core/AdjustParallelSparse.h>
 #include <asp/Tools/bundle_adjust.h>
 
 namespace po = boost::program_options;
@@ -53,7 +54,7 @@ sort_out_gcps( std::vector<std::string>& image_files ) {
 
 struct Options : public asp::BaseOptions {
   std::vector<std::string> image_files, gcp_files;
-  std::string cnet_file, stereosession_type, ba_type;
+  std::string cnet_file, stereosession_type, ba_type, linear_solver, preconditioner;
 
   double lambda, robust_outlier_threshold;
   int report_level, min_matches, max_iterations;
@@ -64,6 +65,19 @@ struct Options : public asp::BaseOptions {
   std::vector<boost::shared_ptr<CameraModel> > camera_models;
 };
 
+// Only the parallel adjuster has linear solver settings
+template <class AdjusterT>
+void set_linear_solver( AdjusterT& /*adjuster*/, Options const& /*opt*/ ) {}
+
+template <class ModelT, class CostT>
+void set_linear_solver( asp::AdjustParallelSparse<ModelT, CostT>& adjuster, Options const& opt ) {
+  asp::LinearSolverOptions solver_opt =
+    asp::linear_solver_options( opt.linear_solver, opt.preconditioner );
+  // ISIS cameras may not be used from several threads
+  solver_opt.threaded_model = opt.stereosession_type != "isis";
+  adjuster.set_linear_solver_options( solver_opt );
+}
+
 template <class AdjusterT>
 void do_ba( typename  AdjusterT::cost_type const& cost_function,
             Options const& opt ) {
@@ -72,6 +86,7 @@ void do_ba( typename  AdjusterT::cost_type const& cost_function,
 
   if ( opt.lambda > 0 )
     bundle_adjuster.set_lambda( opt.lambda );
+  set_linear_solver( bundle_adjuster, opt );
 
   //Clearing the monitoring text files to be used for saving camera params
   if (opt.save_iteration){
@@ -132,7 +147,11 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("cnet,c", po::value(&opt.cnet_file),
      "Load a control network from a file")
     ("bundle-adjuster", po::value(&opt.ba_type)->default_value("RobustSparse"),
-     "Choose a robust cost function from [PseudoHuber, Huber, L1, L2, Cauchy]")
+     "Choose a bundle adjustment version from [Ref, Sparse, RobustRef, RobustSparse, ParallelSparse]")
+    ("linear-solver", po::value(&opt.linear_solver)->default_value("Cholesky"),
+     "Choose how ParallelSparse solves the reduced camera system from [Cholesky, PCG]")
+    ("preconditioner", po::value(&opt.preconditioner)->default_value("BlockJacobi"),
+     "Choose the preconditioner of PCG from [BlockJacobi, Jacobi]")
     ("session-type,t", po::value(&opt.stereosession_type)->default_value("isis"),
      "Select the stereo session type to use for processing.")
     ("lambda,l", po::value(&opt.lambda)->default_value(-1),
@@ -169,9 +188,11 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   if ( !( opt.ba_type == "ref" ||
           opt.ba_type == "sparse" ||
           opt.ba_type == "robustref" ||
-          opt.ba_type == "robustsparse" ) )
+          opt.ba_type == "robustsparse" ||
+          opt.ba_type == "parallelsparse" ) )
     vw_throw( ArgumentErr() << "Unknown bundle adjustment version: " << opt.ba_type
-              << ". Options are : [Ref, Sparse, RobustRef, RobustSparse]\n" );
+              << ". Options are : [Ref, Sparse, RobustRef, RobustSparse, ParallelSparse]\n" );
+  asp::linear_solver_options( opt.linear_solver, opt.preconditioner );
 }
 
 int main(int argc, char* argv[]) {
@@ -257,6 +278,8 @@ int main(int argc, char* argv[]) {
         do_ba<AdjustRobustRef< ModelType,L2Error> >( L2Error(), opt );
       } else if ( opt.ba_type == "robustsparse" ) {
         do_ba<AdjustRobustSparse< ModelType,L2Error> >( L2Error(), opt );
+      } else if ( opt.ba_type == "parallelsparse" ) {
+        do_ba<asp::AdjustParallelSparse< ModelType,L2Error> >( L2Error(), opt );
       }
     }
 
@@ -33,6 +33,10 @@ using std::string;
 using namespace vw;
 using namespace vw::cartography;
 
+// Adjust a DEM by the geoid height. The geoid is smooth on the scale
+// of its own pixels, so each output tile evaluates it only on a grid
+// of nodes every m_spacing DEM pixels and interpolates bilinearly in
+// between. A spacing of 1 evaluates it at every pixel.
 template <class ImageT>
 class DemGeoidView : public ImageViewBase<DemGeoidView<ImageT> >
 {
@@ -43,6 +47,44 @@ class DemGeoidView : public ImageViewBase<DemGeoidView<ImageT> >
   bool m_reverse_adjustment;
   double m_correction;
   double m_nodata_val;
+  int32 m_spacing;
+
+  // The geoid height at a DEM pixel, or NaN where the geoid has no data
+  double geoid_height( Vector2 const& pix ) const {
+    Vector2 lonlat = m_georef.pixel_to_lonlat(pix);
+
+    // For testing (see the link to the reference web form belows).
+    //lonlat[0] = -121;   lonlat[1] = 37;   // mainland US
+    //lonlat[0] = -152;   lonlat[1] = 66;   // Alaska
+    //lonlat[0] = -155.5; lonlat[1] = 19.5; // Hawaii
+
+    // Need to carefully wrap lonlat to the [0, 360) x [-90, 90] box.
+    // Note that lon = 25, lat = 91 is the same as lon = 180 + 25, lat = 89
+    // as we go through the North pole and show up on the other side.
+    double lat = std::fmod( lonlat[1] + 90.0, 360.0 );
+    if ( lat < 0.0 ) lat += 360.0;
+    if ( lat > 180.0 ) {
+      lonlat[1] = 270.0 - lat;
+      lonlat[0] += 180.0;
+    } else {
+      lonlat[1] = lat - 90.0;
+    }
+    lonlat[0] = std::fmod( lonlat[0], 360.0 );
+    if ( lonlat[0] <    0.0 ) lonlat[0] += 360.0;
+    if ( lonlat[0] >= 360.0 ) lonlat[0] -= 360.0;
+
+    Vector2           pix_geoid  = m_geoid_georef.lonlat_to_pixel(lonlat);
+    PixelMask<double> interp_val = m_geoid(pix_geoid[0], pix_geoid[1]);
+    if (!is_valid(interp_val)) return std::numeric_limits<double>::quiet_NaN();
+    return interp_val.child();
+  }
+
+  // See the note in the main program about the formula below
+  inline double adjust( double height_above_ellipsoid, double geoid_height ) const {
+    if ( geoid_height != geoid_height ) return m_nodata_val;
+    double direction = m_reverse_adjustment?-1:1;
+    return height_above_ellipsoid - direction*(geoid_height + m_correction);
+  }
 
 public:
 
@@ -52,12 +94,15 @@ public:
 
   DemGeoidView(ImageT const& img, GeoReference const& georef,
                ImageViewRef<PixelMask<double> > const& geoid,
-               GeoReference const& geoid_georef, bool reverse_adjustment, double correction, double nodata_val):
+               GeoReference const& geoid_georef, bool reverse_adjustment, double correction,
+               double nodata_val, int32 spacing):
     m_img(img), m_georef(georef),
     m_geoid(geoid), m_geoid_georef(geoid_georef),
     m_reverse_adjustment(reverse_adjustment),
     m_correction(correction),
-    m_nodata_val(nodata_val){}
+    m_nodata_val(nodata_val), m_spacing(spacing){
+    VW_ASSERT( spacing >= 1, ArgumentErr() << "The geoid grid spacing must be positive." );
+  }
 
   inline int32 cols() const { return m_img.cols(); }
   inline int32 rows() const { return m_img.rows(); }
@@ -66,50 +111,52 @@ public:
   inline pixel_accessor origin() const { return pixel_accessor(*this); }
 
   inline result_type operator()( size_t col, size_t row, size_t p=0 ) const {
+    double height = m_img(col, row, p);
+    if ( height == m_nodata_val ) return m_nodata_val;
+    return adjust( height, geoid_height(Vector2(col, row)) );
+  }
 
-    if ( m_img(col, row, p) == m_nodata_val ) return m_nodata_val;
-
-    Vector2 lonlat = m_georef.pixel_to_lonlat(Vector2(col, row));
-
-    // For testing (see the link to the reference web form belows).
-    //lonlat[0] = -121;   lonlat[1] = 37;   // mainland US
-    //lonlat[0] = -152;   lonlat[1] = 66;   // Alaska
-    //lonlat[0] = -155.5; lonlat[1] = 19.5; // Hawaii
+  /// \cond INTERNAL
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
+    ImageView<double> tile = crop( m_img.prerasterize(bbox), bbox );
+
+    // Geoid heights at the nodes. The last row and column of nodes
+    // may fall just outside the tile.
+    int32 num_x = (bbox.width()  - 1) / m_spacing + 2;
+    int32 num_y = (bbox.height() - 1) / m_spacing + 2;
+    ImageView<double> nodes(num_x, num_y);
+    for ( int32 j = 0; j < num_y; j++ )
+      for ( int32 i = 0; i < num_x; i++ )
+        nodes(i, j) = geoid_height( Vector2( bbox.min().x() + i*m_spacing,
+                                             bbox.min().y() + j*m_spacing ) );
+
+    // The node and weight of each column are the same on every row
+    std::vector<int32>  node_x( bbox.width() );
+    std::vector<double> weight_x( bbox.width() );
+    for ( int32 col = 0; col < bbox.width(); col++ ) {
+      node_x[col]   = col / m_spacing;
+      weight_x[col] = double(col - node_x[col]*m_spacing) / m_spacing;
+    }
 
-    // Need to carefully wrap lonlat to the [0, 360) x [-90, 90) box.
-    // Note that lon = 25, lat = 91 is the same as lon = 180 + 25, lat = 89
-    // as we go through the North pole and show up on the other side.
-    while ( std::abs(lonlat[1]) > 90.0 ){
-      if ( lonlat[1] > 90.0 ){
-        lonlat[1] = 180.0 - lonlat[1];
-        lonlat[0] += 180.0;
-      }
-      if ( lonlat[1] < -90.0 ){
-        lonlat[1] = -180.0 - lonlat[1];
-        lonlat[0] += 180.0;
+    for ( int32 row = 0; row < bbox.height(); row++ ) {
+      int32  j  = row / m_spacing;
+      double wy = double(row - j*m_spacing) / m_spacing;
+      for ( int32 col = 0; col < bbox.width(); col++ ) {
+        double& height = tile(col, row);
+        if ( height == m_nodata_val ) continue;
+        int32  i  = node_x[col];
+        double wx = weight_x[col];
+        double geoid = (1-wy) * ( (1-wx)*nodes(i, j  ) + wx*nodes(i+1, j  ) ) +
+                          wy  * ( (1-wx)*nodes(i, j+1) + wx*nodes(i+1, j+1) );
+        // Next to where the geoid has no data, use the exact value
+        if ( geoid != geoid )
+          geoid = geoid_height( Vector2( bbox.min().x() + col, bbox.min().y() + row ) );
+        height = adjust( height, geoid );
       }
     }
-    while( lonlat[0] <   0.0  ) lonlat[0] += 360.0;
-    while( lonlat[0] >= 360.0 ) lonlat[0] -= 360.0;
-
-    result_type       geoid_height           = 0.0;
-    Vector2           pix                    = m_geoid_georef.lonlat_to_pixel(lonlat);
-    PixelMask<double> interp_val             = m_geoid(pix[0], pix[1]);
-    if (!is_valid(interp_val)) return m_nodata_val;
-    geoid_height                             = interp_val.child() + m_correction;
-    result_type       height_above_ellipsoid = m_img(col, row, p);
-    double            direction              = m_reverse_adjustment?-1:1;
-    // See the note in the main program about the formula below
-    result_type height_above_geoid           = height_above_ellipsoid - direction*geoid_height;
-
-    return height_above_geoid;
-  }
 
-  /// \cond INTERNAL
-  typedef DemGeoidView<typename ImageT::prerasterize_type> prerasterize_type;
-  inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
-    return prerasterize_type( m_img.prerasterize(bbox), m_georef,
-                              m_geoid, m_geoid_georef, m_reverse_adjustment, m_correction, m_nodata_val );
+    return prerasterize_type( tile, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
   }
   template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
     vw::rasterize( prerasterize(bbox), dest, bbox );
@@ -121,9 +168,34 @@ template <class ImageT>
 DemGeoidView<ImageT>
 dem_geoid( ImageViewBase<ImageT> const& img, GeoReference const& georef,
            ImageViewRef<PixelMask<double> > const& geoid,
-           GeoReference const& geoid_georef, bool reverse_adjustment, double correction, double nodata_val) {
+           GeoReference const& geoid_georef, bool reverse_adjustment, double correction,
+           double nodata_val, int32 spacing) {
   return DemGeoidView<ImageT>( img.impl(), georef, geoid, geoid_georef,
-                               reverse_adjustment, correction, nodata_val );
+                               reverse_adjustment, correction, nodata_val, spacing );
+}
+
+// Spacing of the geoid nodes in DEM pixels: a quarter of a geoid pixel.
+// The geoid is bicubically interpolated between its own pixels, and
+// bilinear interpolation over a quarter of a pixel of such a surface
+// is off by at most 1/128 of its second difference, which is under a
+// centimeter for the supported geoids.
+int32 geoid_grid_spacing( GeoReference const& dem_georef, Vector2i const& dem_size,
+                          GeoReference const& geoid_georef ) {
+  Vector2 center = dem_size / 2;
+  Vector2 lonlat = dem_georef.pixel_to_lonlat(center);
+  double dem_pixel_deg = 0;
+  for ( int k = 0; k < 2; k++ ) {
+    Vector2 step = k == 0 ? Vector2(1, 0) : Vector2(0, 1);
+    Vector2 diff = dem_georef.pixel_to_lonlat(center + step) - lonlat;
+    diff[0] = std::fmod( std::abs(diff[0]), 360.0 );
+    diff[0] = std::min( diff[0], 360.0 - diff[0] );
+    dem_pixel_deg = std::max( dem_pixel_deg, norm_2(diff) );
+  }
+  double geoid_pixel_deg = std::abs( geoid_georef.transform()(0,0) );
+  if ( !(dem_pixel_deg > 0) )
+    return 1;
+  double spacing = 0.25 * geoid_pixel_deg / dem_pixel_deg;
+  return int32( std::max( 1.0, std::min( 64.0, std::floor(spacing) ) ) );
 }
 
 struct Options : asp::BaseOptions {
@@ -131,6 +203,7 @@ struct Options : asp::BaseOptions {
   double nodata_value;
   bool use_double;
   bool reverse_adjustment;
+  int32 geoid_grid_spacing;
 };
 
 std::string get_geoids_path(){
@@ -151,7 +224,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ){
      "Output using double precision (64 bit) instead of float (32 bit).")
     ("reverse-adjustment",
      po::bool_switch(&opt.reverse_adjustment)->default_value(false)->implicit_value(true),
-     "Go from DEM relative to the geoid to DEM relative to the ellipsoid.");
+     "Go from DEM relative to the geoid to DEM relative to the ellipsoid.")
+    ("geoid-grid-spacing", po::value(&opt.geoid_grid_spacing)->default_value(0),
+     "Evaluate the geoid every this many DEM pixels and interpolate in between. Use 1 to evaluate it at every pixel. The default, 0, picks a spacing of about a quarter of a geoid pixel.");
 
   general_options.add( asp::BaseOptionsDescription(opt) );
 
@@ -171,6 +246,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ){
     vw_throw( ArgumentErr() << "Requires <dem> in order to proceed.\n\n"
               << usage << general_options );
 
+  if ( opt.geoid_grid_spacing < 0 )
+    vw_throw( ArgumentErr() << "The geoid grid spacing must not be negative.\n" );
+
   if ( opt.output_prefix.empty() ) {
     opt.output_prefix = fs::path(opt.dem_name).stem().string();
   }
@@ -265,32 +343,29 @@ int main( int argc, char *argv[] ) {
       = interpolate(create_mask( pixel_cast<double>(geoid_img), geoid_nodata_val ),
                     BicubicInterpolation(), ZeroEdgeExtension());
 
+    int32 spacing = opt.geoid_grid_spacing;
+    if ( spacing == 0 )
+      spacing = geoid_grid_spacing( dem_georef, Vector2i(dem_img.cols(), dem_img.rows()),
+                                    geoid_georef );
+    vw_out() << "\tEvaluating the geoid every " << spacing << " DEM pixel(s).\n";
+
     ImageViewRef<double> adj_dem = dem_geoid(dem_img, dem_georef, geoid, geoid_georef,
-                                             reverse_adjustment, correction, dem_nodata_val);
+                                             reverse_adjustment, correction, dem_nodata_val,
+                                             spacing);
 
     std::string adj_dem_file = opt.output_prefix + "-adj.tif";
     vw_out() << "Writing adjusted DEM: " << adj_dem_file << std::endl;
 
+    TerminalProgressCallback tpc("asp", "\t--> Applying DEM adjustment: ");
     if ( opt.use_double ) {
       // Output as double
-      boost::scoped_ptr<DiskImageResourceGDAL> rsrc( asp::build_gdal_rsrc(adj_dem_file,
-                                                                          adj_dem, opt ) );
-      rsrc->set_nodata_write( dem_nodata_val );
-      write_georeference( *rsrc, dem_georef );
-      block_write_image( *rsrc, adj_dem,
-                         TerminalProgressCallback("asp", "\t--> Applying DEM adjustment: ") );
+      asp::block_write_gdal_image( adj_dem_file, adj_dem, dem_georef, dem_nodata_val, opt, tpc );
     }else{
       // Output as float
       ImageViewRef<float> adj_dem_float = channel_cast<float>( adj_dem );
-      boost::scoped_ptr<DiskImageResourceGDAL> rsrc( asp::build_gdal_rsrc(adj_dem_file,
-                                                                          adj_dem_float, opt ) );
-      rsrc->set_nodata_write( dem_nodata_val );
-      write_georeference( *rsrc, dem_georef );
-      block_write_image( *rsrc, adj_dem_float,
-                         TerminalProgressCallback("asp", "\t--> Applying DEM adjustment: ") );
+      asp::block_write_gdal_image( adj_dem_file, adj_dem_float, dem_georef, dem_nodata_val, opt, tpc );
     }
 
-
   } ASP_STANDARD_CATCHES;
 
   return 0;
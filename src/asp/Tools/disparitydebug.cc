@@ -37,6 +37,7 @@
 #include <vw/tools/Common.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/DiskImageResourceMmap.h>
 using namespace vw;
 using namespace vw::stereo;
 
@@ -131,6 +132,12 @@ int main( int argc, char *argv[] ) {
 
   Options opt;
   try {
+    // Disparity intermediates from stereo are in the native
+    // memory-mapped format.
+    DiskImageResource::register_file_type(asp::DiskImageResourceMmap::extension(),
+                                          asp::DiskImageResourceMmap::type_static(),
+                                          &asp::DiskImageResourceMmap::construct_open,
+                                          &asp::DiskImageResourceMmap::construct_create);
     handle_arguments( argc, argv, opt );
 
     vw_out() << "Opening " << opt.input_file_name << "\n";
@@ -15,6 +15,12 @@
 //  limitations under the License.
 // __END_LICENSE__
 
+#include <fstream>
+#include <algorithm>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
+#include <vw/Core/ThreadPool.h>
 #include <vw/FileIO.h>
 #include <vw/Image.h>
 #include <vw/Cartography.h>
@@ -28,6 +34,7 @@ using namespace vw::cartography;
 
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/StreamingStats.h>
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
@@ -43,10 +50,12 @@ public:
 };
 
 struct Options : asp::BaseOptions {
-  string dem1_name, dem2_name, output_prefix;
+  string dem1_name, output_prefix;
+  std::vector<string> dem_names;
   double nodata_value;
+  int32 tile_size;
 
-  bool use_float, use_absolute;
+  bool use_float, use_absolute, write_diff, stats_only;
 };
 
 void handle_arguments( int argc, char *argv[], Options& opt ) {
@@ -55,100 +64,307 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("nodata_value", po::value(&opt.nodata_value)->default_value(-32767), "The value of missing pixels in the first dem")
     ("output-prefix,o", po::value(&opt.output_prefix), "Specify the output prefix.")
     ("float", po::bool_switch(&opt.use_float)->default_value(false), "Output using float (32 bit) instead of using doubles (64 bit).")
-    ("absolute", po::bool_switch(&opt.use_absolute)->default_value(false), "Output the absolute difference as opposed to just the difference.");
+    ("absolute", po::bool_switch(&opt.use_absolute)->default_value(false), "Output the absolute difference as opposed to just the difference.")
+    ("write-diff", po::bool_switch(&opt.write_diff)->default_value(false), "Write a difference image for every DEM. This is the default when differencing a single DEM.")
+    ("stats-only", po::bool_switch(&opt.stats_only)->default_value(false), "Only compute the statistics, even when differencing a single DEM.")
+    ("stats-tile-size", po::value(&opt.tile_size)->default_value(1024), "Size of the tiles over which per-tile statistics are reported.");
   general_options.add( asp::BaseOptionsDescription(opt) );
 
   po::options_description positional("");
   positional.add_options()
     ("dem1", po::value(&opt.dem1_name), "Explicitly specify the first dem")
-    ("dem2", po::value(&opt.dem2_name), "Explicitly specify the second dem");
+    ("dem2", po::value(&opt.dem_names), "Explicitly specify the other dems");
 
   po::positional_options_description positional_desc;
   positional_desc.add("dem1", 1);
-  positional_desc.add("dem2", 1);
+  positional_desc.add("dem2", -1);
 
-  std::string usage("[options] <dem1> <dem2>");
+  std::string usage("[options] <dem1> <dem2> [<dem3> ...]");
   po::variables_map vm =
     asp::check_command_line( argc, argv, opt, general_options, general_options,
                              positional, positional_desc, usage );
 
-  if ( opt.dem1_name.empty() || opt.dem2_name.empty() )
+  if ( opt.dem1_name.empty() || opt.dem_names.empty() )
     vw_throw( ArgumentErr() << "Requires <dem1> and <dem2> in order to proceed.\n\n" << usage << general_options );
 
+  if ( opt.write_diff && opt.stats_only )
+    vw_throw( ArgumentErr() << "Cannot use --write-diff with --stats-only.\n" );
+  if ( opt.dem_names.size() == 1 && !opt.stats_only )
+    opt.write_diff = true;
+
+  if ( opt.tile_size <= 0 )
+    vw_throw( ArgumentErr() << "The statistics tile size must be positive.\n" );
+
   if ( opt.output_prefix.empty() ) {
-    opt.output_prefix =
-      fs::basename(opt.dem1_name) + "__" + fs::basename(opt.dem2_name);
+    if ( opt.dem_names.size() == 1 )
+      opt.output_prefix =
+        fs::basename(opt.dem1_name) + "__" + fs::basename(opt.dem_names[0]);
+    else
+      opt.output_prefix = fs::basename(opt.dem1_name) + "__stack";
   }
 }
 
+namespace asp {
+
+  // A difference image written one tile at a time, in any order
+  class DiffImage : private boost::noncopyable {
+    boost::scoped_ptr<DiskImageResourceGDAL> m_rsrc;
+    bool m_use_float;
+    Mutex& m_write_mutex;
+  public:
+    DiffImage( std::string const& output_file, Vector2i const& size, GeoReference const& georef,
+               Options const& opt, Mutex& write_mutex ) :
+      m_use_float(opt.use_float), m_write_mutex(write_mutex) {
+      vw_out() << "Writing difference: " << output_file << "\n";
+      ImageFormat format;
+      format.cols = size.x();
+      format.rows = size.y();
+      format.planes = 1;
+      format.pixel_format = VW_PIXEL_GRAY;
+      format.channel_type = opt.use_float ? VW_CHANNEL_FLOAT32 : VW_CHANNEL_FLOAT64;
+      m_rsrc.reset( new DiskImageResourceGDAL(output_file, format, opt.raster_tile_size,
+                                              opt.gdal_options) );
+      m_rsrc->set_nodata_write( opt.nodata_value );
+      write_georeference( *m_rsrc, georef );
+    }
+
+    void write_tile( ImageView<double> const& tile, BBox2i const& bbox ) {
+      if ( m_use_float ) {
+        ImageView<float> output = channel_cast<float>( tile );
+        // GDAL does not allow concurrent writes
+        Mutex::Lock lock(m_write_mutex);
+        m_rsrc->write( output.buffer(), bbox );
+      } else {
+        Mutex::Lock lock(m_write_mutex);
+        m_rsrc->write( tile.buffer(), bbox );
+      }
+    }
+  };
+
+  // The statistics of one DEM over one tile of the reference
+  struct TileStats {
+    BBox2i bbox;
+    uint64 count;
+    double mean, rms, nmad;
+    TileStats() : count(0), mean(0), rms(0), nmad(0) {}
+  };
+
+  // Difference a DEM against one tile of the reference. Pixels where
+  // either has no data get the nodata value, and are left out of
+  // 'values'.
+  void difference_tile( ImageView<PixelMask<double> > const& dem1,
+                        ImageViewRef<PixelMask<double> > const& dem_view,
+                        BBox2i const& bbox, Options const& opt,
+                        ImageView<double>& diff, std::vector<double>& values ) {
+    ImageView<PixelMask<double> > dem = crop( dem_view, bbox );
+    diff.set_size( bbox.width(), bbox.height() );
+    values.clear();
+    for ( int32 row = 0; row < diff.rows(); row++ ) {
+      for ( int32 col = 0; col < diff.cols(); col++ ) {
+        if ( !is_valid(dem1(col, row)) || !is_valid(dem(col, row)) ) {
+          diff(col, row) = opt.nodata_value;
+          continue;
+        }
+        double d = dem1(col, row).child() - dem(col, row).child();
+        if ( opt.use_absolute )
+          d = std::abs(d);
+        diff(col, row) = d;
+        values.push_back( d );
+      }
+    }
+  }
+
+  // The exact NMAD of the values of a tile. Reorders the values.
+  double tile_nmad( std::vector<double>& values ) {
+    if ( values.empty() )
+      return 0;
+    size_t middle = ( values.size() - 1 ) / 2;
+    std::nth_element( values.begin(), values.begin() + middle, values.end() );
+    double median = values[middle];
+    for ( size_t k = 0; k < values.size(); k++ )
+      values[k] = std::abs( values[k] - median );
+    std::nth_element( values.begin(), values.begin() + middle, values.end() );
+    return 1.4826 * values[middle];
+  }
+
+  // Difference every DEM against one tile of the reference. The stats
+  // of the tile are kept, and merged into the stats of the whole DEM.
+  class DiffTileTask : public Task, private boost::noncopyable {
+    ImageViewRef<PixelMask<double> > m_dem1;
+    std::vector<ImageViewRef<PixelMask<double> > > const& m_dems;
+    BBox2i m_bbox;
+    Options const& m_opt;
+    std::vector<boost::shared_ptr<DiffImage> >& m_diffs;
+    std::vector<StreamingStats>& m_stats;
+    std::vector<BinnedHistogram>& m_histograms;
+    std::vector<TileStats>& m_tile_stats;
+    Mutex& m_stats_mutex;
+    const ProgressCallback& m_progress;
+    float m_inc_amt;
+  public:
+    DiffTileTask( ImageViewRef<PixelMask<double> > const& dem1,
+                  std::vector<ImageViewRef<PixelMask<double> > > const& dems,
+                  BBox2i const& bbox, Options const& opt,
+                  std::vector<boost::shared_ptr<DiffImage> >& diffs,
+                  std::vector<StreamingStats>& stats,
+                  std::vector<BinnedHistogram>& histograms, std::vector<TileStats>& tile_stats,
+                  Mutex& stats_mutex, const ProgressCallback& progress, float inc_amt ) :
+      m_dem1(dem1), m_dems(dems), m_bbox(bbox), m_opt(opt), m_diffs(diffs),
+      m_stats(stats), m_histograms(histograms), m_tile_stats(tile_stats),
+      m_stats_mutex(stats_mutex), m_progress(progress), m_inc_amt(inc_amt) {}
+
+    void operator()() {
+      ImageView<PixelMask<double> > dem1 = crop( m_dem1, m_bbox );
+      ImageView<double> diff;
+      std::vector<double> values;
+      for ( size_t i = 0; i < m_dems.size(); i++ ) {
+        difference_tile( dem1, m_dems[i], m_bbox, m_opt, diff, values );
+        if ( m_diffs[i] )
+          m_diffs[i]->write_tile( diff, m_bbox );
+
+        StreamingStats stats;
+        BinnedHistogram histogram;
+        for ( size_t k = 0; k < values.size(); k++ ) {
+          stats.add( values[k] );
+          histogram.add( values[k] );
+        }
+
+        TileStats& tile = m_tile_stats[i];
+        tile.bbox  = m_bbox;
+        tile.count = stats.count();
+        tile.mean  = stats.mean();
+        tile.rms   = stats.rms();
+        tile.nmad  = tile_nmad( values );
+
+        Mutex::Lock lock(m_stats_mutex);
+        m_stats[i].merge( stats );
+        m_histograms[i].merge( histogram );
+      }
+      Mutex::Lock lock(m_stats_mutex);
+      m_progress.report_incremental_progress(m_inc_amt);
+    }
+  };
+
+  void write_stats( std::string const& stats_file, Options const& opt,
+                    std::vector<StreamingStats> const& stats,
+                    std::vector<BinnedHistogram> const& histograms ) {
+    vw_out() << "Writing statistics: " << stats_file << "\n";
+    std::ofstream out( stats_file.c_str() );
+    out.precision(10);
+    out << "# dem count mean stddev rms nmad min p05 p25 p50 p75 p95 max\n";
+    for ( size_t i = 0; i < stats.size(); i++ ) {
+      StreamingStats const& s = stats[i];
+      out << opt.dem_names[i] << " " << s.count() << " " << s.mean() << " " << s.stddev()
+          << " " << s.rms() << " " << histograms[i].nmad() << " " << s.min()
+          << " " << s.quantile(0.05) << " " << s.quantile(0.25) << " " << s.quantile(0.5)
+          << " " << s.quantile(0.75) << " " << s.quantile(0.95) << " " << s.max() << "\n";
+      vw_out() << opt.dem_names[i] << ": " << s.count() << " valid pixels, mean "
+               << s.mean() << ", stddev " << s.stddev() << ", RMS " << s.rms()
+               << ", NMAD " << histograms[i].nmad() << ", median " << histograms[i].median() << "\n";
+    }
+  }
+
+  void write_tile_stats( std::string const& stats_file, Options const& opt,
+                         std::vector<std::vector<TileStats> > const& tile_stats ) {
+    vw_out() << "Writing per-tile statistics: " << stats_file << "\n";
+    std::ofstream out( stats_file.c_str() );
+    out.precision(10);
+    out << "# dem min_col min_row cols rows count mean rms nmad\n";
+    for ( size_t i = 0; i < opt.dem_names.size(); i++ ) {
+      for ( size_t t = 0; t < tile_stats.size(); t++ ) {
+        TileStats const& s = tile_stats[t][i];
+        if ( s.count == 0 ) continue;
+        out << opt.dem_names[i] << " " << s.bbox.min().x() << " " << s.bbox.min().y()
+            << " " << s.bbox.width() << " " << s.bbox.height() << " " << s.count
+            << " " << s.mean << " " << s.rms << " " << s.nmad << "\n";
+      }
+    }
+  }
+
+}
+
 int main( int argc, char *argv[] ) {
 
   Options opt;
   try {
     handle_arguments( argc, argv, opt );
 
-    DiskImageResourceGDAL dem1_rsrc(opt.dem1_name), dem2_rsrc(opt.dem2_name);
-    double dem1_nodata = opt.nodata_value, dem2_nodata = opt.nodata_value;
+    DiskImageResourceGDAL dem1_rsrc(opt.dem1_name);
+    double dem1_nodata = opt.nodata_value;
     if ( dem1_rsrc.has_nodata_read() ) {
       dem1_nodata = dem1_rsrc.nodata_read();
       vw_out() << "\tFound input nodata value for DEM 1: " << dem1_nodata << endl;
     }
-    if ( dem2_rsrc.has_nodata_read() ) {
-      dem2_nodata = dem2_rsrc.nodata_read();
-      vw_out() << "\tFound input nodata value for DEM 2: " << dem2_nodata << endl;
-    }
-
-    DiskImageView<double> dem1_dmg(dem1_rsrc), dem2_dmg(dem2_rsrc);
-
-    GeoReference dem1_georef, dem2_georef;
+    DiskImageView<double> dem1_dmg(dem1_rsrc);
+    GeoReference dem1_georef;
     read_georeference(dem1_georef, dem1_rsrc);
-    read_georeference(dem2_georef, dem2_rsrc);
+    ImageViewRef<PixelMask<double> > dem1 = create_mask(dem1_dmg, dem1_nodata);
 
-    // Transform DEM 2 into the same perspective as DEM 1. However, we
-    // don't support datum changes!
-    if ( dem1_georef.datum().proj4_str() !=
-         dem2_georef.datum().proj4_str() ) {
-      vw_throw( NoImplErr() << "GeoDiff can't difference DEMs which are on different datums.\n" );
+    // Transform the other DEMs into the same perspective as DEM 1.
+    // However, we don't support datum changes! Nothing is read until
+    // the tiles are processed.
+    std::vector<ImageViewRef<PixelMask<double> > > dems_trans;
+    for ( size_t i = 0; i < opt.dem_names.size(); i++ ) {
+      DiskImageResourceGDAL dem2_rsrc(opt.dem_names[i]);
+      double dem2_nodata = opt.nodata_value;
+      if ( dem2_rsrc.has_nodata_read() ) {
+        dem2_nodata = dem2_rsrc.nodata_read();
+        vw_out() << "\tFound input nodata value for " << opt.dem_names[i] << ": "
+                 << dem2_nodata << endl;
+      }
+      GeoReference dem2_georef;
+      read_georeference(dem2_georef, dem2_rsrc);
+      if ( dem1_georef.datum().proj4_str() !=
+           dem2_georef.datum().proj4_str() ) {
+        vw_throw( NoImplErr() << "GeoDiff can't difference DEMs which are on different datums.\n" );
+      }
+
+      DiskImageView<double> dem2_dmg(opt.dem_names[i]);
+      dems_trans.push_back
+        ( crop(geo_transform( per_pixel_filter(dem_to_geodetic( create_mask(dem2_dmg, dem2_nodata),
+                                                                dem2_georef),
+                                               MGeodeticToMAltitude()),
+                              dem2_georef, dem1_georef,
+                              ValueEdgeExtension<PixelMask<double> >(PixelMask<double>()) ),
+               bounding_box( dem1_dmg ) ) );
     }
 
-    ImageViewRef<PixelMask<double> > dem2_trans =
-      crop(geo_transform( per_pixel_filter(dem_to_geodetic( dem2_dmg, dem2_georef),
-                                           MGeodeticToMAltitude()),
-                          dem2_georef, dem1_georef,
-                          ValueEdgeExtension<PixelMask<double> >(PixelMask<double>()) ),
-           bounding_box( dem1_dmg ) );
-
-    ImageViewRef<double> difference;
-    if ( opt.use_absolute ) {
-      difference =
-        apply_mask(abs(create_mask(dem1_dmg, dem1_nodata) - dem2_trans),
-                   opt.nodata_value );
-    } else {
-      difference =
-        apply_mask(create_mask(dem1_dmg, dem1_nodata) - dem2_trans,
-                   opt.nodata_value );
+    // Difference images are only created when asked for
+    Mutex write_mutex;
+    std::vector<boost::shared_ptr<asp::DiffImage> > diffs( opt.dem_names.size() );
+    if ( opt.write_diff ) {
+      for ( size_t i = 0; i < opt.dem_names.size(); i++ ) {
+        std::string output_file = opt.output_prefix + "-diff.tif";
+        if ( opt.dem_names.size() > 1 )
+          output_file = opt.output_prefix + "-" + fs::basename(opt.dem_names[i]) + "-diff.tif";
+        diffs[i].reset( new asp::DiffImage( output_file, Vector2i(dem1_dmg.cols(), dem1_dmg.rows()),
+                                            dem1_georef, opt, write_mutex ) );
+      }
     }
-    
-
-    std::string output_file = opt.output_prefix + "-diff.tif";
-    vw_out() << "Writing difference: " << output_file << "\n";
-
-    if ( opt.use_float ) {
-      ImageViewRef<float> difference_float = channel_cast<float>( difference );
-      boost::scoped_ptr<DiskImageResourceGDAL> rsrc( asp::build_gdal_rsrc( output_file,
-                                                                           difference_float, opt ) );
-      rsrc->set_nodata_write( opt.nodata_value );
-      write_georeference( *rsrc, dem1_georef );
-      block_write_image( *rsrc, difference_float,
-                         TerminalProgressCallback("asp", "\t--> Differencing: ") );
-    } else {
-      boost::scoped_ptr<DiskImageResourceGDAL> rsrc( asp::build_gdal_rsrc( output_file,
-                                                                           difference, opt ) );
-      rsrc->set_nodata_write( opt.nodata_value );
-      write_georeference( *rsrc, dem1_georef );
-      block_write_image( *rsrc, difference,
-                         TerminalProgressCallback("asp", "\t--> Differencing: ") );
+
+    // One pass over the tiles of the reference for all DEMs. Tiles
+    // that are a multiple of the raster tile size are written whole.
+    std::vector<BBox2i> blocks = image_blocks( dem1_dmg, opt.tile_size, opt.tile_size );
+    std::vector<asp::StreamingStats> stats( opt.dem_names.size() );
+    std::vector<asp::BinnedHistogram> histograms( opt.dem_names.size() );
+    std::vector<std::vector<asp::TileStats> >
+      tile_stats( blocks.size(), std::vector<asp::TileStats>( opt.dem_names.size() ) );
+
+    TerminalProgressCallback progress("asp", "\t--> Differencing: ");
+    Mutex stats_mutex;
+    float inc_amt = 1.0 / float(blocks.size());
+    FifoWorkQueue queue( vw_settings().default_num_threads() );
+    for ( size_t i = 0; i < blocks.size(); i++ ) {
+      boost::shared_ptr<asp::DiffTileTask>
+        task( new asp::DiffTileTask( dem1, dems_trans, blocks[i], opt, diffs, stats, histograms,
+                                     tile_stats[i], stats_mutex, progress, inc_amt ) );
+      queue.add_task( task );
     }
+    queue.join_all();
+    progress.report_finished();
+
+    asp::write_stats( opt.output_prefix + "-stats.txt", opt, stats, histograms );
+    asp::write_tile_stats( opt.output_prefix + "-tile-stats.txt", opt, tile_stats );
 
   } ASP_STANDARD_CATCHES;
 
@@ -18,6 +18,7 @@
 
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/ColorRelief.h>
 
 #include <boost/program_options.hpp>
 namespace po = boost::program_options;
@@ -30,35 +31,12 @@ namespace fs = boost::filesystem;
 
 using namespace vw;
 
-// Functors
-template <class Arg1T, class Arg2T>
-struct ReplaceChannelFunc: public ReturnFixedType<Arg1T> {
-private:
-  int m_channel;
-public:
-  ReplaceChannelFunc( int const& channel ) : m_channel(channel) {}
-
-  inline Arg1T operator()( Arg1T const& arg1,
-                           Arg2T const& arg2 ) const {
-    Arg1T t( arg1 );
-    t[m_channel] = arg2;
-    return t;
-  }
-};
-
-template <class Image1T, class Image2T>
-inline BinaryPerPixelView<Image1T, Image2T, ReplaceChannelFunc<typename Image1T::pixel_type, typename Image2T::pixel_type> >
-replace_channel( ImageViewBase<Image1T> const& image1,
-                 int const& channel,
-                 ImageViewBase<Image2T> const& image2 ) {
-  typedef ReplaceChannelFunc<typename Image1T::pixel_type, typename Image2T::pixel_type> func_type;
-  return BinaryPerPixelView<Image1T, Image2T, func_type >( image1.impl(), image2.impl(), func_type(channel));
-}
-
 // Standard Arguments
 struct Options : public asp::BaseOptions {
-  std::string input_rgb, input_gray;
-  std::string output_file;
+  std::string input_rgb, input_gray, input_dem;
+  std::string output_file, colormap_file;
+  double min_elevation, max_elevation, nodata_value;
+  asp::HillshadeOptions hillshade;
 };
 
 // Image Operations
@@ -69,10 +47,49 @@ void do_merge(Options const& opt) {
   cartography::GeoReference georef;
   cartography::read_georeference(georef, opt.input_rgb);
 
-  ImageViewRef<PixelRGB<ChannelT> > result =
-    pixel_cast<PixelRGB<ChannelT> >(replace_channel(pixel_cast<PixelHSV<ChannelT> >(rgb_image),2,shaded_image));
+  block_write_gdal_image( opt.output_file,
+                          asp::HsvMergeView<ChannelT>( rgb_image, shaded_image ),
+                          georef, opt,
+                          TerminalProgressCallback("tools.hsv_merge","Writing:") );
+}
+
+// Shade and colorize a DEM in one pass, instead of merging the
+// outputs of gdaldem hillshade and color-relief.
+void do_relief(Options const& opt) {
+  DiskImageResource *rsrc = DiskImageResource::open(opt.input_dem);
+  float nodata = opt.nodata_value;
+  if ( rsrc->has_nodata_read() )
+    nodata = rsrc->nodata_read();
+  delete rsrc;
 
-  block_write_gdal_image( opt.output_file, result, georef, opt,
+  DiskImageView<float> dem( opt.input_dem );
+  cartography::GeoReference georef;
+  bool has_georef = cartography::read_georeference(georef, opt.input_dem);
+  double pixel_width = 1, pixel_height = 1;
+  if ( has_georef ) {
+    pixel_width  = georef.transform()(0,0);
+    pixel_height = georef.transform()(1,1);
+  }
+
+  asp::ColorMap colormap;
+  if ( !opt.colormap_file.empty() ) {
+    colormap = asp::ColorMap::read( opt.colormap_file );
+  } else {
+    double min = opt.min_elevation, max = opt.max_elevation;
+    if ( min >= max ) {
+      vw_out() << "\t--> Computing the elevation range\n";
+      float lo, hi;
+      min_max_channel_values( create_mask( dem, nodata ), lo, hi );
+      min = lo;
+      max = hi;
+    }
+    colormap = asp::ColorMap::jet( min, max );
+  }
+
+  block_write_gdal_image( opt.output_file,
+                          asp::ColorReliefView( dem, nodata, pixel_width, pixel_height,
+                                                opt.hillshade, colormap ),
+                          georef, opt,
                           TerminalProgressCallback("tools.hsv_merge","Writing:") );
 }
 
@@ -82,9 +99,17 @@ int main( int argc, char *argv[] ) {
   Options opt;
 
   try {
-    po::options_description general_options("Description: Mimicks hsv_merge.py by Frank Warmerdam and Trent Hare. Use it to combine results from gdaldem.");
+    po::options_description general_options("Description: Mimicks hsv_merge.py by Frank Warmerdam and Trent Hare. Use it to combine results from gdaldem, or give it a DEM to shade and colorize directly.");
     general_options.add_options()
-      ("output-file,o", po::value(&opt.output_file), "Specify the output file.");
+      ("output-file,o", po::value(&opt.output_file), "Specify the output file.")
+      ("dem", po::value(&opt.input_dem), "Shade and colorize this DEM instead of merging an rgb and a gray image.")
+      ("colormap", po::value(&opt.colormap_file), "A gdaldem color-relief file for --dem. By default a blue to red ramp over the elevation range is used.")
+      ("min", po::value(&opt.min_elevation)->default_value(0), "The elevation at the low end of the default ramp.")
+      ("max", po::value(&opt.max_elevation)->default_value(0), "The elevation at the high end of the default ramp. The DEM range is used unless --max is above --min.")
+      ("azimuth", po::value(&opt.hillshade.azimuth)->default_value(315), "Direction of the light for --dem, in degrees clockwise from north.")
+      ("elevation", po::value(&opt.hillshade.elevation)->default_value(45), "Angle of the light above the horizon for --dem, in degrees.")
+      ("scale", po::value(&opt.hillshade.scale)->default_value(1), "Ratio of horizontal to vertical units for --dem, as for gdaldem. Use 111120 for DEMs in degrees and meters.")
+      ("nodata-value", po::value(&opt.nodata_value)->default_value(-32767), "The value of missing pixels of --dem, if it does not specify one.");
     general_options.add( asp::BaseOptionsDescription(opt) );
 
     po::options_description positional_options("");
@@ -96,11 +121,19 @@ int main( int argc, char *argv[] ) {
     positional_desc.add("input-rgb", 1 );
     positional_desc.add("input-gray", 1 );
 
-    std::string usage("[options] <input rgb> <input gray>");
+    std::string usage("[options] <input rgb> <input gray>\n  or: hsv_merge [options] --dem <dem>");
     po::variables_map vm =
       asp::check_command_line( argc, argv, opt, general_options, general_options,
                                positional_options, positional_desc, usage );
 
+    if ( !opt.input_dem.empty() ) {
+      if ( !opt.input_rgb.empty() || !opt.input_gray.empty() )
+        vw_throw( ArgumentErr() << "Input images cannot be used with --dem.\n"
+                  << usage << general_options );
+      do_relief( opt );
+      return 0;
+    }
+
     if ( opt.input_rgb.empty() || opt.input_gray.empty() )
       vw_throw( ArgumentErr() << "Missing required input files.\n"
                 << usage << general_options );
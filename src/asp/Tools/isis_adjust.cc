@@ -24,6 +24,7 @@
 
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/AdjustParallelSparse.h>
 #include <asp/Tools/isis_adjust.h>
 
 namespace po = boost::program_options;
@@ -38,7 +39,8 @@ using namespace vw::ba;
 struct Options : public asp::BaseOptions {
   Options() : lambda(-1), seed_previous(false) {}
   // Input
-  std::string cnet_file, cost_function, ba_type, output_prefix;
+  std::string cnet_file, cost_function, ba_type, output_prefix,
+    linear_solver, preconditioner;
   std::vector<std::string> input_names, gcp_names, gcp_cnet_names, directory_names;
   double cam_position_sigma, cam_pose_sigma, gcp_scalar,
     lambda, robust_threshold;
@@ -54,6 +56,17 @@ struct Options : public asp::BaseOptions {
   std::vector< boost::shared_ptr< IsisAdjustCameraModel > > camera_models;
 };
 
+// Only the parallel adjuster has linear solver settings. The ISIS
+// cameras are evaluated on a single thread.
+template <class AdjusterT>
+void set_linear_solver( AdjusterT& /*adjuster*/, Options const& /*opt*/ ) {}
+
+template <class ModelT, class CostT>
+void set_linear_solver( asp::AdjustParallelSparse<ModelT, CostT>& adjuster, Options const& opt ) {
+  adjuster.set_linear_solver_options( asp::linear_solver_options( opt.linear_solver,
+                                                                  opt.preconditioner ) );
+}
+
 // Helper Function to allow selection of different Bundle Adjustment Algorithms.
 //------------------------------------------------------------------------------
 template <class AdjusterT>
@@ -73,6 +86,7 @@ void do_ba( typename AdjusterT::cost_type const& cost_function,
     bundle_adjuster.set_lambda( opt.lambda );
   if ( cost_function.name_tag() != "L2Error" )
     bundle_adjuster.set_control( 1 ); // Shutting off fast Fletcher-style control
+  set_linear_solver( bundle_adjuster, opt );
   if ( opt.seed_previous ) {
     vw_out() << "Seeding with previous ISIS adjustment files.\n";
     for (unsigned j = 0; j < opt.input_names.size(); ++j ) {
@@ -189,7 +203,11 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("cost-function", po::value(&opt.cost_function)->default_value("L2"),
      "Choose a robust cost function from [PseudoHuber, Huber, L1, L2, Cauchy]")
     ("bundle-adjuster", po::value(&opt.ba_type)->default_value("Sparse"),
-     "Choose a bundle adjustment version from [Ref, Sparse, RobustRef, RobustSparse]")
+     "Choose a bundle adjustment version from [Ref, Sparse, RobustRef, RobustSparse, ParallelSparse]")
+    ("linear-solver", po::value(&opt.linear_solver)->default_value("Cholesky"),
+     "Choose how ParallelSparse solves the reduced camera system from [Cholesky, PCG]")
+    ("preconditioner", po::value(&opt.preconditioner)->default_value("BlockJacobi"),
+     "Choose the preconditioner of PCG from [BlockJacobi, Jacobi]")
     ("directory,d", po::value(&opt.directory_names),
      "Directory(-ies) to search for match files. Defaults with current directory.")
     ("disable-camera-const", po::bool_switch(&opt.disable_camera)->default_value(false),
@@ -256,9 +274,11 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   if ( !( opt.ba_type == "ref" ||
           opt.ba_type == "sparse" ||
           opt.ba_type == "robustref" ||
-          opt.ba_type == "robustsparse" ) )
+          opt.ba_type == "robustsparse" ||
+          opt.ba_type == "parallelsparse" ) )
     vw_throw( ArgumentErr() << "Unknown bundle adjustment version: " << opt.ba_type
-              << ". Options are : [Ref, Sparse, RobustRef, RobustSparse]\n" );
+              << ". Options are : [Ref, Sparse, RobustRef, RobustSparse, ParallelSparse]\n" );
+  asp::linear_solver_options( opt.linear_solver, opt.preconditioner );
   if ( opt.directory_names.empty() )
     opt.directory_names.push_back( std::string(".") );
 }
@@ -417,6 +437,18 @@ int main(int argc, char* argv[]) {
         } else if ( opt.cost_function == "cauchy" ) {
           do_ba<AdjustSparse< ModelType, CauchyError > >( CauchyError(opt.robust_threshold), opt );
         }
+      } else if ( opt.ba_type == "parallelsparse" ) {
+        if ( opt.cost_function == "pseudohuber" ) {
+          do_ba<asp::AdjustParallelSparse< ModelType, PseudoHuberError > >( PseudoHuberError(opt.robust_threshold), opt );
+        } else if ( opt.cost_function == "huber" ) {
+          do_ba<asp::AdjustParallelSparse< ModelType, HuberError > >( HuberError(opt.robust_threshold), opt );
+        } else if ( opt.cost_function == "l1" ) {
+          do_ba<asp::AdjustParallelSparse< ModelType, L1Error > >( L1Error(), opt );
+        } else if ( opt.cost_function == "l2" ) {
+          do_ba<asp::AdjustParallelSparse< ModelType, L2Error > >( L2Error(), opt );
+        } else if ( opt.cost_function == "cauchy" ) {
+          do_ba<asp::AdjustParallelSparse< ModelType, CauchyError > >( CauchyError(opt.robust_threshold), opt );
+        }
       } else if ( opt.ba_type == "robustref" ) {
         if ( opt.cost_function == "l2" ) {
           do_ba<AdjustRobustRef< ModelType,L2Error> >( L2Error(), opt );
@@ -23,6 +23,7 @@
 using namespace vw;
 using namespace vw::cartography;
 
+#include <vw/Core/ThreadPool.h>
 #include <asp/Core/OrthoRasterizer.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
@@ -178,8 +179,54 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   opt.has_nodata_value = vm.count("nodata-value");
 }
 
-template <class ImageT>
-ImageViewRef<PixelGray<float> >
+// A pixel with every channel set to value
+template <class PixelT>
+PixelT fill_pixel( float value ) {
+  PixelT px;
+  for ( int ch = 0; ch < CompoundNumChannels<PixelT>::value; ch++ )
+    compound_select_channel<float&>(px, ch) = value;
+  return px;
+}
+
+// For oversampling, each channel of the raster is paired with a
+// channel that is 1 where it is no-data and 0 elsewhere, and both are
+// filtered together. A filtered channel is then valid only where its
+// no-data channel is still 0, as if it were rasterized and masked on
+// its own.
+template <class PixelT>
+struct MarkNodata : public ReturnFixedType<Vector<float, 2*CompoundNumChannels<PixelT>::value> > {
+  static const int NUM_CHANNELS = CompoundNumChannels<PixelT>::value;
+  float m_nodata_value;
+  MarkNodata(float nodata_value) : m_nodata_value(nodata_value) {}
+  Vector<float, 2*NUM_CHANNELS> operator()(PixelT const& px) const {
+    Vector<float, 2*NUM_CHANNELS> result;
+    for ( int ch = 0; ch < NUM_CHANNELS; ch++ ) {
+      float value = compound_select_channel<float const&>(px, ch);
+      if ( value == m_nodata_value )
+        result[NUM_CHANNELS + ch] = 1;
+      else
+        result[ch] = value;
+    }
+    return result;
+  }
+};
+
+template <class PixelT>
+struct ApplyNodata : public ReturnFixedType<PixelT> {
+  static const int NUM_CHANNELS = CompoundNumChannels<PixelT>::value;
+  float m_nodata_value;
+  ApplyNodata(float nodata_value) : m_nodata_value(nodata_value) {}
+  PixelT operator()(Vector<float, 2*NUM_CHANNELS> const& px) const {
+    PixelT result;
+    for ( int ch = 0; ch < NUM_CHANNELS; ch++ )
+      compound_select_channel<float&>(result, ch) =
+        px[NUM_CHANNELS + ch] > 0 ? m_nodata_value : px[ch];
+    return result;
+  }
+};
+
+template <class PixelT, class ImageT>
+ImageViewRef<PixelT>
 generate_fsaa_raster( ImageViewBase<ImageT> const& rasterizer,
                       Options const& opt ) {
   // This probably needs a lanczos filter. Sinc filter is the ideal
@@ -187,44 +234,32 @@ generate_fsaa_raster( ImageViewBase<ImageT> const& rasterizer,
   // ... or ...
   // possibly apply the blur on a linear scale (pow(0,2.2), blur, then exp).
 
-  ImageViewRef<PixelGray<float> > rasterizer_fsaa;
-  if ( opt.target_projwin != BBox2() ) {
-    typedef ValueEdgeExtension<PixelGray<float> > ValExtend;
-    if ( opt.fsaa > 1 ) {
-      // subsample .. samples from the corner.
-      rasterizer_fsaa =
-        crop(edge_extend(
-                         apply_mask(
-                                    subsample(
-                                              translate(
-                                                        gaussian_filter(
-                                                                        create_mask(rasterizer.impl(),opt.nodata_value),
-                                                                        1.0f * float(opt.fsaa)/2.0f),
-                                                        -double(opt.fsaa-1)/2., double(opt.fsaa-1)/2.,
-                                                        ConstantEdgeExtension()), opt.fsaa),
-                                    opt.nodata_value),
-                         ValExtend(opt.nodata_value)), opt.target_projwin_pixels );
-    } else {
-      rasterizer_fsaa =
-        crop(edge_extend(rasterizer.impl(),
-                         ValExtend(opt.nodata_value)), opt.target_projwin_pixels );
-    }
+  // Pixels not covered by the point cloud have all channels at the
+  // no-data value.
+  PixelT nodata = fill_pixel<PixelT>(opt.nodata_value);
+
+  ImageViewRef<PixelT> rasterizer_fsaa;
+  if ( opt.fsaa > 1 ) {
+    // subsample .. samples from the corner.
+    rasterizer_fsaa =
+      per_pixel_filter(
+                       subsample(
+                                 translate(
+                                           gaussian_filter(
+                                                           per_pixel_filter(rasterizer.impl(),
+                                                                            MarkNodata<PixelT>(opt.nodata_value)),
+                                                           1.0f * float(opt.fsaa)/2.0f),
+                                           -double(opt.fsaa-1)/2., double(opt.fsaa-1)/2.,
+                                           ConstantEdgeExtension()), opt.fsaa),
+                       ApplyNodata<PixelT>(opt.nodata_value));
   } else {
-    if ( opt.fsaa > 1 ) {
-      // subsample .. samples from the corner.
-      rasterizer_fsaa =
-        apply_mask(
-                   subsample(
-                             translate(
-                                       gaussian_filter(
-                                                       create_mask(rasterizer.impl(),opt.nodata_value),
-                                                       1.0f * float(opt.fsaa)/2.0f),
-                                       -double(opt.fsaa-1)/2., double(opt.fsaa-1)/2.,
-                                       ConstantEdgeExtension()), opt.fsaa),
-                   opt.nodata_value);
-    } else {
-      rasterizer_fsaa = rasterizer.impl();
-    }
+    rasterizer_fsaa = rasterizer.impl();
+  }
+
+  if ( opt.target_projwin != BBox2() ) {
+    typedef ValueEdgeExtension<PixelT> ValExtend;
+    rasterizer_fsaa =
+      crop(edge_extend(rasterizer_fsaa, ValExtend(nodata)), opt.target_projwin_pixels );
   }
   return rasterizer_fsaa;
 }
@@ -288,105 +323,145 @@ namespace asp{
                                                   ErrorToNED(georef) );
   }
 
-  template<class ImageT>
-  void save_image(Options const& opt, ImageT img, GeoReference const& georef,
-                  std::string const& imgName){
-
-    std::string output_file = opt.out_prefix + "-" + imgName + "." + opt.output_file_type;
-    vw_out() << "Writing: " << output_file << "\n";
-    if ( opt.output_file_type == "tif" ) {
-      boost::scoped_ptr<DiskImageResourceGDAL> rsrc( asp::build_gdal_rsrc( output_file, img, opt) );
-      rsrc->set_nodata_write( opt.nodata_value );
-      write_georeference( *rsrc, georef );
-      block_write_image( *rsrc, img,
-                         TerminalProgressCallback("asp", imgName + ": ") );
-    } else {
-      asp::write_gdal_georeferenced_image(output_file, img, georef, opt,
-                                          TerminalProgressCallback("asp", imgName + ":") );
-    }
-  }
-
-  // A class for combining the three channels of errors and finding
-  // their absolute values.
-  template <class ImageT>
-  class CombinedView : public ImageViewBase<CombinedView<ImageT> >
-  {
-    double m_nodata_value;
-    ImageT m_image1;
-    ImageT m_image2;
-    ImageT m_image3;
-    typedef typename ImageT::pixel_type dpixel_type;
+  // Functors that turn a pixel of the multi-channel raster into a
+  // pixel of one of the output products.
 
-  public:
-
-    typedef Vector3f pixel_type;
-    typedef const Vector3f result_type;
-    typedef ProceduralPixelAccessor<CombinedView> pixel_accessor;
-
-    CombinedView(double nodata_value,
-                 ImageViewBase<ImageT> const& image1,
-                 ImageViewBase<ImageT> const& image2,
-                 ImageViewBase<ImageT> const& image3):
-      m_nodata_value(nodata_value),
-      m_image1( image1.impl() ),
-      m_image2( image2.impl() ),
-      m_image3( image3.impl() ){}
-
-    inline int32 cols() const { return m_image1.cols(); }
-    inline int32 rows() const { return m_image1.rows(); }
-    inline int32 planes() const { return 1; }
+  template <class PixelT>
+  struct SelectRasterChannel : public ReturnFixedType<float> {
+    int m_channel;
+    SelectRasterChannel(int channel) : m_channel(channel) {}
+    float operator()(PixelT const& px) const { return px[m_channel]; }
+  };
 
-    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+  // Absolute values of the three error channels starting at
+  // m_channel. If any of them is no-data, so is the result.
+  template <class PixelT>
+  struct ErrorMagnitude : public ReturnFixedType<Vector3f> {
+    int m_channel;
+    float m_nodata_value;
+    ErrorMagnitude(int channel, float nodata_value) :
+      m_channel(channel), m_nodata_value(nodata_value) {}
+    Vector3f operator()(PixelT const& px) const {
+      Vector3f error(px[m_channel], px[m_channel+1], px[m_channel+2]);
+      if (error[0] == m_nodata_value || error[1] == m_nodata_value ||
+          error[2] == m_nodata_value)
+        return Vector3f(m_nodata_value, m_nodata_value, m_nodata_value);
+      return Vector3f(std::abs(error[0]), std::abs(error[1]), std::abs(error[2]));
+    }
+  };
 
-    inline result_type operator()( size_t i, size_t j, size_t p=0 ) const {
+  // The DEM stretched from [min_z, max_z] to [0, 255] (for debugging)
+  template <class PixelT>
+  struct NormalizeHeight : public ReturnFixedType<uint8> {
+    float m_nodata_value, m_min_z, m_max_z;
+    NormalizeHeight(float nodata_value, float min_z, float max_z) :
+      m_nodata_value(nodata_value), m_min_z(min_z), m_max_z(max_z) {}
+    uint8 operator()(PixelT const& px) const {
+      if (px[0] == m_nodata_value || m_max_z <= m_min_z) return 0;
+      double value = (px[0] - m_min_z) * 255.0 / (m_max_z - m_min_z);
+      return uint8(std::min(std::max(value, 0.0), 255.0));
+    }
+  };
 
-      Vector3f error(m_image1(i, j), m_image2(i, j), m_image3(i, j));
+  // One file written from the rasterized tiles
+  template <class PixelT>
+  class RasterProduct {
+  public:
+    virtual ~RasterProduct() {}
+    virtual void write_tile(ImageView<PixelT> const& tile, BBox2i const& bbox) = 0;
+  };
 
-      if (error[0] == m_nodata_value || error[1] == m_nodata_value || error[2] == m_nodata_value){
-        return Vector3f(m_nodata_value, m_nodata_value, m_nodata_value);
-      }
+  template <class PixelT, class FuncT>
+  class RasterProductImpl : public RasterProduct<PixelT> {
+    FuncT m_func;
+    TileWriter<typename FuncT::result_type> m_writer;
+  public:
+    RasterProductImpl(std::string const& output_file, FuncT const& func,
+                      Vector2i const& size, GeoReference const& georef,
+                      Options const& opt, Mutex& write_mutex) :
+      m_func(func), m_writer(output_file, size, opt, write_mutex) {
+      vw_out() << "Writing: " << output_file << "\n";
+      m_writer.resource().set_nodata_write( opt.nodata_value );
+      write_georeference( m_writer.resource(), georef );
+    }
 
-      return Vector3f(std::abs(error[0]), std::abs(error[1]), std::abs(error[2]));
+    virtual void write_tile(ImageView<PixelT> const& tile, BBox2i const& bbox) {
+      m_writer.write_tile( per_pixel_filter(tile, m_func), bbox );
     }
+  };
 
-    /// \cond INTERNAL
-    typedef CombinedView<typename ImageT::prerasterize_type> prerasterize_type;
+  template <class PixelT, class FuncT>
+  boost::shared_ptr<RasterProduct<PixelT> >
+  make_raster_product(std::string const& output_file, FuncT const& func,
+                      Vector2i const& size, GeoReference const& georef,
+                      Options const& opt, Mutex& write_mutex) {
+    return boost::shared_ptr<RasterProduct<PixelT> >
+      ( new RasterProductImpl<PixelT, FuncT>(output_file, func, size, georef,
+                                             opt, write_mutex) );
+  }
 
-    inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
-      return prerasterize_type(m_nodata_value,
-                               m_image1.prerasterize(bbox),
-                               m_image2.prerasterize(bbox),
-                               m_image3.prerasterize(bbox)
-                               );
-    }
-    template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
-      vw::rasterize( prerasterize(bbox), dest, bbox );
+  // Rasterize one tile of the multi-channel raster and hand it to
+  // every product.
+  template <class PixelT>
+  class RasterProductsTask : public Task, private boost::noncopyable {
+    ImageViewRef<PixelT> m_raster;
+    BBox2i m_bbox;
+    std::vector<boost::shared_ptr<RasterProduct<PixelT> > >& m_products;
+    Mutex& m_progress_mutex;
+    const ProgressCallback& m_progress;
+    float m_inc_amt;
+  public:
+    RasterProductsTask(ImageViewRef<PixelT> const& raster, BBox2i const& bbox,
+                       std::vector<boost::shared_ptr<RasterProduct<PixelT> > >& products,
+                       Mutex& progress_mutex, const ProgressCallback& progress,
+                       float inc_amt) :
+      m_raster(raster), m_bbox(bbox), m_products(products),
+      m_progress_mutex(progress_mutex), m_progress(progress), m_inc_amt(inc_amt) {}
+
+    void operator()() {
+      ImageView<PixelT> tile = crop(m_raster, m_bbox);
+      for (size_t i = 0; i < m_products.size(); i++)
+        m_products[i]->write_tile(tile, m_bbox);
+      Mutex::Lock lock(m_progress_mutex);
+      m_progress.report_incremental_progress(m_inc_amt);
     }
-    /// \endcond
   };
-  template <class ImageT>
-  CombinedView<ImageT> combine_channels(double nodata_value,
-                                        ImageViewBase<ImageT> const& image1,
-                                        ImageViewBase<ImageT> const& image2,
-                                        ImageViewBase<ImageT> const& image3){
-    VW_ASSERT(image1.impl().cols() == image2.impl().cols() &&
-              image2.impl().cols() == image3.impl().cols() &&
-              image1.impl().rows() == image2.impl().rows() &&
-              image2.impl().rows() == image3.impl().rows(),
-              ArgumentErr() << "Expecting the error channels to have the same size.");
-
-    return CombinedView<ImageT>(nodata_value, image1.impl(), image2.impl(), image3.impl());
+
+  // Traverse the raster once, tile by tile, writing all products.
+  template <class PixelT>
+  void write_raster_products(ImageViewRef<PixelT> const& raster,
+                             std::vector<boost::shared_ptr<RasterProduct<PixelT> > >& products,
+                             Options const& opt, const ProgressCallback& progress) {
+    std::vector<BBox2i> blocks =
+      image_blocks(raster, opt.raster_tile_size.x(), opt.raster_tile_size.y());
+    FifoWorkQueue queue( vw_settings().default_num_threads() );
+    Mutex progress_mutex;
+    float inc_amt = 1.0 / float(blocks.size());
+    for (size_t i = 0; i < blocks.size(); i++) {
+      boost::shared_ptr<RasterProductsTask<PixelT> >
+        task( new RasterProductsTask<PixelT>(raster, blocks[i], products,
+                                             progress_mutex, progress, inc_amt) );
+      queue.add_task(task);
+    }
+    queue.join_all();
+    progress.report_finished();
   }
 }
 
-template <class ViewT>
-void do_software_rasterization( const ImageViewBase<ViewT>& proj_point_input,
-                                Options& opt,
-                                cartography::GeoReference& georef ) {
+// Rasterize the height and all requested attributes (triangulation
+// error, DRG) as NUM_CHANNELS channels of one raster, so the point
+// cloud is read and triangulated only once for all products.
+template <int NUM_CHANNELS, class ViewT>
+void rasterize_products( const ImageViewBase<ViewT>& proj_point_input,
+                         int num_error_channels,
+                         Options& opt,
+                         cartography::GeoReference& georef ) {
+  typedef Vector<float, NUM_CHANNELS> PixelT;
+
   Stopwatch sw1;
   sw1.start();
 
-  OrthoRasterizerView<PixelGray<float>, ViewT >
+  OrthoRasterizerView<PixelT, ViewT >
     rasterizer(proj_point_input.impl(), select_channel(proj_point_input.impl(),2),
                opt.dem_spacing, TerminalProgressCallback("asp","QuadTree: ") );
 
@@ -449,81 +524,102 @@ void do_software_rasterization( const ImageViewBase<ViewT>& proj_point_input,
 
   vw_out() << "\nOutput Georeference: \n\t" << georef << std::endl;
 
-  ImageViewRef<PixelGray<float> > rasterizer_fsaa =
-    generate_fsaa_raster( rasterizer, opt );
-  vw_out()<< "Creating output file that is " << bounding_box(rasterizer_fsaa).size() << " px.\n";
-
-  if ( !opt.no_dem ) { // Write out the DEM. (Normally users want this.)
-    Stopwatch sw2;
-    sw2.start();
-    save_image(opt, rasterizer_fsaa, georef, "DEM");
-    sw2.stop();
-    vw_out(DebugMessage,"asp") << "Render time: "
-                               << sw2.elapsed_seconds() << std::endl;
+  // The remaining channels carry the triangulation error and the
+  // orthoimage, in that order.
+  if ( num_error_channels == 1 ) {
+    // The error is a scalar.
+    ImageViewRef<Vector4> point_disk_image = read_n_channels<4>(opt.pointcloud_filename);
+    rasterizer.add_texture( select_channel(point_disk_image,3) );
+  } else if ( num_error_channels == 3 ) {
+    // The error is a 3D vector. Convert it to the NED coordinate
+    // system, and rasterize its three components.
+    ImageViewRef<Vector6> point_disk_image = read_n_channels<6>(opt.pointcloud_filename);
+    rasterizer.add_texture( asp::error_to_NED(point_disk_image, georef) );
   }
+  int drg_channel = 1 + num_error_channels;
+  if (!opt.texture_filename.empty())
+    rasterizer.add_texture( DiskImageView<PixelGray<float> >(opt.texture_filename) );
+
+  ImageViewRef<PixelT> rasterizer_fsaa =
+    generate_fsaa_raster<PixelT>( rasterizer, opt );
+  Vector2i size = bounding_box(rasterizer_fsaa).size();
+  vw_out()<< "Creating output file that is " << size << " px.\n";
+
+  Mutex write_mutex;
+  std::vector<boost::shared_ptr<asp::RasterProduct<PixelT> > > products;
+  std::string suffix = "." + opt.output_file_type;
+
+  if ( !opt.no_dem ) // Write out the DEM. (Normally users want this.)
+    products.push_back( asp::make_raster_product<PixelT>
+                        ( opt.out_prefix + "-DEM" + suffix,
+                          asp::SelectRasterChannel<PixelT>(0),
+                          size, georef, opt, write_mutex ) );
 
   // Write triangulation error image if requested
+  if ( num_error_channels == 1 )
+    products.push_back( asp::make_raster_product<PixelT>
+                        ( opt.out_prefix + "-IntersectionErr" + suffix,
+                          asp::SelectRasterChannel<PixelT>(1),
+                          size, georef, opt, write_mutex ) );
+  else if ( num_error_channels == 3 )
+    products.push_back( asp::make_raster_product<PixelT>
+                        ( opt.out_prefix + "-IntersectionErr" + suffix,
+                          asp::ErrorMagnitude<PixelT>(1, opt.nodata_value),
+                          size, georef, opt, write_mutex ) );
+
+  // Write DRG if the user requested and provided a texture file
+  if (!opt.texture_filename.empty())
+    products.push_back( asp::make_raster_product<PixelT>
+                        ( opt.out_prefix + "-DRG.tif",
+                          asp::SelectRasterChannel<PixelT>(drg_channel),
+                          size, georef, opt, write_mutex ) );
+
+  // Write out a normalized version of the DEM, if requested (for debugging)
+  if (opt.do_normalize)
+    products.push_back( asp::make_raster_product<PixelT>
+                        ( opt.out_prefix + "-DEM-normalized" + suffix,
+                          asp::NormalizeHeight<PixelT>(opt.nodata_value,
+                                                       rasterizer.bounding_box().min().z(),
+                                                       rasterizer.bounding_box().max().z()),
+                          size, georef, opt, write_mutex ) );
+
+  if ( products.empty() )
+    return;
+
+  Stopwatch sw2;
+  sw2.start();
+  asp::write_raster_products( rasterizer_fsaa, products, opt,
+                              TerminalProgressCallback("asp", "Rasterizing: ") );
+  sw2.stop();
+  vw_out(DebugMessage,"asp") << "Render time: "
+                             << sw2.elapsed_seconds() << std::endl;
+}
+
+template <class ViewT>
+void do_software_rasterization( const ImageViewBase<ViewT>& proj_point_input,
+                                Options& opt,
+                                cartography::GeoReference& georef ) {
+
+  int num_error_channels = 0;
   if ( opt.do_error ) {
     int num_channels = get_num_channles(opt.pointcloud_filename);
-
-    if (num_channels == 4){
-      // The error is a scalar.
-      DiskImageView<Vector4> point_disk_image(opt.pointcloud_filename);
-      ImageViewRef<double> error_channel = select_channel(point_disk_image,3);
-      rasterizer.set_texture( error_channel );
-      rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
-      save_image(opt, rasterizer_fsaa, georef, "IntersectionErr");
-    }else if (num_channels == 6){
-      // The error is a 3D vector. Convert it to NED coordinate system,
-      // and rasterize it.
-      DiskImageView<Vector6> point_disk_image(opt.pointcloud_filename);
-      ImageViewRef<Vector3> ned_err = asp::error_to_NED(point_disk_image, georef);
-      std::vector< ImageViewRef<PixelGray<float> > >  rasterized(3);
-      for (int ch_index = 0; ch_index < 3; ch_index++){
-        // Cache the channel to disk, to force the rasterization
-        // to happen right away, before we switch to the next one.
-        ImageViewRef<double> ch = select_channel(ned_err, ch_index);
-        rasterizer.set_texture(ch);
-        rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
-        rasterized[ch_index] =
-          block_cache(rasterizer_fsaa,Vector2i(vw_settings().default_tile_size(),
-                                               vw_settings().default_tile_size()),0);
-      }
-      save_image(opt,
-                 asp::combine_channels(opt.nodata_value,
-                                       rasterized[0], rasterized[1], rasterized[2]),
-                 georef, "IntersectionErr");
-    }else{
+    if (num_channels == 4)
+      num_error_channels = 1;
+    else if (num_channels == 6)
+      num_error_channels = 3;
+    else
       vw_throw( ArgumentErr() << "Expecting the input point cloud to have points of size 4 or 6.");
-    }
   }
 
-  // Write DRG if the user requested and provided a texture file
-  if (!opt.texture_filename.empty()) {
-    DiskImageView<PixelGray<float> > texture(opt.texture_filename);
-    rasterizer.set_texture(texture);
-    rasterizer_fsaa =
-      generate_fsaa_raster( rasterizer, opt );
-    std::string output_file = opt.out_prefix + "-DRG.tif";
-    vw_out() << "Writing DRG: " << output_file << "\n";
-    boost::scoped_ptr<DiskImageResourceGDAL> rsrc( asp::build_gdal_rsrc( output_file, rasterizer_fsaa, opt ) );
-    rsrc->set_nodata_write( opt.nodata_value );
-    write_georeference( *rsrc, georef );
-    block_write_image( *rsrc, rasterizer_fsaa,
-                       TerminalProgressCallback("asp","DRG:") );
-  }
-
-  // Write out a normalized version of the DEM, if requested (for debugging)
-  if (opt.do_normalize) {
-    DiskImageView<PixelGray<float> >
-      dem_image(opt.out_prefix + "-DEM." + opt.output_file_type);
-
-    save_image(opt,
-               apply_mask(channel_cast<uint8>(normalize(create_mask(dem_image,opt.nodata_value),
-                                                        rasterizer.bounding_box().min().z(),
-                                                        rasterizer.bounding_box().max().z(),
-                                                        0, 255))),
-               georef, "DEM-normalized");
+  int num_channels = 1 + num_error_channels + (opt.texture_filename.empty() ? 0 : 1);
+  switch (num_channels) {
+  case 1: rasterize_products<1>(proj_point_input, num_error_channels, opt, georef); break;
+  case 2: rasterize_products<2>(proj_point_input, num_error_channels, opt, georef); break;
+  case 3: rasterize_products<3>(proj_point_input, num_error_channels, opt, georef); break;
+  case 4: rasterize_products<4>(proj_point_input, num_error_channels, opt, georef); break;
+  case 5: rasterize_products<5>(proj_point_input, num_error_channels, opt, georef); break;
+  default:
+    vw_throw( LogicErr() << "Unexpected number of raster channels: " << num_channels << ".");
   }
 }
 
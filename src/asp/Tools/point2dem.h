@@ -30,6 +30,7 @@
 #include <vw/Image.h>
 #include <vw/Math.h>
 #include <vw/Cartography.h>
+#include <asp/Core/PointCloudQuantization.h>
 
 namespace vw {
 
@@ -135,8 +136,23 @@ namespace vw {
     return num_channels*num_planes;
   }
 
+  // Dequantize the first n channels of an int32 point cloud with m
+  // channels. Only 3, 4 and 6 channel clouds are ever quantized.
+  template<int n>
+  ImageViewRef< Vector<double, n> > read_quantized_channels(std::string filename, int m,
+                                                          asp::PointCloudQuantization const& quant){
+    ImageViewRef< Vector<double, n> > out_image;
+    if      (m == 3) out_image = asp::dequantize_points<n, 3>(DiskImageView< Vector<int32, 3> >(filename), quant);
+    else if (m == 4) out_image = asp::dequantize_points<n, 4>(DiskImageView< Vector<int32, 4> >(filename), quant);
+    else if (m == 6) out_image = asp::dequantize_points<n, 6>(DiskImageView< Vector<int32, 6> >(filename), quant);
+    else vw_throw( NoImplErr() << "Reading quantized point clouds with "
+                   << m << " channels is not implemented.");
+    return out_image;
+  }
+
   // Given an image with each pixel a vector of size m, return the
   // first n channels of that image. We must have 1 <= n <= m <= 6.
+  // Quantized point clouds are dequantized on the fly.
   template<int n>
   ImageViewRef< Vector<double, n> > read_n_channels(std::string filename){
 
@@ -152,6 +168,10 @@ namespace vw {
                NoImplErr() << "Reading from images with more than "
                << max_m << " channels is not implemented.");
 
+    asp::PointCloudQuantization quant = asp::read_point_cloud_quantization(filename);
+    if (quant.is_quantized())
+      return read_quantized_channels<n>(filename, m, quant);
+
     ImageViewRef< Vector<double, n> > out_image;
     if      (m == 1) out_image = select_points<n, 1>(DiskImageView< Vector<double, 1> >(filename));
     else if (m == 2) out_image = select_points<n, 2>(DiskImageView< Vector<double, 2> >(filename));
@@ -21,14 +21,18 @@
 
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <boost/program_options.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
 #include <liblas/liblas.hpp>
 
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <asp/Tools/point2dem.h> // We share common functions with point2dem
 
+#include <vw/Core/ThreadPool.h>
 #include <vw/FileIO.h>
 #include <vw/Image.h>
 #include <vw/Math.h>
@@ -50,6 +54,8 @@ struct Options : asp::BaseOptions {
   bool compressed;
   // Output
   std::string out_prefix;
+  int tile_size;
+  bool tiled;
 };
 
 void handle_arguments( int argc, char *argv[], Options& opt ) {
@@ -57,7 +63,10 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   po::options_description general_options("General Options");
   general_options.add_options()
     ("compressed,c", "Compress using laszip.")
-    ("output-prefix,o", po::value(&opt.out_prefix), "Specify the output prefix.");
+    ("output-prefix,o", po::value(&opt.out_prefix), "Specify the output prefix.")
+    ("las-tile-size", po::value(&opt.tile_size)->default_value(1024),
+     "Size in pixels of the point cloud tiles read and converted in parallel.")
+    ("tiled", "Write one LAS file per tile of the point cloud, plus an index listing the files and their bounds, instead of a single file.");
 
   general_options.add( asp::BaseOptionsDescription(opt) );
 
@@ -77,74 +86,311 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     vw_throw( ArgumentErr() << "Missing point cloud.\n"
               << usage << general_options );
 
+  if ( opt.tile_size <= 0 )
+    vw_throw( ArgumentErr() << "The LAS tile size must be positive.\n"
+              << usage << general_options );
+
   if ( opt.out_prefix.empty() )
     opt.out_prefix =
       asp::prefix_from_filename( opt.pointcloud_filename );
 
   opt.compressed = vm.count("compressed");
-
+  opt.tiled = vm.count("tiled");
 }
 
-int main( int argc, char *argv[] ) {
-
-  // To do: need to understand what is the optimal strategy for
-  // traversing the input point cloud file to minimize the reading
-  // time.
-
-  Options opt;
-  try {
-    handle_arguments( argc, argv, opt );
-
-    ImageViewRef<Vector3> point_image = read_n_channels<3>(opt.pointcloud_filename);
-    BBox3 cloud_bbox = pointcloud_bbox(point_image);
-
-    // The las format stores the values as 32 bit integers. So, for a
-    // given point, we store round((point-offset)/scale), as well as
-    // the offset and scale values. Here we decide the values for
-    // offset and scale to lose minimum amount of precision. We make
-    // the scale almost as large as it can be without causing integer
-    // overflow.
+namespace asp {
+
+  // The valid points of one tile of the point cloud. The point
+  // Vector3(), being at the center of the planet, is an invalid point.
+  void read_las_tile( ImageViewRef<Vector3> const& point_image, BBox2i const& bbox,
+                      std::vector<Vector3>& points, BBox3& point_bbox ) {
+    ImageView<Vector3> tile = crop( point_image, bbox );
+    points.clear();
+    point_bbox = BBox3();
+    for ( int32 row = 0; row < tile.rows(); row++ ) {
+      for ( int32 col = 0; col < tile.cols(); col++ ) {
+        Vector3 const& point = tile(col, row);
+        if ( point == Vector3() ) continue; // skip no-data points
+        points.push_back( point );
+        point_bbox.grow( point );
+      }
+    }
+  }
+
+  // The las format stores the values as 32 bit integers. So, for a
+  // given point, we store round((point-offset)/scale), as well as
+  // the offset and scale values. Here we decide the values for
+  // offset and scale to lose minimum amount of precision. We make
+  // the scale almost as large as it can be without causing integer
+  // overflow.
+  liblas::Header las_header( BBox3 const& cloud_bbox, uint64 num_points, bool compressed ) {
     Vector3 offset = (cloud_bbox.min() + cloud_bbox.max())/2.0;
     double maxInt = std::numeric_limits<int32>::max();
     maxInt *= 0.95; // Just in case stay a bit away
     Vector3 scale = cloud_bbox.size()/(2.0*maxInt);
+    for ( size_t i = 0; i < 3; i++ )
+      if ( scale[i] <= 0 ) scale[i] = 1.0; // All points share this coordinate
 
     liblas::Header header;
     header.SetDataFormatId(liblas::ePointFormat1);
     header.SetScale(scale[0], scale[1], scale[2]);
     header.SetOffset(offset[0], offset[1], offset[2]);
+    header.SetMin(cloud_bbox.min()[0], cloud_bbox.min()[1], cloud_bbox.min()[2]);
+    header.SetMax(cloud_bbox.max()[0], cloud_bbox.max()[1], cloud_bbox.max()[2]);
+    header.SetPointRecordsCount(num_points);
+    header.SetCompressed(compressed);
+    return header;
+  }
+
+  void quantize_las_points( std::vector<Vector3> const& points, liblas::Header const& header,
+                            std::vector<Vector3i>& quantized ) {
+    Vector3 offset( header.GetOffsetX(), header.GetOffsetY(), header.GetOffsetZ() );
+    Vector3 scale ( header.GetScaleX(),  header.GetScaleY(),  header.GetScaleZ()  );
+    quantized.resize( points.size() );
+    for ( size_t i = 0; i < points.size(); i++ )
+      quantized[i] = round( elem_quot((points[i] - offset), scale) );
+  }
+
+  // Points are set through their raw, already quantized, coordinates.
+  void write_las_points( liblas::Writer& writer, liblas::Header const& header,
+                         std::vector<Vector3i> const& quantized ) {
+    liblas::Point las_point(&header);
+    for ( size_t i = 0; i < quantized.size(); i++ ) {
+      las_point.SetRawX(quantized[i][0]);
+      las_point.SetRawY(quantized[i][1]);
+      las_point.SetRawZ(quantized[i][2]);
+      writer.WritePoint(las_point);
+    }
+  }
+
+  std::string las_extension( Options const& opt ) {
+    return opt.compressed ? ".laz" : ".las";
+  }
+
+  // Base for the tasks below, which each handle one tile and report
+  // progress.
+  class LasTileTask : public Task, private boost::noncopyable {
+  protected:
+    ImageViewRef<Vector3> m_point_image;
+    BBox2i m_bbox;
+    Mutex& m_progress_mutex;
+    const ProgressCallback& m_progress;
+    float m_inc_amt;
+
+    void report_progress() {
+      Mutex::Lock lock(m_progress_mutex);
+      m_progress.report_incremental_progress(m_inc_amt);
+    }
+  public:
+    LasTileTask( ImageViewRef<Vector3> const& point_image, BBox2i const& bbox,
+                 Mutex& progress_mutex, const ProgressCallback& progress, float inc_amt ) :
+      m_point_image(point_image), m_bbox(bbox), m_progress_mutex(progress_mutex),
+      m_progress(progress), m_inc_amt(inc_amt) {}
+  };
+
+  // Count the valid points of a tile and find their bounds
+  class LasBoundsTask : public LasTileTask {
+    uint64& m_num_points;
+    BBox3& m_point_bbox;
+  public:
+    LasBoundsTask( ImageViewRef<Vector3> const& point_image, BBox2i const& bbox,
+                   uint64& num_points, BBox3& point_bbox,
+                   Mutex& progress_mutex, const ProgressCallback& progress, float inc_amt ) :
+      LasTileTask(point_image, bbox, progress_mutex, progress, inc_amt),
+      m_num_points(num_points), m_point_bbox(point_bbox) {}
+
+    void operator()() {
+      std::vector<Vector3> points;
+      read_las_tile( m_point_image, m_bbox, points, m_point_bbox );
+      m_num_points = points.size();
+      report_progress();
+    }
+  };
+
+  // Quantize the points of a tile with the header of the output file
+  class LasQuantizeTask : public LasTileTask {
+    liblas::Header const& m_header;
+    std::vector<Vector3i>& m_quantized;
+  public:
+    LasQuantizeTask( ImageViewRef<Vector3> const& point_image, BBox2i const& bbox,
+                     liblas::Header const& header, std::vector<Vector3i>& quantized,
+                     Mutex& progress_mutex, const ProgressCallback& progress, float inc_amt ) :
+      LasTileTask(point_image, bbox, progress_mutex, progress, inc_amt),
+      m_header(header), m_quantized(quantized) {}
+
+    void operator()() {
+      std::vector<Vector3> points;
+      BBox3 point_bbox;
+      read_las_tile( m_point_image, m_bbox, points, point_bbox );
+      quantize_las_points( points, m_header, m_quantized );
+      report_progress();
+    }
+  };
+
+  // Write the points of a tile to their own LAS file, with the header
+  // fit to the tile's bounds.
+  class LasTileFileTask : public LasTileTask {
+    std::string m_filename;
+    bool m_compressed;
+    uint64& m_num_points;
+    BBox3& m_point_bbox;
+  public:
+    LasTileFileTask( ImageViewRef<Vector3> const& point_image, BBox2i const& bbox,
+                     std::string const& filename, bool compressed,
+                     uint64& num_points, BBox3& point_bbox,
+                     Mutex& progress_mutex, const ProgressCallback& progress, float inc_amt ) :
+      LasTileTask(point_image, bbox, progress_mutex, progress, inc_amt),
+      m_filename(filename), m_compressed(compressed),
+      m_num_points(num_points), m_point_bbox(point_bbox) {}
+
+    void operator()() {
+      std::vector<Vector3> points;
+      read_las_tile( m_point_image, m_bbox, points, m_point_bbox );
+      m_num_points = points.size();
+      if ( !points.empty() ) {
+        liblas::Header header = las_header( m_point_bbox, m_num_points, m_compressed );
+        std::vector<Vector3i> quantized;
+        quantize_las_points( points, header, quantized );
+        std::ofstream ofs( m_filename.c_str(), std::ios::out | std::ios::binary );
+        if ( !ofs )
+          vw_throw( IOErr() << "Unable to open " << m_filename << " for writing." );
+        liblas::Writer writer(ofs, header);
+        write_las_points( writer, header, quantized );
+      }
+      report_progress();
+    }
+  };
+
+  // Read the cloud once, in parallel, and write one LAS file per tile
+  // along with an index of the files written.
+  void write_tiled_las( ImageViewRef<Vector3> const& point_image,
+                        std::vector<BBox2i> const& blocks, Options const& opt ) {
+    std::vector<uint64> num_points( blocks.size(), 0 );
+    std::vector<BBox3> point_bboxes( blocks.size() );
+    std::vector<std::string> filenames( blocks.size() );
+
+    TerminalProgressCallback progress("asp", "LAS: ");
+    Mutex progress_mutex;
+    float inc_amt = 1.0 / float(blocks.size());
+    FifoWorkQueue queue( vw_settings().default_num_threads() );
+    for ( size_t i = 0; i < blocks.size(); i++ ) {
+      std::ostringstream name;
+      name << opt.out_prefix << "-" << blocks[i].min().x() << "_" << blocks[i].min().y()
+           << las_extension(opt);
+      filenames[i] = name.str();
+      boost::shared_ptr<LasTileFileTask>
+        task( new LasTileFileTask( point_image, blocks[i], filenames[i], opt.compressed,
+                                   num_points[i], point_bboxes[i],
+                                   progress_mutex, progress, inc_amt ) );
+      queue.add_task( task );
+    }
+    queue.join_all();
+    progress.report_finished();
+
+    // Index: one line per file with its point count and bounds
+    std::string index_file = opt.out_prefix + "-las-index.txt";
+    vw_out() << "Writing LAS index: " << index_file << "\n";
+    std::ofstream index( index_file.c_str() );
+    index.precision(17);
+    index << "# file num_points min_x min_y min_z max_x max_y max_z\n";
+    for ( size_t i = 0; i < blocks.size(); i++ ) {
+      if ( num_points[i] == 0 ) continue;
+      BBox3 const& b = point_bboxes[i];
+      index << filenames[i] << " " << num_points[i] << " "
+            << b.min()[0] << " " << b.min()[1] << " " << b.min()[2] << " "
+            << b.max()[0] << " " << b.max()[1] << " " << b.max()[2] << "\n";
+    }
+  }
+
+  // A single LAS file. The header must hold the scale and offset
+  // before any point is written, so a first parallel pass finds the
+  // bounds and count of the cloud. The second reads and quantizes a
+  // window of tiles in parallel while the previous window is written,
+  // in tile order, by this thread.
+  void write_las( ImageViewRef<Vector3> const& point_image,
+                  std::vector<BBox2i> const& blocks, Options const& opt ) {
+    std::vector<uint64> num_points( blocks.size(), 0 );
+    std::vector<BBox3> point_bboxes( blocks.size() );
+    {
+      TerminalProgressCallback progress("asp", "Bounds: ");
+      Mutex progress_mutex;
+      float inc_amt = 1.0 / float(blocks.size());
+      FifoWorkQueue queue( vw_settings().default_num_threads() );
+      for ( size_t i = 0; i < blocks.size(); i++ ) {
+        boost::shared_ptr<LasBoundsTask>
+          task( new LasBoundsTask( point_image, blocks[i], num_points[i], point_bboxes[i],
+                                   progress_mutex, progress, inc_amt ) );
+        queue.add_task( task );
+      }
+      queue.join_all();
+      progress.report_finished();
+    }
 
-    std::string lasFile;
-    header.SetCompressed(opt.compressed);
-    if (opt.compressed){
-      lasFile = opt.out_prefix + ".laz";
-    }else{
-      lasFile = opt.out_prefix + ".las";
+    BBox3 cloud_bbox;
+    uint64 total_points = 0;
+    for ( size_t i = 0; i < blocks.size(); i++ ) {
+      if ( num_points[i] == 0 ) continue;
+      cloud_bbox.grow( point_bboxes[i] );
+      total_points += num_points[i];
     }
+    if ( total_points == 0 )
+      vw_throw( ArgumentErr() << "No valid points in " << opt.pointcloud_filename << ".\n" );
 
+    liblas::Header header = las_header( cloud_bbox, total_points, opt.compressed );
+    std::string lasFile = opt.out_prefix + las_extension(opt);
     vw_out() << "Writing LAS file: " << lasFile + "\n";
-
     std::ofstream ofs;
     ofs.open(lasFile.c_str(), std::ios::out | std::ios::binary);
     liblas::Writer writer(ofs, header);
 
-    TerminalProgressCallback progress_bar("asp","LAS: ");
-    for (int row = 0; row < point_image.rows(); row++){
-      progress_bar.report_fractional_progress(row, point_image.rows());
-      for (int col = 0; col < point_image.cols(); col++){
+    // Each window is twice the number of threads, so workers stay busy
+    // while a window is written.
+    const size_t window = 2 * std::max( vw_settings().default_num_threads(), 1u );
+    size_t num_tiles = 0;
+    for ( size_t i = 0; i < blocks.size(); i++ )
+      num_tiles += num_points[i] > 0;
+    TerminalProgressCallback progress("asp", "LAS: ");
+    Mutex progress_mutex;
+    float inc_amt = 1.0 / float(num_tiles);
+    std::vector<std::vector<Vector3i> > written, pending;
+    for ( size_t start = 0; start < blocks.size(); start += window ) {
+      size_t end = std::min( start + window, blocks.size() );
+      pending.resize( end - start );
+      FifoWorkQueue queue( vw_settings().default_num_threads() );
+      for ( size_t i = start; i < end; i++ ) {
+        if ( num_points[i] == 0 ) continue;
+        boost::shared_ptr<LasQuantizeTask>
+          task( new LasQuantizeTask( point_image, blocks[i], header, pending[i - start],
+                                     progress_mutex, progress, inc_amt ) );
+        queue.add_task( task );
+      }
+      for ( size_t i = 0; i < written.size(); i++ )
+        write_las_points( writer, header, written[i] );
+      queue.join_all();
+      written.swap( pending );
+      pending.clear();
+    }
+    for ( size_t i = 0; i < written.size(); i++ )
+      write_las_points( writer, header, written[i] );
+    progress.report_finished();
+  }
+}
 
-        Vector3 point = point_image(col, row);
-        if ( point == Vector3() ) continue; // skip no-data points
+int main( int argc, char *argv[] ) {
 
-        point = round( elem_quot((point - offset), scale) );
+  Options opt;
+  try {
+    handle_arguments( argc, argv, opt );
 
-        liblas::Point las_point;
-        las_point.SetCoordinates(point[0], point[1], point[2]);
-        writer.WritePoint(las_point);
+    // The cloud is read one tile at a time by each thread, never pixel
+    // by pixel.
+    ImageViewRef<Vector3> point_image = read_n_channels<3>(opt.pointcloud_filename);
+    std::vector<BBox2i> blocks = image_blocks( point_image, opt.tile_size, opt.tile_size );
 
-      }
-    }
-    progress_bar.report_finished();
+    if ( opt.tiled )
+      asp::write_tiled_las( point_image, blocks, opt );
+    else
+      asp::write_las( point_image, blocks, opt );
 
   } ASP_STANDARD_CATCHES;
 
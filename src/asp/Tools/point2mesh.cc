@@ -26,11 +26,15 @@
 #include <stdio.h>
 #include <stddef.h>
 #include <math.h>
+#include <float.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
 
 //VisionWorkbench & ASP
 #include <asp/Tools/point2dem.h> // We share common functions with point2dem
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <vw/Core/ThreadPool.h>
 using namespace vw;
 namespace po = boost::program_options;
 
@@ -42,6 +46,7 @@ namespace po = boost::program_options;
 #include <osgUtil/SmoothingVisitor>
 #include <osgUtil/Simplifier>
 #include <osg/Node>
+#include <osg/PagedLOD>
 #include <osg/Texture1D>
 #include <osg/Texture2D>
 #include <osg/TexGen>
@@ -50,6 +55,7 @@ namespace po = boost::program_options;
 #include <osgDB/Registry>
 #include <osgDB/WriteFile>
 #include <osgDB/ReadFile>
+#include <osgDB/FileNameUtils>
 
 // ---------------------------------------------------------
 // UTILITIES
@@ -76,6 +82,10 @@ struct Options : asp::BaseOptions {
   std::string rot_order;
   double phi_rot, omega_rot, kappa_rot;
   bool center, enable_lighting, smooth_mesh, simplify_mesh;
+  // Tiled output
+  bool tiled;
+  int32 tile_size, lod_levels;
+  float lod_ratio;
 
   // Output
   std::string output_prefix, output_file_type;
@@ -145,27 +155,15 @@ osg::StateSet* create1DTexture( osg::Node* loadedModel , const osg::Vec3f& Direc
 }
 
 // ---------------------------------------------------------
-// BUILD MESH
+// PREPARE TEXTURE
 //
-// Takes in an image and builds geodes for every triangle strip.
+// Writes an 8 bit jpg copy of the texture, no larger than 4096 on
+// a side, and returns its name. Returns an empty string when no
+// texture was given.
 // ---------------------------------------------------------
 template <class ViewT>
-osg::Node* build_mesh( vw::ImageViewBase<ViewT> const& point_image,
-                       Options& opt ) {
-
-  //const ViewT& point_image_impl = point_image.impl();
-  osg::Geode* mesh = new osg::Geode();
-  osg::Geometry* geometry = new osg::Geometry();
-  osg::Vec3Array* vertices = new osg::Vec3Array();
-  osg::Vec2Array* texcoords = new osg::Vec2Array();
-  osg::Vec3Array* normals = new osg::Vec3Array();
-
-  opt.dataNormal = osg::Vec3f( 0.0f , 0.0f , 0.0f );
-
-  vw_out() << "\t--> Orginal size: [" << point_image.impl().cols() << ", " << point_image.impl().rows() << "]\n";
-  vw_out() << "\t--> Subsampled:   [" << point_image.impl().cols()/opt.step_size << ", "
-            << point_image.impl().rows()/opt.step_size << "]\n";
-
+std::string prepare_texture( vw::ImageViewBase<ViewT> const& point_image,
+                             Options const& opt ) {
   //////////////////////////////////////////////////
   // Deciding how to reduce the texture size
   //   Max texture width or height is 4096
@@ -199,6 +197,32 @@ osg::Node* build_mesh( vw::ImageViewBase<ViewT> const& point_image,
     unlink((tex_file+".tif").c_str());
     tex_file += ".jpg";
   }
+  return tex_file;
+}
+
+// ---------------------------------------------------------
+// BUILD MESH
+//
+// Takes in an image and builds geodes for every triangle strip.
+// ---------------------------------------------------------
+template <class ViewT>
+osg::Node* build_mesh( vw::ImageViewBase<ViewT> const& point_image,
+                       Options& opt ) {
+
+  //const ViewT& point_image_impl = point_image.impl();
+  osg::Geode* mesh = new osg::Geode();
+  osg::Geometry* geometry = new osg::Geometry();
+  osg::Vec3Array* vertices = new osg::Vec3Array();
+  osg::Vec2Array* texcoords = new osg::Vec2Array();
+  osg::Vec3Array* normals = new osg::Vec3Array();
+
+  opt.dataNormal = osg::Vec3f( 0.0f , 0.0f , 0.0f );
+
+  vw_out() << "\t--> Orginal size: [" << point_image.impl().cols() << ", " << point_image.impl().rows() << "]\n";
+  vw_out() << "\t--> Subsampled:   [" << point_image.impl().cols()/opt.step_size << ", "
+            << point_image.impl().rows()/opt.step_size << "]\n";
+
+  std::string tex_file = prepare_texture( point_image, opt );
 
   //////////////////////////////////////////////////
   /// Setting name of geode
@@ -415,6 +439,271 @@ osg::Node* build_mesh( vw::ImageViewBase<ViewT> const& point_image,
 
 }
 
+// ---------------------------------------------------------
+// TILED MESH
+//
+// The point cloud is meshed one tile of the subsampled grid at a
+// time. Each tile is simplified into a chain of levels of detail,
+// with its border vertices locked so that neighbouring tiles meet
+// at any mix of levels, and each level is written to its own file.
+// The root file only holds one PagedLOD per tile.
+// ---------------------------------------------------------
+namespace asp {
+
+  // Tiles of the grid of mesh vertices, which has one vertex every
+  // step_size pixels. Neighbouring tiles share their border row or
+  // column of vertices.
+  std::vector<BBox2i> mesh_tiles( int32 num_cols, int32 num_rows, int32 tile_size ) {
+    std::vector<BBox2i> tiles;
+    for ( int32 row = 0; row < num_rows - 1; row += tile_size ) {
+      for ( int32 col = 0; col < num_cols - 1; col += tile_size ) {
+        tiles.push_back( BBox2i( col, row,
+                                 std::min(tile_size, num_cols - 1 - col) + 1,
+                                 std::min(tile_size, num_rows - 1 - row) + 1 ) );
+      }
+    }
+    return tiles;
+  }
+
+  // Distance from the tile center beyond which a level no finer than
+  // 'level' is shown.
+  float lod_cutoff( float radius, int level ) {
+    return 3.0f * radius * float(1 << (level - 1));
+  }
+
+  // Triangulate the vertices of a tile. Cells with four valid corners
+  // give two triangles and cells with three give one. The indices of
+  // the vertices on the tile border are returned in 'seam'.
+  osg::Geometry* build_tile_geometry( ImageView<Vector3> const& points, BBox2i const& tile,
+                                      Vector2i const& image_size, uint32 step_size,
+                                      bool textured,
+                                      osgUtil::Simplifier::IndexList& seam,
+                                      Vector3& point_sum ) {
+    osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry();
+    osg::ref_ptr<osg::Vec3Array> vertices = new osg::Vec3Array();
+    osg::ref_ptr<osg::Vec2Array> texcoords = new osg::Vec2Array();
+    osg::ref_ptr<osg::DrawElementsUInt> triangles =
+      new osg::DrawElementsUInt(GL_TRIANGLES);
+
+    ImageView<uint32> index( points.cols(), points.rows() );
+    const uint32 invalid = std::numeric_limits<uint32>::max();
+    seam.clear();
+    point_sum = Vector3();
+    for ( int32 row = 0; row < points.rows(); row++ ) {
+      for ( int32 col = 0; col < points.cols(); col++ ) {
+        Vector3 const& point = points(col, row);
+        if ( point == Vector3() ) {
+          index(col, row) = invalid;
+          continue;
+        }
+        index(col, row) = vertices->size();
+        vertices->push_back( osg::Vec3f( point[0], point[1], point[2] ) );
+        point_sum += point;
+        if ( textured ) {
+          float pix_col = float((tile.min().x() + col) * step_size);
+          float pix_row = float((tile.min().y() + row) * step_size);
+          texcoords->push_back( osg::Vec2f( pix_col / float(image_size.x()),
+                                            1 - pix_row / float(image_size.y()) ) );
+        }
+        if ( row == 0 || col == 0 || row == points.rows() - 1 || col == points.cols() - 1 )
+          seam.push_back( index(col, row) );
+      }
+    }
+
+    for ( int32 row = 0; row < points.rows() - 1; row++ ) {
+      for ( int32 col = 0; col < points.cols() - 1; col++ ) {
+        uint32 ul = index(col, row),   ur = index(col+1, row);
+        uint32 ll = index(col, row+1), lr = index(col+1, row+1);
+        int num_valid = (ul != invalid) + (ur != invalid) + (ll != invalid) + (lr != invalid);
+        if ( num_valid < 3 ) continue;
+        uint32 corners[4] = { ul, ll, lr, ur }; // same winding as the quad
+        if ( num_valid == 4 ) {
+          uint32 quad[6] = { ul, ll, lr, lr, ur, ul };
+          triangles->insert( triangles->end(), quad, quad + 6 );
+        } else {
+          for ( int i = 0; i < 4; i++ )
+            if ( corners[i] != invalid ) triangles->push_back( corners[i] );
+        }
+      }
+    }
+    if ( triangles->empty() )
+      return NULL;
+
+    geometry->setVertexArray( vertices.get() );
+    if ( textured )
+      geometry->setTexCoordArray( 0, texcoords.get() );
+    osg::ref_ptr<osg::Vec4Array> colour = new osg::Vec4Array();
+    colour->push_back( osg::Vec4f( 1.0f, 1.0f, 1.0f, 1.0f ) );
+    geometry->setColorArray( colour.get() );
+    geometry->setColorBinding( osg::Geometry::BIND_OVERALL );
+    geometry->addPrimitiveSet( triangles.get() );
+    return geometry.release();
+  }
+
+  // What the root needs to know about a tile once it is written
+  struct MeshTile {
+    std::string root_file;
+    osg::BoundingSphere bound;
+    Vector3 point_sum;
+    uint64 num_points;
+    MeshTile() : num_points(0) {}
+  };
+
+  class MeshTileTask : public Task, private boost::noncopyable {
+    ImageViewRef<Vector3> m_point_image;
+    BBox2i m_tile;
+    Options const& m_opt;
+    osg::ref_ptr<osg::Texture2D> m_texture;
+    MeshTile& m_result;
+    Mutex& m_progress_mutex;
+    const ProgressCallback& m_progress;
+    float m_inc_amt;
+
+    std::string level_file( int level ) const {
+      std::ostringstream os;
+      os << m_opt.output_prefix << "-" << m_tile.min().x() << "_" << m_tile.min().y()
+         << "-L" << level << "." << m_opt.output_file_type;
+      return os.str();
+    }
+
+  public:
+    MeshTileTask( ImageViewRef<Vector3> const& point_image, BBox2i const& tile,
+                  Options const& opt, osg::Texture2D* texture, MeshTile& result,
+                  Mutex& progress_mutex, const ProgressCallback& progress, float inc_amt ) :
+      m_point_image(point_image), m_tile(tile), m_opt(opt), m_texture(texture),
+      m_result(result), m_progress_mutex(progress_mutex), m_progress(progress),
+      m_inc_amt(inc_amt) {}
+
+    void operator()() {
+      // Only this tile's vertices are read
+      int32 step = m_opt.step_size;
+      BBox2i pixels( m_tile.min() * step, m_tile.max() * step - Vector2i(step - 1, step - 1) );
+      ImageView<Vector3> points = subsample( crop( m_point_image, pixels ), step );
+
+      osgUtil::Simplifier::IndexList seam;
+      osg::ref_ptr<osg::Geometry> full =
+        build_tile_geometry( points, m_tile,
+                             Vector2i(m_point_image.cols(), m_point_image.rows()),
+                             m_opt.step_size, m_texture.valid(), seam, m_result.point_sum );
+      m_result.num_points = full.valid() ? full->getVertexArray()->getNumElements() : 0;
+
+      if ( full.valid() ) {
+        if ( m_texture.valid() )
+          full->getOrCreateStateSet()->setTextureAttributeAndModes( 0, m_texture.get(),
+                                                                   osg::StateAttribute::ON );
+        bool smooth = m_opt.enable_lighting || m_opt.smooth_mesh;
+        if ( smooth )
+          osgUtil::SmoothingVisitor::smooth( *full );
+        osg::ref_ptr<osgDB::ReaderWriter::Options> write_options =
+          new osgDB::ReaderWriter::Options( "noTexturesInIVEFile WriteImageHint=UseExternal" );
+
+        // Finest level first. Every coarser level is simplified from
+        // the full tile, as the seam indices only refer to it.
+        osg::BoundingSphere bound;
+        for ( int level = 0; level < m_opt.lod_levels; level++ ) {
+          osg::ref_ptr<osg::Geode> geode = new osg::Geode();
+          if ( level == 0 ) {
+            geode->addDrawable( full.get() );
+            bound = geode->getBound();
+          } else {
+            osg::ref_ptr<osg::Geometry> coarse =
+              new osg::Geometry( *full, osg::CopyOp::DEEP_COPY_ARRAYS |
+                                        osg::CopyOp::DEEP_COPY_PRIMITIVES );
+            osgUtil::Simplifier simplifier;
+            simplifier.setSmoothing( smooth );
+            simplifier.setSampleRatio( std::pow( m_opt.lod_ratio, level ) );
+            simplifier.simplify( *coarse, seam );
+            geode->addDrawable( coarse.get() );
+          }
+
+          // A coarser level hands over to the next finer file once the
+          // viewer is close enough.
+          osg::ref_ptr<osg::Node> node = geode.get();
+          if ( level > 0 ) {
+            float cutoff = lod_cutoff( bound.radius(), level );
+            osg::ref_ptr<osg::PagedLOD> plod = new osg::PagedLOD();
+            plod->setCenter( bound.center() );
+            plod->setRadius( bound.radius() );
+            plod->addChild( geode.get(), cutoff, FLT_MAX );
+            plod->setFileName( 1, osgDB::getSimpleFileName( level_file(level - 1) ) );
+            plod->setRange( 1, 0, cutoff );
+            node = plod.get();
+          }
+          if ( !osgDB::writeNodeFile( *node, level_file(level), write_options.get() ) )
+            vw_throw( IOErr() << "Unable to write " << level_file(level) );
+        }
+        m_result.bound = bound;
+        m_result.root_file = level_file( m_opt.lod_levels - 1 );
+      }
+
+      Mutex::Lock lock(m_progress_mutex);
+      m_progress.report_incremental_progress(m_inc_amt);
+    }
+  };
+
+  // Mesh, simplify and write all tiles in parallel, and return the
+  // root of the PagedLOD hierarchy.
+  osg::Node* write_mesh_tiles( ImageViewRef<Vector3> const& point_image,
+                               std::string const& tex_file, Options& opt ) {
+    int32 num_cols = point_image.cols() / opt.step_size;
+    int32 num_rows = point_image.rows() / opt.step_size;
+    std::vector<BBox2i> tiles = mesh_tiles( num_cols, num_rows, opt.tile_size );
+    vw_out() << "\t--> Subsampled:   [" << num_cols << ", " << num_rows << "] in "
+             << tiles.size() << " tiles of " << opt.lod_levels << " levels\n";
+
+    osg::ref_ptr<osg::Texture2D> texture;
+    if ( !tex_file.empty() ) {
+      osg::ref_ptr<osg::Image> image = osgDB::readImageFile( tex_file );
+      if ( image.valid() && image->valid() ) {
+        texture = new osg::Texture2D;
+        texture->setImage( image.get() );
+      } else {
+        vw_out() << "Failed to open texture data in " << tex_file << std::endl;
+      }
+    }
+
+    // Load the writer plugin before the threads need it
+    if ( !osgDB::Registry::instance()->getReaderWriterForExtension( opt.output_file_type ) )
+      vw_throw( ArgumentErr() << "No OSG writer for \"" << opt.output_file_type << "\" files." );
+
+    std::vector<MeshTile> results( tiles.size() );
+    TerminalProgressCallback progress("asp", "\tTiles:      ");
+    Mutex progress_mutex;
+    float inc_amt = 1.0 / float(tiles.size());
+    FifoWorkQueue queue( vw_settings().default_num_threads() );
+    for ( size_t i = 0; i < tiles.size(); i++ ) {
+      boost::shared_ptr<MeshTileTask>
+        task( new MeshTileTask( point_image, tiles[i], opt, texture.get(), results[i],
+                                progress_mutex, progress, inc_amt ) );
+      queue.add_task( task );
+    }
+    queue.join_all();
+    progress.report_finished();
+
+    osg::Group* root = new osg::Group();
+    Vector3 point_sum;
+    uint64 num_points = 0;
+    for ( size_t i = 0; i < results.size(); i++ ) {
+      if ( results[i].root_file.empty() ) continue;
+      osg::ref_ptr<osg::PagedLOD> plod = new osg::PagedLOD();
+      plod->setCenter( results[i].bound.center() );
+      plod->setRadius( results[i].bound.radius() );
+      plod->setFileName( 0, osgDB::getSimpleFileName( results[i].root_file ) );
+      plod->setRange( 0, 0, FLT_MAX );
+      root->addChild( plod.get() );
+      point_sum += results[i].point_sum;
+      num_points += results[i].num_points;
+    }
+    vw_out() << "\t > size: " << num_points << " vertices\n";
+
+    opt.dataNormal = osg::Vec3f( point_sum[0], point_sum[1], point_sum[2] );
+    opt.dataNormal.normalize();
+    return root;
+  }
+
+}
+
+// ---------------------------------------------------------
 // MAIN
 // ---------------------------------------------------------
 
@@ -437,7 +726,13 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
      po::bool_switch(&opt.enable_lighting)->default_value(false),
      "Enables shades and light on the mesh" )
     ("center", po::bool_switch(&opt.center)->default_value(false),
-     "Center the model around the origin. Use this option if you are experiencing numerical precision issues.");
+     "Center the model around the origin. Use this option if you are experiencing numerical precision issues.")
+    ("tiled", po::bool_switch(&opt.tiled)->default_value(false),
+     "Mesh the point cloud tile by tile in parallel and write a PagedLOD hierarchy of per-tile files, instead of one mesh.")
+    ("tile-size", po::value(&opt.tile_size)->default_value(256),
+     "With --tiled, the number of mesh vertices along the side of a tile.")
+    ("lod-levels", po::value(&opt.lod_levels)->default_value(3),
+     "With --tiled, the number of levels of detail written per tile. With --simplify-mesh, each level keeps that fraction of the triangles of the next finer one (default 0.25).");
   general_options.add( asp::BaseOptionsDescription(opt) );
 
   po::options_description positional("");
@@ -463,6 +758,16 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     opt.output_prefix =
       prefix_from_pointcloud_filename( opt.pointcloud_filename );
   opt.simplify_mesh = vm.count("simplify-mesh");
+
+  if ( opt.step_size < 1 )
+    vw_throw( ArgumentErr() << "The step size must be positive.\n" );
+  if ( opt.tiled ) {
+    if ( opt.tile_size < 1 || opt.lod_levels < 1 )
+      vw_throw( ArgumentErr() << "The tile size and the number of levels of detail must be positive.\n" );
+    opt.lod_ratio = opt.simplify_mesh ? opt.simplify_percent : 0.25;
+    if ( opt.lod_ratio <= 0 || opt.lod_ratio > 1 )
+      vw_throw( ArgumentErr() << "The simplification ratio must be in (0, 1].\n" );
+  }
 }
 
 int main( int argc, char *argv[] ){
@@ -484,10 +789,18 @@ int main( int argc, char *argv[] ){
       point_image = point_image_offset(point_image, -midpoint);
     }
 
-    {
+    if ( opt.tiled ) {
+      // Each tile is simplified and written on its own, so only the
+      // root remains to be styled and saved.
+      vw_out() << "\nGenerating tiled 3D mesh from point cloud:\n";
+      std::string tex_file = prepare_texture( point_image, opt );
+      opt.root->addChild( asp::write_mesh_tiles( point_image, tex_file, opt ) );
+    } else {
       vw_out() << "\nGenerating 3D mesh from point cloud:\n";
       opt.root->addChild(build_mesh(point_image, opt));
+    }
 
+    {
       if ( !opt.texture_file_name.empty() ) {
         // Turning off lighting and other likes
         osg::StateSet* stateSet = new osg::StateSet();
@@ -507,13 +820,13 @@ int main( int argc, char *argv[] ){
       }
     }
 
-    if ( opt.smooth_mesh ) {
+    if ( opt.smooth_mesh && !opt.tiled ) {
       vw_out() << "Smoothing Data\n";
       osgUtil::SmoothingVisitor sv;
       opt.root->accept(sv);
     }
 
-    if ( opt.simplify_mesh ) {
+    if ( opt.simplify_mesh && !opt.tiled ) {
       if ( opt.simplify_percent == 0.0 )
         opt.simplify_percent = 1.0;
 
@@ -524,7 +837,7 @@ int main( int argc, char *argv[] ){
       opt.root->accept(simple);
     }
 
-    {
+    if ( !opt.tiled ) {
       vw_out() << "Optimizing Data\n";
       osgUtil::Optimizer optimizer;
       optimizer.optimize( opt.root.get() );
@@ -18,130 +18,295 @@
 
 /// \file results.cc
 ///
+/// Scores predicted disparity maps against ground truth. Every pair of
+/// prefixes is evaluated in one parallel pass over tiles, and the
+/// statistics of the tiles are merged per pair and over all pairs.
 
-/************************************************************************
- *     File: results.cc
- *     Date: December 2008
- *       By: Ara Nefian and Michael Broxton
- *      For: NASA Ames Research Center, Intelligent Mechanisms Group
- * Function: Main program for the measuring the performance and accuracy of the stereo pipeline
- ************************************************************************/
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
 #include <boost/algorithm/string.hpp>
-#include <boost/program_options.hpp>
-#include <boost/filesystem/path.hpp>
-#include <boost/filesystem/operations.hpp>
-#include <boost/filesystem/convenience.hpp>
-#include <boost/filesystem/fstream.hpp>
-using namespace boost;
-namespace po = boost::program_options;
-namespace fs = boost::filesystem;
+#include <boost/lexical_cast.hpp>
 
-#include <vw/Core.h>
-#include <vw/Image.h>
-#include <vw/Math.h>
+#include <vw/Core/ThreadPool.h>
 #include <vw/FileIO.h>
-#include <vw/Camera.h>
-#include <vw/Stereo.h>
+#include <vw/Image.h>
+
+using std::endl;
+using std::string;
 
 using namespace vw;
-using namespace vw::math;
-using namespace vw::camera;
-using namespace vw::stereo;
-
-#include <asp/Core/StereoSettings.h>
-#include <asp/Sessions.h>
-
-// Support for ISIS image files
-#if defined(ASP_HAVE_PKG_ISIS) && ASP_HAVE_PKG_ISIS == 1
-#include <asp/IsisIO/DiskImageResourceIsis.h>
-#endif
-
-// Boost headers
-#include <boost/thread/xtime.hpp>
-// Posix time is not fully supported in the version of Boost for RHEL
-// Workstation 4
-#ifdef __APPLE__
-#include <boost/date_time/posix_time/posix_time.hpp>
-#else
-#include <ctime>
-#endif
-
-
-using namespace std;
-
-//***********************************************************************
-// MAIN
-//***********************************************************************
-int main(int argc, char* argv[]) {
-
-
-  string true_prefix = argv[1];
-  string pred_prefix = argv[2];
-
-  //string true_prefix = "/Users/anefian/projects/stereopipeline/data/apollo/apollo-crop-small/results/apollo-crop-small";
-  //string pred_prefix = "/Users/anefian/projects/stereopipeline/data/apollo/apollo-crop-small/results/apollo-crop-small";
-
-  string true_disp_map_h_filename;
-  string true_disp_map_v_filename;
-  string pred_disp_map_h_filename;
-  string pred_disp_map_v_filename;
-  string good_pixels_map_filename;
-
-  true_disp_map_h_filename = true_prefix+"-R-H.tif";
-  true_disp_map_v_filename = true_prefix+"-R-V.tif";
-  pred_disp_map_h_filename = pred_prefix+"-R-H.tif";
-  pred_disp_map_v_filename = pred_prefix+"-R-V.tif";
-  good_pixels_map_filename = pred_prefix+"-GoodPixelMap.tif";
-
-  DiskImageView<PixelGray<float> > true_disp_map_h (true_disp_map_h_filename);
-  DiskImageView<PixelGray<float> > true_disp_map_v (true_disp_map_v_filename);
-  DiskImageView<PixelGray<float> > pred_disp_map_h (pred_disp_map_h_filename);
-  DiskImageView<PixelGray<float> > pred_disp_map_v (pred_disp_map_v_filename);
-  DiskImageView<PixelRGB<uint8> >  good_pixels_map (good_pixels_map_filename);
-
-  //compute the average coverage measure
-  int img_size = true_disp_map_h.rows() * true_disp_map_h.cols();
-  int num_good_pixels = 0;
-  int i, j;
-
-  for (i = 0; i < good_pixels_map.rows(); i++){
-    for (j = 0; j < good_pixels_map.cols(); j++){
-
-      if (good_pixels_map(i,j).r()==200){
-          num_good_pixels++;
-      }
+
+#include <asp/Core/Macros.h>
+#include <asp/Core/Common.h>
+#include <asp/Core/StreamingStats.h>
+namespace po = boost::program_options;
+
+struct Options : asp::BaseOptions {
+  std::vector<string> prefixes;
+  string list_file, output_file, thresholds_str;
+  std::vector<double> thresholds;
+  double histogram_max;
+  int32 histogram_bins, tile_size;
+};
+
+void handle_arguments( int argc, char *argv[], Options& opt ) {
+  po::options_description general_options("");
+  general_options.add_options()
+    ("list", po::value(&opt.list_file), "A file listing a ground truth prefix and a predicted prefix on each line.")
+    ("output-file,o", po::value(&opt.output_file), "Also write the statistics of every pair to this file.")
+    ("thresholds", po::value(&opt.thresholds_str)->default_value("1,2,4"), "Comma separated error thresholds, in pixels, for the bad pixel percentages.")
+    ("histogram-max", po::value(&opt.histogram_max)->default_value(8), "Upper bound of the error histogram, in pixels. Larger errors go in the last bin.")
+    ("histogram-bins", po::value(&opt.histogram_bins)->default_value(16), "Number of bins of the error histogram below --histogram-max.")
+    ("tile-size", po::value(&opt.tile_size)->default_value(1024), "Size of the tiles processed in parallel.");
+  general_options.add( asp::BaseOptionsDescription(opt) );
+
+  po::options_description positional("");
+  positional.add_options()
+    ("prefixes", po::value(&opt.prefixes), "Ground truth and predicted prefixes, alternating");
+
+  po::positional_options_description positional_desc;
+  positional_desc.add("prefixes", -1);
+
+  std::string usage("[options] <true-prefix> <pred-prefix> [<true-prefix> <pred-prefix> ...]");
+  po::variables_map vm =
+    asp::check_command_line( argc, argv, opt, general_options, general_options,
+                             positional, positional_desc, usage );
+
+  if ( !opt.list_file.empty() ) {
+    std::ifstream list( opt.list_file.c_str() );
+    if ( !list.is_open() )
+      vw_throw( IOErr() << "Could not open list: " << opt.list_file << "\n" );
+    string true_prefix, pred_prefix;
+    while ( list >> true_prefix >> pred_prefix ) {
+      opt.prefixes.push_back( true_prefix );
+      opt.prefixes.push_back( pred_prefix );
+    }
+  }
+
+  if ( opt.prefixes.empty() || opt.prefixes.size() % 2 != 0 )
+    vw_throw( ArgumentErr() << "Requires pairs of ground truth and predicted prefixes in order to proceed.\n\n" << usage << general_options );
+  if ( opt.tile_size <= 0 )
+    vw_throw( ArgumentErr() << "The tile size must be positive.\n" );
+  if ( opt.histogram_bins <= 0 || opt.histogram_max <= 0 )
+    vw_throw( ArgumentErr() << "The histogram needs a positive number of bins and a positive upper bound.\n" );
+
+  std::vector<string> thresholds;
+  boost::split( thresholds, opt.thresholds_str, boost::is_any_of(", "), boost::token_compress_on );
+  for ( size_t i = 0; i < thresholds.size(); i++ ) {
+    if ( thresholds[i].empty() ) continue;
+    try {
+      opt.thresholds.push_back( boost::lexical_cast<double>( thresholds[i] ) );
+    } catch ( const boost::bad_lexical_cast& ) {
+      vw_throw( ArgumentErr() << "Invalid threshold: " << thresholds[i] << "\n" );
     }
   }
+}
+
+namespace asp {
+
+  // The error statistics of a set of pixels. Statistics of tiles are
+  // merged into those of a pair and those of pairs into the total.
+  struct DisparityErrorStats {
+    uint64 num_pixels, num_good;
+    StreamingStats h, v, error;
+    std::vector<uint64> bad;        // Good pixels with error above each threshold
+    std::vector<uint64> histogram;  // The last bin counts the overflow
+
+    DisparityErrorStats( Options const& opt ) :
+      num_pixels(0), num_good(0), bad( opt.thresholds.size(), 0 ),
+      histogram( opt.histogram_bins + 1, 0 ) {}
 
-  float avg_cover = num_good_pixels/(float) img_size;
-  printf("Average Coverage = %f\n", avg_cover);
+    void merge( DisparityErrorStats const& other ) {
+      num_pixels += other.num_pixels;
+      num_good   += other.num_good;
+      h.merge( other.h );
+      v.merge( other.v );
+      error.merge( other.error );
+      for ( size_t i = 0; i < bad.size(); i++ )
+        bad[i] += other.bad[i];
+      for ( size_t i = 0; i < histogram.size(); i++ )
+        histogram[i] += other.histogram[i];
+    }
+  };
 
-  //compute the average error measure
-  float avg_error_h = 0;
+  // The images of one ground truth and predicted pair
+  struct DisparityPair {
+    string true_prefix, pred_prefix;
+    DiskImageView<float> true_h, true_v, pred_h, pred_v;
+    DiskImageView<PixelRGB<uint8> > good_pixels;
+    DisparityErrorStats stats;
 
-  for (i = 0; i < pred_disp_map_h.rows(); i++){
-    for (j = 0; j < pred_disp_map_h.cols(); j++){
-      float tmp = pred_disp_map_h(i,j).v()-true_disp_map_h(i,j).v();
-       avg_error_h = avg_error_h + tmp*tmp;
+    DisparityPair( string const& true_prefix_, string const& pred_prefix_, Options const& opt ) :
+      true_prefix(true_prefix_), pred_prefix(pred_prefix_),
+      true_h( true_prefix + "-R-H.tif" ), true_v( true_prefix + "-R-V.tif" ),
+      pred_h( pred_prefix + "-R-H.tif" ), pred_v( pred_prefix + "-R-V.tif" ),
+      good_pixels( pred_prefix + "-GoodPixelMap.tif" ), stats(opt) {
+      BBox2i bbox = bounding_box( true_h );
+      if ( bounding_box( true_v ) != bbox || bounding_box( pred_h ) != bbox ||
+           bounding_box( pred_v ) != bbox || bounding_box( good_pixels ) != bbox )
+        vw_throw( ArgumentErr() << "The disparity maps of " << true_prefix << " and "
+                  << pred_prefix << " differ in size.\n" );
     }
+  };
+
+  // Accumulate all statistics of one tile of a pair in a single pass,
+  // and merge them into the statistics of the pair.
+  class ErrorTileTask : public Task, private boost::noncopyable {
+    DisparityPair& m_pair;
+    BBox2i m_bbox;
+    Options const& m_opt;
+    Mutex& m_stats_mutex;
+    const ProgressCallback& m_progress;
+    float m_inc_amt;
+  public:
+    ErrorTileTask( DisparityPair& pair, BBox2i const& bbox, Options const& opt,
+                   Mutex& stats_mutex, const ProgressCallback& progress, float inc_amt ) :
+      m_pair(pair), m_bbox(bbox), m_opt(opt), m_stats_mutex(stats_mutex),
+      m_progress(progress), m_inc_amt(inc_amt) {}
+
+    void operator()() {
+      ImageView<float> true_h = crop( m_pair.true_h, m_bbox );
+      ImageView<float> true_v = crop( m_pair.true_v, m_bbox );
+      ImageView<float> pred_h = crop( m_pair.pred_h, m_bbox );
+      ImageView<float> pred_v = crop( m_pair.pred_v, m_bbox );
+      ImageView<PixelRGB<uint8> > good_pixels = crop( m_pair.good_pixels, m_bbox );
+
+      DisparityErrorStats stats( m_opt );
+      stats.num_pixels = uint64(m_bbox.width()) * m_bbox.height();
+      double bin_scale = m_opt.histogram_bins / m_opt.histogram_max;
+      for ( int32 row = 0; row < true_h.rows(); row++ ) {
+        for ( int32 col = 0; col < true_h.cols(); col++ ) {
+          if ( good_pixels(col, row).r() != 200 )
+            continue;
+          double dh = pred_h(col, row) - true_h(col, row);
+          double dv = pred_v(col, row) - true_v(col, row);
+          double error = sqrt( dh*dh + dv*dv );
+          if ( error != error ) // NaN
+            continue;
+          stats.num_good++;
+          stats.h.add( dh );
+          stats.v.add( dv );
+          stats.error.add( error );
+          for ( size_t i = 0; i < m_opt.thresholds.size(); i++ )
+            if ( error > m_opt.thresholds[i] )
+              stats.bad[i]++;
+          size_t bin = std::min( error * bin_scale, double(m_opt.histogram_bins) );
+          stats.histogram[bin]++;
+        }
+      }
+
+      Mutex::Lock lock(m_stats_mutex);
+      m_pair.stats.merge( stats );
+      m_progress.report_incremental_progress(m_inc_amt);
+    }
+  };
+
+  double percent( uint64 count, uint64 total ) {
+    return total ? 100.0 * double(count) / double(total) : 0.0;
   }
 
-  avg_error_h = avg_error_h/num_good_pixels;
-  printf("avg_error_h = %f\n", avg_error_h);
+  void print_stats( std::string const& name, Options const& opt,
+                    DisparityErrorStats const& s ) {
+    double coverage = s.num_pixels ? double(s.num_good) / double(s.num_pixels) : 0.0;
+    vw_out() << name << ":\n";
+    vw_out() << "\tAverage Coverage = " << coverage << "\n";
+    vw_out() << "\tHorizontal error: mean " << s.h.mean() << ", RMS " << s.h.rms() << "\n";
+    vw_out() << "\tVertical error:   mean " << s.v.mean() << ", RMS " << s.v.rms() << "\n";
+    vw_out() << "\tEndpoint error:   mean " << s.error.mean() << ", RMS " << s.error.rms()
+             << ", median " << s.error.quantile(0.5) << ", 95% " << s.error.quantile(0.95)
+             << ", max " << s.error.max() << "\n";
+    for ( size_t i = 0; i < opt.thresholds.size(); i++ )
+      vw_out() << "\tBad pixels (error > " << opt.thresholds[i] << "): "
+               << percent( s.bad[i], s.num_good ) << "%\n";
+    vw_out() << "\tError histogram:";
+    for ( size_t i = 0; i < s.histogram.size(); i++ )
+      vw_out() << " " << s.histogram[i];
+    vw_out() << "\n";
+  }
 
-  float avg_error_v = 0;
+  void write_stats( std::string const& stats_file, Options const& opt,
+                    std::vector<boost::shared_ptr<DisparityPair> > const& pairs,
+                    DisparityErrorStats const& total ) {
+    vw_out() << "Writing statistics: " << stats_file << "\n";
+    std::ofstream out( stats_file.c_str() );
+    out.precision(10);
+    out << "# true_prefix pred_prefix pixels good coverage mean_h rms_h mean_v rms_v"
+        << " mean_error rms_error median_error p95_error";
+    for ( size_t i = 0; i < opt.thresholds.size(); i++ )
+      out << " bad_" << opt.thresholds[i];
+    for ( int32 i = 0; i < opt.histogram_bins; i++ )
+      out << " hist_" << opt.histogram_max * i / opt.histogram_bins;
+    out << " hist_overflow\n";
 
-  for (i = 0; i < pred_disp_map_h.rows(); i++){
-    for (j = 0; j < pred_disp_map_h.cols(); j++){
-      float tmp = pred_disp_map_v(i,j).v()-true_disp_map_v(i,j).v();
-       avg_error_v = avg_error_v + tmp*tmp;
+    for ( size_t p = 0; p <= pairs.size(); p++ ) {
+      DisparityErrorStats const& s = p < pairs.size() ? pairs[p]->stats : total;
+      if ( p < pairs.size() )
+        out << pairs[p]->true_prefix << " " << pairs[p]->pred_prefix;
+      else
+        out << "ALL ALL";
+      out << " " << s.num_pixels << " " << s.num_good << " "
+          << ( s.num_pixels ? double(s.num_good) / double(s.num_pixels) : 0.0 )
+          << " " << s.h.mean() << " " << s.h.rms() << " " << s.v.mean() << " " << s.v.rms()
+          << " " << s.error.mean() << " " << s.error.rms() << " " << s.error.quantile(0.5)
+          << " " << s.error.quantile(0.95);
+      for ( size_t i = 0; i < s.bad.size(); i++ )
+        out << " " << percent( s.bad[i], s.num_good );
+      for ( size_t i = 0; i < s.histogram.size(); i++ )
+        out << " " << s.histogram[i];
+      out << "\n";
     }
   }
 
-  avg_error_v = avg_error_v/num_good_pixels;
-  printf("avg_error_v = %f\n", avg_error_v);
-  float avg_error = 0.5*(avg_error_v + avg_error_h);
-  printf("avg_error = %f\n", avg_error);
+}
+
+int main( int argc, char *argv[] ) {
+
+  Options opt;
+  try {
+    handle_arguments( argc, argv, opt );
+
+    std::vector<boost::shared_ptr<asp::DisparityPair> > pairs;
+    for ( size_t i = 0; i < opt.prefixes.size(); i += 2 )
+      pairs.push_back( boost::shared_ptr<asp::DisparityPair>
+                       ( new asp::DisparityPair( opt.prefixes[i], opt.prefixes[i+1], opt ) ) );
+
+    // The tiles of all pairs go in one queue, so that small pairs do
+    // not leave threads idle.
+    std::vector<std::pair<size_t, BBox2i> > tiles;
+    for ( size_t p = 0; p < pairs.size(); p++ ) {
+      std::vector<BBox2i> blocks = image_blocks( pairs[p]->true_h, opt.tile_size, opt.tile_size );
+      for ( size_t i = 0; i < blocks.size(); i++ )
+        tiles.push_back( std::make_pair( p, blocks[i] ) );
+    }
+
+    TerminalProgressCallback progress("asp", "\t--> Evaluating: ");
+    Mutex stats_mutex;
+    float inc_amt = 1.0 / float(tiles.size());
+    FifoWorkQueue queue( vw_settings().default_num_threads() );
+    for ( size_t i = 0; i < tiles.size(); i++ ) {
+      boost::shared_ptr<asp::ErrorTileTask>
+        task( new asp::ErrorTileTask( *pairs[tiles[i].first], tiles[i].second, opt,
+                                      stats_mutex, progress, inc_amt ) );
+      queue.add_task( task );
+    }
+    queue.join_all();
+    progress.report_finished();
+
+    asp::DisparityErrorStats total( opt );
+    for ( size_t p = 0; p < pairs.size(); p++ ) {
+      asp::print_stats( pairs[p]->pred_prefix, opt, pairs[p]->stats );
+      total.merge( pairs[p]->stats );
+    }
+    if ( pairs.size() > 1 )
+      asp::print_stats( "All pairs", opt, total );
+
+    if ( !opt.output_file.empty() )
+      asp::write_stats( opt.output_file, opt, pairs, total );
+
+  } ASP_STANDARD_CATCHES;
 
-  return(EXIT_SUCCESS);
+  return 0;
 }
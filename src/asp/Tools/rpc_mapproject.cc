@@ -25,7 +25,7 @@ using namespace vw;
 #include <asp/Core/Common.h>
 #include <asp/Sessions/DG/StereoSessionDG.h>
 #include <asp/Sessions/DG/XML.h>
-#include <asp/Sessions/RPC/RPCMapTransform.h>
+#include <asp/Sessions/RPC/RPCMapProject.h>
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
@@ -39,7 +39,8 @@ struct Options : asp::BaseOptions {
   std::string target_srs_string;
   float target_resolution;
   BBox2 target_projwin;
-  double nodata_value;
+  double nodata_value, mapping_tolerance;
+  bool has_nodata_value;
 };
 
 void handle_arguments( int argc, char *argv[], Options& opt ) {
@@ -49,7 +50,9 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     ("t_srs", po::value(&opt.target_srs_string), "Target spatial reference set. This mimicks the  gdal option.")
     ("tr", po::value(&opt.target_resolution)->default_value(0), "Set output file resolution (in target georeferenced units per pixel)")
     ("t_projwin", po::value(&opt.target_projwin),
-     "Selects a subwindow from the source image for copying, with the corners given in georeferenced coordinates (xmin ymin xmax ymax). Max is exclusive.");
+     "Selects a subwindow from the source image for copying, with the corners given in georeferenced coordinates (xmin ymin xmax ymax). Max is exclusive.")
+    ("mapping-tolerance", po::value(&opt.mapping_tolerance)->default_value(0.05),
+     "Largest error, in camera pixels, of interpolating where each output pixel was seen between exactly projected ones. Set to 0 to project every pixel exactly.");
 
   general_options.add( asp::BaseOptionsDescription(opt) );
 
@@ -76,6 +79,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
     vw_throw( ArgumentErr() << "Requires <dem> <camera-image> <camera-model> and <t_srs> input in order to proceed.\n\n"
               << usage << general_options );
 
+  opt.has_nodata_value = vm.count("nodata-value");
+
   if ( opt.output_file.empty() )
     opt.output_file = fs::path( opt.image_file ).replace_extension( "_rpcmapped.tif" ).string();
 }
@@ -184,37 +189,40 @@ int main( int argc, char* argv[] ) {
       target_georef.point_to_pixel_bbox( point_bounds );
     vw_out() << "Creating output file that is " << target_image_size.size() << " px.\n";
 
+    // Each output tile finds where it was seen from a coarse grid
+    // over the DEM under it, then reads only the part of the camera
+    // image it needs, so tiles are written in parallel in bounded
+    // memory.
+    ImageViewRef<PixelMask<float> > dem;
+    if ( dem_rsrc->has_nodata_read() )
+      dem = create_mask( DiskImageView<float>( dem_rsrc ), dem_rsrc->nodata_read() );
+    else
+      dem = pixel_cast<PixelMask<float> >( DiskImageView<float>( dem_rsrc ) );
+    asp::RPCInverseGrid grid( *xml.rpc_ptr(), target_georef, dem_georef, dem,
+                              opt.mapping_tolerance );
+
     boost::shared_ptr<DiskImageResource>
       src_rsrc( DiskImageResource::open( opt.image_file ) );
+    ImageViewRef<PixelMask<float> > image;
+    if ( src_rsrc->has_nodata_read() )
+      image = create_mask( DiskImageView<float>( src_rsrc ), src_rsrc->nodata_read() );
+    else
+      image = pixel_cast<PixelMask<float> >( DiskImageView<float>( src_rsrc ) );
 
     // Raster output image
-    if ( src_rsrc->has_nodata_read() ) {
-      asp::block_write_gdal_image( opt.output_file,
-                                   apply_mask(transform( create_mask( DiskImageView<float>( src_rsrc), src_rsrc->nodata_read() ),
-                                                         asp::RPCMapTransform( *xml.rpc_ptr(),
-                                                                               target_georef,
-                                                                               dem_georef,
-                                                                               dem_rsrc ),
-                                                         target_image_size.width(),
-                                                         target_image_size.height(),
-                                                         ValueEdgeExtension<PixelMask<float> >( PixelMask<float>() ),
-                                                         BicubicInterpolation() ),
-                                              src_rsrc->nodata_read() ),
-                                   target_georef, opt,
+    ImageViewRef<PixelMask<float> > projected =
+      asp::rpc_map_project( image, grid,
+                            target_image_size.width(),
+                            target_image_size.height() );
+    if ( opt.has_nodata_value || src_rsrc->has_nodata_read() ) {
+      float nodata = opt.has_nodata_value ? opt.nodata_value : src_rsrc->nodata_read();
+      asp::block_write_gdal_image( opt.output_file, apply_mask( projected, nodata ),
+                                   target_georef, nodata, opt,
                                    TerminalProgressCallback("","") );
     } else {
-      asp::block_write_gdal_image(opt.output_file,
-                                  transform( DiskImageView<float>( src_rsrc ),
-                                             asp::RPCMapTransform( *xml.rpc_ptr(),
-                                                                   target_georef,
-                                                                   dem_georef,
-                                                                   dem_rsrc ),
-                                             target_image_size.width(),
-                                             target_image_size.height(),
-                                             ZeroEdgeExtension(),
-                                             BicubicInterpolation() ),
-                                  target_georef, opt,
-                                  TerminalProgressCallback("","") );
+      asp::block_write_gdal_image( opt.output_file, apply_mask( projected, 0 ),
+                                   target_georef, opt,
+                                   TerminalProgressCallback("","") );
     }
 
   } ASP_STANDARD_CATCHES;
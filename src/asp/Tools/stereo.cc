@@ -50,7 +50,10 @@ namespace asp {
     general_options_sub.add_options()
       ("session-type,t", po::value(&opt.stereo_session_string), "Select the stereo session type to use for processing. [options: pinhole isis dg rpc]")
       ("stereo-file,s", po::value(&opt.stereo_default_filename)->default_value("./stereo.default"), "Explicitly specify the stereo.default file to use. [default: ./stereo.default]")
-      ("left-image-crop-win", po::value(&opt.left_image_crop_win)->default_value(BBox2i(0, 0, 0, 0), "xoff yoff xsize ysize"), "Do stereo in a subregion of the left image [default: use the entire image].");
+      ("left-image-crop-win", po::value(&opt.left_image_crop_win)->default_value(BBox2i(0, 0, 0, 0), "xoff yoff xsize ysize"), "Do stereo in a subregion of the left image [default: use the entire image].")
+      ("memory-budget", po::value(&opt.memory_budget)->default_value(0), "Memory (in MiB) each stereo stage may use. If set, the tile size and number of threads are chosen to fit it.")
+      ("tif-intermediates", po::bool_switch(&opt.tif_intermediates)->default_value(false), "Write the disparity intermediates (D, RD, F) as GeoTIFF instead of the native memory-mapped format.")
+      ("telemetry", po::bool_switch(&opt.telemetry)->default_value(false), "Record the time, CPU, I/O and memory of each tile in <output-prefix>-telemetry.jsonl.");
 
     // We distinguish between all_general_options, which is all the
     // options we must parse, even if we don't need some of them, and
@@ -173,6 +176,12 @@ namespace asp {
       }
     }
 
+    // Every stage appends its tiles to the same log, which
+    // telemetry_summary.py reads.
+    if ( opt.telemetry )
+      asp::telemetry().open( opt.out_prefix + "-telemetry.jsonl",
+                             fs::path(argv[0]).stem().string() );
+
     opt.session.reset( asp::StereoSession::create(opt.stereo_session_string) );
     opt.session->initialize(opt, opt.in_file1, opt.in_file2,
                             opt.cam_file1, opt.cam_file2,
@@ -243,6 +252,11 @@ namespace asp {
                                           &DiskImageResourceIsis::construct_open,
                                           &DiskImageResourceIsis::construct_create);
 #endif
+    // Native format of the disparity intermediates
+    DiskImageResource::register_file_type(asp::DiskImageResourceMmap::extension(),
+                                          asp::DiskImageResourceMmap::type_static(),
+                                          &asp::DiskImageResourceMmap::construct_open,
+                                          &asp::DiskImageResourceMmap::construct_create);
     asp::StereoSession::register_session_type( "rpc",  &asp::StereoSessionRPC::construct);
     asp::StereoSession::register_session_type( "rmax", &asp::StereoSessionRmax::construct);
 #if defined(ASP_HAVE_PKG_ISISIO) && ASP_HAVE_PKG_ISISIO == 1
@@ -251,6 +265,19 @@ namespace asp {
 
   }
 
+  std::string intermediate_filename(Options const& opt, std::string const& suffix) {
+    return opt.out_prefix + suffix +
+      (opt.tif_intermediates ? std::string(".tif") : DiskImageResourceMmap::extension());
+  }
+
+  std::string existing_intermediate_filename(Options const& opt, std::string const& suffix) {
+    std::string filename = intermediate_filename(opt, suffix);
+    std::string tif_filename = opt.out_prefix + suffix + ".tif";
+    if ( !fs::exists(filename) && fs::exists(tif_filename) )
+      return tif_filename;
+    return filename;
+  }
+
   void user_safety_check(Options const& opt){
 
     //---------------------------------------------------------
@@ -33,6 +33,8 @@
 #include <asp/Core/MedianFilter.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/MemoryPlanner.h>
+#include <asp/Core/DiskImageResourceMmap.h>
 #include <asp/Sessions.h>
 
 namespace po = boost::program_options;
@@ -76,6 +78,27 @@ namespace asp {
   // Register Session types
   void stereo_register_sessions();
 
+  // Name of a disparity intermediate (suffix is "-D", "-RD" or "-F")
+  // to be written by the current run.
+  std::string intermediate_filename(Options const& opt, std::string const& suffix);
+
+  // Name of a disparity intermediate to be read. Falls back to the
+  // GeoTIFF left by an earlier run when no native file exists.
+  std::string existing_intermediate_filename(Options const& opt, std::string const& suffix);
+
+  // Block write a disparity intermediate, picking the writer from the
+  // file extension. Final products keep using block_write_gdal_image.
+  template <class ImageT>
+  void block_write_intermediate_image( std::string const& filename,
+                                       vw::ImageViewBase<ImageT> const& image,
+                                       Options const& opt,
+                                       vw::ProgressCallback const& progress_callback = vw::ProgressCallback::dummy_instance() ) {
+    if ( boost::iends_with(filename, DiskImageResourceMmap::extension()) )
+      block_write_mmap_image( filename, image, opt, progress_callback );
+    else
+      block_write_gdal_image( filename, image, opt, progress_callback );
+  }
+
   // Checks for obvious user mistakes
   void user_safety_check(Options const& opt);
 
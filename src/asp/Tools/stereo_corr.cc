@@ -20,6 +20,7 @@
 ///
 
 #include <asp/Tools/stereo.h>
+#include <asp/Tools/stereo_corr.h>
 #include <vw/InterestPoint.h>
 #include <boost/accumulators/accumulators.hpp>
 #include <boost/accumulators/statistics.hpp>
@@ -187,323 +188,6 @@ void lowres_correlation( Options & opt ) {
            << " ] : LOW-RESOLUTION CORRELATION FINISHED \n";
 }
 
-void split_n_into_k(int n, int k, std::vector<int> & partition){
-
-  // We would like to split the numbers 0, ..., n - 1
-  // into k buckets of approximately equal size.
-  // For example, for n = 8 and k = 3, we will
-  // have the split
-  // {0, 1, 2}, {3, 4, 5}, {6, 7}.
-
-  VW_ASSERT(n >= k && k > 0, ArgumentErr() << "split_n_into_k: Must have n >= k && k > 0.\n");
-  int rem = n % k;
-  int dx0 = n / k;
-
-  partition.clear();
-  int start = 0;
-  for (int i = 0; i < k; i++){
-    int dx = dx0;
-    if (rem > 0){
-      dx++;
-      rem--;
-    }
-    partition.push_back(start);
-    start += dx;
-  }
-  partition.push_back(start);
-
-}
-
-// Given a disparity map restricted to a subregion, find the homography
-// transform which aligns best the two images based on this disparity.
-template<class SeedDispT>
-Matrix<double> homography_for_disparity(BBox2i subregion,
-                                        SeedDispT const& disparity){
-
-  VW_ASSERT(subregion.width() == disparity.cols() &&
-            subregion.height() == disparity.rows(),
-            ArgumentErr() << "homography_for_disparity: "
-            << "The sizes of subregion and disparity don't match.\n");
-
-  // To do: Find the bounding box of the region with valid disparities first!
-  // Even that one may not be enough!
-
-  // We will split the subregion into N x N boxes, and average the
-  // disparity in each box, to reduce the run-time.
-  int N = 10;
-
-  std::vector<int> partitionx, partitiony;
-  split_n_into_k(disparity.cols(), std::min(disparity.cols(), N), partitionx);
-  split_n_into_k(disparity.rows(), std::min(disparity.rows(), N), partitiony);
-
-  std::vector<vw::ip::InterestPoint> left_ip, right_ip;
-  for (int ix = 0; ix < (int)partitionx.size()-1; ix++){
-    for (int iy = 0; iy < (int)partitiony.size()-1; iy++){
-
-      // First sum up the disparities in each subbox.
-      double lx = 0, ly = 0, rx = 0, ry = 0, count = 0; // int may cause overflow
-      for (int x = partitionx[ix]; x < partitionx[ix+1]; x++){
-        for (int y = partitiony[iy]; y < partitiony[iy+1]; y++){
-
-          typename SeedDispT::pixel_type disp = disparity(x, y);
-          if (!is_valid(disp)) continue;
-          lx += x; rx += (x + disp.child().x());
-          ly += y; ry += (y + disp.child().y());
-          count++;
-        }
-      }
-      if (count == 0) continue; // no valid points
-
-      // Do the averaging. We must add the box corner to the left and
-      // right interest points.
-      vw::ip::InterestPoint l, r;
-      l.x = subregion.min().x() + lx/count; r.x = subregion.min().x() + rx/count;
-      l.y = subregion.min().y() + ly/count; r.y = subregion.min().y() + ry/count;
-      left_ip.push_back(l);
-      right_ip.push_back(r);
-    }
-  }
-
-  try {
-    return homography_fit(right_ip, left_ip, bounding_box(disparity));
-  }catch ( const ArgumentErr& e ){
-    // Will return the identity matrix.
-  }
-  return math::identity_matrix<3>();
-
-}
-
-// This correlator takes a low resolution disparity image as an input
-// so that it may narrow its search range for each tile that is
-// processed.
-template <class Image1T, class Image2T, class Mask1T, class Mask2T, class SeedDispT, class PProcT>
-class SeededCorrelatorView : public ImageViewBase<SeededCorrelatorView<Image1T, Image2T, Mask1T, Mask2T, SeedDispT, PProcT > > {
-  Image1T m_left_image;
-  Image2T m_right_image;
-  Mask1T m_left_mask;
-  Mask2T m_right_mask;
-  SeedDispT m_sub_disparity;
-  SeedDispT m_sub_disparity_spread;
-  PProcT m_preproc_func;
-
-  // Settings
-  Vector2f m_upscale_factor;
-  BBox2i m_seed_bbox;
-  BBox2i m_left_image_crop_win;
-  stereo::CostFunctionType m_cost_mode;
-
-public:
-  SeededCorrelatorView( ImageViewBase<Image1T> const& left_image,
-                        ImageViewBase<Image2T> const& right_image,
-                        ImageViewBase<Mask1T> const& left_mask,
-                        ImageViewBase<Mask2T> const& right_mask,
-                        ImageViewBase<SeedDispT> const& sub_disparity,
-                        ImageViewBase<SeedDispT> const& sub_disparity_spread,
-                        stereo::PreFilterBase<PProcT> const& filter,
-                        BBox2i left_image_crop_win,
-                        stereo::CostFunctionType cost_mode ) :
-    m_left_image(left_image.impl()), m_right_image(right_image.impl()),
-    m_left_mask(left_mask.impl()), m_right_mask(right_mask.impl()),
-    m_sub_disparity( sub_disparity.impl() ),
-    m_sub_disparity_spread( sub_disparity_spread.impl() ),
-    m_preproc_func( filter.impl() ), m_left_image_crop_win(left_image_crop_win), m_cost_mode(cost_mode) {
-    m_upscale_factor[0] = float(m_left_image.cols()) / float(m_sub_disparity.cols());
-    m_upscale_factor[1] = float(m_left_image.rows()) / float(m_sub_disparity.rows());
-    m_seed_bbox = bounding_box( m_sub_disparity );
-  }
-
-  // Image View interface
-  typedef PixelMask<Vector2i> pixel_type;
-  typedef pixel_type result_type;
-  typedef ProceduralPixelAccessor<SeededCorrelatorView> pixel_accessor;
-
-  inline int32 cols() const { return m_left_image.cols(); }
-  inline int32 rows() const { return m_left_image.rows(); }
-  inline int32 planes() const { return 1; }
-
-  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
-
-  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
-    vw_throw(NoImplErr() << "SeededCorrelatorView::operator()(...) is not implemented");
-    return pixel_type();
-  }
-
-  typedef CropView<ImageView<pixel_type> > prerasterize_type;
-  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
-
-    // We do stereo only in m_left_image_crop_win. Skip the current tile if
-    // it does not intersect this region.
-    BBox2i intersection = bbox; intersection.crop(m_left_image_crop_win);
-    if (intersection.empty()){
-      return prerasterize_type(ImageView<pixel_type>(bbox.width(),
-                                                     bbox.height()),
-                               -bbox.min().x(), -bbox.min().y(),
-                               cols(), rows() );
-    }
-
-    CropView<ImageView<pixel_type> > disparity = prerasterize_helper(bbox);
-
-    // Set to invalid the disparity outside m_left_image_crop_win.
-    for (int col = bbox.min().x(); col < bbox.max().x(); col++){
-      for (int row = bbox.min().y(); row < bbox.max().y(); row++){
-        if (!m_left_image_crop_win.contains(Vector2(col, row))){
-          disparity(col, row) = pixel_type();
-        }
-      }
-    }
-
-    return disparity;
-  }
-
-  inline prerasterize_type prerasterize_helper(BBox2i const& bbox) const {
-
-    bool use_local_homography = stereo_settings().use_local_homography;
-
-    Matrix<double> lowres_hom  = math::identity_matrix<3>();
-    Matrix<double> fullres_hom = math::identity_matrix<3>();
-    ImageViewRef<typename Image2T::pixel_type> right_trans_img;
-    ImageViewRef<typename Mask2T::pixel_type> right_trans_mask;
-
-    // User strategies
-    BBox2f local_search_range;
-    if ( stereo_settings().seed_mode == 1 || stereo_settings().seed_mode == 2 ) {
-
-      // The low-res version of bbox
-      BBox2i seed_bbox( elem_quot(bbox.min(), m_upscale_factor),
-                        elem_quot(bbox.max(), m_upscale_factor) );
-      if (use_local_homography){
-        // Expand the box until square to make sure the local homography
-        // calculation does not fail.
-        int len = std::max(seed_bbox.width(), seed_bbox.height());
-        seed_bbox = BBox2i(seed_bbox.max() - Vector2(len, len), seed_bbox.max());
-      }
-
-      seed_bbox.expand(1);
-      seed_bbox.crop( m_seed_bbox );
-      VW_OUT(DebugMessage, "stereo") << "Getting disparity range for : "
-                                     << seed_bbox << "\n";
-
-      SeedDispT disparity_in_box = crop( m_sub_disparity, seed_bbox );
-
-      if (!use_local_homography){
-        local_search_range = stereo::get_disparity_range( disparity_in_box );
-      }else{
-        lowres_hom = homography_for_disparity(seed_bbox, disparity_in_box);
-        local_search_range = stereo::get_disparity_range
-          (transform_disparities(seed_bbox, lowres_hom, disparity_in_box));
-      }
-
-      if (stereo_settings().seed_mode == 2){
-        // Expand the disparity range by the disparity spread computed
-        // from input DEM.
-
-        SeedDispT spread_in_box = crop( m_sub_disparity_spread, seed_bbox );
-
-        if (!use_local_homography){
-          BBox2f spread = stereo::get_disparity_range( spread_in_box );
-          local_search_range.min() -= spread.max();
-          local_search_range.max() += spread.max();
-        }else{
-          SeedDispT upper_disp
-            = transform_disparities(seed_bbox, lowres_hom,
-                                    disparity_in_box + spread_in_box);
-          SeedDispT lower_disp
-            = transform_disparities(seed_bbox, lowres_hom,
-                                    disparity_in_box - spread_in_box);
-          BBox2f upper_range = stereo::get_disparity_range(upper_disp);
-          BBox2f lower_range = stereo::get_disparity_range(lower_disp);
-
-          local_search_range = upper_range;
-          local_search_range.grow(lower_range);
-        }
-      }
-
-      if (use_local_homography){
-        Vector3 upscale( m_upscale_factor[0], m_upscale_factor[1], 1 );
-        Vector3 dnscale( 1.0/m_upscale_factor[0], 1.0/m_upscale_factor[1], 1 );
-        fullres_hom = diagonal_matrix(upscale)*lowres_hom*diagonal_matrix(dnscale);
-
-        ImageViewRef< PixelMask<typename Image2T::pixel_type> >
-          right_trans_masked_img = transform (copy_mask( m_right_image.impl(),
-                                                         create_mask(m_right_mask.impl()) ),
-                                              HomographyTransform(fullres_hom),
-                                              m_left_image.impl().cols(),
-                                              m_left_image.impl().rows());
-        right_trans_img  = apply_mask(right_trans_masked_img);
-        right_trans_mask = channel_cast_rescale<uint8>(select_channel(right_trans_masked_img, 1));
-      }
-
-      local_search_range = grow_bbox_to_int(local_search_range);
-      // Expand local_search_range by 1. This is necessary since
-      // m_sub_disparity is integer-valued, and perhaps the search
-      // range was supposed to be a fraction of integer bigger.
-      local_search_range.expand(1);
-      // Scale the search range to full-resolution
-      local_search_range.min() = floor(elem_prod(local_search_range.min(),
-                                                 m_upscale_factor));
-      local_search_range.max() = ceil(elem_prod(local_search_range.max(),
-                                                m_upscale_factor));
-
-      VW_OUT(DebugMessage, "stereo") << "SeededCorrelatorView("
-                                     << bbox << ") search range "
-                                     << local_search_range << " vs "
-                                     << stereo_settings().search_range << "\n";
-
-    } else if ( stereo_settings().seed_mode == 0 ) {
-      local_search_range = stereo_settings().search_range;
-      VW_OUT(DebugMessage,"stereo") << "Searching with " << stereo_settings().search_range << "\n";
-    }else{
-      vw_throw( ArgumentErr() << "stereo_corr: Invalid value for seed-mode: "
-                << stereo_settings().seed_mode << ".\n" );
-    }
-
-    if (use_local_homography){
-      typedef stereo::PyramidCorrelationView<Image1T, ImageViewRef<typename Image2T::pixel_type>, Mask1T,ImageViewRef<typename Mask2T::pixel_type>, PProcT> CorrView;
-      CorrView corr_view( m_left_image, right_trans_img,
-                          m_left_mask, right_trans_mask,
-                          m_preproc_func, local_search_range,
-                          stereo_settings().corr_kernel, m_cost_mode,
-                          stereo_settings().xcorr_threshold,
-                          stereo_settings().corr_max_levels );
-      return prerasterize_type
-        (transform_disparities(bbox, inverse(fullres_hom),
-                               crop(corr_view.prerasterize(bbox), bbox)),
-         -bbox.min().x(), -bbox.min().y(),
-         cols(), rows() );
-    }else{
-      typedef stereo::PyramidCorrelationView<Image1T, Image2T, Mask1T, Mask2T, PProcT> CorrView;
-      CorrView corr_view( m_left_image, m_right_image,
-                          m_left_mask, m_right_mask,
-                          m_preproc_func, local_search_range,
-                          stereo_settings().corr_kernel, m_cost_mode,
-                          stereo_settings().xcorr_threshold,
-                          stereo_settings().corr_max_levels );
-      return corr_view.prerasterize(bbox);
-    }
-  }
-
-  template <class DestT>
-  inline void rasterize(DestT const& dest, BBox2i bbox) const {
-    vw::rasterize(prerasterize(bbox), dest, bbox);
-  }
-};
-
-template <class Image1T, class Image2T, class Mask1T, class Mask2T, class SeedDispT, class PProcT>
-SeededCorrelatorView<Image1T, Image2T, Mask1T, Mask2T, SeedDispT, PProcT>
-seeded_correlation( ImageViewBase<Image1T> const& left,
-                    ImageViewBase<Image2T> const& right,
-                    ImageViewBase<Mask1T> const& lmask,
-                    ImageViewBase<Mask2T> const& rmask,
-                    ImageViewBase<SeedDispT> const& sub_disparity,
-                    ImageViewBase<SeedDispT> const& sub_disparity_spread,
-                    stereo::PreFilterBase<PProcT> const& filter,
-                    BBox2i left_image_crop_win,
-                    stereo::CostFunctionType cost_type ) {
-  typedef SeededCorrelatorView<Image1T, Image2T, Mask1T, Mask2T, SeedDispT, PProcT> return_type;
-  return return_type( left.impl(), right.impl(), lmask.impl(), rmask.impl(),
-                      sub_disparity.impl(), sub_disparity_spread.impl(), filter.impl(), left_image_crop_win, cost_type );
-}
-
 void stereo_correlation( Options& opt ) {
 
   lowres_correlation(opt);
@@ -529,6 +213,12 @@ void stereo_correlation( Options& opt ) {
   vw_out(DebugMessage) << "\t   Prefilter Size:  " << stereo_settings().slogW << std::endl;
   vw_out() << "\t--------------------------------------------------\n";
 
+  // The search range is known only now, so this is the earliest we
+  // can estimate the correlator's working set.
+  apply_tile_plan( opt, correlation_footprint( stereo_settings().corr_kernel,
+                                               stereo_settings().search_range.size(),
+                                               stereo_settings().corr_max_levels ) );
+
   // Load up for the actual native resolution processing
   DiskImageView<PixelGray<float> > left_disk_image(opt.out_prefix+"-L.tif"),
     right_disk_image(opt.out_prefix+"-R.tif");
@@ -574,9 +264,9 @@ void stereo_correlation( Options& opt ) {
                           cost_mode );
   }
 
-  asp::block_write_gdal_image( opt.out_prefix + "-D.tif",
-                               fullres_disparity, opt,
-                               TerminalProgressCallback("asp", "\t--> Correlation :") );
+  asp::block_write_intermediate_image( asp::intermediate_filename(opt, "-D"),
+                                       asp::telemetry_view(fullres_disparity, "correlation"), opt,
+                                       TerminalProgressCallback("asp", "\t--> Correlation :") );
 
   vw_out() << "\n[ " << current_posix_time_string()
            << " ] : CORRELATION FINISHED \n";
@@ -21,6 +21,7 @@
 //#define USE_GRAPHICS
 
 #include <asp/Tools/stereo.h>
+#include <asp/Tools/stereo_fltr.h>
 #include <vw/Stereo/DisparityMap.h>
 
 #include <asp/Core/BlobIndexThreaded.h>
@@ -35,45 +36,6 @@ namespace vw {
   template<> struct PixelFormatID<PixelMask<Vector<float, 5> > >   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
 }
 
-// This uses a struct as partial template specialization is not
-// allowed for functions in C++.
-template <class ViewT, int N>
-struct MultipleDisparityCleanUp {
-
-  MultipleDisparityCleanUp<ViewT,N-1> inner_func;
-
-  typedef typename MultipleDisparityCleanUp<ViewT,N-1>::result_type inner_type;
-  typedef UnaryPerPixelAccessorView< UnaryPerPixelAccessorView<EdgeExtensionView<inner_type,ConstantEdgeExtension>, stereo::RemoveOutliersFunc<typename inner_type::pixel_type> >, stereo::RemoveOutliersFunc<typename inner_type::pixel_type> > result_type;
-
-  inline result_type operator()( ImageViewBase<ViewT> const& input,
-                                 int const& h_half_kern,
-                                 int const& v_half_kern,
-                                 double const& pixel_thres,
-                                 double const& rej_thres )  {
-    return stereo::disparity_clean_up(
-                                      inner_func(input.impl(), h_half_kern,
-                                                 v_half_kern, pixel_thres,
-                                                 rej_thres), h_half_kern,
-                                      v_half_kern, pixel_thres, rej_thres);
-  }
-};
-
-template <class ViewT>
-struct MultipleDisparityCleanUp<ViewT,1> {
-
-  typedef UnaryPerPixelAccessorView< UnaryPerPixelAccessorView<EdgeExtensionView<ViewT,ConstantEdgeExtension>, stereo::RemoveOutliersFunc<typename ViewT::pixel_type> >, stereo::RemoveOutliersFunc<typename ViewT::pixel_type> > result_type;
-
-  inline result_type operator()( ImageViewBase<ViewT> const& input,
-                                 int const& h_half_kern,
-                                 int const& v_half_kern,
-                                 double const& pixel_thres,
-                                 double const& rej_thres ) {
-    return stereo::disparity_clean_up(
-                                      input.impl(), h_half_kern,
-                                      v_half_kern, pixel_thres, rej_thres);
-  }
-};
-
 template <class ImageT>
 void write_good_pixel_and_filtered( ImageViewBase<ImageT> const& inputview,
                                     Options const& opt ) {
@@ -101,15 +63,16 @@ void write_good_pixel_and_filtered( ImageViewBase<ImageT> const& inputview,
     vw_out() << "\t    * Identified " << bindex.num_blobs() << " holes\n";
     bool use_grassfire = true;
     typename ImageT::pixel_type default_inpaint_val;
-    asp::block_write_gdal_image( opt.out_prefix + "-F.tif",
-                                 inpaint(inputview.impl(), bindex,
-                                         use_grassfire, default_inpaint_val),
-                                 opt, TerminalProgressCallback("asp","\t--> Filtering: ") );
+    asp::block_write_intermediate_image( asp::intermediate_filename(opt, "-F"),
+                                         asp::telemetry_view(inpaint(inputview.impl(), bindex,
+                                                                     use_grassfire, default_inpaint_val),
+                                                             "filtering and inpainting"),
+                                         opt, TerminalProgressCallback("asp","\t--> Filtering: ") );
 
   } else {
-    asp::block_write_gdal_image( opt.out_prefix + "-F.tif",
-                                 inputview.impl(), opt,
-                                 TerminalProgressCallback("asp", "\t--> Filtering: ") );
+    asp::block_write_intermediate_image( asp::intermediate_filename(opt, "-F"),
+                                         asp::telemetry_view(inputview, "filtering"), opt,
+                                         TerminalProgressCallback("asp", "\t--> Filtering: ") );
   }
 }
 
@@ -117,7 +80,7 @@ void stereo_filtering( Options& opt ) {
   vw_out() << "\n[ " << current_posix_time_string() << " ] : Stage 3 --> FILTERING \n";
 
   std::string post_correlation_fname;
-  opt.session->pre_filtering_hook(opt.out_prefix+"-RD.tif",
+  opt.session->pre_filtering_hook(asp::existing_intermediate_filename(opt, "-RD"),
                                   post_correlation_fname);
 
   try {
@@ -261,6 +224,9 @@ int main(int argc, char* argv[]) {
     handle_arguments( argc, argv, opt,
                       FilteringDescription() );
 
+    apply_tile_plan( opt, filtering_footprint( stereo_settings().rm_half_kernel,
+                                               stereo_settings().fill_hole_max_size ) );
+
     // Internal Processes
     //---------------------------------------------------------
     stereo_filtering( opt );
@@ -0,0 +1,73 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file stereo_fltr.h
+///
+/// Repeated outlier removal on a disparity map. Shared by
+/// stereo_fltr and the benchmarks.
+
+#ifndef __ASP_TOOLS_STEREO_FLTR_H__
+#define __ASP_TOOLS_STEREO_FLTR_H__
+
+#include <vw/Image.h>
+#include <vw/Stereo/DisparityMap.h>
+
+namespace vw {
+
+  // This uses a struct as partial template specialization is not
+  // allowed for functions in C++.
+  template <class ViewT, int N>
+  struct MultipleDisparityCleanUp {
+
+    MultipleDisparityCleanUp<ViewT,N-1> inner_func;
+
+    typedef typename MultipleDisparityCleanUp<ViewT,N-1>::result_type inner_type;
+    typedef UnaryPerPixelAccessorView< UnaryPerPixelAccessorView<EdgeExtensionView<inner_type,ConstantEdgeExtension>, stereo::RemoveOutliersFunc<typename inner_type::pixel_type> >, stereo::RemoveOutliersFunc<typename inner_type::pixel_type> > result_type;
+
+    inline result_type operator()( ImageViewBase<ViewT> const& input,
+                                   int const& h_half_kern,
+                                   int const& v_half_kern,
+                                   double const& pixel_thres,
+                                   double const& rej_thres )  {
+      return stereo::disparity_clean_up(
+                                        inner_func(input.impl(), h_half_kern,
+                                                   v_half_kern, pixel_thres,
+                                                   rej_thres), h_half_kern,
+                                        v_half_kern, pixel_thres, rej_thres);
+    }
+  };
+
+  template <class ViewT>
+  struct MultipleDisparityCleanUp<ViewT,1> {
+
+    typedef UnaryPerPixelAccessorView< UnaryPerPixelAccessorView<EdgeExtensionView<ViewT,ConstantEdgeExtension>, stereo::RemoveOutliersFunc<typename ViewT::pixel_type> >, stereo::RemoveOutliersFunc<typename ViewT::pixel_type> > result_type;
+
+    inline result_type operator()( ImageViewBase<ViewT> const& input,
+                                   int const& h_half_kern,
+                                   int const& v_half_kern,
+                                   double const& pixel_thres,
+                                   double const& rej_thres ) {
+      return stereo::disparity_clean_up(
+                                        input.impl(), h_half_kern,
+                                        v_half_kern, pixel_thres, rej_thres);
+    }
+  };
+
+} // end namespace vw
+
+#endif//__ASP_TOOLS_STEREO_FLTR_H__
@@ -208,19 +208,18 @@ void stereo_preprocessing( Options& opt ) {
     if ( sub_scale > 0.6 ) sub_scale = 0.6;
 
     // Solving for the number of threads and the tile size to use for
-    // subsampling while only using 500 MiB of memory. (The cache code
-    // is a little slow on releasing so it will probably use 1.5GiB
-    // memory during subsampling) Also tile size must be a power of 2
-    // and greater than or equal to 64 px;
-    uint32 sub_threads = vw_settings().default_num_threads() + 1;
-    uint32 tile_power = 0;
-    while ( tile_power < 6 && sub_threads > 1) {
-      sub_threads--;
-      tile_power = boost::numeric_cast<uint32>( log10(500e6*sub_scale*sub_scale/(4.0*float(sub_threads)))/(2*log10(2)));
-    }
-    uint32 sub_tile_size = 1u << tile_power;
-    if ( sub_tile_size > vw_settings().default_tile_size() )
-      sub_tile_size = vw_settings().default_tile_size();
+    // subsampling within the memory budget, or 500 MB if none was
+    // given. (The cache code is a little slow on releasing so it will
+    // probably use 3x that during subsampling) Also tile size must be
+    // a power of 2 and greater than or equal to 64 px.
+    double sub_budget = opt.memory_budget > 0 ? opt.memory_budget*1024.0*1024.0 : 500e6;
+    TilePlan sub_plan = plan_tiles( subsample_footprint( sub_scale ),
+                                    sub_budget,
+                                    vw_settings().default_num_threads(),
+                                    64, std::max(64, int(vw_settings().default_tile_size())) );
+    uint32 sub_threads   = sub_plan.num_threads;
+    uint32 sub_tile_size = sub_plan.tile_size.x();
+    vw_out(DebugMessage,"asp") << "Subsampling memory plan: " << sub_plan << "\n";
 
     vw_out() << "\t--> Creating previews. Subsampling by " << sub_scale
              << " by using " << sub_tile_size << " tile size and "
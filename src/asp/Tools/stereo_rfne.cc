@@ -106,7 +106,8 @@ void stereo_refinement( Options& opt ) {
     */
     typedef DiskImageView<PixelGray<float> > InnerView;
     InnerView left_disk_image(filename_L), right_disk_image(filename_R);
-    DiskImageView<PixelMask<Vector2i> > disparity_disk_image(opt.out_prefix + "-D.tif");
+    DiskImageView<PixelMask<Vector2i> >
+      disparity_disk_image(asp::existing_intermediate_filename(opt, "-D"));
     ImageViewRef<PixelMask<Vector2f> > disparity_map =
       pixel_cast<PixelMask<Vector2f> >(disparity_disk_image);
 
@@ -174,7 +175,8 @@ void stereo_refinement( Options& opt ) {
 
       DiskImageResourceOpenEXR em_disparity_map_rsrc(opt.out_prefix + "-F6.exr", em_correlator.format());
 
-      block_write_image(em_disparity_map_rsrc, em_correlator,
+      block_write_image(em_disparity_map_rsrc,
+                        asp::telemetry_view(em_correlator, "em subpixel"),
                         TerminalProgressCallback("asp", "\t--> EM Refinement :"));
 
       DiskImageResource *em_disparity_map_rsrc_2 =
@@ -198,10 +200,10 @@ void stereo_refinement( Options& opt ) {
       vw_out() << "\t--> Doing nothing\n";
     }
 
-    asp::block_write_gdal_image( opt.out_prefix + "-RD.tif",
-                                 selective_rasterize(disparity_map,
-                                                     opt.left_image_crop_win), opt,
-                                 TerminalProgressCallback("asp", "\t--> Refinement :") );
+    asp::block_write_intermediate_image( asp::intermediate_filename(opt, "-RD"),
+                                         selective_rasterize(asp::telemetry_view(disparity_map, "subpixel"),
+                                                             opt.left_image_crop_win), opt,
+                                         TerminalProgressCallback("asp", "\t--> Refinement :") );
 
   } catch (IOErr const& e) {
     vw_throw( ArgumentErr() << "\nUnable to start at refinement stage -- could not read input files.\n" << e.what() << "\nExiting.\n\n" );
@@ -216,6 +218,10 @@ int main(int argc, char* argv[]) {
     handle_arguments( argc, argv, opt,
                       SubpixelDescription() );
 
+    apply_tile_plan( opt, subpixel_footprint( stereo_settings().subpixel_kernel,
+                                              stereo_settings().subpixel_mode,
+                                              stereo_settings().subpixel_max_levels ) );
+
     // Internal Processes
     //---------------------------------------------------------
     stereo_refinement( opt );
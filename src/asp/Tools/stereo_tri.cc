@@ -21,6 +21,8 @@
 //#define USE_GRAPHICS
 
 #include <asp/Tools/stereo.h>
+#include <asp/Tools/stereo_tri.h>
+#include <asp/Core/PointCloudQuantization.h>
 #include <asp/Sessions/RPC/RPCModel.h>
 #include <asp/Sessions/RPC/RPCStereoModel.h>
 #include <vw/Cartography.h>
@@ -32,7 +34,6 @@ using namespace vw;
 using namespace asp;
 
 namespace vw {
-  typedef Vector<double, 6> Vector6;
   template<> struct PixelFormatID<PixelMask<Vector<float, 5> > >   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
   template<> struct PixelFormatID<Vector<double, 6> >   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_6_CHANNEL; };
   template<> struct PixelFormatID<Vector<double, 4> >   { static const PixelFormatEnum value = VW_PIXEL_GENERIC_4_CHANNEL; };
@@ -59,268 +60,41 @@ namespace asp{
   }
 
   template <class ImageT>
-  void save_point_cloud(ImageT const& point_cloud, Options const& opt){
-
-    std::string point_cloud_file = opt.out_prefix + "-PC.tif";
-    vw_out() << "Writing Point Cloud: " << point_cloud_file << "\n";
-
-    boost::scoped_ptr<DiskImageResource> rsrc (asp::build_gdal_rsrc( point_cloud_file,
-                                                                     point_cloud, opt ));
+  void write_point_cloud(DiskImageResource& rsrc, ImageT const& point_cloud, Options const& opt){
     if ( opt.stereo_session_string == "isis" ){
       // ISIS does not support multi-threading
-      write_image(*rsrc, point_cloud,
+      write_image(rsrc, asp::telemetry_write_view(point_cloud, opt.out_prefix + "-PC.tif"),
                   TerminalProgressCallback("asp", "\t--> Triangulating: "));
     }else{
-      block_write_image(*rsrc, point_cloud,
+      block_write_image(rsrc, asp::telemetry_write_view(point_cloud, opt.out_prefix + "-PC.tif"),
                         TerminalProgressCallback("asp", "\t--> Triangulating: "));
     }
-
-  }
-
-}
-
-// Class definition
-template <class DisparityImageT, class StereoModelT>
-class StereoAndErrorView : public ImageViewBase<StereoAndErrorView<DisparityImageT, StereoModelT> >
-{
-  DisparityImageT m_disparity_map;
-  StereoModelT m_stereo_model;
-  typedef typename DisparityImageT::pixel_type dpixel_type;
-
-  template <class PixelT>
-  struct NotSingleChannel {
-    static const bool value = (1 != CompoundNumChannels<typename UnmaskedPixelType<PixelT>::type>::value);
-  };
-
-  template <class T>
-  inline typename boost::enable_if<IsScalar<T>,Vector3>::type
-  StereoModelHelper( StereoModelT const& model, Vector2 const& index,
-                     T const& disparity, Vector3& error ) const {
-    return model( index, Vector2( index[0] + disparity, index[1] ), error );
-  }
-
-  template <class T>
-  inline typename boost::enable_if_c<IsCompound<T>::value && (CompoundNumChannels<typename UnmaskedPixelType<T>::type>::value == 1),Vector3>::type
-    StereoModelHelper( StereoModelT const& model, Vector2 const& index,
-                       T const& disparity, Vector3& error ) const {
-    return model( index, Vector2( index[0] + disparity, index[1] ), error );
-  }
-
-  template <class T>
-  inline typename boost::enable_if_c<IsCompound<T>::value && (CompoundNumChannels<typename UnmaskedPixelType<T>::type>::value != 1),Vector3>::type
-    StereoModelHelper( StereoModelT const& model, Vector2 const& index,
-                       T const& disparity, Vector3& error ) const {
-    return model( index, Vector2( index[0] + disparity[0],
-                                  index[1] + disparity[1] ), error );
-  }
-
-public:
-
-  typedef Vector6 pixel_type;
-  typedef const Vector6 result_type;
-  typedef ProceduralPixelAccessor<StereoAndErrorView> pixel_accessor;
-
-  StereoAndErrorView( DisparityImageT const& disparity_map,
-                      vw::camera::CameraModel const* camera_model1,
-                      vw::camera::CameraModel const* camera_model2,
-                      bool least_squares_refine = false) :
-    m_disparity_map(disparity_map),
-    m_stereo_model(camera_model1, camera_model2, least_squares_refine) {}
-
-  StereoAndErrorView( DisparityImageT const& disparity_map,
-                      StereoModelT const& stereo_model) :
-    m_disparity_map(disparity_map),
-    m_stereo_model(stereo_model) {}
-
-  inline int32 cols() const { return m_disparity_map.cols(); }
-  inline int32 rows() const { return m_disparity_map.rows(); }
-  inline int32 planes() const { return 1; }
-
-  inline pixel_accessor origin() const { return pixel_accessor(*this); }
-
-  inline result_type operator()( size_t i, size_t j, size_t p=0 ) const {
-    if ( is_valid(m_disparity_map(i,j,p)) ) {
-      Vector3 error;
-      pixel_type result;
-      subvector(result,0,3) = StereoModelHelper( m_stereo_model, Vector2(i,j),
-                                                 m_disparity_map(i,j,p), error );
-      subvector(result,3,3) = error;
-      return result;
-    }
-    // For missing pixels in the disparity map, we return a null 3D position.
-    return pixel_type();
   }
 
-  /// \cond INTERNAL
-  typedef StereoAndErrorView<typename DisparityImageT::prerasterize_type, StereoModelT> prerasterize_type;
-  inline prerasterize_type prerasterize( BBox2i const& bbox ) const { return prerasterize_type( m_disparity_map.prerasterize(bbox), m_stereo_model ); }
-  template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const { vw::rasterize( prerasterize(bbox), dest, bbox ); }
-  /// \endcond
-};
-
-// Variant that uses LUT tables
-template <class DisparityImageT, class LUTImage1T, class LUTImage2T, class StereoModelT>
-class StereoLUTAndErrorView : public ImageViewBase<StereoLUTAndErrorView<DisparityImageT, LUTImage1T, LUTImage2T, StereoModelT> >
-{
-  DisparityImageT m_disparity_map;
-  LUTImage1T m_lut_image1;
-  InterpolationView< EdgeExtensionView<LUTImage2T, ConstantEdgeExtension>, BilinearInterpolation>  m_lut_image2;
-  LUTImage2T m_lut_image2_org;
-  StereoModelT m_stereo_model;
-  typedef typename DisparityImageT::pixel_type dpixel_type;
-
-  template <class PixelT>
-  struct NotSingleChannel {
-    static const bool value = (1 != CompoundNumChannels<typename UnmaskedPixelType<PixelT>::type>::value);
-  };
-
-  template <class T>
-  inline typename boost::enable_if<IsScalar<T>,Vector3>::type
-  StereoModelHelper( size_t i, size_t j, T const& disparity, Vector3& error ) const {
-    return m_stereo_model( m_lut_image1(i,j),
-                           m_lut_image2( T(i) + disparity, j ), error );
-  }
-
-  template <class T>
-  inline typename boost::enable_if_c<IsCompound<T>::value && (CompoundNumChannels<typename UnmaskedPixelType<T>::type>::value == 1),Vector3>::type
-    StereoModelHelper( size_t i, size_t j, T const& disparity, Vector3& error ) const {
-    return m_stereo_model( m_lut_image1(i,j),
-                           m_lut_image2( float(i) + disparity, j ),  error );
-  }
-
-  template <class T>
-  inline typename boost::enable_if_c<IsCompound<T>::value && (CompoundNumChannels<typename UnmaskedPixelType<T>::type>::value != 1),Vector3>::type
-    StereoModelHelper( size_t i, size_t j, T const& disparity, Vector3& error ) const {
-
-    float i2 = float(i) + disparity[0];
-    float j2 = float(j) + disparity[1];
-    if ( i2 < 0 || i2 >= m_lut_image2.cols() ||
-         j2 < 0 || j2 >= m_lut_image2.rows() ||
-         !is_valid( disparity ) ){
-      return Vector3(); // out of bounds
-    }
-
-    return m_stereo_model( m_lut_image1(i,j), m_lut_image2(i2, j2), error );
-  }
+  template <class ImageT>
+  void save_point_cloud(ImageT const& point_cloud, Options const& opt){
 
-public:
-
-  typedef Vector6 pixel_type;
-  typedef const Vector6 result_type;
-  typedef ProceduralPixelAccessor<StereoLUTAndErrorView> pixel_accessor;
-
-  StereoLUTAndErrorView( ImageViewBase<DisparityImageT> const& disparity_map,
-                         ImageViewBase<LUTImage1T> const& lut_image1,
-                         ImageViewBase<LUTImage2T> const& lut_image2,
-                         vw::camera::CameraModel const* camera_model1,
-                         vw::camera::CameraModel const* camera_model2,
-                         bool least_squares_refine = false) :
-    m_disparity_map(disparity_map.impl()), m_lut_image1( lut_image1.impl() ),
-    m_lut_image2(interpolate(lut_image2.impl())),
-    m_lut_image2_org( lut_image2.impl() ),
-    m_stereo_model(camera_model1, camera_model2, least_squares_refine) {}
-
-  StereoLUTAndErrorView( ImageViewBase<DisparityImageT> const& disparity_map,
-                         ImageViewBase<LUTImage1T> const& lut_image1,
-                         ImageViewBase<LUTImage2T> const& lut_image2,
-                         StereoModelT const& stereo_model) :
-    m_disparity_map(disparity_map.impl()), m_lut_image1(lut_image1.impl()),
-    m_lut_image2(interpolate(lut_image2.impl())),
-    m_lut_image2_org( lut_image2.impl() ),
-    m_stereo_model(stereo_model) {}
-
-  inline int32 cols() const { return m_disparity_map.cols(); }
-  inline int32 rows() const { return m_disparity_map.rows(); }
-  inline int32 planes() const { return 1; }
-
-  inline pixel_accessor origin() const { return pixel_accessor(*this); }
-
-  inline result_type operator()( size_t i, size_t j, size_t p=0 ) const {
-    if ( is_valid(m_disparity_map(i,j,p)) ) {
-      Vector3 error;
-      pixel_type result;
-      subvector(result,0,3) = StereoModelHelper( i, j, m_disparity_map(i,j,p), error );
-      subvector(result,3,3) = error;
-      return result;
-    }
-    // For missing pixels in the disparity map, we return a null 3D position.
-    return pixel_type();
-  }
+    std::string point_cloud_file = opt.out_prefix + "-PC.tif";
+    vw_out() << "Writing Point Cloud: " << point_cloud_file << "\n";
 
-  /// \cond INTERNAL
-  typedef StereoLUTAndErrorView<CropView<ImageView<typename DisparityImageT::pixel_type> >,
-                                typename LUTImage1T::prerasterize_type,
-                                typename LUTImage2T::prerasterize_type,
-                                StereoModelT> prerasterize_type;
-  inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
-    typedef typename DisparityImageT::pixel_type DPixelT;
-    CropView<ImageView<DPixelT> > disparity_preraster =
-      crop( ImageView<DPixelT>( crop( m_disparity_map, bbox ) ),
-            -bbox.min().x(), -bbox.min().y(), cols(), rows() );
-
-    // Calculate the range of disparities in our BBox to determine the
-    // crop size needed for LUT 2.
-    typedef typename UnmaskedPixelType<DPixelT>::type accum_t;
-    PixelAccumulator<EWMinMaxAccumulator<accum_t> > accumulator;
-    for_each_pixel( disparity_preraster.child(), accumulator );
-
-    BBox2i preraster(0,0,0,0);
-    if ( accumulator.is_valid() ){
-      accum_t input_min = accumulator.minimum();
-      accum_t input_max = accumulator.maximum();
-      // Bugfix: expand the preraster window by 1 pixel to avoid segfaults.
-      // This is needed for interpolation.
-      preraster = BBox2i(bbox.min() + floor(Vector2f(input_min[0]-1,input_min[1]-1)),
-                         bbox.max() + ceil(Vector2(input_max[0]+1,input_max[1]+1)) );
+    double precision = stereo_settings().point_cloud_precision;
+    if ( precision > 0 ) {
+      // The local origin comes from a sparse sample of triangulated
+      // pixels, so it is known before the first tile is written.
+      PointCloudQuantization quant( point_cloud_origin(point_cloud), precision );
+      vw_out() << "\t--> Quantizing to " << precision << " m around " << quant.offset << "\n";
+      boost::scoped_ptr<DiskImageResourceGDAL>
+        rsrc (asp::build_gdal_rsrc( point_cloud_file, quantize_points(point_cloud, quant), opt ));
+      write_point_cloud_quantization(*rsrc, quant);
+      write_point_cloud(*rsrc, quantize_points(point_cloud, quant), opt);
+      return;
     }
 
-    return prerasterize_type( disparity_preraster,
-                              m_lut_image1.prerasterize(bbox),
-                              m_lut_image2_org.prerasterize(preraster),
-                              m_stereo_model );
+    boost::scoped_ptr<DiskImageResource> rsrc (asp::build_gdal_rsrc( point_cloud_file,
+                                                                     point_cloud, opt ));
+    write_point_cloud(*rsrc, point_cloud, opt);
   }
-  template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const { vw::rasterize( prerasterize(bbox), dest, bbox ); }
-  /// \endcond
-};
-
-template <class ImageT, class StereoModelT>
-StereoAndErrorView<ImageT, StereoModelT>
-stereo_error_triangulate( ImageViewBase<ImageT> const& v,
-                          vw::camera::CameraModel const* camera1,
-                          vw::camera::CameraModel const* camera2 ) {
-  return StereoAndErrorView<ImageT, StereoModelT>( v.impl(), camera1, camera2 );
-}
 
-template <class ImageT, class StereoModelT>
-StereoAndErrorView<ImageT, StereoModelT>
-lsq_stereo_error_triangulate( ImageViewBase<ImageT> const& v,
-                              vw::camera::CameraModel const* camera1,
-                              vw::camera::CameraModel const* camera2 ) {
-  return StereoAndErrorView<ImageT, StereoModelT>( v.impl(), camera1, camera2, true );
-}
-
-template <class DisparityT, class LUT1T, class LUT2T, class StereoModelT>
-StereoLUTAndErrorView<DisparityT, LUT1T, LUT2T, StereoModelT>
-stereo_error_triangulate( ImageViewBase<DisparityT> const& disparity,
-                          ImageViewBase<LUT1T> const& lut1,
-                          ImageViewBase<LUT2T> const& lut2,
-                          vw::camera::CameraModel const* camera1,
-                          vw::camera::CameraModel const* camera2 ) {
-  typedef StereoLUTAndErrorView<DisparityT, LUT1T, LUT2T, StereoModelT> result_type;
-  return result_type( disparity.impl(), lut1.impl(), lut2.impl(),
-                      camera1, camera2 );
-}
-
-template <class DisparityT, class LUT1T, class LUT2T, class StereoModelT>
-StereoLUTAndErrorView<DisparityT, LUT1T, LUT2T, StereoModelT>
-lsq_stereo_error_triangulate( ImageViewBase<DisparityT> const& disparity,
-                              ImageViewBase<LUT1T> const& lut1,
-                              ImageViewBase<LUT2T> const& lut2,
-                              vw::camera::CameraModel const* camera1,
-                              vw::camera::CameraModel const* camera2 ) {
-  typedef StereoLUTAndErrorView<DisparityT,LUT1T,LUT2T, StereoModelT> result_type;
-  return result_type( disparity.impl(), lut1.impl(), lut2.impl(),
-                      camera1, camera2, true );
 }
 
 template <class StereoModelT>
@@ -332,7 +106,7 @@ void stereo_triangulation( Options const& opt ) {
   typedef ImageViewRef<Vector2f>             VImageT;
   try {
     PVImageT disparity_map =
-      opt.session->pre_pointcloud_hook(opt.out_prefix+"-F.tif");
+      opt.session->pre_pointcloud_hook(asp::existing_intermediate_filename(opt, "-F"));
 
     boost::shared_ptr<camera::CameraModel> camera_model1, camera_model2;
     opt.session->camera_models(camera_model1, camera_model2);
@@ -424,9 +198,11 @@ void stereo_triangulation( Options const& opt ) {
     }
 
     if (stereo_settings().compute_error_vector)
-      save_point_cloud(crop(point_cloud, opt.left_image_crop_win), opt);
+      save_point_cloud(crop(asp::telemetry_view(point_cloud, "triangulation"),
+                            opt.left_image_crop_win), opt);
     else
-      save_point_cloud(point_and_error_norm(crop(point_cloud, opt.left_image_crop_win)), opt);
+      save_point_cloud(point_and_error_norm(crop(asp::telemetry_view(point_cloud, "triangulation"),
+                                                 opt.left_image_crop_win)), opt);
 
   } catch (IOErr const& e) {
     vw_throw( ArgumentErr() << "\nUnable to start at point cloud stage -- could not read input files.\n"
@@ -443,6 +219,8 @@ int main( int argc, char* argv[] ) {
     handle_arguments( argc, argv, opt,
                       TriangulationDescription() );
 
+    apply_tile_plan( opt, triangulation_footprint( opt.session->has_lut_images() ) );
+
     // Internal Processes
     //---------------------------------------------------------
 
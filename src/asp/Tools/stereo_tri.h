@@ -0,0 +1,294 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2012, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file stereo_tri.h
+///
+/// Triangulation views that keep the ray intersection error next to
+/// each point. Shared by stereo_tri and the benchmarks.
+
+#ifndef __ASP_TOOLS_STEREO_TRI_H__
+#define __ASP_TOOLS_STEREO_TRI_H__
+
+#include <vw/Image.h>
+#include <vw/Math.h>
+#include <vw/Camera/CameraModel.h>
+#include <vw/Stereo/StereoModel.h>
+
+#include <boost/utility/enable_if.hpp>
+
+namespace vw {
+
+  typedef Vector<double, 6> Vector6;
+
+  // Class definition
+  template <class DisparityImageT, class StereoModelT>
+  class StereoAndErrorView : public ImageViewBase<StereoAndErrorView<DisparityImageT, StereoModelT> >
+  {
+    DisparityImageT m_disparity_map;
+    StereoModelT m_stereo_model;
+    typedef typename DisparityImageT::pixel_type dpixel_type;
+
+    template <class PixelT>
+    struct NotSingleChannel {
+      static const bool value = (1 != CompoundNumChannels<typename UnmaskedPixelType<PixelT>::type>::value);
+    };
+
+    template <class T>
+    inline typename boost::enable_if<IsScalar<T>,Vector3>::type
+    StereoModelHelper( StereoModelT const& model, Vector2 const& index,
+                       T const& disparity, Vector3& error ) const {
+      return model( index, Vector2( index[0] + disparity, index[1] ), error );
+    }
+
+    template <class T>
+    inline typename boost::enable_if_c<IsCompound<T>::value && (CompoundNumChannels<typename UnmaskedPixelType<T>::type>::value == 1),Vector3>::type
+      StereoModelHelper( StereoModelT const& model, Vector2 const& index,
+                         T const& disparity, Vector3& error ) const {
+      return model( index, Vector2( index[0] + disparity, index[1] ), error );
+    }
+
+    template <class T>
+    inline typename boost::enable_if_c<IsCompound<T>::value && (CompoundNumChannels<typename UnmaskedPixelType<T>::type>::value != 1),Vector3>::type
+      StereoModelHelper( StereoModelT const& model, Vector2 const& index,
+                         T const& disparity, Vector3& error ) const {
+      return model( index, Vector2( index[0] + disparity[0],
+                                    index[1] + disparity[1] ), error );
+    }
+
+  public:
+
+    typedef Vector6 pixel_type;
+    typedef const Vector6 result_type;
+    typedef ProceduralPixelAccessor<StereoAndErrorView> pixel_accessor;
+
+    StereoAndErrorView( DisparityImageT const& disparity_map,
+                        vw::camera::CameraModel const* camera_model1,
+                        vw::camera::CameraModel const* camera_model2,
+                        bool least_squares_refine = false) :
+      m_disparity_map(disparity_map),
+      m_stereo_model(camera_model1, camera_model2, least_squares_refine) {}
+
+    StereoAndErrorView( DisparityImageT const& disparity_map,
+                        StereoModelT const& stereo_model) :
+      m_disparity_map(disparity_map),
+      m_stereo_model(stereo_model) {}
+
+    inline int32 cols() const { return m_disparity_map.cols(); }
+    inline int32 rows() const { return m_disparity_map.rows(); }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()( size_t i, size_t j, size_t p=0 ) const {
+      if ( is_valid(m_disparity_map(i,j,p)) ) {
+        Vector3 error;
+        pixel_type result;
+        subvector(result,0,3) = StereoModelHelper( m_stereo_model, Vector2(i,j),
+                                                   m_disparity_map(i,j,p), error );
+        subvector(result,3,3) = error;
+        return result;
+      }
+      // For missing pixels in the disparity map, we return a null 3D position.
+      return pixel_type();
+    }
+
+    /// \cond INTERNAL
+    typedef StereoAndErrorView<typename DisparityImageT::prerasterize_type, StereoModelT> prerasterize_type;
+    inline prerasterize_type prerasterize( BBox2i const& bbox ) const { return prerasterize_type( m_disparity_map.prerasterize(bbox), m_stereo_model ); }
+    template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const { vw::rasterize( prerasterize(bbox), dest, bbox ); }
+    /// \endcond
+  };
+
+  // Variant that uses LUT tables
+  template <class DisparityImageT, class LUTImage1T, class LUTImage2T, class StereoModelT>
+  class StereoLUTAndErrorView : public ImageViewBase<StereoLUTAndErrorView<DisparityImageT, LUTImage1T, LUTImage2T, StereoModelT> >
+  {
+    DisparityImageT m_disparity_map;
+    LUTImage1T m_lut_image1;
+    InterpolationView< EdgeExtensionView<LUTImage2T, ConstantEdgeExtension>, BilinearInterpolation>  m_lut_image2;
+    LUTImage2T m_lut_image2_org;
+    StereoModelT m_stereo_model;
+    typedef typename DisparityImageT::pixel_type dpixel_type;
+
+    template <class PixelT>
+    struct NotSingleChannel {
+      static const bool value = (1 != CompoundNumChannels<typename UnmaskedPixelType<PixelT>::type>::value);
+    };
+
+    template <class T>
+    inline typename boost::enable_if<IsScalar<T>,Vector3>::type
+    StereoModelHelper( size_t i, size_t j, T const& disparity, Vector3& error ) const {
+      return m_stereo_model( m_lut_image1(i,j),
+                             m_lut_image2( T(i) + disparity, j ), error );
+    }
+
+    template <class T>
+    inline typename boost::enable_if_c<IsCompound<T>::value && (CompoundNumChannels<typename UnmaskedPixelType<T>::type>::value == 1),Vector3>::type
+      StereoModelHelper( size_t i, size_t j, T const& disparity, Vector3& error ) const {
+      return m_stereo_model( m_lut_image1(i,j),
+                             m_lut_image2( float(i) + disparity, j ),  error );
+    }
+
+    template <class T>
+    inline typename boost::enable_if_c<IsCompound<T>::value && (CompoundNumChannels<typename UnmaskedPixelType<T>::type>::value != 1),Vector3>::type
+      StereoModelHelper( size_t i, size_t j, T const& disparity, Vector3& error ) const {
+
+      float i2 = float(i) + disparity[0];
+      float j2 = float(j) + disparity[1];
+      if ( i2 < 0 || i2 >= m_lut_image2.cols() ||
+           j2 < 0 || j2 >= m_lut_image2.rows() ||
+           !is_valid( disparity ) ){
+        return Vector3(); // out of bounds
+      }
+
+      return m_stereo_model( m_lut_image1(i,j), m_lut_image2(i2, j2), error );
+    }
+
+  public:
+
+    typedef Vector6 pixel_type;
+    typedef const Vector6 result_type;
+    typedef ProceduralPixelAccessor<StereoLUTAndErrorView> pixel_accessor;
+
+    StereoLUTAndErrorView( ImageViewBase<DisparityImageT> const& disparity_map,
+                           ImageViewBase<LUTImage1T> const& lut_image1,
+                           ImageViewBase<LUTImage2T> const& lut_image2,
+                           vw::camera::CameraModel const* camera_model1,
+                           vw::camera::CameraModel const* camera_model2,
+                           bool least_squares_refine = false) :
+      m_disparity_map(disparity_map.impl()), m_lut_image1( lut_image1.impl() ),
+      m_lut_image2(interpolate(lut_image2.impl())),
+      m_lut_image2_org( lut_image2.impl() ),
+      m_stereo_model(camera_model1, camera_model2, least_squares_refine) {}
+
+    StereoLUTAndErrorView( ImageViewBase<DisparityImageT> const& disparity_map,
+                           ImageViewBase<LUTImage1T> const& lut_image1,
+                           ImageViewBase<LUTImage2T> const& lut_image2,
+                           StereoModelT const& stereo_model) :
+      m_disparity_map(disparity_map.impl()), m_lut_image1(lut_image1.impl()),
+      m_lut_image2(interpolate(lut_image2.impl())),
+      m_lut_image2_org( lut_image2.impl() ),
+      m_stereo_model(stereo_model) {}
+
+    inline int32 cols() const { return m_disparity_map.cols(); }
+    inline int32 rows() const { return m_disparity_map.rows(); }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()( size_t i, size_t j, size_t p=0 ) const {
+      if ( is_valid(m_disparity_map(i,j,p)) ) {
+        Vector3 error;
+        pixel_type result;
+        subvector(result,0,3) = StereoModelHelper( i, j, m_disparity_map(i,j,p), error );
+        subvector(result,3,3) = error;
+        return result;
+      }
+      // For missing pixels in the disparity map, we return a null 3D position.
+      return pixel_type();
+    }
+
+    /// \cond INTERNAL
+    typedef StereoLUTAndErrorView<CropView<ImageView<typename DisparityImageT::pixel_type> >,
+                                  typename LUTImage1T::prerasterize_type,
+                                  CropView<ImageView<typename LUTImage2T::pixel_type> >,
+                                  StereoModelT> prerasterize_type;
+    inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
+      typedef typename DisparityImageT::pixel_type DPixelT;
+      CropView<ImageView<DPixelT> > disparity_preraster =
+        crop( ImageView<DPixelT>( crop( m_disparity_map, bbox ) ),
+              -bbox.min().x(), -bbox.min().y(), cols(), rows() );
+
+      // Calculate the range of disparities in our BBox to determine the
+      // crop size needed for LUT 2.
+      typedef typename UnmaskedPixelType<DPixelT>::type accum_t;
+      PixelAccumulator<EWMinMaxAccumulator<accum_t> > accumulator;
+      for_each_pixel( disparity_preraster.child(), accumulator );
+
+      BBox2i preraster(0,0,0,0);
+      if ( accumulator.is_valid() ){
+        accum_t input_min = accumulator.minimum();
+        accum_t input_max = accumulator.maximum();
+        // Bugfix: expand the preraster window by 1 pixel to avoid segfaults.
+        // This is needed for interpolation.
+        preraster = BBox2i(bbox.min() + floor(Vector2f(input_min[0]-1,input_min[1]-1)),
+                           bbox.max() + ceil(Vector2(input_max[0]+1,input_max[1]+1)) );
+      }
+
+      // Read the needed window of LUT 2 into memory. Anything outside
+      // the LUT is never used, as StereoModelHelper rejects
+      // out-of-bounds pixels.
+      typedef typename LUTImage2T::pixel_type LPixelT;
+      preraster.crop( bounding_box( m_lut_image2_org ) );
+      CropView<ImageView<LPixelT> > lut2_preraster =
+        crop( ImageView<LPixelT>( crop( m_lut_image2_org, preraster ) ),
+              -preraster.min().x(), -preraster.min().y(),
+              m_lut_image2_org.cols(), m_lut_image2_org.rows() );
+
+      return prerasterize_type( disparity_preraster,
+                                m_lut_image1.prerasterize(bbox),
+                                lut2_preraster,
+                                m_stereo_model );
+    }
+    template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const { vw::rasterize( prerasterize(bbox), dest, bbox ); }
+    /// \endcond
+  };
+
+  template <class ImageT, class StereoModelT>
+  StereoAndErrorView<ImageT, StereoModelT>
+  stereo_error_triangulate( ImageViewBase<ImageT> const& v,
+                            vw::camera::CameraModel const* camera1,
+                            vw::camera::CameraModel const* camera2 ) {
+    return StereoAndErrorView<ImageT, StereoModelT>( v.impl(), camera1, camera2 );
+  }
+
+  template <class ImageT, class StereoModelT>
+  StereoAndErrorView<ImageT, StereoModelT>
+  lsq_stereo_error_triangulate( ImageViewBase<ImageT> const& v,
+                                vw::camera::CameraModel const* camera1,
+                                vw::camera::CameraModel const* camera2 ) {
+    return StereoAndErrorView<ImageT, StereoModelT>( v.impl(), camera1, camera2, true );
+  }
+
+  template <class DisparityT, class LUT1T, class LUT2T, class StereoModelT>
+  StereoLUTAndErrorView<DisparityT, LUT1T, LUT2T, StereoModelT>
+  stereo_error_triangulate( ImageViewBase<DisparityT> const& disparity,
+                            ImageViewBase<LUT1T> const& lut1,
+                            ImageViewBase<LUT2T> const& lut2,
+                            vw::camera::CameraModel const* camera1,
+                            vw::camera::CameraModel const* camera2 ) {
+    typedef StereoLUTAndErrorView<DisparityT, LUT1T, LUT2T, StereoModelT> result_type;
+    return result_type( disparity.impl(), lut1.impl(), lut2.impl(),
+                        camera1, camera2 );
+  }
+
+  template <class DisparityT, class LUT1T, class LUT2T, class StereoModelT>
+  StereoLUTAndErrorView<DisparityT, LUT1T, LUT2T, StereoModelT>
+  lsq_stereo_error_triangulate( ImageViewBase<DisparityT> const& disparity,
+                                ImageViewBase<LUT1T> const& lut1,
+                                ImageViewBase<LUT2T> const& lut2,
+                                vw::camera::CameraModel const* camera1,
+                                vw::camera::CameraModel const* camera2 ) {
+    typedef StereoLUTAndErrorView<DisparityT,LUT1T,LUT2T, StereoModelT> result_type;
+    return result_type( disparity.impl(), lut1.impl(), lut2.impl(),
+                        camera1, camera2, true );
+  }
+
+} // end namespace vw
+
+#endif//__ASP_TOOLS_STEREO_TRI_H__